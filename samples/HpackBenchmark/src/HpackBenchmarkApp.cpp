@@ -0,0 +1,234 @@
+#include "cinder/app/App.h"
+#include "cinder/app/RendererGl.h"
+#include "cinder/gl/gl.h"
+#include "cinder/Log.h"
+
+#include "cinder/http/hpack.hpp"
+
+#include <mutex>
+
+using namespace ci;
+using namespace ci::app;
+using namespace std;
+
+//! A header block of RFC 7541 Appendix C, the fields it decodes to and the size of the
+//! dynamic table afterwards
+struct HpackExample {
+	const char					*name;
+	const char					*block;
+	http::HeaderSet::Headers	fields;
+	size_t						tableSize;
+};
+
+//! A sequence of examples decoded through one decoder whose table may grow to tableSize
+struct HpackSequence {
+	size_t					maxTableSize;
+	vector<HpackExample>	examples;
+};
+
+static const http::HeaderSet::Headers sRequest1 = { { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" }, { ":authority", "www.example.com" } };
+static const http::HeaderSet::Headers sRequest2 = { { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" }, { ":authority", "www.example.com" }, { "cache-control", "no-cache" } };
+static const http::HeaderSet::Headers sRequest3 = { { ":method", "GET" }, { ":scheme", "https" }, { ":path", "/index.html" }, { ":authority", "www.example.com" }, { "custom-key", "custom-value" } };
+static const http::HeaderSet::Headers sResponse1 = { { ":status", "302" }, { "cache-control", "private" }, { "date", "Mon, 21 Oct 2013 20:13:21 GMT" }, { "location", "https://www.example.com" } };
+static const http::HeaderSet::Headers sResponse2 = { { ":status", "307" }, { "cache-control", "private" }, { "date", "Mon, 21 Oct 2013 20:13:21 GMT" }, { "location", "https://www.example.com" } };
+static const http::HeaderSet::Headers sResponse3 = { { ":status", "200" }, { "cache-control", "private" }, { "date", "Mon, 21 Oct 2013 20:13:22 GMT" }, { "location", "https://www.example.com" }, { "content-encoding", "gzip" }, { "set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1" } };
+
+static const vector<HpackSequence> sSequences = {
+	{ 4096, { { "C.2.1", "400a 6375 7374 6f6d 2d6b 6579 0d63 7573 746f 6d2d 6865 6164 6572", { { "custom-key", "custom-header" } }, 55 } } },
+	{ 4096, { { "C.2.2", "040c 2f73 616d 706c 652f 7061 7468", { { ":path", "/sample/path" } }, 0 } } },
+	{ 4096, { { "C.2.3", "1008 7061 7373 776f 7264 0673 6563 7265 74", { { "password", "secret" } }, 0 } } },
+	{ 4096, { { "C.2.4", "82", { { ":method", "GET" } }, 0 } } },
+	{ 4096, {
+		{ "C.3.1", "8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d", sRequest1, 57 },
+		{ "C.3.2", "8286 84be 5808 6e6f 2d63 6163 6865", sRequest2, 110 },
+		{ "C.3.3", "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65", sRequest3, 164 } } },
+	{ 4096, {
+		{ "C.4.1", "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff", sRequest1, 57 },
+		{ "C.4.2", "8286 84be 5886 a8eb 1064 9cbf", sRequest2, 110 },
+		{ "C.4.3", "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf", sRequest3, 164 } } },
+	{ 256, {
+		{ "C.5.1", "4803 3330 3258 0770 7269 7661 7465 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133 2032 303a 3133 3a32 3120 474d 546e 1768 7474 7073 3a2f 2f77 7777 2e65 7861 6d70 6c65 2e63 6f6d", sResponse1, 222 },
+		{ "C.5.2", "4803 3330 37c1 c0bf", sResponse2, 222 },
+		{ "C.5.3", "88c1 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133 2032 303a 3133 3a32 3220 474d 54c0 5a04 677a 6970 7738 666f 6f3d 4153 444a 4b48 514b 425a 584f 5157 454f 5049 5541 5851 5745 4f49 553b 206d 6178 2d61 6765 3d33 3630 303b 2076 6572 7369 6f6e 3d31", sResponse3, 215 } } },
+	{ 256, {
+		{ "C.6.1", "4882 6402 5885 aec3 771a 4b61 96d0 7abe 9410 54d4 44a8 2005 9504 0b81 66e0 82a6 2d1b ff6e 919d 29ad 1718 63c7 8f0b 97c8 e9ae 82ae 43d3", sResponse1, 222 },
+		{ "C.6.2", "4883 640e ffc1 c0bf", sResponse2, 222 },
+		{ "C.6.3", "88c1 6196 d07a be94 1054 d444 a820 0595 040b 8166 e084 a62d 1bff c05a 839b d9ab 77ad 94e7 821d d7f2 e6c7 b335 dfdf cd5b 3960 d5af 2708 7f36 72c1 ab27 0fb5 291f 9587 3160 65c0 03ed 4ee5 b106 3d50 07", sResponse3, 215 } } },
+};
+
+//! Malformed blocks a decoder has to reject
+static const pair<const char*, const char*> sMalformed[] = {
+	{ "integer past 32 bits", "ff ff ff ff ff 0f" },
+	{ "table size update after a field", "82 3f e1 1f" },
+	{ "index past the tables", "ff 00" },
+	{ "EOS in a Huffman string", "0081 00 8100" },
+};
+
+static vector<uint8_t> fromHex( const char *hex )
+{
+	vector<uint8_t> bytes;
+	for( auto c = hex; c[0] && c[1]; ) {
+		if( *c == ' ' ) {
+			++c;
+			continue;
+		}
+		bytes.push_back( static_cast<uint8_t>( stoul( string( c, 2 ), nullptr, 16 ) ) );
+		c += 2;
+	}
+	return bytes;
+}
+
+class HpackBenchmarkApp : public App {
+  public:
+	void setup() override;
+	void draw() override;
+	void cleanup() override;
+	
+	void runBenchmark();
+	
+	thread			benchmarkThread;
+	mutex			resultsMutex;
+	vector<string>	results;
+	atomic<bool>	quitting{false};
+};
+
+void HpackBenchmarkApp::setup()
+{
+	benchmarkThread = thread( [this] { runBenchmark(); } );
+}
+
+void HpackBenchmarkApp::runBenchmark()
+{
+	auto report = [this]( const string &result ) {
+		CI_LOG_I( result );
+		lock_guard<mutex> lock( resultsMutex );
+		results.push_back( result );
+	};
+	
+	// Each example decodes to its fields and leaves the table at its size, in sequence.
+	size_t examples = 0, failures = 0;
+	for( auto &sequence : sSequences ) {
+		http::HpackDecoder decoder( sequence.maxTableSize );
+		for( auto &example : sequence.examples ) {
+			++examples;
+			auto block = fromHex( example.block );
+			http::HeaderSet::Headers fields;
+			if( ! decoder.decode( block.data(), block.size(), fields ) || fields != example.fields ||
+			    decoder.getTableSize() != example.tableSize ) {
+				report( string( example.name ) + " decoded wrong, table size " + to_string( decoder.getTableSize() ) );
+				++failures;
+			}
+		}
+	}
+	for( auto &malformed : sMalformed ) {
+		++examples;
+		auto block = fromHex( malformed.second );
+		http::HpackDecoder decoder;
+		http::HeaderSet::Headers fields;
+		if( decoder.decode( block.data(), block.size(), fields ) ) {
+			report( string( "accepted " ) + malformed.first );
+			++failures;
+		}
+	}
+
+	// The list limit counts fields as SETTINGS_MAX_HEADER_LIST_SIZE does, C.5.1 fits its
+	// own size exactly and not a byte less.
+	{
+		++examples;
+		size_t listSize = 0;
+		for( auto &field : sResponse1 )
+			listSize += field.first.size() + field.second.size() + 32;
+		auto block = fromHex( sSequences[6].examples[0].block );
+		http::HpackDecoder exact( 256 ), under( 256 );
+		http::HeaderSet::Headers fields, partial;
+		if( ! exact.decode( block.data(), block.size(), fields, listSize ) || fields != sResponse1 ||
+		    under.decode( block.data(), block.size(), partial, listSize - 1 ) || ! under.isOverLimit() ) {
+			report( "C.5.1 against its list size decoded wrong" );
+			++failures;
+		}
+	}
+	// A 4000 byte entry referenced by 12000 single byte indexes would decode to 48MB, the
+	// limit stops it a few fields in.
+	{
+		++examples;
+		vector<uint8_t> block = { 0x40, 0x01, 'x', 0x7f, 0xa1, 0x1e };
+		block.insert( block.end(), 4000, 'y' );
+		block.insert( block.end(), 12000, 0xbe );
+		http::HpackDecoder decoder;
+		http::HeaderSet::Headers fields;
+		if( decoder.decode( block.data(), block.size(), fields, 64 * 1024 ) || ! decoder.isOverLimit() ||
+		    fields.size() > 20 ) {
+			report( "decoded a flood of references to a large entry, " + to_string( fields.size() ) + " fields" );
+			++failures;
+		}
+	}
+
+	// The encoder makes its own choices, it has to be read back the same and, where its
+	// choices are the RFC's, byte for byte the same as C.4.
+	for( auto &sequence : sSequences ) {
+		http::HpackEncoder encoder( sequence.maxTableSize );
+		http::HpackDecoder decoder( sequence.maxTableSize );
+		for( auto &example : sequence.examples ) {
+			++examples;
+			vector<uint8_t> block;
+			encoder.encode( example.fields, block );
+			http::HeaderSet::Headers fields;
+			bool same = decoder.decode( block.data(), block.size(), fields ) && fields == example.fields;
+			if( same && string( example.name ).compare( 0, 3, "C.4" ) == 0 )
+				same = block == fromHex( example.block );
+			if( ! same ) {
+				report( string( example.name ) + " encoded wrong" );
+				++failures;
+			}
+		}
+	}
+	report( to_string( examples - failures ) + " of " + to_string( examples ) + " RFC 7541 checks passed" );
+	
+	// A connection's coders keep their tables, the blocks of C.5 go through them over and over.
+	const size_t rounds = 200000;
+	vector<vector<uint8_t>> blocks;
+	http::HpackEncoder encoder( 4096 );
+	auto start = chrono::steady_clock::now();
+	for( size_t round = 0; round < rounds && ! quitting; ++round ) {
+		for( auto &example : sSequences[6].examples ) {
+			if( blocks.size() < 3 * rounds )
+				blocks.emplace_back();
+			encoder.encode( example.fields, blocks.back() );
+		}
+	}
+	auto encoded = chrono::duration<double, nano>( chrono::steady_clock::now() - start ).count() / ( rounds * 3 );
+	
+	http::HpackDecoder decoder( 4096 );
+	http::HeaderSet::Headers fields;
+	start = chrono::steady_clock::now();
+	for( size_t i = 0; i < blocks.size() && ! quitting; ++i ) {
+		fields.clear();
+		decoder.decode( blocks[i].data(), blocks[i].size(), fields );
+	}
+	auto decoded = chrono::duration<double, nano>( chrono::steady_clock::now() - start ).count() / blocks.size();
+	if( quitting )
+		return;
+	report( "encode: " + to_string( int( encoded ) ) + " ns per block" );
+	report( "decode: " + to_string( int( decoded ) ) + " ns per block" );
+	report( "savings: " + to_string( int( encoder.getStats().getSavings() * 100 ) ) + "% of the header bytes" );
+}
+
+void HpackBenchmarkApp::draw()
+{
+	gl::clear( Color( 0, 0, 0 ) );
+	lock_guard<mutex> lock( resultsMutex );
+	vec2 position( 20, 20 );
+	for( auto &result : results ) {
+		gl::drawString( result, position );
+		position.y += 20;
+	}
+}
+
+void HpackBenchmarkApp::cleanup()
+{
+	quitting = true;
+	if( benchmarkThread.joinable() )
+		benchmarkThread.join();
+}
+
+CINDER_APP( HpackBenchmarkApp, RendererGl )
@@ -0,0 +1,166 @@
+#include "cinder/app/App.h"
+#include "cinder/app/RendererGl.h"
+#include "cinder/gl/gl.h"
+
+#include "cinder/http/server.hpp"
+
+#include <mutex>
+
+using namespace ci;
+using namespace ci::app;
+using namespace std;
+
+//! Keeps a number of keep-alive connections busy with back to back requests against a
+//! loopback server and counts the responses.
+class LoadClient {
+public:
+	LoadClient( asio::io_service &io_service, asio::ip::tcp::endpoint endpoint, size_t connections )
+	{
+		for( size_t i = 0; i < connections; ++i ) {
+			auto connection = make_shared<Connection>( io_service, *this );
+			connection->socket.async_connect( endpoint, [connection]( asio::error_code ec ) {
+				if( ! ec ) {
+					connection->socket.set_option( asio::ip::tcp::no_delay( true ) );
+					connection->write();
+				}
+			});
+			mConnections.push_back( connection );
+		}
+	}
+	
+	void stop()
+	{
+		for( auto &connection : mConnections ) {
+			asio::error_code ignored;
+			connection->socket.close( ignored );
+		}
+	}
+	
+	std::atomic<uint64_t>	responses{0};
+	
+private:
+	struct Connection : enable_shared_from_this<Connection> {
+		Connection( asio::io_service &io_service, LoadClient &client )
+		: socket( io_service ), client( client ) {}
+		
+		void write()
+		{
+			static const char request[] = "GET /status HTTP/1.1\r\nHost: localhost\r\n\r\n";
+			auto self = shared_from_this();
+			asio::async_write( socket, asio::buffer( request, sizeof( request ) - 1 ),
+			[self]( asio::error_code ec, size_t ) {
+				if( ! ec )
+					self->readHeaders();
+			});
+		}
+		void readHeaders()
+		{
+			auto self = shared_from_this();
+			asio::async_read_until( socket, buffer, "\r\n\r\n", [self]( asio::error_code ec, size_t size ) {
+				if( ec )
+					return;
+				string headers( asio::buffers_begin( self->buffer.data() ), asio::buffers_begin( self->buffer.data() ) + size );
+				self->buffer.consume( size );
+				auto length = headers.find( "Content-Length: " );
+				size_t contentLength = length != string::npos ? stoul( headers.substr( length + 16 ) ) : 0;
+				auto remaining = contentLength > self->buffer.size() ? contentLength - self->buffer.size() : 0;
+				asio::async_read( self->socket, self->buffer, asio::transfer_exactly( remaining ),
+				[self, contentLength]( asio::error_code ec, size_t ) {
+					if( ec )
+						return;
+					self->buffer.consume( contentLength );
+					++self->client.responses;
+					self->write();
+				});
+			});
+		}
+		
+		asio::ip::tcp::socket	socket;
+		asio::streambuf			buffer;
+		LoadClient				&client;
+	};
+	
+	vector<shared_ptr<Connection>>	mConnections;
+};
+
+class ServerBenchmarkApp : public App {
+  public:
+	void setup() override;
+	void draw() override;
+	void cleanup() override;
+	
+	void runBenchmark();
+	
+	thread			benchmarkThread;
+	mutex			resultsMutex;
+	vector<string>	results;
+	atomic<bool>	quitting{false};
+};
+
+void ServerBenchmarkApp::setup()
+{
+	benchmarkThread = thread( [this] { runBenchmark(); } );
+}
+
+void ServerBenchmarkApp::runBenchmark()
+{
+	// The load is generated on as many threads as the machine has, the server's share of
+	// them grows from one reactor up to one per core.
+	size_t cores = std::max( thread::hardware_concurrency(), 1u );
+	const size_t connections = 64;
+	const auto duration = chrono::seconds( 3 );
+	
+	for( size_t reactors = 1; reactors <= cores && ! quitting; reactors *= 2 ) {
+		http::Server server( reactors );
+		string status = "{\"reactors\":" + to_string( reactors ) + "}";
+		server.getRouter().add( http::RequestMethod::GET, "/status",
+		[status]( const http::RequestRef &request, const http::ResponseRef &response, const http::RouteParams &params ) {
+			response->appendHeader( http::Content( "application/json", status ) );
+		});
+		auto ec = server.listen( asio::ip::tcp::endpoint( asio::ip::address_v4::loopback(), 0 ) );
+		if( ec ) {
+			CI_LOG_E( "Can't listen: " << ec.message() );
+			return;
+		}
+		
+		asio::io_service clientService;
+		LoadClient client( clientService, server.getEndpoint(), connections );
+		vector<thread> clientThreads;
+		for( size_t i = 0; i < cores; ++i )
+			clientThreads.emplace_back( [&clientService] { clientService.run(); } );
+		
+		this_thread::sleep_for( duration );
+		uint64_t responses = client.responses;
+		clientService.stop();
+		for( auto &clientThread : clientThreads )
+			clientThread.join();
+		client.stop();
+		server.stop();
+		
+		auto result = to_string( reactors ) + " reactor(s): " +
+					  to_string( responses / duration.count() ) + " requests/s";
+		CI_LOG_I( result );
+		lock_guard<mutex> lock( resultsMutex );
+		results.push_back( result );
+	}
+}
+
+void ServerBenchmarkApp::draw()
+{
+	gl::clear( Color( 0, 0, 0 ) );
+	lock_guard<mutex> lock( resultsMutex );
+	vec2 position( 20, 20 );
+	for( auto &result : results ) {
+		gl::drawString( result, position );
+		position.y += 20;
+	}
+}
+
+void ServerBenchmarkApp::cleanup()
+{
+	quitting = true;
+	if( benchmarkThread.joinable() )
+		benchmarkThread.join();
+}
+
+CINDER_APP( ServerBenchmarkApp, RendererGl )
@@ -0,0 +1,157 @@
+#include "cinder/app/App.h"
+#include "cinder/app/RendererGl.h"
+#include "cinder/gl/gl.h"
+#include "cinder/Log.h"
+
+#include "cinder/http/url.hpp"
+
+#include <mutex>
+
+using namespace ci;
+using namespace ci::app;
+using namespace std;
+
+//! A reference, the base it's resolved against and the url it must resolve to.
+struct Resolution {
+	const char *base;
+	const char *reference;
+	const char *target;
+};
+
+//! The examples of RFC 3986 5.4, and the kind of Location headers and links redirects and
+//! manifests carry.
+static const Resolution sCorpus[] = {
+	{ "http://a/b/c/d;p?q", "g", "http://a/b/c/g" },
+	{ "http://a/b/c/d;p?q", "./g", "http://a/b/c/g" },
+	{ "http://a/b/c/d;p?q", "g/", "http://a/b/c/g/" },
+	{ "http://a/b/c/d;p?q", "/g", "http://a/g" },
+	{ "http://a/b/c/d;p?q", "//g", "http://g/" },
+	{ "http://a/b/c/d;p?q", "?y", "http://a/b/c/d;p?y" },
+	{ "http://a/b/c/d;p?q", "g?y", "http://a/b/c/g?y" },
+	{ "http://a/b/c/d;p?q", "#s", "http://a/b/c/d;p?q#s" },
+	{ "http://a/b/c/d;p?q", "g#s", "http://a/b/c/g#s" },
+	{ "http://a/b/c/d;p?q", "g?y#s", "http://a/b/c/g?y#s" },
+	{ "http://a/b/c/d;p?q", ";x", "http://a/b/c/;x" },
+	{ "http://a/b/c/d;p?q", "g;x", "http://a/b/c/g;x" },
+	{ "http://a/b/c/d;p?q", "g;x?y#s", "http://a/b/c/g;x?y#s" },
+	{ "http://a/b/c/d;p?q", "", "http://a/b/c/d;p?q" },
+	{ "http://a/b/c/d;p?q", ".", "http://a/b/c/" },
+	{ "http://a/b/c/d;p?q", "./", "http://a/b/c/" },
+	{ "http://a/b/c/d;p?q", "..", "http://a/b/" },
+	{ "http://a/b/c/d;p?q", "../", "http://a/b/" },
+	{ "http://a/b/c/d;p?q", "../g", "http://a/b/g" },
+	{ "http://a/b/c/d;p?q", "../..", "http://a/" },
+	{ "http://a/b/c/d;p?q", "../../", "http://a/" },
+	{ "http://a/b/c/d;p?q", "../../g", "http://a/g" },
+	{ "http://a/b/c/d;p?q", "../../../g", "http://a/g" },
+	{ "http://a/b/c/d;p?q", "../../../../g", "http://a/g" },
+	{ "http://a/b/c/d;p?q", "/./g", "http://a/g" },
+	{ "http://a/b/c/d;p?q", "/../g", "http://a/g" },
+	{ "http://a/b/c/d;p?q", "g.", "http://a/b/c/g." },
+	{ "http://a/b/c/d;p?q", ".g", "http://a/b/c/.g" },
+	{ "http://a/b/c/d;p?q", "g..", "http://a/b/c/g.." },
+	{ "http://a/b/c/d;p?q", "..g", "http://a/b/c/..g" },
+	{ "http://a/b/c/d;p?q", "./../g", "http://a/b/g" },
+	{ "http://a/b/c/d;p?q", "./g/.", "http://a/b/c/g/" },
+	{ "http://a/b/c/d;p?q", "g/./h", "http://a/b/c/g/h" },
+	{ "http://a/b/c/d;p?q", "g/../h", "http://a/b/c/h" },
+	{ "http://a/b/c/d;p?q", "g;x=1/./y", "http://a/b/c/g;x=1/y" },
+	{ "http://a/b/c/d;p?q", "g;x=1/../y", "http://a/b/c/y" },
+	{ "http://a/b/c/d;p?q", "g?y/./x", "http://a/b/c/g?y/./x" },
+	{ "http://a/b/c/d;p?q", "g?y/../x", "http://a/b/c/g?y/../x" },
+	{ "http://a/b/c/d;p?q", "g#s/./x", "http://a/b/c/g#s/./x" },
+	{ "http://a/b/c/d;p?q", "g#s/../x", "http://a/b/c/g#s/../x" },
+	{ "http://a/b/c/d;p?q", "http:g", "http://a/b/c/g" },
+	{ "https://www.example.com/gallery/2016/index.html", "../../img/a.png", "https://www.example.com/img/a.png" },
+	{ "https://www.example.com/gallery/2016/index.html", "//cdn.example.net/x/y.js", "https://cdn.example.net/x/y.js" },
+	{ "https://www.example.com/gallery/2016/index.html", "thumbs/b.jpg?w=320&h=240", "https://www.example.com/gallery/2016/thumbs/b.jpg?w=320&h=240" },
+	{ "http://tiles.example.org:8080/v1/roads/12/2048/1361.png", "/v1/roads/12/2048/1362.png", "http://tiles.example.org:8080/v1/roads/12/2048/1362.png" },
+	{ "http://example.org/old/path", "https://secure.example.org/new/path?from=old", "https://secure.example.org/new/path?from=old" },
+	{ "http://[::1]:8080/stream/manifest.m3u8", "segments/00042.ts", "http://[::1]:8080/stream/segments/00042.ts" },
+};
+
+class UrlBenchmarkApp : public App {
+  public:
+	void setup() override;
+	void draw() override;
+	void cleanup() override;
+	
+	void runBenchmark();
+	
+	thread			benchmarkThread;
+	mutex			resultsMutex;
+	vector<string>	results;
+	atomic<bool>	quitting{false};
+};
+
+void UrlBenchmarkApp::setup()
+{
+	benchmarkThread = thread( [this] { runBenchmark(); } );
+}
+
+void UrlBenchmarkApp::runBenchmark()
+{
+	auto report = [this]( const string &result ) {
+		CI_LOG_I( result );
+		lock_guard<mutex> lock( resultsMutex );
+		results.push_back( result );
+	};
+	
+	// The bases are parsed once, as a session holds the url it requested.
+	const size_t count = sizeof( sCorpus ) / sizeof( sCorpus[0] );
+	vector<http::Url> bases;
+	size_t failures = 0;
+	for( auto &resolution : sCorpus ) {
+		bases.push_back( http::Url::from_string( resolution.base ) );
+		asio::error_code ec;
+		auto target = http::Url::resolve( bases.back(), resolution.reference, ec );
+		if( ec || target.to_string() != resolution.target ) {
+			report( string( "\"" ) + resolution.reference + "\" resolved to " + ( ec ? ec.message() : target.to_string() ) +
+				   ", not " + resolution.target );
+			++failures;
+		}
+	}
+	report( to_string( count - failures ) + " of " + to_string( count ) + " references resolved as RFC 3986 has it" );
+	
+	// Resolving is measured against parsing the targets, the least it could cost.
+	const size_t rounds = 20000;
+	auto measure = [&]( const function<size_t( size_t )> &work ) {
+		size_t checksum = 0;
+		auto start = chrono::steady_clock::now();
+		for( size_t round = 0; round < rounds && ! quitting; ++round )
+			for( size_t i = 0; i < count; ++i )
+				checksum += work( i );
+		auto elapsed = chrono::duration<double, nano>( chrono::steady_clock::now() - start ).count();
+		return make_pair( elapsed / ( rounds * count ), checksum );
+	};
+	auto resolved = measure( [&]( size_t i ) {
+		return http::Url::resolve( bases[i], sCorpus[i].reference ).hash() & 1;
+	});
+	auto parsed = measure( [&]( size_t i ) {
+		return http::Url::from_string( sCorpus[i].target ).hash() & 1;
+	});
+	if( quitting )
+		return;
+	report( "resolve: " + to_string( int( resolved.first ) ) + " ns per reference" );
+	report( "from_string of the target: " + to_string( int( parsed.first ) ) + " ns per url" );
+}
+
+void UrlBenchmarkApp::draw()
+{
+	gl::clear( Color( 0, 0, 0 ) );
+	lock_guard<mutex> lock( resultsMutex );
+	vec2 position( 20, 20 );
+	for( auto &result : results ) {
+		gl::drawString( result, position );
+		position.y += 20;
+	}
+}
+
+void UrlBenchmarkApp::cleanup()
+{
+	quitting = true;
+	if( benchmarkThread.joinable() )
+		benchmarkThread.join();
+}
+
+CINDER_APP( UrlBenchmarkApp, RendererGl )
@@ -0,0 +1,601 @@
+//
+//  cache.hpp
+//  Cinder-HTTP
+//
+//
+
+#pragma once
+
+#include "request_response.hpp"
+#include "parsers.hpp"
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace cinder {
+namespace http {
+	
+namespace detail {
+namespace cache {
+	
+using Clock = std::chrono::system_clock;
+
+//! Calls /a visit with the value of each of /a headers named /a name, in any case
+template<typename Visit>
+inline void forEachHeader( const HeaderSet &headers, const char *name, Visit visit )
+{
+	for( auto &header : headers.getHeaders() ) {
+		if( urdl::detail::headers_equal( header.first, name ) )
+			visit( header.second );
+	}
+}
+
+//! Returns the value of the first of /a headers named /a name, in any case, or nullptr
+inline const std::string* findHeader( const HeaderSet &headers, const char *name )
+{
+	for( auto &header : headers.getHeaders() ) {
+		if( urdl::detail::headers_equal( header.first, name ) )
+			return &header.second;
+	}
+	return nullptr;
+}
+
+//! Returns the trimmed, comma separated elements of /a value
+inline std::vector<std::string> splitList( const std::string &value )
+{
+	std::vector<std::string> elements;
+	size_t begin = 0;
+	while( begin < value.size() ) {
+		auto end = std::min( value.find( ',', begin ), value.size() );
+		auto first = value.find_first_not_of( " \t", begin );
+		auto last = value.find_last_not_of( " \t", end - 1 );
+		if( first < end && last != std::string::npos && last >= first )
+			elements.push_back( value.substr( first, last - first + 1 ) );
+		begin = end + 1;
+	}
+	return elements;
+}
+
+//! The Cache-Control directives a shared cache acts on, of a request or a response. Delta
+//! seconds are -1 when the directive is absent.
+struct CacheControl {
+	explicit CacheControl( const HeaderSet &headers )
+	{
+		forEachHeader( headers, "Cache-Control", [this]( const std::string &value ) {
+			for( auto &directive : splitList( value ) ) {
+				auto equals = directive.find( '=' );
+				auto name = directive.substr( 0, equals );
+				int64_t seconds = -1;
+				if( equals != std::string::npos ) {
+					auto argument = directive.substr( equals + 1 );
+					if( ! argument.empty() && argument.front() == '"' )
+						argument = argument.substr( 1, argument.find( '"', 1 ) - 1 );
+					if( ! argument.empty() && std::all_of( argument.begin(), argument.end(), urdl::detail::is_digit ) )
+						seconds = argument.size() > 10 ? INT32_MAX : std::stoll( argument );
+				}
+				if( urdl::detail::headers_equal( name, "no-store" ) )
+					noStore = true;
+				else if( urdl::detail::headers_equal( name, "no-cache" ) )
+					noCache = true;
+				else if( urdl::detail::headers_equal( name, "private" ) )
+					isPrivate = true;
+				else if( urdl::detail::headers_equal( name, "public" ) )
+					isPublic = true;
+				else if( urdl::detail::headers_equal( name, "must-revalidate" ) ||
+						 urdl::detail::headers_equal( name, "proxy-revalidate" ) )
+					mustRevalidate = true;
+				else if( urdl::detail::headers_equal( name, "max-age" ) )
+					maxAge = seconds;
+				else if( urdl::detail::headers_equal( name, "s-maxage" ) )
+					sMaxAge = seconds;
+				else if( urdl::detail::headers_equal( name, "min-fresh" ) )
+					minFresh = seconds;
+				else if( urdl::detail::headers_equal( name, "max-stale" ) )
+					// Without a value any staleness will do.
+					maxStale = equals == std::string::npos ? INT32_MAX : seconds;
+				else if( urdl::detail::headers_equal( name, "stale-while-revalidate" ) )
+					staleWhileRevalidate = seconds;
+				else if( urdl::detail::headers_equal( name, "stale-if-error" ) )
+					staleIfError = seconds;
+			}
+		});
+		// The HTTP/1.0 spelling, for requests without a Cache-Control.
+		if( ! findHeader( headers, "Cache-Control" ) ) {
+			if( auto pragma = findHeader( headers, "Pragma" ) )
+				noCache = pragma->find( "no-cache" ) != std::string::npos;
+		}
+	}
+	
+	bool	noStore{false},
+			noCache{false},
+			isPrivate{false},
+			isPublic{false},
+			mustRevalidate{false};
+	int64_t	maxAge{-1},
+			sMaxAge{-1},
+			minFresh{-1},
+			maxStale{-1},
+			//! RFC 5861, how long past its freshness a response may still be used
+			staleWhileRevalidate{-1},
+			staleIfError{-1};
+};
+
+//! Returns whether /a request has the /a vary header values a response was stored for
+inline bool matchesVary( const std::vector<std::pair<std::string, std::string>> &vary, const Request &request )
+{
+	return std::all_of( vary.begin(), vary.end(), [&request]( const std::pair<std::string, std::string> &header ) {
+		auto value = findHeader( request.getHeaders(), header.first.c_str() );
+		return ( value ? *value : std::string() ) == header.second;
+	});
+}
+
+//! Returns whether responses with /a status may be cached without explicit freshness
+inline bool isHeuristicallyCacheable( uint32_t status )
+{
+	switch( status ) {
+		case 200: case 203: case 204: case 300: case 301: case 404: case 405: case 410: case 414: case 501:
+			return true;
+		default:
+			return false;
+	}
+}
+
+//! Returns the date in /a headers' /a name, or /a fallback if it's missing or malformed
+inline Clock::time_point findDate( const HeaderSet &headers, const char *name, Clock::time_point fallback )
+{
+	time_t time;
+	auto value = findHeader( headers, name );
+	return value && parseHttpDate( *value, time ) ? Clock::from_time_t( time ) : fallback;
+}
+	
+} // cache
+} // detail
+
+using CachedResponseRef = std::shared_ptr<struct CachedResponse>;
+
+//! A response held by a ResponseCache, with what it takes to tell how fresh it is.
+struct CachedResponse {
+	using Clock = detail::cache::Clock;
+	
+	//! Returns the age of the response at /a now, as a cache along the way would report it
+	std::chrono::seconds	getAge( Clock::time_point now ) const;
+	//! Returns whether the response can be used at /a now without asking the origin
+	bool					isFresh( Clock::time_point now ) const { return getAge( now ) < freshnessLifetime; }
+	
+	//! The cache key of the request's url
+	std::string				key;
+	ResponseRef				response;
+	//! The request headers the response varies on, with the request's values, empty if absent
+	std::vector<std::pair<std::string, std::string>>	vary;
+	Clock::time_point		requestTime, responseTime;
+	//! The age the response had when it was received
+	std::chrono::seconds	initialAge{0};
+	std::chrono::seconds	freshnessLifetime{0};
+	bool					mustRevalidate{false};
+	//! What it counts for against the cache's capacity, content mapped from a CacheStore
+	//! doesn't count
+	size_t					size{0};
+};
+
+inline std::chrono::seconds CachedResponse::getAge( Clock::time_point now ) const
+{
+	using namespace std::chrono;
+	return initialAge + duration_cast<seconds>( std::max( now - responseTime, Clock::duration::zero() ) );
+}
+
+using CacheStoreRef = std::shared_ptr<class CacheStore>;
+
+//! A larger, slower tier behind a ResponseCache's memory, consulted when a response isn't
+//! held in memory and written through when one is stored. Implementations are thread safe.
+class CacheStore {
+public:
+	virtual ~CacheStore() = default;
+	
+	//! Returns the stored response under /a key that /a request's headers match the
+	//! variant of, fresh or not, or nullptr
+	virtual CachedResponseRef	load( const std::string &key, const Request &request ) = 0;
+	//! Stores /a entry, replacing the variant under its key it matches
+	virtual void				save( const CachedResponse &entry ) = 0;
+	//! Drops every variant under /a key
+	virtual void				remove( const std::string &key ) = 0;
+};
+
+using ResponseCacheRef = std::shared_ptr<class ResponseCache>;
+
+//! A shared HTTP cache of responses to GET requests, following RFC 7234, held in memory.
+//! Give it to any number of Sessions and SslSessions with setCache(). A fresh response is
+//! handed over without touching the network, freshness coming from Cache-Control, Expires
+//! or, failing both, a tenth of the time since Last-Modified. Responses varying on request
+//! headers are kept per variant. Once the total size passes the capacity, the least
+//! recently used responses are evicted. Thread safe.
+class ResponseCache {
+public:
+	using Clock = detail::cache::Clock;
+	
+	//! Constructs a cache holding up to /a capacity bytes of responses, 64MB by default
+	explicit ResponseCache( size_t capacity = 64 * 1024 * 1024 ) : mCapacity( capacity ) {}
+	
+	//! Returns a fresh response to /a request at /a now, or nullptr. The response is a copy,
+	//! with an Age header, whose content it shares with the cache. When there's only a stale
+	//! response with an ETag or Last-Modified, it's copied to /a stale, if given, to be
+	//! revalidated with Request::setPriorResponse(). Given /a stale, a response still within
+	//! its stale-while-revalidate is returned too, with a Warning, and copied to /a stale to
+	//! be revalidated in the background.
+	ResponseRef find( const Request &request, Clock::time_point now = Clock::now(), ResponseRef *stale = nullptr );
+	//! Returns a stale response to /a request at /a now that may stand in for the origin's
+	//! failure to answer, as its stale-if-error or the request's allows, or nullptr
+	ResponseRef	findIfError( const Request &request, Clock::time_point now = Clock::now() );
+	//! Stores /a response to /a request, sent at /a requestTime and received at
+	//! /a responseTime, if it may be cached. Other requests than GET invalidate the url's
+	//! responses. Returns whether the response was stored.
+	bool		store( const Request &request, const ResponseRef &response, Clock::time_point requestTime,
+					   Clock::time_point responseTime = Clock::now() );
+	//! Drops the responses to /a url, from the store too
+	void		invalidate( const Url &url );
+	//! Drops the responses held in memory
+	void		clear();
+	
+	//! Backs the cache with /a store, which holds what memory can't
+	void					setStore( CacheStoreRef store );
+	const CacheStoreRef&	getStore() const { return mStore; }
+	
+	size_t		getCapacity() const { return mCapacity; }
+	//! Sets the capacity, evicting responses until they fit
+	void		setCapacity( size_t capacity );
+	//! Returns the total size of the responses held
+	size_t		getSize() const;
+	//! Returns the number of responses held
+	size_t		getCount() const;
+	//! Returns the number of requests answered from the cache, and the ones find() couldn't answer
+	uint64_t	getHits() const { return mHits; }
+	uint64_t	getMisses() const { return mMisses; }
+	
+	//! Returns the key /a url's responses are stored under, normalized and without its fragment
+	static std::string getKey( const Url &url );
+	
+private:
+	//! Returns the entry for /a request, fresh or not, or nullptr. Must be called locked.
+	CachedResponseRef	lookup( const std::string &key, const Request &request );
+	//! Returns the entry for /a request from memory or the store, fresh or not, or nullptr
+	CachedResponseRef	fetch( const std::string &key, const Request &request );
+	//! Makes /a entry the most recently used. Must be called locked.
+	void				touch( const CachedResponseRef &entry );
+	//! Adds /a entry, replacing the variant it matches, and evicts what no longer fits.
+	//! Must be called locked.
+	void				insert( const CachedResponseRef &entry );
+	//! Must be called locked
+	void				remove( const CachedResponseRef &entry );
+	void				evict();
+	//! Returns /a entry's response as handed to a client at /a now, with /a warning if any
+	static ResponseRef	copyResponse( const CachedResponse &entry, Clock::time_point now, const char *warning = nullptr );
+	
+	mutable std::mutex	mMutex;
+	CacheStoreRef		mStore;
+	size_t				mCapacity, mSize{0};
+	std::atomic<uint64_t>	mHits{0}, mMisses{0};
+	//! The variants stored for each key
+	std::unordered_map<std::string, std::vector<CachedResponseRef>>	mEntries;
+	//! Every entry, most recently used first
+	std::list<CachedResponseRef>	mRecent;
+	std::unordered_map<const CachedResponse*, std::list<CachedResponseRef>::iterator>	mPositions;
+};
+
+inline std::string ResponseCache::getKey( const Url &url )
+{
+	// Normalized, equivalent urls share entries.
+	return url.normalized().to_string( Url::protocol_component | Url::host_component | Url::port_component |
+									   Url::path_component | Url::query_component );
+}
+
+inline ResponseRef ResponseCache::find( const Request &request, Clock::time_point now, ResponseRef *stale )
+{
+	using namespace std::chrono;
+	if( stale )
+		stale->reset();
+	if( request.getRequestMethod() != RequestMethod::GET || ! request.getUrl() )
+		return nullptr;
+	detail::cache::CacheControl control( request.getHeaders() );
+	if( control.noStore || ( control.noCache && ! stale ) )
+		return nullptr;
+	
+	auto entry = fetch( getKey( *request.getUrl() ), request );
+	if( entry ) {
+		// The request can ask for a younger response, or settle for a staler one.
+		auto age = entry->getAge( now ).count();
+		auto lifetime = entry->freshnessLifetime.count();
+		if( control.maxAge >= 0 )
+			lifetime = std::min<int64_t>( lifetime, control.maxAge );
+		if( control.minFresh >= 0 )
+			lifetime -= control.minFresh;
+		else if( control.maxStale >= 0 && ! entry->mustRevalidate )
+			lifetime = std::max<int64_t>( lifetime, entry->freshnessLifetime.count() + control.maxStale );
+		if( age < lifetime && ! control.noCache ) {
+			++mHits;
+			std::lock_guard<std::mutex> lock( mMutex );
+			touch( entry );
+			return copyResponse( *entry, now );
+		}
+		auto &headers = entry->response->getHeaders();
+		if( stale && ! entry->mustRevalidate && ! control.noCache && control.maxAge < 0 && control.minFresh < 0 ) {
+			// Good for a while longer, as long as it's brought up to date meanwhile.
+			detail::cache::CacheControl responseControl( headers );
+			if( age - entry->freshnessLifetime.count() < responseControl.staleWhileRevalidate ) {
+				++mHits;
+				*stale = std::make_shared<Response>( *entry->response );
+				std::lock_guard<std::mutex> lock( mMutex );
+				touch( entry );
+				return copyResponse( *entry, now, "110 - \"Response is Stale\"" );
+			}
+		}
+		// Without an Age header, that's for the origin to tell once it's revalidated.
+		if( stale && ( detail::cache::findHeader( headers, "ETag" ) || detail::cache::findHeader( headers, "Last-Modified" ) ) )
+			*stale = std::make_shared<Response>( *entry->response );
+	}
+	++mMisses;
+	return nullptr;
+}
+
+inline ResponseRef ResponseCache::findIfError( const Request &request, Clock::time_point now )
+{
+	if( request.getRequestMethod() != RequestMethod::GET || ! request.getUrl() )
+		return nullptr;
+	detail::cache::CacheControl control( request.getHeaders() );
+	if( control.noStore )
+		return nullptr;
+	auto entry = fetch( getKey( *request.getUrl() ), request );
+	if( ! entry || entry->mustRevalidate )
+		return nullptr;
+	detail::cache::CacheControl responseControl( entry->response->getHeaders() );
+	auto staleness = entry->getAge( now ).count() - entry->freshnessLifetime.count();
+	if( staleness >= std::max( control.staleIfError, responseControl.staleIfError ) )
+		return nullptr;
+	++mHits;
+	std::lock_guard<std::mutex> lock( mMutex );
+	touch( entry );
+	return copyResponse( *entry, now, "111 - \"Revalidation Failed\"" );
+}
+
+inline bool ResponseCache::store( const Request &request, const ResponseRef &response, Clock::time_point requestTime,
+								  Clock::time_point responseTime )
+{
+	using namespace std::chrono;
+	if( ! response || ! request.getUrl() )
+		return false;
+	auto key = getKey( *request.getUrl() );
+	auto status = response->getStatusCode();
+	if( request.getRequestMethod() != RequestMethod::GET ) {
+		// What's cached is likely out of date once the resource was changed.
+		if( request.getRequestMethod() != RequestMethod::HEAD && request.getRequestMethod() != RequestMethod::OPTIONS &&
+		    status >= http::errc::ok && status < http::errc::bad_request )
+			invalidate( *request.getUrl() );
+		return false;
+	}
+	
+	auto &headers = response->getHeaders();
+	detail::cache::CacheControl requestControl( request.getHeaders() );
+	detail::cache::CacheControl control( headers );
+	if( requestControl.noStore || control.noStore || control.isPrivate || status == http::errc::partial_content )
+		return false;
+	// Credentials make a response personal unless it says otherwise.
+	if( detail::cache::findHeader( request.getHeaders(), BasicAuthorization::key() ) &&
+	    ! control.isPublic && ! control.mustRevalidate && control.sMaxAge < 0 )
+		return false;
+	
+	auto entry = std::make_shared<CachedResponse>();
+	auto date = detail::cache::findDate( headers, "Date", responseTime );
+	if( auto vary = detail::cache::findHeader( headers, "Vary" ) ) {
+		for( auto &name : detail::cache::splitList( *vary ) ) {
+			// It varies on something other than headers, there's no telling which variant fits.
+			if( name == "*" )
+				return false;
+			auto value = detail::cache::findHeader( request.getHeaders(), name.c_str() );
+			entry->vary.emplace_back( name, value ? *value : std::string() );
+		}
+	}
+	
+	// Explicit freshness wins, the heuristic only applies where caching is the default.
+	bool explicitFreshness = true;
+	if( control.noCache )
+		entry->freshnessLifetime = seconds( 0 );
+	else if( control.sMaxAge >= 0 )
+		entry->freshnessLifetime = seconds( control.sMaxAge );
+	else if( control.maxAge >= 0 )
+		entry->freshnessLifetime = seconds( control.maxAge );
+	else if( detail::cache::findHeader( headers, "Expires" ) ) {
+		// A malformed date, like "0", means already expired.
+		auto expires = detail::cache::findDate( headers, "Expires", date );
+		entry->freshnessLifetime = duration_cast<seconds>( std::max( expires - date, Clock::duration::zero() ) );
+	}
+	else {
+		explicitFreshness = false;
+		auto lastModified = detail::cache::findDate( headers, "Last-Modified", date );
+		entry->freshnessLifetime = duration_cast<seconds>( std::max( date - lastModified, Clock::duration::zero() ) ) / 10;
+	}
+	if( ! explicitFreshness && ! control.isPublic && ! detail::cache::isHeuristicallyCacheable( status ) )
+		return false;
+	entry->mustRevalidate = control.mustRevalidate || control.sMaxAge >= 0;
+	
+	// How old the response was when it got here, RFC 7234 4.2.3.
+	int64_t ageValue = 0;
+	if( auto age = detail::cache::findHeader( headers, "Age" ) )
+		ageValue = std::strtoll( age->c_str(), nullptr, 10 );
+	auto apparentAge = std::max( responseTime - date, Clock::duration::zero() );
+	auto correctedAge = seconds( std::max<int64_t>( ageValue, 0 ) ) + ( responseTime - requestTime );
+	entry->initialAge = duration_cast<seconds>( std::max<Clock::duration>( apparentAge, correctedAge ) );
+	
+	entry->key = std::move( key );
+	entry->requestTime = requestTime;
+	entry->responseTime = responseTime;
+	entry->response = std::make_shared<Response>( *response );
+	entry->size = sizeof( CachedResponse ) + sizeof( Response ) + entry->key.size();
+	for( auto &header : headers.getHeaders() )
+		entry->size += header.first.size() + header.second.size();
+	if( auto &content = response->getContent() )
+		entry->size += content->getSize();
+	
+	CacheStoreRef store;
+	bool fits = false;
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		store = mStore;
+		fits = entry->size <= mCapacity;
+		if( fits )
+			insert( entry );
+	}
+	if( store )
+		store->save( *entry );
+	return fits || store;
+}
+
+inline void ResponseCache::invalidate( const Url &url )
+{
+	auto key = getKey( url );
+	CacheStoreRef store;
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		store = mStore;
+		auto found = mEntries.find( key );
+		if( found != mEntries.end() ) {
+			auto entries = found->second;
+			for( auto &entry : entries )
+				remove( entry );
+		}
+	}
+	if( store )
+		store->remove( key );
+}
+
+inline void ResponseCache::setStore( CacheStoreRef store )
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	mStore = std::move( store );
+}
+
+inline void ResponseCache::clear()
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	mEntries.clear();
+	mRecent.clear();
+	mPositions.clear();
+	mSize = 0;
+}
+
+inline void ResponseCache::setCapacity( size_t capacity )
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	mCapacity = capacity;
+	evict();
+}
+
+inline size_t ResponseCache::getSize() const
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	return mSize;
+}
+
+inline size_t ResponseCache::getCount() const
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	return mRecent.size();
+}
+
+inline CachedResponseRef ResponseCache::lookup( const std::string &key, const Request &request )
+{
+	auto found = mEntries.find( key );
+	if( found == mEntries.end() )
+		return nullptr;
+	for( auto &entry : found->second ) {
+		if( detail::cache::matchesVary( entry->vary, request ) )
+			return entry;
+	}
+	return nullptr;
+}
+
+inline CachedResponseRef ResponseCache::fetch( const std::string &key, const Request &request )
+{
+	CachedResponseRef entry;
+	CacheStoreRef store;
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		entry = lookup( key, request );
+		store = mStore;
+	}
+	// The store is consulted unlocked, a slow disk mustn't hold up requests served from memory.
+	if( ! entry && store ) {
+		entry = store->load( key, request );
+		if( entry ) {
+			std::lock_guard<std::mutex> lock( mMutex );
+			insert( entry );
+		}
+	}
+	return entry;
+}
+
+inline void ResponseCache::touch( const CachedResponseRef &entry )
+{
+	auto position = mPositions.find( entry.get() );
+	if( position != mPositions.end() )
+		mRecent.splice( mRecent.begin(), mRecent, position->second );
+}
+
+inline void ResponseCache::insert( const CachedResponseRef &entry )
+{
+	auto &variants = mEntries[entry->key];
+	for( auto &variant : variants ) {
+		if( variant->vary == entry->vary ) {
+			// remove() would take the vector out from under us.
+			mSize -= variant->size;
+			auto position = mPositions.find( variant.get() );
+			mRecent.erase( position->second );
+			mPositions.erase( position );
+			variant = entry;
+			break;
+		}
+	}
+	if( std::find( variants.begin(), variants.end(), entry ) == variants.end() )
+		variants.push_back( entry );
+	mRecent.push_front( entry );
+	mPositions[entry.get()] = mRecent.begin();
+	mSize += entry->size;
+	evict();
+}
+
+inline void ResponseCache::remove( const CachedResponseRef &entry )
+{
+	auto position = mPositions.find( entry.get() );
+	if( position == mPositions.end() )
+		return;
+	mRecent.erase( position->second );
+	mPositions.erase( position );
+	mSize -= entry->size;
+	auto found = mEntries.find( entry->key );
+	auto &variants = found->second;
+	variants.erase( std::find( variants.begin(), variants.end(), entry ) );
+	if( variants.empty() )
+		mEntries.erase( found );
+}
+
+inline void ResponseCache::evict()
+{
+	while( mSize > mCapacity && ! mRecent.empty() ) {
+		auto entry = mRecent.back();
+		remove( entry );
+	}
+}
+
+inline ResponseRef ResponseCache::copyResponse( const CachedResponse &entry, Clock::time_point now, const char *warning )
+{
+	auto response = std::make_shared<Response>( *entry.response );
+	auto &headers = response->getHeaders().getHeaders();
+	headers.erase( std::remove_if( headers.begin(), headers.end(), []( const HeaderSet::Header &header ) {
+		return urdl::detail::headers_equal( header.first, "Age" );
+	}), headers.end() );
+	response->getHeaders().appendHeader( "Age", std::to_string( entry.getAge( now ).count() ) );
+	if( warning )
+		response->getHeaders().appendHeader( "Warning", warning );
+	return response;
+}
+	
+}} // http // cinder
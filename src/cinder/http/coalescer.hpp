@@ -0,0 +1,124 @@
+//
+//  coalescer.hpp
+//  Cinder-HTTP
+//
+//
+
+#pragma once
+
+#if ! defined( ASIO_STANDALONE )
+#define ASIO_STANDALONE 1
+#endif
+
+#include "asio/asio.hpp"
+#include "request_response.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+namespace cinder {
+namespace http {
+	
+using RequestCoalescerRef = std::shared_ptr<class RequestCoalescer>;
+
+//! Collapses identical GET requests in flight into one transfer. Give it to any number of
+//! Sessions and SslSessions with setCoalescer(). The first to start a request makes the
+//! transfer, the ones starting the same request before it completes wait for it instead,
+//! and all of them are handed the same response, or the same error. A transfer its maker
+//! cancels or aborts isn't the waiters' to fail, they start over and one of them makes it.
+//! Requests are the same when their urls, without fragments, and all of their headers are,
+//! as a response may vary on any of them, urls being compared normalized. Thread safe.
+class RequestCoalescer {
+public:
+	//! Receives the outcome of the transfer a request waited on
+	using Handler = std::function<void( asio::error_code, const ResponseRef & )>;
+	
+	RequestCoalescer() = default;
+	
+	//! Waits with /a handler on the transfer of the request under /a key if one is in
+	//! flight and returns true. Otherwise the caller makes the transfer, and must complete()
+	//! or abandon() it, and false is returned.
+	bool		join( const std::string &key, Handler handler );
+	//! Hands /a response, or /a ec, to the requests waiting on the transfer under /a key
+	void		complete( const std::string &key, asio::error_code ec, const ResponseRef &response );
+	//! Hands abandoned() to the requests waiting on the transfer under /a key, which its
+	//! maker gave up on, for them to start over
+	void		abandon( const std::string &key );
+	
+	//! Returns the error the requests waiting on an abandoned transfer are handed
+	static asio::error_code	abandoned() { return asio::error::try_again; }
+	
+	//! Returns the number of transfers in flight
+	size_t		getCount() const;
+	//! Returns the number of requests that waited on another's transfer
+	uint64_t	getJoined() const { return mJoined; }
+	
+	//! Returns the key /a request is coalesced under, empty if it can't be. Only GET
+	//! requests whose content isn't streamed to a handler are.
+	static std::string getKey( const Request &request );
+	
+private:
+	mutable std::mutex	mMutex;
+	std::atomic<uint64_t>	mJoined{0};
+	//! The requests waiting on each transfer in flight
+	std::unordered_map<std::string, std::vector<Handler>>	mFlights;
+};
+
+inline std::string RequestCoalescer::getKey( const Request &request )
+{
+	if( request.getRequestMethod() != RequestMethod::GET || ! request.getUrl() || request.getContentHandler() )
+		return std::string();
+	auto key = request.getUrl()->normalized().to_string( Url::protocol_component | Url::host_component | Url::port_component |
+														 Url::path_component | Url::query_component );
+	// The headers are kept sorted, the same ones make the same key.
+	for( auto &header : request.getHeaders().getHeaders() ) {
+		key += "\r\n";
+		key += header.first;
+		key += ": ";
+		key += header.second;
+	}
+	return key;
+}
+
+inline bool RequestCoalescer::join( const std::string &key, Handler handler )
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	auto found = mFlights.find( key );
+	if( found == mFlights.end() ) {
+		mFlights.emplace( key, std::vector<Handler>() );
+		return false;
+	}
+	found->second.push_back( std::move( handler ) );
+	++mJoined;
+	return true;
+}
+
+inline void RequestCoalescer::abandon( const std::string &key )
+{
+	complete( key, abandoned(), nullptr );
+}
+
+inline void RequestCoalescer::complete( const std::string &key, asio::error_code ec, const ResponseRef &response )
+{
+	std::vector<Handler> waiting;
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		auto found = mFlights.find( key );
+		if( found == mFlights.end() )
+			return;
+		waiting = std::move( found->second );
+		mFlights.erase( found );
+	}
+	// Outside the lock, a handler may well start the next transfer.
+	for( auto &handler : waiting )
+		handler( ec, response );
+}
+
+inline size_t RequestCoalescer::getCount() const
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	return mFlights.size();
+}
+	
+}} // http // cinder
@@ -0,0 +1,236 @@
+//
+//  compression.hpp
+//  Cinder-HTTP
+//
+//
+
+#pragma once
+
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include <zlib.h>
+
+namespace cinder {
+namespace http { namespace detail {
+	
+//! Streaming zlib inflater for "gzip" and "deflate" content codings. Input can be fed in
+//! arbitrary pieces as it comes off the socket, the decompressed bytes are appended to
+//! the caller's buffer so the compressed body is never held in full.
+struct Inflater {
+	Inflater();
+	//! Constructs an inflater for a raw deflate stream with a window of /a windowBits, 8 to 15,
+	//! skipping the detection of the stream's format
+	explicit Inflater( int windowBits );
+	~Inflater();
+	
+	Inflater( const Inflater & ) = delete;
+	Inflater& operator=( const Inflater & ) = delete;
+	
+	//! Inflates /a size bytes at /a data, appending the output to /a out. Returns false if
+	//! the data is corrupt, or as soon as /a out would grow past /a limit bytes.
+	bool decode( const uint8_t *data, size_t size, std::vector<uint8_t> &out, size_t limit = SIZE_MAX );
+	//! Returns whether the end of the compressed stream has been reached
+	bool isFinished() const { return mFinished; }
+	//! Returns whether any of the compressed stream has been fed to it yet
+	bool hasInput() const { return mPrefixSize > 0 || mStream.total_in > 0; }
+	//! Returns whether decode() failed because the output outgrew its limit
+	bool isOverLimit() const { return mOverLimit; }
+	//! Starts over with an empty window, for streams that don't share context between messages
+	void reset();
+	
+private:
+	bool inflate( const uint8_t *data, size_t size, std::vector<uint8_t> &out, size_t limit );
+	
+	z_stream	mStream;
+	uint8_t		mPrefix[2];
+	size_t		mPrefixSize{0};
+	int			mWindowBits{0};
+	bool		mInitialized{false},
+				mFinished{false},
+				mOverLimit{false};
+};
+
+inline Inflater::Inflater()
+{
+	memset( &mStream, 0, sizeof( mStream ) );
+}
+
+inline Inflater::Inflater( int windowBits )
+: mWindowBits( windowBits )
+{
+	memset( &mStream, 0, sizeof( mStream ) );
+	mInitialized = inflateInit2( &mStream, -windowBits ) == Z_OK;
+}
+
+inline Inflater::~Inflater()
+{
+	if( mInitialized )
+		inflateEnd( &mStream );
+}
+
+inline bool Inflater::decode( const uint8_t *data, size_t size, std::vector<uint8_t> &out, size_t limit )
+{
+	if( mFinished )
+		return true;
+	
+	if( ! mInitialized ) {
+		if( mWindowBits )
+			return false;
+		// The first two bytes tell a gzip or zlib header apart from the raw deflate stream
+		// plenty of servers send for "deflate", hold on to them until both have arrived.
+		while( size > 0 && mPrefixSize < 2 ) {
+			mPrefix[mPrefixSize++] = *data++;
+			--size;
+		}
+		if( mPrefixSize < 2 )
+			return true;
+		bool gzip = mPrefix[0] == 0x1f && mPrefix[1] == 0x8b;
+		bool zlib = ( mPrefix[0] & 0x0f ) == Z_DEFLATED && ( ( mPrefix[0] << 8 ) | mPrefix[1] ) % 31 == 0;
+		if( inflateInit2( &mStream, gzip ? 15 + 16 : zlib ? 15 : -15 ) != Z_OK )
+			return false;
+		mInitialized = true;
+		if( ! inflate( mPrefix, mPrefixSize, out, limit ) )
+			return false;
+	}
+	return inflate( data, size, out, limit );
+}
+
+inline void Inflater::reset()
+{
+	if( mInitialized && mWindowBits )
+		inflateReset( &mStream );
+	mFinished = false;
+	mOverLimit = false;
+}
+
+inline bool Inflater::inflate( const uint8_t *data, size_t size, std::vector<uint8_t> &out, size_t limit )
+{
+	mStream.next_in = const_cast<Bytef*>( data );
+	mStream.avail_in = static_cast<uInt>( size );
+	do {
+		// Compressed text usually expands several times over, grow in generous steps, but
+		// never more than a byte past the limit, a small input may well inflate to gigabytes.
+		auto offset = out.size();
+		auto available = std::max<size_t>( mStream.avail_in * 4, 16 * 1024 );
+		if( limit != SIZE_MAX )
+			available = std::min<size_t>( available, limit - std::min( limit, offset ) + 1 );
+		out.resize( offset + available );
+		mStream.next_out = out.data() + offset;
+		mStream.avail_out = static_cast<uInt>( available );
+		
+		auto result = ::inflate( &mStream, Z_NO_FLUSH );
+		out.resize( out.size() - mStream.avail_out );
+		
+		if( out.size() > limit ) {
+			mOverLimit = true;
+			return false;
+		}
+		if( result == Z_STREAM_END )
+			mFinished = true;
+		else if( result != Z_OK && result != Z_BUF_ERROR )
+			return false;
+	} while( ! mFinished && ( mStream.avail_in > 0 || mStream.avail_out == 0 ) );
+	
+	return true;
+}
+	
+//! Streaming zlib deflater producing a "gzip" content coding. The body is handed over in
+//! slices and each call appends whatever compressed output is ready, so nothing larger
+//! than a slice has to exist in compressed form at once.
+struct Deflater {
+	//! Constructs a gzip deflater with compression /a level, 0 to 9
+	Deflater( int level );
+	//! Constructs a raw deflater with compression /a level, 0 to 9, and a window of
+	//! /a windowBits, 9 to 15
+	Deflater( int level, int windowBits );
+	~Deflater();
+	
+	Deflater( const Deflater & ) = delete;
+	Deflater& operator=( const Deflater & ) = delete;
+	
+	//! Deflates /a size bytes at /a data, appending the output to /a out. Passing /a finish
+	//! flushes everything pending and ends the stream. Returns false on failure.
+	bool encode( const uint8_t *data, size_t size, bool finish, std::vector<uint8_t> &out );
+	//! Deflates /a size bytes at /a data and flushes them to a byte boundary without ending
+	//! the stream, so later data can still refer back to them. The output ends with the
+	//! empty stored block 00 00 FF FF. Returns false on failure.
+	bool flush( const uint8_t *data, size_t size, std::vector<uint8_t> &out );
+	//! Starts over with an empty window, for streams that don't share context between messages
+	void reset();
+	
+private:
+	bool deflate( const uint8_t *data, size_t size, int flush, std::vector<uint8_t> &out );
+	
+	z_stream	mStream;
+	bool		mInitialized{false};
+};
+
+inline Deflater::Deflater( int level )
+{
+	memset( &mStream, 0, sizeof( mStream ) );
+	// 15 window bits plus 16 writes a gzip header and trailer instead of zlib's.
+	mInitialized = deflateInit2( &mStream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY ) == Z_OK;
+}
+
+inline Deflater::Deflater( int level, int windowBits )
+{
+	memset( &mStream, 0, sizeof( mStream ) );
+	// Negative window bits leave out the header and trailer altogether.
+	mInitialized = deflateInit2( &mStream, level, Z_DEFLATED, -windowBits, 8, Z_DEFAULT_STRATEGY ) == Z_OK;
+}
+
+inline Deflater::~Deflater()
+{
+	if( mInitialized )
+		deflateEnd( &mStream );
+}
+
+inline bool Deflater::encode( const uint8_t *data, size_t size, bool finish, std::vector<uint8_t> &out )
+{
+	return deflate( data, size, finish ? Z_FINISH : Z_NO_FLUSH, out );
+}
+
+inline bool Deflater::flush( const uint8_t *data, size_t size, std::vector<uint8_t> &out )
+{
+	return deflate( data, size, Z_SYNC_FLUSH, out );
+}
+
+inline void Deflater::reset()
+{
+	if( mInitialized )
+		deflateReset( &mStream );
+}
+
+inline bool Deflater::deflate( const uint8_t *data, size_t size, int flush, std::vector<uint8_t> &out )
+{
+	if( ! mInitialized )
+		return false;
+	
+	mStream.next_in = const_cast<Bytef*>( data );
+	mStream.avail_in = static_cast<uInt>( size );
+	bool finish = flush == Z_FINISH;
+	int result;
+	do {
+		auto offset = out.size();
+		// Output is usually a fraction of the input, the loop picks up anything that doesn't fit.
+		auto available = std::max<size_t>( mStream.avail_in / 2, 4 * 1024 );
+		out.resize( offset + available );
+		mStream.next_out = out.data() + offset;
+		mStream.avail_out = static_cast<uInt>( available );
+		
+		result = ::deflate( &mStream, flush );
+		out.resize( out.size() - mStream.avail_out );
+		
+		if( result == Z_STREAM_ERROR )
+			return false;
+	} while( mStream.avail_out == 0 || ( finish && result != Z_STREAM_END ) );
+	
+	return true;
+}
+	
+} // detail
+} // http
+} // cinder
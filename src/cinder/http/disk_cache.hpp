@@ -0,0 +1,792 @@
+//
+//  disk_cache.hpp
+//  Cinder-HTTP
+//
+//
+
+#pragma once
+
+#include "http.hpp"
+
+#include "cinder/Filesystem.h"
+
+#include <cstdio>
+#include <map>
+#include <mutex>
+#if ! defined( _WIN32 )
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cinder {
+namespace http {
+	
+namespace detail {
+namespace disk {
+	
+using Clock = cache::Clock;
+
+const uint32_t kIndexMagic = 0x49444843; // "CHDI"
+const uint32_t kRecordMagic = 0x52444843; // "CHDR"
+const uint32_t kVersion = 1;
+//! Segments are closed for appending once they pass this size
+const uint64_t kSegmentSize = 64 * 1024 * 1024;
+
+//! A file mapped into memory, unmapped once the last reference to it goes
+class MappedFile {
+public:
+	//! Maps /a path, growing it to /a size if it's shorter, or whole if /a size is 0.
+	//! A /a shared mapping writes through to the file, any other is a private
+	//! copy-on-write view of it. Returns nullptr if the file can't be mapped.
+	static std::shared_ptr<MappedFile> open( const ci::fs::path &path, uint64_t size, bool shared );
+	~MappedFile();
+	
+	uint8_t*	data() const { return mData; }
+	uint64_t	size() const { return mSize; }
+	//! Writes the changes to a shared mapping back to the file
+	void		flush();
+	
+private:
+	MappedFile() = default;
+	
+	uint8_t		*mData{nullptr};
+	uint64_t	mSize{0};
+};
+
+using MappedFileRef = std::shared_ptr<MappedFile>;
+
+inline MappedFileRef MappedFile::open( const ci::fs::path &path, uint64_t size, bool shared )
+{
+	std::shared_ptr<MappedFile> file( new MappedFile );
+#if defined( _WIN32 )
+	auto handle = CreateFileW( path.wstring().c_str(), GENERIC_READ | ( shared ? GENERIC_WRITE : 0 ),
+							   FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+							   shared ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+	if( handle == INVALID_HANDLE_VALUE )
+		return nullptr;
+	LARGE_INTEGER current;
+	GetFileSizeEx( handle, &current );
+	file->mSize = std::max<uint64_t>( size, current.QuadPart );
+	// Growing the mapping of a shared file grows the file with it.
+	auto mapping = file->mSize ? CreateFileMappingW( handle, nullptr, shared ? PAGE_READWRITE : PAGE_WRITECOPY,
+													 static_cast<DWORD>( file->mSize >> 32 ),
+													 static_cast<DWORD>( file->mSize ), nullptr ) : nullptr;
+	CloseHandle( handle );
+	if( ! mapping )
+		return nullptr;
+	file->mData = static_cast<uint8_t*>( MapViewOfFile( mapping, shared ? FILE_MAP_WRITE : FILE_MAP_COPY, 0, 0,
+														static_cast<SIZE_T>( file->mSize ) ) );
+	CloseHandle( mapping );
+	if( ! file->mData )
+		return nullptr;
+#else
+	int fd = ::open( path.string().c_str(), shared ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0644 );
+	if( fd < 0 )
+		return nullptr;
+	struct stat st;
+	if( ::fstat( fd, &st ) || ( shared && static_cast<uint64_t>( st.st_size ) < size && ::ftruncate( fd, size ) ) ) {
+		::close( fd );
+		return nullptr;
+	}
+	file->mSize = std::max<uint64_t>( size, st.st_size );
+	void *data = file->mSize ? ::mmap( nullptr, file->mSize, PROT_READ | PROT_WRITE, shared ? MAP_SHARED : MAP_PRIVATE, fd, 0 )
+							 : MAP_FAILED;
+	::close( fd );
+	if( data == MAP_FAILED )
+		return nullptr;
+	file->mData = static_cast<uint8_t*>( data );
+#endif
+	return file;
+}
+
+inline MappedFile::~MappedFile()
+{
+	if( ! mData )
+		return;
+#if defined( _WIN32 )
+	UnmapViewOfFile( mData );
+#else
+	::munmap( mData, mSize );
+#endif
+}
+
+inline void MappedFile::flush()
+{
+#if defined( _WIN32 )
+	FlushViewOfFile( mData, 0 );
+#else
+	::msync( mData, mSize, MS_ASYNC );
+#endif
+}
+
+// ci::fs may be boost::filesystem, whose overloads don't take a std::error_code, these are plain POSIX and Win32.
+
+//! Returns whether there's a file at /a path, and its size in /a size if there is.
+inline bool fileSize( const ci::fs::path &path, uint64_t *size = nullptr )
+{
+#if defined( _WIN32 )
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if( ! GetFileAttributesExW( path.wstring().c_str(), GetFileExInfoStandard, &data ) )
+		return false;
+	if( size )
+		*size = ( static_cast<uint64_t>( data.nFileSizeHigh ) << 32 ) | data.nFileSizeLow;
+#else
+	struct stat st;
+	if( ::stat( path.string().c_str(), &st ) )
+		return false;
+	if( size )
+		*size = st.st_size;
+#endif
+	return true;
+}
+
+//! Deletes the file at /a path, if there is one
+inline void removeFile( const ci::fs::path &path )
+{
+#if defined( _WIN32 )
+	DeleteFileW( path.wstring().c_str() );
+#else
+	::unlink( path.string().c_str() );
+#endif
+}
+
+//! The start of the index file
+struct IndexHeader {
+	uint32_t	magic,
+				version,
+				slotCount,
+				//! The slots holding a record, and the ones that did
+				liveCount,
+				usedCount,
+				//! The oldest segment and the one appended to
+				firstSegment,
+				activeSegment,
+				reserved;
+};
+
+//! A slot of the index's open addressed hash table, locating a record in a segment
+struct IndexSlot {
+	enum State : uint32_t { EMPTY, LIVE, REMOVED };
+	enum Flags : uint32_t { HAS_VALIDATORS = 1 };
+	
+	uint64_t	hash;
+	uint64_t	offset,
+				size;
+	//! When the response goes stale, in seconds since the epoch
+	int64_t		expires;
+	uint32_t	segment;
+	uint32_t	state;
+	uint32_t	flags;
+	uint32_t	reserved;
+};
+
+//! Returns the 64-bit FNV-1a hash of /a key
+inline uint64_t hashKey( const std::string &key )
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for( unsigned char c : key ) {
+		hash ^= c;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+inline int64_t toMicroseconds( Clock::time_point time )
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>( time.time_since_epoch() ).count();
+}
+
+inline Clock::time_point fromMicroseconds( int64_t microseconds )
+{
+	return Clock::time_point( std::chrono::duration_cast<Clock::duration>( std::chrono::microseconds( microseconds ) ) );
+}
+
+//! Writes the fields of a record ahead of its content
+struct RecordWriter {
+	template<typename T>
+	void write( T value )
+	{
+		auto bytes = reinterpret_cast<const uint8_t*>( &value );
+		data.insert( data.end(), bytes, bytes + sizeof( T ) );
+	}
+	void write( const std::string &value )
+	{
+		write<uint32_t>( static_cast<uint32_t>( value.size() ) );
+		data.insert( data.end(), value.begin(), value.end() );
+	}
+	
+	std::vector<uint8_t> data;
+};
+
+//! Reads the fields of a record, failing instead of reading past its end
+struct RecordReader {
+	RecordReader() = default;
+	RecordReader( const uint8_t *data, uint64_t size ) : it( data ), end( data + size ) {}
+	
+	template<typename T>
+	T read()
+	{
+		T value{};
+		if( static_cast<uint64_t>( end - it ) < sizeof( T ) ) {
+			failed = true;
+			return value;
+		}
+		memcpy( &value, it, sizeof( T ) );
+		it += sizeof( T );
+		return value;
+	}
+	std::string readString()
+	{
+		auto size = read<uint32_t>();
+		if( failed || static_cast<uint64_t>( end - it ) < size ) {
+			failed = true;
+			return std::string();
+		}
+		std::string value( reinterpret_cast<const char*>( it ), size );
+		it += size;
+		return value;
+	}
+	
+	const uint8_t	*it{nullptr}, *end{nullptr};
+	bool			failed{false};
+};
+
+//! Returns the record of /a entry up to its content, which follows it. Sets /a validators
+//! to whether the response has an ETag or Last-Modified.
+inline std::vector<uint8_t> writeRecord( const CachedResponse &entry, bool &validators )
+{
+	auto &response = *entry.response;
+	auto &content = response.getContent();
+	uint64_t contentSize = content ? content->getSize() : 0;
+	
+	RecordWriter writer;
+	writer.write<uint32_t>( kRecordMagic );
+	// The sizes are filled in once they're known.
+	writer.write<uint64_t>( 0 );
+	writer.write<uint64_t>( contentSize );
+	writer.write( entry.key );
+	writer.write<int64_t>( toMicroseconds( entry.requestTime ) );
+	writer.write<int64_t>( toMicroseconds( entry.responseTime ) );
+	writer.write<int64_t>( entry.initialAge.count() );
+	writer.write<int64_t>( entry.freshnessLifetime.count() );
+	writer.write<uint8_t>( entry.mustRevalidate );
+	writer.write<uint32_t>( static_cast<uint32_t>( entry.vary.size() ) );
+	for( auto &vary : entry.vary ) {
+		writer.write( vary.first );
+		writer.write( vary.second );
+	}
+	writer.write<uint32_t>( response.statusCode );
+	writer.write<uint32_t>( response.versionMajor );
+	writer.write<uint32_t>( response.versionMinor );
+	auto &headers = response.getHeaders().getHeaders();
+	writer.write<uint32_t>( static_cast<uint32_t>( headers.size() ) );
+	validators = false;
+	for( auto &header : headers ) {
+		writer.write( header.first );
+		writer.write( header.second );
+		validators = validators || urdl::detail::headers_equal( header.first, "ETag" ) ||
+					 urdl::detail::headers_equal( header.first, "Last-Modified" );
+	}
+	uint64_t headerSize = writer.data.size();
+	memcpy( writer.data.data() + sizeof( uint32_t ), &headerSize, sizeof( headerSize ) );
+	return std::move( writer.data );
+}
+
+//! Parses the record /a reader is at, /a size bytes long, up to the response into
+//! /a entry, leaving /a reader at the response
+inline bool readRecord( RecordReader &reader, uint64_t size, CachedResponse &entry )
+{
+	if( reader.read<uint32_t>() != kRecordMagic )
+		return false;
+	// The content ends the record, whatever is left once the response is read.
+	auto headerSize = reader.read<uint64_t>();
+	auto contentSize = reader.read<uint64_t>();
+	if( headerSize + contentSize != size )
+		return false;
+	entry.key = reader.readString();
+	entry.requestTime = fromMicroseconds( reader.read<int64_t>() );
+	entry.responseTime = fromMicroseconds( reader.read<int64_t>() );
+	entry.initialAge = std::chrono::seconds( reader.read<int64_t>() );
+	entry.freshnessLifetime = std::chrono::seconds( reader.read<int64_t>() );
+	entry.mustRevalidate = reader.read<uint8_t>() != 0;
+	auto varyCount = reader.read<uint32_t>();
+	for( uint32_t i = 0; i < varyCount && ! reader.failed; ++i ) {
+		auto name = reader.readString();
+		entry.vary.emplace_back( std::move( name ), reader.readString() );
+	}
+	return ! reader.failed;
+}
+
+//! Parses the response /a reader is at, the rest of the record being its content, which
+//! /a keepAlive is held for as long as the response's content views it. Returns nullptr
+//! if the record is malformed.
+inline ResponseRef readResponse( RecordReader &reader, std::shared_ptr<void> keepAlive )
+{
+	auto response = std::make_shared<Response>();
+	response->statusCode = reader.read<uint32_t>();
+	response->versionMajor = reader.read<uint32_t>();
+	response->versionMinor = reader.read<uint32_t>();
+	auto headerCount = reader.read<uint32_t>();
+	auto &headers = response->getHeaders().getHeaders();
+	for( uint32_t i = 0; i < headerCount && ! reader.failed; ++i ) {
+		auto name = reader.readString();
+		headers.emplace_back( std::move( name ), reader.readString() );
+	}
+	if( reader.failed )
+		return nullptr;
+	auto contentSize = static_cast<uint64_t>( reader.end - reader.it );
+	if( contentSize ) {
+		// The buffer only views the record, what holds it lives as long as the buffer.
+		auto data = const_cast<uint8_t*>( reader.it );
+		response->getContent() = ci::BufferRef( new ci::Buffer( data, static_cast<size_t>( contentSize ) ),
+		[keepAlive]( ci::Buffer *buffer ) {
+			delete buffer;
+		});
+	}
+	return response;
+}
+	
+} // disk
+} // detail
+
+using DiskCacheRef = std::shared_ptr<class DiskCache>;
+
+//! A CacheStore in a directory, which outlives the process. Records, the response's
+//! headers followed by its content, are appended to segment files, and an index file
+//! mapped into memory locates them by the hash of their key. Content is handed out as a
+//! view of the mapped segment, it's never read into the heap. Once the segments pass the
+//! capacity, expired responses that can't be revalidated are dropped, segments that are
+//! mostly dead are compacted into the active one, and then the oldest are deleted.
+//! Responses already handed out keep the segments they map alive. Thread safe, but
+//! only one process can use a directory at a time.
+class DiskCache : public CacheStore {
+public:
+	//! Opens the cache in /a directory, creating it if needed, holding up to /a capacity
+	//! bytes in at most /a maxEntries responses
+	explicit DiskCache( const ci::fs::path &directory, uint64_t capacity = 1024ULL * 1024 * 1024,
+						uint32_t maxEntries = 64 * 1024 );
+	~DiskCache();
+	
+	CachedResponseRef	load( const std::string &key, const Request &request ) override;
+	void				save( const CachedResponse &entry ) override;
+	void				remove( const std::string &key ) override;
+	
+	//! Rewrites the live records of segments that are mostly dead into the active one and
+	//! deletes them
+	void		compact();
+	
+	//! Returns whether the directory could be opened, a DiskCache that couldn't stores nothing
+	bool		isOpen() const { return mIndex != nullptr; }
+	const ci::fs::path&	getDirectory() const { return mDirectory; }
+	uint64_t	getCapacity() const { return mCapacity; }
+	//! Returns the size of the segments
+	uint64_t	getSize() const;
+	//! Returns the number of responses stored
+	uint32_t	getCount() const;
+	
+private:
+	detail::disk::IndexHeader&	header() const { return *reinterpret_cast<detail::disk::IndexHeader*>( mIndex->data() ); }
+	detail::disk::IndexSlot*	slots() const { return reinterpret_cast<detail::disk::IndexSlot*>( mIndex->data() + sizeof( detail::disk::IndexHeader ) ); }
+	ci::fs::path		getSegmentPath( uint32_t segment ) const;
+	//! Returns the mapping of /a segment at least /a size long
+	detail::disk::MappedFileRef	mapSegment( uint32_t segment, uint64_t size );
+	//! Parses the record of /a slot up to the response into /a entry, leaving /a reader at
+	//! the response and /a mapping holding the segment
+	bool				readRecord( const detail::disk::IndexSlot &slot, CachedResponse &entry,
+									detail::disk::MappedFileRef &mapping, detail::disk::RecordReader &reader );
+	//! Appends /a header and /a size bytes of /a content to the active segment, returning
+	//! where they went
+	bool				append( const std::vector<uint8_t> &header, const void *content, uint64_t size,
+								uint32_t &segment, uint64_t &offset );
+	void				insertSlot( const detail::disk::IndexSlot &slot );
+	void				removeSlot( detail::disk::IndexSlot &slot );
+	//! Reinserts the live slots, dropping the removed ones probes had to skip
+	void				rehash();
+	void				dropSegment( uint32_t segment );
+	void				enforceCapacity();
+	void				compactLocked();
+	
+	ci::fs::path				mDirectory;
+	uint64_t					mCapacity;
+	uint64_t					mSize{0}, mActiveSize{0};
+	mutable std::mutex			mMutex;
+	detail::disk::MappedFileRef	mIndex;
+	std::FILE					*mActive{nullptr};
+	std::map<uint32_t, detail::disk::MappedFileRef>	mSegments;
+};
+
+inline DiskCache::DiskCache( const ci::fs::path &directory, uint64_t capacity, uint32_t maxEntries )
+: mDirectory( directory ), mCapacity( capacity )
+{
+	using namespace detail::disk;
+	try {
+		ci::fs::create_directories( mDirectory );
+	}
+	catch( const std::exception & ) {
+		// Opening the index fails below.
+	}
+	auto indexPath = mDirectory / "index.dat";
+	uint32_t slotCount = std::max<uint32_t>( maxEntries, 16 ) / 3 * 4;
+	mIndex = MappedFile::open( indexPath, sizeof( IndexHeader ), true );
+	if( mIndex && ( header().magic != kIndexMagic || header().version != kVersion ||
+					mIndex->size() != sizeof( IndexHeader ) + header().slotCount * sizeof( IndexSlot ) ) ) {
+		// Not an index this version wrote, whatever it indexed is lost.
+		if( header().magic )
+			CI_LOG_W( "Resetting the disk cache in " << mDirectory );
+		mIndex.reset();
+		try {
+			for( ci::fs::directory_iterator it( mDirectory ), end; it != end; ++it ) {
+				if( it->path().extension() == ".seg" )
+					removeFile( it->path() );
+			}
+		}
+		catch( const std::exception & ) {
+			// Stale segments are overwritten as the new index gets to them.
+		}
+		removeFile( indexPath );
+		mIndex = MappedFile::open( indexPath, sizeof( IndexHeader ) + slotCount * sizeof( IndexSlot ), true );
+		if( mIndex ) {
+			memset( mIndex->data(), 0, mIndex->size() );
+			header().magic = kIndexMagic;
+			header().version = kVersion;
+			header().slotCount = slotCount;
+			header().firstSegment = header().activeSegment = 1;
+		}
+	}
+	if( ! mIndex ) {
+		CI_LOG_E( "Can't open the disk cache in " << mDirectory );
+		return;
+	}
+	for( auto segment = header().firstSegment; segment <= header().activeSegment; ++segment ) {
+		uint64_t size;
+		if( fileSize( getSegmentPath( segment ), &size ) ) {
+			mSize += size;
+			if( segment == header().activeSegment )
+				mActiveSize = size;
+		}
+	}
+}
+
+inline DiskCache::~DiskCache()
+{
+	if( mActive )
+		std::fclose( mActive );
+	if( mIndex )
+		mIndex->flush();
+}
+
+inline ci::fs::path DiskCache::getSegmentPath( uint32_t segment ) const
+{
+	char name[32];
+	snprintf( name, sizeof( name ), "%08x.seg", segment );
+	return mDirectory / name;
+}
+
+inline uint64_t DiskCache::getSize() const
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	return mSize;
+}
+
+inline uint32_t DiskCache::getCount() const
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	return mIndex ? header().liveCount : 0;
+}
+
+inline CachedResponseRef DiskCache::load( const std::string &key, const Request &request )
+{
+	using namespace detail::disk;
+	std::lock_guard<std::mutex> lock( mMutex );
+	if( ! mIndex )
+		return nullptr;
+	auto hash = hashKey( key );
+	auto count = header().slotCount;
+	for( uint32_t probe = 0; probe < count; ++probe ) {
+		auto &slot = slots()[( hash + probe ) % count];
+		if( slot.state == IndexSlot::EMPTY )
+			break;
+		if( slot.state != IndexSlot::LIVE || slot.hash != hash )
+			continue;
+		auto entry = std::make_shared<CachedResponse>();
+		MappedFileRef mapping;
+		RecordReader reader;
+		if( ! readRecord( slot, *entry, mapping, reader ) || entry->key != key ||
+		    ! detail::cache::matchesVary( entry->vary, request ) )
+			continue;
+		
+		auto response = readResponse( reader, mapping );
+		if( ! response )
+			continue;
+		auto contentSize = static_cast<uint64_t>( reader.end - reader.it );
+		entry->response = std::move( response );
+		entry->size = sizeof( CachedResponse ) + sizeof( Response ) + static_cast<size_t>( slot.size - contentSize );
+		return entry;
+	}
+	return nullptr;
+}
+
+inline bool DiskCache::readRecord( const detail::disk::IndexSlot &slot, CachedResponse &entry,
+								   detail::disk::MappedFileRef &mapping, detail::disk::RecordReader &reader )
+{
+	using namespace detail::disk;
+	mapping = mapSegment( slot.segment, slot.offset + slot.size );
+	if( ! mapping )
+		return false;
+	reader = RecordReader( mapping->data() + slot.offset, slot.size );
+	return detail::disk::readRecord( reader, slot.size, entry );
+}
+
+inline void DiskCache::save( const CachedResponse &entry )
+{
+	using namespace detail::disk;
+	auto &content = entry.response->getContent();
+	uint64_t contentSize = content ? content->getSize() : 0;
+	bool validators;
+	auto record = writeRecord( entry, validators );
+	uint64_t headerSize = record.size();
+	
+	IndexSlot slot = {};
+	slot.hash = hashKey( entry.key );
+	slot.size = headerSize + contentSize;
+	slot.expires = std::chrono::duration_cast<std::chrono::seconds>(
+		( entry.responseTime - entry.initialAge + entry.freshnessLifetime ).time_since_epoch() ).count();
+	slot.state = IndexSlot::LIVE;
+	slot.flags = validators ? static_cast<uint32_t>( IndexSlot::HAS_VALIDATORS ) : static_cast<uint32_t>( 0 );
+	
+	std::lock_guard<std::mutex> lock( mMutex );
+	if( ! mIndex || slot.size > mCapacity )
+		return;
+	if( ! append( record, content ? content->getData() : nullptr, contentSize, slot.segment, slot.offset ) )
+		return;
+	// The variant it replaces, if there is one, is dead from now on.
+	auto count = header().slotCount;
+	for( uint32_t probe = 0; probe < count; ++probe ) {
+		auto &existing = slots()[( slot.hash + probe ) % count];
+		if( existing.state == IndexSlot::EMPTY )
+			break;
+		if( existing.state != IndexSlot::LIVE || existing.hash != slot.hash )
+			continue;
+		CachedResponse stored;
+		MappedFileRef mapping;
+		RecordReader reader;
+		if( ! readRecord( existing, stored, mapping, reader ) || ( stored.key == entry.key && stored.vary == entry.vary ) )
+			removeSlot( existing );
+	}
+	insertSlot( slot );
+	enforceCapacity();
+}
+
+inline void DiskCache::remove( const std::string &key )
+{
+	using namespace detail::disk;
+	std::lock_guard<std::mutex> lock( mMutex );
+	if( ! mIndex )
+		return;
+	auto hash = hashKey( key );
+	auto count = header().slotCount;
+	for( uint32_t probe = 0; probe < count; ++probe ) {
+		auto &slot = slots()[( hash + probe ) % count];
+		if( slot.state == IndexSlot::EMPTY )
+			break;
+		if( slot.state != IndexSlot::LIVE || slot.hash != hash )
+			continue;
+		CachedResponse stored;
+		MappedFileRef mapping;
+		RecordReader reader;
+		if( ! readRecord( slot, stored, mapping, reader ) || stored.key == key )
+			removeSlot( slot );
+	}
+}
+
+inline void DiskCache::compact()
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	if( mIndex )
+		compactLocked();
+}
+
+inline detail::disk::MappedFileRef DiskCache::mapSegment( uint32_t segment, uint64_t size )
+{
+	auto &mapping = mSegments[segment];
+	if( ! mapping || mapping->size() < size ) {
+		// The segment grew since, the old mapping lives on in the buffers viewing it.
+		if( segment == header().activeSegment && mActive )
+			std::fflush( mActive );
+		mapping = detail::disk::MappedFile::open( getSegmentPath( segment ), 0, false );
+		if( ! mapping || mapping->size() < size ) {
+			mSegments.erase( segment );
+			return nullptr;
+		}
+	}
+	return mapping;
+}
+
+inline bool DiskCache::append( const std::vector<uint8_t> &header, const void *content, uint64_t size,
+							   uint32_t &segment, uint64_t &offset )
+{
+	auto recordSize = header.size() + size;
+	if( mActive && mActiveSize && mActiveSize + recordSize > detail::disk::kSegmentSize ) {
+		std::fclose( mActive );
+		mActive = nullptr;
+		++this->header().activeSegment;
+		mActiveSize = 0;
+	}
+	segment = this->header().activeSegment;
+	if( ! mActive ) {
+		mActive = std::fopen( getSegmentPath( segment ).string().c_str(), "ab" );
+		if( ! mActive ) {
+			CI_LOG_E( "Can't append to " << getSegmentPath( segment ) );
+			return false;
+		}
+	}
+	offset = mActiveSize;
+	if( ( ! header.empty() && std::fwrite( header.data(), 1, header.size(), mActive ) != header.size() ) ||
+	    ( size && std::fwrite( content, 1, size, mActive ) != size ) || std::fflush( mActive ) ) {
+		// The record may be partly written, whatever follows goes after it.
+		CI_LOG_E( "Can't append to " << getSegmentPath( segment ) );
+		std::fclose( mActive );
+		mActive = nullptr;
+		++this->header().activeSegment;
+		mActiveSize = 0;
+		return false;
+	}
+	mActiveSize += recordSize;
+	mSize += recordSize;
+	return true;
+}
+
+inline void DiskCache::insertSlot( const detail::disk::IndexSlot &slot )
+{
+	using namespace detail::disk;
+	auto count = header().slotCount;
+	// Removed slots make probes longer, they're cleared out before they're too many.
+	if( header().usedCount + 1 > count / 4 * 3 )
+		rehash();
+	while( header().liveCount + 1 > count / 4 * 3 && header().firstSegment < header().activeSegment )
+		dropSegment( header().firstSegment );
+	for( uint32_t probe = 0; probe < count; ++probe ) {
+		auto &target = slots()[( slot.hash + probe ) % count];
+		if( target.state != IndexSlot::LIVE ) {
+			if( target.state == IndexSlot::EMPTY )
+				++header().usedCount;
+			target = slot;
+			++header().liveCount;
+			return;
+		}
+	}
+}
+
+inline void DiskCache::removeSlot( detail::disk::IndexSlot &slot )
+{
+	slot.state = detail::disk::IndexSlot::REMOVED;
+	--header().liveCount;
+}
+
+inline void DiskCache::rehash()
+{
+	using namespace detail::disk;
+	auto count = header().slotCount;
+	std::vector<IndexSlot> live;
+	live.reserve( header().liveCount );
+	for( uint32_t i = 0; i < count; ++i ) {
+		if( slots()[i].state == IndexSlot::LIVE )
+			live.push_back( slots()[i] );
+	}
+	memset( slots(), 0, count * sizeof( IndexSlot ) );
+	header().liveCount = header().usedCount = 0;
+	for( auto &slot : live ) {
+		for( uint32_t probe = 0; probe < count; ++probe ) {
+			auto &target = slots()[( slot.hash + probe ) % count];
+			if( target.state == IndexSlot::EMPTY ) {
+				target = slot;
+				break;
+			}
+		}
+	}
+	header().liveCount = header().usedCount = static_cast<uint32_t>( live.size() );
+}
+
+inline void DiskCache::dropSegment( uint32_t segment )
+{
+	using namespace detail::disk;
+	auto count = header().slotCount;
+	for( uint32_t i = 0; i < count; ++i ) {
+		auto &slot = slots()[i];
+		if( slot.state == IndexSlot::LIVE && slot.segment == segment )
+			removeSlot( slot );
+	}
+	mSegments.erase( segment );
+	auto path = getSegmentPath( segment );
+	uint64_t size;
+	if( fileSize( path, &size ) ) {
+		mSize -= std::min( mSize, size );
+		removeFile( path );
+	}
+	if( segment == header().firstSegment ) {
+		// Compaction may have deleted the ones after it already.
+		auto &first = header().firstSegment;
+		do
+			++first;
+		while( first < header().activeSegment && ! fileSize( getSegmentPath( first ) ) );
+	}
+}
+
+inline void DiskCache::enforceCapacity()
+{
+	using namespace detail::disk;
+	if( mSize <= mCapacity )
+		return;
+	// Expired responses without validators can't even be revalidated, they're dead weight.
+	auto now = std::chrono::duration_cast<std::chrono::seconds>( Clock::now().time_since_epoch() ).count();
+	auto count = header().slotCount;
+	for( uint32_t i = 0; i < count; ++i ) {
+		auto &slot = slots()[i];
+		if( slot.state == IndexSlot::LIVE && slot.expires <= now && ! ( slot.flags & IndexSlot::HAS_VALIDATORS ) )
+			removeSlot( slot );
+	}
+	compactLocked();
+	while( mSize > mCapacity && header().firstSegment < header().activeSegment )
+		dropSegment( header().firstSegment );
+}
+
+inline void DiskCache::compactLocked()
+{
+	using namespace detail::disk;
+	auto count = header().slotCount;
+	std::map<uint32_t, uint64_t> liveSizes;
+	for( uint32_t i = 0; i < count; ++i ) {
+		auto &slot = slots()[i];
+		if( slot.state == IndexSlot::LIVE )
+			liveSizes[slot.segment] += slot.size;
+	}
+	auto active = header().activeSegment;
+	for( auto segment = header().firstSegment; segment < active; ++segment ) {
+		uint64_t size;
+		if( ! fileSize( getSegmentPath( segment ), &size ) || liveSizes[segment] * 2 > size )
+			continue;
+		// Its live records move to the end of the active segment, readers of the old ones
+		// keep the mapping.
+		auto mapping = mapSegment( segment, 0 );
+		for( uint32_t i = 0; mapping && i < count; ++i ) {
+			auto &slot = slots()[i];
+			if( slot.state != IndexSlot::LIVE || slot.segment != segment )
+				continue;
+			if( slot.offset + slot.size > mapping->size() ) {
+				removeSlot( slot );
+				continue;
+			}
+			uint32_t newSegment;
+			uint64_t newOffset;
+			if( ! append( std::vector<uint8_t>(), mapping->data() + slot.offset, slot.size, newSegment, newOffset ) )
+				return;
+			slot.segment = newSegment;
+			slot.offset = newOffset;
+		}
+		dropSegment( segment );
+	}
+}
+	
+}} // http // cinder
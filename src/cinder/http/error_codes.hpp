@@ -50,6 +50,21 @@ enum errc_t
   /// The response's headers were malformed.
   malformed_response_headers = 2,
 
+  /// The response's content could not be decoded.
+  malformed_response_content = 3,
+
+  /// The HTTP/2 connection was closed because of a protocol violation.
+  http2_protocol_error = 4,
+
+  /// The server reset the HTTP/2 stream carrying the request.
+  http2_stream_reset = 5,
+
+  /// The server's answer to a WebSocket upgrade didn't complete the handshake.
+  websocket_handshake_failed = 6,
+
+  /// The WebSocket connection was closed because of a protocol violation.
+  websocket_protocol_error = 7,
+
   // Server-generated status codes.
 
   /// The server-generated status code "100 Continue".
@@ -154,6 +169,9 @@ enum errc_t
   /// The server-generated status code "417 Expectation Failed".
   expectation_failed = 417,
 
+  /// The server-generated status code "431 Request Header Fields Too Large".
+  request_header_fields_too_large = 431,
+
   /// The server-generated status code "500 Internal Server Error".
   internal_server_error = 500,
 
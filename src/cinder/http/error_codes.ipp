@@ -35,6 +35,16 @@ class error_category_impl
       return "Malformed status line";
     case http::errc::malformed_response_headers:
       return "Malformed response headers";
+    case http::errc::malformed_response_content:
+      return "Malformed response content";
+    case http::errc::http2_protocol_error:
+      return "HTTP/2 protocol error";
+    case http::errc::http2_stream_reset:
+      return "HTTP/2 stream reset";
+    case http::errc::websocket_handshake_failed:
+      return "WebSocket handshake failed";
+    case http::errc::websocket_protocol_error:
+      return "WebSocket protocol error";
     case http::errc::continue_request:
       return "Continue";
     case http::errc::switching_protocols:
@@ -103,6 +113,8 @@ class error_category_impl
       return "Requested range not satisfiable";
     case http::errc::expectation_failed:
       return "Expectation failed";
+    case http::errc::request_header_fields_too_large:
+      return "Request header fields too large";
     case http::errc::internal_server_error:
       return "Internal server error";
     case http::errc::not_implemented:
@@ -0,0 +1,351 @@
+//
+//  event_source.hpp
+//  Cinder-HTTP
+//
+//
+
+#pragma once
+
+#include "http.hpp"
+#include "pipeline.hpp"
+
+#include <chrono>
+
+namespace cinder {
+namespace http {
+	
+//! An event received from a text/event-stream
+struct ServerSentEvent {
+	//! The "event" field, "message" if the server didn't name the event
+	std::string	type;
+	//! The "data" lines, joined by line feeds
+	std::string	data;
+	//! The last event id the server sent, at the time of this event
+	std::string	lastEventId;
+};
+
+using ServerSentEventHandler = std::function<void( const ServerSentEvent &event )>;
+
+namespace detail {
+	
+//! Incremental parser of the text/event-stream format. Bytes are fed as they come off the
+//! socket, lines may be split anywhere and end in CRLF, LF or CR. Each event is handed
+//! over as soon as the empty line ending it has arrived.
+struct EventStreamParser {
+	//! Parses /a size bytes at /a data, calling /a handler for each complete event
+	void parse( const char *data, size_t size, const ServerSentEventHandler &handler );
+	//! Drops the event being parsed, for a new connection. The last event id survives.
+	void reset();
+	
+	const std::string&	getLastEventId() const { return mLastEventId; }
+	//! Returns the reconnection delay the server asked for, or -1 if it didn't
+	int64_t				getRetry() const { return mRetry; }
+	
+private:
+	void process_line( const char *line, size_t size, const ServerSentEventHandler &handler );
+	void dispatch( const ServerSentEventHandler &handler );
+	
+	std::string	mLine, mData, mType, mIdBuffer, mLastEventId;
+	int64_t		mRetry{-1};
+	bool		mSkipLineFeed{false},
+				mStarted{false};
+};
+
+inline void EventStreamParser::parse( const char *data, size_t size, const ServerSentEventHandler &handler )
+{
+	auto end = data + size;
+	while( data < end ) {
+		if( mSkipLineFeed ) {
+			mSkipLineFeed = false;
+			if( *data == '\n' ) {
+				++data;
+				continue;
+			}
+		}
+		auto lineEnd = data;
+		while( lineEnd < end && *lineEnd != '\n' && *lineEnd != '\r' )
+			++lineEnd;
+		if( lineEnd == end ) {
+			mLine.append( data, end );
+			break;
+		}
+		if( mLine.empty() )
+			process_line( data, lineEnd - data, handler );
+		else {
+			mLine.append( data, lineEnd );
+			process_line( mLine.data(), mLine.size(), handler );
+			mLine.clear();
+		}
+		mSkipLineFeed = *lineEnd == '\r';
+		data = lineEnd + 1;
+	}
+}
+
+inline void EventStreamParser::reset()
+{
+	mLine.clear();
+	mData.clear();
+	mType.clear();
+	mIdBuffer = mLastEventId;
+	mSkipLineFeed = false;
+	mStarted = false;
+}
+
+inline void EventStreamParser::process_line( const char *line, size_t size, const ServerSentEventHandler &handler )
+{
+	// A byte order mark may start the stream, and only the stream.
+	if( ! mStarted ) {
+		mStarted = true;
+		if( size >= 3 && ! memcmp( line, "\xEF\xBB\xBF", 3 ) ) {
+			line += 3;
+			size -= 3;
+		}
+	}
+	if( ! size ) {
+		dispatch( handler );
+		return;
+	}
+	// Comments keep connections alive through proxies, nothing else.
+	if( line[0] == ':' )
+		return;
+	auto colon = static_cast<const char*>( memchr( line, ':', size ) );
+	std::string field( line, colon ? colon : line + size );
+	const char *value = line + size;
+	if( colon ) {
+		value = colon + 1;
+		if( value < line + size && *value == ' ' )
+			++value;
+	}
+	size_t valueSize = line + size - value;
+	
+	if( field == "data" ) {
+		mData.append( value, valueSize );
+		mData.push_back( '\n' );
+	}
+	else if( field == "event" )
+		mType.assign( value, valueSize );
+	else if( field == "id" ) {
+		if( ! memchr( value, '\0', valueSize ) )
+			mIdBuffer.assign( value, valueSize );
+	}
+	else if( field == "retry" ) {
+		if( valueSize && std::all_of( value, value + valueSize, []( char c ) { return c >= '0' && c <= '9'; } ) )
+			mRetry = std::strtoll( std::string( value, valueSize ).c_str(), nullptr, 10 );
+	}
+}
+
+inline void EventStreamParser::dispatch( const ServerSentEventHandler &handler )
+{
+	mLastEventId = mIdBuffer;
+	if( mData.empty() ) {
+		mType.clear();
+		return;
+	}
+	ServerSentEvent event;
+	event.type = mType.empty() ? "message" : std::move( mType );
+	mData.pop_back();
+	event.data = std::move( mData );
+	event.lastEventId = mLastEventId;
+	mData.clear();
+	mType.clear();
+	if( handler )
+		handler( event );
+}
+	
+} // detail
+
+using EventSourceRef = std::shared_ptr<class EventSource>;
+
+//! A client of a Server-Sent Events stream, like the browser's EventSource. Events are
+//! handed over as they arrive. When the stream ends or the connection drops, it reconnects
+//! after the delay the server advised, sending the last event id it saw so the server can
+//! pick up where it left off. A response other than a 200 with a text/event-stream, or a
+//! 204, ends it for good. Runs over a Session or, for https urls, an SslSession.
+class EventSource : public std::enable_shared_from_this<EventSource> {
+public:
+	
+	enum class State {
+		CONNECTING,
+		OPEN,
+		CLOSED
+	};
+	
+	EventSource( UrlRef url, ServerSentEventHandler eventHandler, ErrorHandler errorHandler,
+				 asio::io_service &io_service = ci::app::App::get()->io_service() )
+	: io_service( io_service ), mRetryTimer( io_service ), eventHandler( eventHandler ),
+	errorHandler( errorHandler ), mUrl( url ),
+	request( std::make_shared<Request>( RequestMethod::GET, url ) )
+	{
+		request->appendHeader( Accept( "text/event-stream" ) );
+		request->getHeaders().appendHeader( "Cache-Control", "no-cache" );
+	}
+	~EventSource() = default;
+	
+	asio::io_service&	get_io_service() { return io_service; }
+	const UrlRef&		getUrl() const { return mUrl; }
+	
+	//! Returns the request sent on every connection, headers can be added to it
+	const RequestRef&	getRequest() const { return request; }
+	
+	//! Sets /a handler, called each time a connection is established
+	void setOpenHandler( ResponseHandler handler ) { openHandler = std::move( handler ); }
+	
+	//! Returns the delay before reconnecting, 3 seconds unless set here or changed by the
+	//! server with a "retry" field
+	std::chrono::milliseconds	getRetry() const { return mRetry; }
+	void						setRetry( std::chrono::milliseconds delay ) { mRetry = delay; }
+	
+	//! Returns the id of the last event, sent as "Last-Event-ID" when reconnecting
+	const std::string&	getLastEventId() const { return mParser.getLastEventId(); }
+	State				getState() const { return mState; }
+	
+	void start()
+	{
+		mState = State::CONNECTING;
+		connect();
+	}
+	
+	//! Closes the stream for good. Until then the connection keeps the EventSource alive.
+	void close()
+	{
+		mState = State::CLOSED;
+		++mGeneration;
+		mRetryTimer.cancel();
+		cancelConnection();
+		request->setContentHandler( nullptr );
+	}
+	
+private:
+	void connect()
+	{
+		auto generation = ++mGeneration;
+		mParser.reset();
+		auto &lastEventId = mParser.getLastEventId();
+		if( ! lastEventId.empty() )
+			request->getHeaders().appendHeader( "Last-Event-ID", lastEventId );
+		else
+			request->getHeaders().removeHeader( "Last-Event-ID" );
+		
+		auto self = shared_from_this();
+		request->setContentHandler(
+		[self, generation]( const ResponseRef &response, const uint8_t *data, size_t size ) {
+			if( generation == self->mGeneration )
+				self->onContent( response, reinterpret_cast<const char*>( data ), size );
+		});
+		auto responseHandler = [self, generation]( asio::error_code ec, ResponseRef response ) {
+			if( generation == self->mGeneration )
+				self->onEnd( ec, response );
+		};
+		auto errorHandler = [self, generation]( asio::error_code ec, const UrlRef &url, ResponseRef response ) {
+			if( generation == self->mGeneration )
+				self->onError( ec, response );
+		};
+#if defined( USING_SSL )
+		if( mUrl->scheme() == protocol::https ) {
+			mSslSession = std::make_shared<SslSession>( request, responseHandler, errorHandler, io_service );
+			mSslSession->start();
+			return;
+		}
+#endif
+		mSession = std::make_shared<Session>( request, responseHandler, errorHandler, io_service );
+		mSession->start();
+	}
+	
+	void onContent( const ResponseRef &response, const char *data, size_t size )
+	{
+		if( mState == State::CONNECTING ) {
+			// Headers only, the stream is open once it's known to be one. A 204 is the
+			// server's way of saying there's nothing more to come.
+			if( response->statusCode == http::errc::no_content ) {
+				close();
+				return;
+			}
+			auto contentType = response->headerSet.findHeader( Content::Type::key() );
+			if( response->statusCode != http::errc::ok || ! contentType ||
+			    contentType->second.compare( 0, 17, "text/event-stream" ) != 0 ) {
+				fail( http::errc::malformed_response_headers, response );
+				return;
+			}
+			mState = State::OPEN;
+			if( openHandler )
+				openHandler( asio::error_code(), response );
+		}
+		mParser.parse( data, size, eventHandler );
+		if( mParser.getRetry() >= 0 )
+			mRetry = std::chrono::milliseconds( mParser.getRetry() );
+	}
+	
+	void onEnd( asio::error_code ec, ResponseRef response )
+	{
+		// Only a stream that was accepted as one can end normally.
+		if( mState == State::CONNECTING ) {
+			fail( http::errc::malformed_response_headers, response );
+			return;
+		}
+		reconnect();
+	}
+	
+	void onError( asio::error_code ec, ResponseRef response )
+	{
+		// The server answered and didn't want us, anything else is worth another try.
+		if( detail::isStatusError( ec ) ) {
+			fail( ec, response );
+			return;
+		}
+		errorHandler( ec, mUrl, response );
+		if( mState != State::CLOSED )
+			reconnect();
+	}
+	
+	void fail( asio::error_code ec, ResponseRef response )
+	{
+		close();
+		errorHandler( ec, mUrl, response );
+	}
+	
+	void reconnect()
+	{
+		++mGeneration;
+		cancelConnection();
+		mState = State::CONNECTING;
+		auto self = shared_from_this();
+		mRetryTimer.expires_from_now( mRetry );
+		mRetryTimer.async_wait( [self]( asio::error_code ec ) {
+			if( ec != asio::error::operation_aborted && self->mState == State::CONNECTING )
+				self->connect();
+		});
+	}
+	
+	void cancelConnection()
+	{
+		if( mSession )
+			mSession->cancel();
+		mSession.reset();
+#if defined( USING_SSL )
+		if( mSslSession )
+			mSslSession->cancel();
+		mSslSession.reset();
+#endif
+	}
+	
+	asio::io_service		&io_service;
+	asio::steady_timer		mRetryTimer;
+	
+	ServerSentEventHandler	eventHandler;
+	ErrorHandler			errorHandler;
+	ResponseHandler			openHandler;
+	
+	UrlRef					mUrl;
+	RequestRef				request;
+	SessionRef				mSession;
+#if defined( USING_SSL )
+	SslSessionRef			mSslSession;
+#endif
+	
+	detail::EventStreamParser	mParser;
+	std::chrono::milliseconds	mRetry{3000};
+	State					mState{State::CLOSED};
+	uint64_t				mGeneration{0};
+};
+	
+}} // http // cinder
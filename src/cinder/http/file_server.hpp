@@ -0,0 +1,430 @@
+//
+//  file_server.hpp
+//  Cinder-HTTP
+//
+//
+
+#pragma once
+
+#include "server.hpp"
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/stat.h>
+#if ! defined( _WIN32 )
+#include <unistd.h>
+#endif
+
+namespace cinder {
+namespace http {
+	
+namespace detail {
+
+#if defined( _WIN32 )
+using FileStat = struct _stat64;
+inline int openFile( const std::string &path ) { return _open( path.c_str(), _O_RDONLY | _O_BINARY ); }
+inline int statFile( int fd, FileStat &stat ) { return _fstat64( fd, &stat ); }
+inline int statFile( const std::string &path, FileStat &stat ) { return _stat64( path.c_str(), &stat ); }
+inline void closeFile( int fd ) { _close( fd ); }
+inline bool isDirectory( const FileStat &stat ) { return ( stat.st_mode & _S_IFMT ) == _S_IFDIR; }
+#else
+using FileStat = struct stat;
+inline int openFile( const std::string &path ) { return ::open( path.c_str(), O_RDONLY | O_CLOEXEC ); }
+inline int statFile( int fd, FileStat &stat ) { return ::fstat( fd, &stat ); }
+inline int statFile( const std::string &path, FileStat &stat ) { return ::stat( path.c_str(), &stat ); }
+inline void closeFile( int fd ) { ::close( fd ); }
+inline bool isDirectory( const FileStat &stat ) { return S_ISDIR( stat.st_mode ); }
+#endif
+
+//! An open file of a FileServer, with everything its responses need worked out once.
+//! A missing file is cached too, with a negative descriptor.
+struct FileEntry {
+	FileEntry() = default;
+	FileEntry( const FileEntry& ) = delete;
+	FileEntry& operator=( const FileEntry& ) = delete;
+	~FileEntry()
+	{
+		if( fd >= 0 )
+			closeFile( fd );
+	}
+	
+	int				fd{-1};
+	bool			directory{false};
+	uint64_t		size{0}, inode{0};
+	time_t			modified{0};
+	std::string		etag, lastModified;
+	//! When the file was last stat'd, guarded by the FileServer's mutex
+	std::chrono::steady_clock::time_point	checked;
+};
+
+//! Returns the media type of files named like /a path
+inline const char* getMimeType( const std::string &path )
+{
+	static const std::pair<const char*, const char*> types[] = {
+		{ "html", "text/html; charset=utf-8" }, { "htm", "text/html; charset=utf-8" },
+		{ "css", "text/css; charset=utf-8" }, { "js", "application/javascript; charset=utf-8" },
+		{ "mjs", "application/javascript; charset=utf-8" }, { "json", "application/json" },
+		{ "txt", "text/plain; charset=utf-8" }, { "xml", "application/xml" },
+		{ "csv", "text/csv; charset=utf-8" }, { "md", "text/markdown; charset=utf-8" },
+		{ "png", "image/png" }, { "jpg", "image/jpeg" }, { "jpeg", "image/jpeg" },
+		{ "gif", "image/gif" }, { "svg", "image/svg+xml" }, { "ico", "image/x-icon" },
+		{ "webp", "image/webp" }, { "wasm", "application/wasm" }, { "pdf", "application/pdf" },
+		{ "woff", "font/woff" }, { "woff2", "font/woff2" }, { "ttf", "font/ttf" },
+		{ "otf", "font/otf" }, { "mp3", "audio/mpeg" }, { "wav", "audio/wav" },
+		{ "ogg", "audio/ogg" }, { "mp4", "video/mp4" }, { "webm", "video/webm" },
+		{ "mov", "video/quicktime" }, { "zip", "application/zip" }, { "gz", "application/gzip" }
+	};
+	auto dot = path.rfind( '.' );
+	if( dot != std::string::npos && path.find( '/', dot ) == std::string::npos ) {
+		auto extension = path.substr( dot + 1 );
+		for( auto &type : types ) {
+			if( urdl::detail::headers_equal( extension, type.first ) )
+				return type.second;
+		}
+	}
+	return "application/octet-stream";
+}
+
+//! Returns whether an Accept-Encoding /a header takes gzip
+inline bool acceptsGzip( const HeaderSet::Header *header )
+{
+	if( ! header )
+		return false;
+	auto &value = header->second;
+	bool accepted = false;
+	size_t begin = 0;
+	while( begin < value.size() ) {
+		auto end = std::min( value.find( ',', begin ), value.size() );
+		auto coding = value.substr( begin, end - begin );
+		auto semicolon = coding.find( ';' );
+		auto first = coding.find_first_not_of( " \t" );
+		auto last = coding.find_last_not_of( " \t", semicolon == std::string::npos ? std::string::npos : semicolon - 1 );
+		if( first != std::string::npos && last != std::string::npos && last >= first ) {
+			auto name = coding.substr( first, last - first + 1 );
+			bool gzip = urdl::detail::headers_equal( name, "gzip" );
+			if( gzip || name == "*" ) {
+				// A q of zero turns a coding down, and gzip by name trumps the wildcard.
+				auto q = coding.find( "q=", semicolon == std::string::npos ? coding.size() : semicolon );
+				bool refused = q != std::string::npos && std::strtod( coding.c_str() + q + 2, nullptr ) <= 0.0;
+				if( gzip )
+					return ! refused;
+				accepted = ! refused;
+			}
+		}
+		begin = end + 1;
+	}
+	return accepted;
+}
+
+//! Returns whether the If-None-Match /a value lists /a etag, compared weakly
+inline bool matchesEtag( const std::string &value, const std::string &etag )
+{
+	size_t begin = 0;
+	while( begin < value.size() ) {
+		auto end = std::min( value.find( ',', begin ), value.size() );
+		auto first = value.find_first_not_of( " \t", begin );
+		auto last = value.find_last_not_of( " \t", end - 1 );
+		if( first < end && last != std::string::npos && last >= first ) {
+			if( ! value.compare( first, 2, "W/" ) )
+				first += 2;
+			if( ( last - first + 1 == 1 && value[first] == '*' ) || ! value.compare( first, last - first + 1, etag ) )
+				return true;
+		}
+		begin = end + 1;
+	}
+	return false;
+}
+
+enum class RangeResult {
+	NONE,
+	SATISFIABLE,
+	UNSATISFIABLE
+};
+
+//! Parses the Range /a value against a file of /a size into the inclusive /a first and
+//! /a last bytes. Only single ranges are served, anything else gets the whole file.
+inline RangeResult parseRange( const std::string &value, uint64_t size, uint64_t &first, uint64_t &last )
+{
+	if( value.compare( 0, 6, "bytes=" ) || value.find( ',' ) != std::string::npos )
+		return RangeResult::NONE;
+	auto dash = value.find( '-', 6 );
+	if( dash == std::string::npos )
+		return RangeResult::NONE;
+	auto start = value.substr( 6, dash - 6 ), end = value.substr( dash + 1 );
+	auto isNumber = []( const std::string &number ) {
+		return ! number.empty() && number.size() < 20 && std::all_of( number.begin(), number.end(), urdl::detail::is_digit );
+	};
+	if( start.empty() ) {
+		// The last n bytes.
+		if( ! isNumber( end ) )
+			return RangeResult::NONE;
+		auto suffix = std::stoull( end );
+		if( ! suffix || ! size )
+			return RangeResult::UNSATISFIABLE;
+		first = size - std::min<uint64_t>( suffix, size );
+		last = size - 1;
+		return RangeResult::SATISFIABLE;
+	}
+	if( ! isNumber( start ) || ( ! end.empty() && ! isNumber( end ) ) )
+		return RangeResult::NONE;
+	first = std::stoull( start );
+	last = end.empty() ? size - 1 : std::min<uint64_t>( std::stoull( end ), size - 1 );
+	if( ! end.empty() && std::stoull( end ) < first )
+		return RangeResult::NONE;
+	return first < size ? RangeResult::SATISFIABLE : RangeResult::UNSATISFIABLE;
+}
+	
+} // detail
+
+using FileServerRef = std::shared_ptr<class FileServer>;
+
+//! Serves the files under a directory, the way a static file server in front of an app
+//! would. Content goes out with sendfile(2) where the platform has it. Responses carry an
+//! ETag and Last-Modified and answer conditional requests with "304 Not Modified", single
+//! byte ranges are served, and a precompressed "name.gz" next to a file is sent in its place
+//! to clients taking gzip. Open files are cached, and only stat'd again once the
+//! revalidation interval has passed, so a busy file costs no system calls beyond sending it.
+//! Must be held by a shared_ptr, the routes it mounts keep it alive.
+class FileServer : public std::enable_shared_from_this<FileServer> {
+public:
+	//! Constructs a FileServer of the files under /a root
+	explicit FileServer( std::string root )
+	: mRoot( std::move( root ) )
+	{
+		while( mRoot.size() > 1 && ( mRoot.back() == '/' || mRoot.back() == '\\' ) )
+			mRoot.pop_back();
+	}
+	
+	//! Routes GET and HEAD requests for paths under /a prefix on /a router to the files,
+	//! "/static" serves "/static/css/site.css" from "root/css/site.css".
+	void mount( Router &router, std::string prefix = "/" )
+	{
+		if( prefix.empty() || prefix.back() != '/' )
+			prefix += '/';
+		auto self = shared_from_this();
+		router.add( RequestMethod::GET, prefix + "*path",
+		[self]( const RequestRef &request, const ResponseRef &response, const RouteParams &params ) {
+			self->serve( request, response, params.empty() ? std::string() : params.front().second );
+		});
+	}
+	
+	//! Fills in /a response with the file at /a path, relative to the root, for /a request.
+	//! For handlers that decide for themselves which file to send.
+	void serve( const RequestRef &request, const ResponseRef &response, const std::string &path );
+	
+	const std::string&	getRoot() const { return mRoot; }
+	
+	//! Sets the file served for a directory, "index.html" by default
+	void setIndexFile( std::string name ) { mIndexFile = std::move( name ); }
+	//! Sets the "max-age" of the Cache-Control sent with files, none by default
+	void setMaxAge( std::chrono::seconds maxAge ) { mMaxAge = maxAge; }
+	//! Sets how many files are kept open, 1024 by default
+	void setCacheCapacity( size_t capacity ) { mCapacity = std::max<size_t>( capacity, 1 ); }
+	//! Sets how long a cached file is trusted before it's stat'd again, a second by default
+	void setRevalidateInterval( std::chrono::milliseconds interval ) { mRevalidateInterval = interval; }
+	
+private:
+	using FileEntryRef = std::shared_ptr<detail::FileEntry>;
+	
+	//! Returns the entry for /a path, from the cache while it's fresh
+	FileEntryRef	find( const std::string &path );
+	FileEntryRef	open( const std::string &path ) const;
+	//! Returns /a path made safe to append to the root, false if it would escape it
+	static bool		normalize( const std::string &path, std::string &normalized );
+	
+	struct CacheEntry {
+		FileEntryRef						file;
+		std::list<std::string>::iterator	position;
+	};
+	
+	std::string					mRoot, mIndexFile{"index.html"};
+	std::chrono::seconds		mMaxAge{0};
+	std::chrono::milliseconds	mRevalidateInterval{1000};
+	size_t						mCapacity{1024};
+	
+	std::mutex									mMutex;
+	std::unordered_map<std::string, CacheEntry>	mCache;
+	//! Cached paths, most recently used first
+	std::list<std::string>						mRecent;
+};
+
+inline void FileServer::serve( const RequestRef &request, const ResponseRef &response, const std::string &path )
+{
+	std::string relative;
+	if( ! normalize( path, relative ) ) {
+		response->setStatusCode( http::errc::bad_request );
+		return;
+	}
+	auto file = find( relative );
+	if( file && file->directory ) {
+		// Relative links in the index resolve against the directory only with the slash.
+		if( ! path.empty() && path.back() != '/' ) {
+			response->setStatusCode( http::errc::moved_permanently );
+			auto &url = request->getUrl();
+			response->getHeaders().appendHeader( "Location", ( url ? url->to_string( Url::path_component ) : "/" + relative ) + "/" );
+			return;
+		}
+		relative += ( relative.empty() ? "" : "/" ) + mIndexFile;
+		file = find( relative );
+	}
+	if( ! file || file->directory ) {
+		response->setStatusCode( http::errc::not_found );
+		return;
+	}
+	
+	auto &requestHeaders = request->getHeaders().getHeaders();
+	auto &headers = response->getHeaders();
+	bool gzip = false;
+	if( detail::acceptsGzip( detail::findRequestHeader( requestHeaders, "Accept-Encoding" ) ) ) {
+		auto variant = find( relative + ".gz" );
+		if( variant && ! variant->directory ) {
+			file = std::move( variant );
+			gzip = true;
+		}
+	}
+	auto etag = gzip ? file->etag.substr( 0, file->etag.size() - 1 ) + "-gz\"" : file->etag;
+	headers.appendHeader( "ETag", etag );
+	headers.appendHeader( "Last-Modified", file->lastModified );
+	headers.appendHeader( "Accept-Ranges", "bytes" );
+	if( mMaxAge.count() > 0 )
+		headers.appendHeader( "Cache-Control", "public, max-age=" + std::to_string( mMaxAge.count() ) );
+	// Whether or not this one is compressed, another client may get the other variant.
+	if( gzip || find( relative + ".gz" ) )
+		headers.appendHeader( "Vary", "Accept-Encoding" );
+	
+	// If-None-Match decides on its own when there is one, the date is only a fallback.
+	auto ifNoneMatch = detail::findRequestHeader( requestHeaders, "If-None-Match" );
+	auto ifModifiedSince = detail::findRequestHeader( requestHeaders, "If-Modified-Since" );
+	time_t since = 0;
+	if( ifNoneMatch ? detail::matchesEtag( ifNoneMatch->second, etag ) :
+		ifModifiedSince && detail::parseHttpDate( ifModifiedSince->second, since ) && file->modified <= since ) {
+		response->setStatusCode( http::errc::not_modified );
+		return;
+	}
+	
+	headers.appendHeader( Content::Type::key(), detail::getMimeType( relative ) );
+	if( gzip )
+		headers.appendHeader( "Content-Encoding", "gzip" );
+	
+	auto content = std::make_shared<FileContent>();
+	content->fd = file->fd;
+	content->size = file->size;
+	content->handle = file;
+	
+	// A Range only applies to the representation If-Range names, if it names one.
+	auto range = detail::findRequestHeader( requestHeaders, "Range" );
+	auto ifRange = detail::findRequestHeader( requestHeaders, "If-Range" );
+	if( range && ( ! ifRange || ifRange->second == etag || ifRange->second == file->lastModified ) ) {
+		uint64_t first = 0, last = 0;
+		switch( detail::parseRange( range->second, file->size, first, last ) ) {
+			case detail::RangeResult::SATISFIABLE:
+				response->setStatusCode( http::errc::partial_content );
+				headers.appendHeader( "Content-Range", "bytes " + std::to_string( first ) + "-" + std::to_string( last ) +
+									  "/" + std::to_string( file->size ) );
+				content->offset = first;
+				content->size = last - first + 1;
+			break;
+			case detail::RangeResult::UNSATISFIABLE:
+				response->setStatusCode( http::errc::requested_range_not_satisfiable );
+				headers.removeHeader( Content::Type::key() );
+				headers.appendHeader( "Content-Range", "bytes */" + std::to_string( file->size ) );
+				return;
+			case detail::RangeResult::NONE:
+			break;
+		}
+	}
+	response->setFileContent( std::move( content ) );
+}
+
+inline FileServer::FileEntryRef FileServer::find( const std::string &path )
+{
+	auto now = std::chrono::steady_clock::now();
+	FileEntryRef stale;
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		auto found = mCache.find( path );
+		if( found != mCache.end() ) {
+			mRecent.splice( mRecent.begin(), mRecent, found->second.position );
+			if( now - found->second.file->checked < mRevalidateInterval )
+				return found->second.file->fd >= 0 || found->second.file->directory ? found->second.file : nullptr;
+			stale = found->second.file;
+		}
+	}
+	
+	// Outside the lock, a slow disk only holds up the requests for this file.
+	detail::FileStat stat;
+	bool unchanged = stale && stale->fd >= 0 && ! detail::statFile( mRoot + "/" + path, stat ) &&
+					 static_cast<uint64_t>( stat.st_size ) == stale->size && stat.st_mtime == stale->modified &&
+					 static_cast<uint64_t>( stat.st_ino ) == stale->inode;
+	// The descriptor still reads the same file, it's good for another interval.
+	auto file = unchanged ? stale : open( path );
+	
+	std::lock_guard<std::mutex> lock( mMutex );
+	auto found = mCache.find( path );
+	file->checked = now;
+	if( found != mCache.end() )
+		found->second.file = file;
+	else {
+		mRecent.push_front( path );
+		mCache[path] = { file, mRecent.begin() };
+		if( mCache.size() > mCapacity ) {
+			mCache.erase( mRecent.back() );
+			mRecent.pop_back();
+		}
+	}
+	return file->fd >= 0 || file->directory ? file : nullptr;
+}
+
+inline FileServer::FileEntryRef FileServer::open( const std::string &path ) const
+{
+	auto file = std::make_shared<detail::FileEntry>();
+	auto fullPath = path.empty() ? mRoot : mRoot + "/" + path;
+	detail::FileStat stat;
+	if( ! detail::statFile( fullPath, stat ) && detail::isDirectory( stat ) ) {
+		file->directory = true;
+		return file;
+	}
+	file->fd = detail::openFile( fullPath );
+	if( file->fd < 0 )
+		return file;
+	if( detail::statFile( file->fd, stat ) || detail::isDirectory( stat ) ) {
+		detail::closeFile( file->fd );
+		file->fd = -1;
+		return file;
+	}
+	file->size = static_cast<uint64_t>( stat.st_size );
+	file->inode = static_cast<uint64_t>( stat.st_ino );
+	file->modified = stat.st_mtime;
+	char etag[48];
+	snprintf( etag, sizeof( etag ), "\"%llx-%llx\"", static_cast<unsigned long long>( file->modified ),
+			  static_cast<unsigned long long>( file->size ) );
+	file->etag = etag;
+	file->lastModified = detail::formatHttpDate( file->modified );
+	return file;
+}
+
+inline bool FileServer::normalize( const std::string &path, std::string &normalized )
+{
+	normalized.clear();
+	if( path.find_first_of( std::string( "\\\0", 2 ) ) != std::string::npos )
+		return false;
+	size_t begin = 0;
+	while( begin <= path.size() ) {
+		auto end = std::min( path.find( '/', begin ), path.size() );
+		auto segment = path.substr( begin, end - begin );
+		begin = end + 1;
+		if( segment.empty() || segment == "." )
+			continue;
+		// Nothing above the root, and no drive letters or streams on Windows.
+		if( segment == ".." || segment.find( ':' ) != std::string::npos )
+			return false;
+		if( ! normalized.empty() )
+			normalized += '/';
+		normalized += segment;
+	}
+	return true;
+}
+	
+}} // http // cinder
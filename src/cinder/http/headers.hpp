@@ -10,6 +10,8 @@
 
 #include <string>
 #include <vector>
+#include <ctime>
+#include <cstdio>
 
 #include "cinder/Base64.h"
 #include "cinder/Log.h"
@@ -41,7 +43,8 @@ private:
 struct Connection {
 	enum class Type {
 		CLOSE,
-		KEEP_ALIVE
+		KEEP_ALIVE,
+		UPGRADE
 	};
 	
 	Connection( Type type ) : type( type ) {}
@@ -52,6 +55,7 @@ struct Connection {
 		switch( type ) {
 			case Type::CLOSE: return "close";
 			case Type::KEEP_ALIVE : return "keep-alive";
+			case Type::UPGRADE: return "Upgrade";
 			default: return "close";
 		}
 	}
@@ -60,6 +64,28 @@ struct Connection {
 private:
 	Type type;
 };
+
+//! Asks the server to switch the connection to /a protocol, sent with "Connection: Upgrade"
+struct Upgrade {
+	Upgrade( std::string protocol ) : protocol( std::move( protocol ) ) {}
+	
+	std::string value() const { return protocol; }
+	static const char* key() { return "Upgrade"; }
+	
+private:
+	std::string protocol;
+};
+
+struct Expect {
+	Expect( std::string expectation ) : expectation( std::move( expectation ) ) {}
+	Expect() : expectation( "100-continue" ) {}
+	
+	std::string value() const { return expectation; }
+	static const char* key() { return "Expect"; }
+	
+private:
+	std::string expectation;
+};
 	
 struct Content {
 	Content( std::string content_type, std::string content )
@@ -124,6 +150,26 @@ private:
 	Type type;
 };
 	
+struct ContentEncoding {
+	ContentEncoding( TransferEncoding::Type type ) : type( type ) {}
+	
+	static const char* key() { return "Content-Encoding"; }
+	std::string value() const { return TransferEncoding( type ).value(); }
+private:
+	TransferEncoding::Type type;
+};
+	
+struct AcceptEncoding {
+	AcceptEncoding( std::string encodings ) : encodings( std::move( encodings ) ) {}
+	AcceptEncoding() : encodings( "gzip, deflate" ) {}
+	
+	std::string value() const { return encodings; }
+	static const char* key() { return "Accept-Encoding"; }
+	
+private:
+	std::string encodings;
+};
+	
 struct HeaderSet {
 	using Header = std::pair<std::string, std::string>;
 	using Headers = std::vector<Header>;
@@ -139,6 +185,8 @@ struct HeaderSet {
 	
 	template<typename T>
 	void appendHeader( T header );
+	//! Removes /a header from the set of headers if it exists
+	void removeHeader( const char *header );
 	
 	const Header* findHeader( const std::string &headerKey ) const;
 	const Header* findHeader( const char *headerKey ) const;
@@ -201,6 +249,17 @@ inline void HeaderSet::appendHeader( const std::string &header, const std::strin
 		headers.emplace_back( header, headerValue );
 }
 	
+inline void HeaderSet::removeHeader( const char *header )
+{
+	auto endIt = end( headers );
+	auto foundIt = std::lower_bound( begin( headers ), endIt, header,
+	[]( const Header &a, const char *key ){
+		return strcmp( a.first.c_str(), key ) < 0;
+	});
+	if( foundIt != endIt && ! strcmp( foundIt->first.c_str(), header ) )
+		headers.erase( foundIt );
+}
+
 inline const HeaderSet::Header* HeaderSet::findHeader( const char *header ) const
 {
 	auto endIt = end( headers );
@@ -227,6 +286,58 @@ inline void HeaderSet::appendHeader( Content header )
 	content = header.content();
 }
 	
+namespace detail {
+	
+//! Formats /a time as an HTTP-date, "Sun, 06 Nov 1994 08:49:37 GMT"
+inline std::string formatHttpDate( time_t time )
+{
+	static const char *days[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+	static const char *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+	std::tm tm;
+#if defined( _WIN32 )
+	gmtime_s( &tm, &time );
+#else
+	gmtime_r( &time, &tm );
+#endif
+	char date[32];
+	snprintf( date, sizeof( date ), "%s, %02d %s %04d %02d:%02d:%02d GMT", days[tm.tm_wday], tm.tm_mday,
+			  months[tm.tm_mon], tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec );
+	return date;
+}
+
+//! Parses the HTTP-date /a value into /a time, in the preferred format or either of the
+//! obsolete ones, "Sunday, 06-Nov-94 08:49:37 GMT" and "Sun Nov  6 08:49:37 1994".
+inline bool parseHttpDate( const std::string &value, time_t &time )
+{
+	static const std::string months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	char month[4] = {};
+	std::tm tm = {};
+	auto date = value.c_str();
+	if( sscanf( date, "%*3s, %2d %3s %4d %2d:%2d:%2d GMT", &tm.tm_mday, month, &tm.tm_year,
+				&tm.tm_hour, &tm.tm_min, &tm.tm_sec ) != 6 &&
+		sscanf( date, "%*[a-zA-Z], %2d-%3s-%2d %2d:%2d:%2d GMT", &tm.tm_mday, month, &tm.tm_year,
+				&tm.tm_hour, &tm.tm_min, &tm.tm_sec ) != 6 &&
+		sscanf( date, "%*3s %3s %2d %2d:%2d:%2d %4d", month, &tm.tm_mday, &tm.tm_hour, &tm.tm_min,
+				&tm.tm_sec, &tm.tm_year ) != 6 )
+		return false;
+	auto found = months.find( month );
+	if( found == std::string::npos || found % 3 )
+		return false;
+	tm.tm_mon = static_cast<int>( found / 3 );
+	// Two digit years more than 50 years ahead are in the past.
+	if( tm.tm_year < 100 )
+		tm.tm_year += tm.tm_year < 70 ? 2000 : 1900;
+	tm.tm_year -= 1900;
+#if defined( _WIN32 )
+	time = _mkgmtime( &tm );
+#else
+	time = timegm( &tm );
+#endif
+	return time != -1;
+}
+	
+} // detail
+
 inline std::ostream& operator<<( std::ostream &stream, const HeaderSet &headers )
 {
 	for( auto & header : headers.headers ) {
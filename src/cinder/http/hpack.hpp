@@ -0,0 +1,698 @@
+//
+//  hpack.hpp
+//  Cinder-HTTP
+//
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include <cctype>
+#include <algorithm>
+#include <unordered_map>
+
+#include "headers.hpp"
+
+namespace cinder {
+namespace http {
+	
+namespace detail {
+	
+//! An entry in the HPACK static table, RFC 7541 Appendix A
+struct HpackStaticEntry {
+	const char *name, *value;
+};
+
+//! Returns the 61 entries of the HPACK static table, index 1 is at position 0
+inline const HpackStaticEntry* hpackStaticTable()
+{
+	static const HpackStaticEntry table[] = {
+		{ ":authority", "" }, { ":method", "GET" }, { ":method", "POST" }, { ":path", "/" },
+		{ ":path", "/index.html" }, { ":scheme", "http" }, { ":scheme", "https" },
+		{ ":status", "200" }, { ":status", "204" }, { ":status", "206" }, { ":status", "304" },
+		{ ":status", "400" }, { ":status", "404" }, { ":status", "500" },
+		{ "accept-charset", "" }, { "accept-encoding", "gzip, deflate" }, { "accept-language", "" },
+		{ "accept-ranges", "" }, { "accept", "" }, { "access-control-allow-origin", "" },
+		{ "age", "" }, { "allow", "" }, { "authorization", "" }, { "cache-control", "" },
+		{ "content-disposition", "" }, { "content-encoding", "" }, { "content-language", "" },
+		{ "content-length", "" }, { "content-location", "" }, { "content-range", "" },
+		{ "content-type", "" }, { "cookie", "" }, { "date", "" }, { "etag", "" }, { "expect", "" },
+		{ "expires", "" }, { "from", "" }, { "host", "" }, { "if-match", "" },
+		{ "if-modified-since", "" }, { "if-none-match", "" }, { "if-range", "" },
+		{ "if-unmodified-since", "" }, { "last-modified", "" }, { "link", "" }, { "location", "" },
+		{ "max-forwards", "" }, { "proxy-authenticate", "" }, { "proxy-authorization", "" },
+		{ "range", "" }, { "referer", "" }, { "refresh", "" }, { "retry-after", "" },
+		{ "server", "" }, { "set-cookie", "" }, { "strict-transport-security", "" },
+		{ "transfer-encoding", "" }, { "user-agent", "" }, { "vary", "" }, { "via", "" },
+		{ "www-authenticate", "" }
+	};
+	return table;
+}
+
+const size_t hpackStaticTableSize = 61;
+
+//! Hash lookups into the static table, keyed by name and by name and value
+struct HpackStaticIndex {
+	std::unordered_map<std::string, uint32_t>	names, fields;
+};
+
+//! Returns the static table index, built on first use. Names map to their lowest index.
+inline const HpackStaticIndex& hpackStaticIndex()
+{
+	static const HpackStaticIndex index = [] {
+		HpackStaticIndex index;
+		auto table = hpackStaticTable();
+		for( uint32_t i = hpackStaticTableSize; i > 0; --i ) {
+			auto &entry = table[i - 1];
+			index.names[entry.name] = i;
+			index.fields[std::string( entry.name ) + '\0' + entry.value] = i;
+		}
+		return index;
+	}();
+	return index;
+}
+
+//! A Huffman code from RFC 7541 Appendix B, right aligned in /a code
+struct HuffmanCode {
+	uint32_t	code;
+	uint8_t		length;
+};
+
+//! Returns the 257 HPACK Huffman codes, indexed by symbol with EOS last
+inline const HuffmanCode* huffmanCodes()
+{
+	static const HuffmanCode codes[] = {
+		{ 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 },
+		{ 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 },
+		{ 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 },
+		{ 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 },
+		{ 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 },
+		{ 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+		{ 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 },
+		{ 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 },
+		{ 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 },
+		{ 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 },
+		{ 0x3fa, 10 }, { 0x3fb, 10 }, { 0xf9, 8 }, { 0x7fb, 11 },
+		{ 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+		{ 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 },
+		{ 0x1a, 6 }, { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 },
+		{ 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 },
+		{ 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+		{ 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 },
+		{ 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+		{ 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 },
+		{ 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 },
+		{ 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 },
+		{ 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 },
+		{ 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 },
+		{ 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+		{ 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 },
+		{ 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 }, { 0x26, 6 },
+		{ 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 },
+		{ 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 },
+		{ 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 },
+		{ 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+		{ 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 },
+		{ 0x7fc, 11 }, { 0x3ffd, 14 }, { 0x1ffd, 13 }, { 0xffffffc, 28 },
+		{ 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 },
+		{ 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 },
+		{ 0x3fffd6, 22 }, { 0x7fffda, 23 }, { 0x7fffdb, 23 }, { 0x7fffdc, 23 },
+		{ 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+		{ 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 },
+		{ 0xffffee, 24 }, { 0x7fffe1, 23 }, { 0x7fffe2, 23 }, { 0x7fffe3, 23 },
+		{ 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 },
+		{ 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 },
+		{ 0x3fffda, 22 }, { 0x1fffdd, 21 }, { 0xfffe9, 20 }, { 0x3fffdb, 22 },
+		{ 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+		{ 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 },
+		{ 0x1fffdf, 21 }, { 0x3fffdf, 22 }, { 0x7fffeb, 23 }, { 0x7fffec, 23 },
+		{ 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 },
+		{ 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 },
+		{ 0xfffea, 20 }, { 0x3fffe2, 22 }, { 0x3fffe3, 22 }, { 0x3fffe4, 22 },
+		{ 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+		{ 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 },
+		{ 0x3fffe7, 22 }, { 0x7ffff2, 23 }, { 0x3fffe8, 22 }, { 0x1ffffec, 25 },
+		{ 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 },
+		{ 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 },
+		{ 0x7fff2, 19 }, { 0x1fffe3, 21 }, { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 },
+		{ 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+		{ 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 },
+		{ 0xffffffd, 28 }, { 0x7ffffe3, 27 }, { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 },
+		{ 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 },
+		{ 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 },
+		{ 0x3fffea, 22 }, { 0x3fffeb, 22 }, { 0x1ffffee, 25 }, { 0x1ffffef, 25 },
+		{ 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+		{ 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 },
+		{ 0x7ffffe7, 27 }, { 0x7ffffe8, 27 }, { 0x7ffffe9, 27 }, { 0x7ffffea, 27 },
+		{ 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 },
+		{ 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 },
+		{ 0x3fffffff, 30 }
+	};
+	return codes;
+}
+
+//! One transition of the Huffman decoder, which consumes input a nibble at a time
+struct HuffmanTransition {
+	enum Flags : uint8_t {
+		EMIT = 1,
+		ACCEPT = 2,
+		FAIL = 4
+	};
+	uint8_t		state;
+	uint8_t		flags;
+	uint8_t		symbol;
+};
+
+//! Returns the nibble driven decoding table, built from the code table on first use. Every
+//! state is an interior node of the code tree and has 16 transitions. As no code is shorter
+//! than 5 bits, a nibble emits at most one symbol.
+inline const std::vector<HuffmanTransition>& huffmanDecodeTable()
+{
+	static const std::vector<HuffmanTransition> table = [] {
+		struct Node {
+			int16_t	children[2]{ -1, -1 };
+			int16_t	symbol{-1};
+			int16_t	state{-1};
+			bool	accepting{false};
+		};
+		std::vector<Node> nodes( 1 );
+		nodes[0].accepting = true;
+		auto codes = huffmanCodes();
+		for( int16_t symbol = 0; symbol < 257; ++symbol ) {
+			size_t node = 0;
+			for( int bit = codes[symbol].length - 1; bit >= 0; --bit ) {
+				auto branch = ( codes[symbol].code >> bit ) & 1;
+				if( nodes[node].children[branch] < 0 ) {
+					nodes[node].children[branch] = static_cast<int16_t>( nodes.size() );
+					nodes.emplace_back();
+					// Padding is up to 7 most significant bits of EOS, which is all ones.
+					auto depth = codes[symbol].length - bit;
+					nodes.back().accepting = nodes[node].accepting && branch == 1 && depth <= 7;
+				}
+				node = nodes[node].children[branch];
+			}
+			nodes[node].symbol = symbol;
+		}
+		
+		int16_t states = 0;
+		for( auto &node : nodes )
+			if( node.symbol < 0 )
+				node.state = states++;
+		
+		std::vector<HuffmanTransition> transitions( states * 16 );
+		for( auto &node : nodes ) {
+			if( node.symbol >= 0 )
+				continue;
+			for( uint8_t nibble = 0; nibble < 16; ++nibble ) {
+				HuffmanTransition transition{ 0, 0, 0 };
+				size_t current = &node - nodes.data();
+				for( int bit = 3; bit >= 0; --bit ) {
+					current = nodes[current].children[( nibble >> bit ) & 1];
+					auto symbol = nodes[current].symbol;
+					if( symbol == 256 ) {
+						transition.flags = HuffmanTransition::FAIL;
+						break;
+					}
+					if( symbol >= 0 ) {
+						transition.flags |= HuffmanTransition::EMIT;
+						transition.symbol = static_cast<uint8_t>( symbol );
+						current = 0;
+					}
+				}
+				if( ! ( transition.flags & HuffmanTransition::FAIL ) ) {
+					transition.state = static_cast<uint8_t>( nodes[current].state );
+					if( nodes[current].accepting )
+						transition.flags |= HuffmanTransition::ACCEPT;
+				}
+				transitions[node.state * 16 + nibble] = transition;
+			}
+		}
+		return transitions;
+	}();
+	return table;
+}
+
+//! Huffman decodes /a size bytes at /a data, appending to /a out. Returns false if the
+//! input contains EOS or isn't padded correctly.
+inline bool huffmanDecode( const uint8_t *data, size_t size, std::string &out )
+{
+	auto &table = huffmanDecodeTable();
+	uint8_t state = 0;
+	bool accepting = true;
+	for( auto end = data + size; data != end; ++data ) {
+		for( auto nibble : { uint8_t( *data >> 4 ), uint8_t( *data & 0x0f ) } ) {
+			auto &transition = table[state * 16 + nibble];
+			if( transition.flags & HuffmanTransition::FAIL )
+				return false;
+			if( transition.flags & HuffmanTransition::EMIT )
+				out.push_back( static_cast<char>( transition.symbol ) );
+			state = transition.state;
+			accepting = ( transition.flags & HuffmanTransition::ACCEPT ) != 0;
+		}
+	}
+	return accepting;
+}
+
+//! Decodes an HPACK integer with an /a prefix bit prefix, RFC 7541 section 5.1
+inline bool hpackDecodeInteger( const uint8_t *&pos, const uint8_t *end, uint8_t prefix, uint32_t &value )
+{
+	if( pos == end )
+		return false;
+	uint32_t mask = ( 1u << prefix ) - 1;
+	value = *pos++ & mask;
+	if( value < mask )
+		return true;
+	for( uint32_t shift = 0; pos != end; shift += 7 ) {
+		// Shifted past 28 bits, or summed past 32, the integer overflows.
+		if( shift > 28 )
+			return false;
+		auto byte = *pos++;
+		auto sum = uint64_t( value ) + ( uint64_t( byte & 0x7f ) << shift );
+		if( sum > UINT32_MAX )
+			return false;
+		value = static_cast<uint32_t>( sum );
+		if( ! ( byte & 0x80 ) )
+			return true;
+	}
+	return false;
+}
+
+//! Encodes /a value as an HPACK integer with an /a prefix bit prefix, the bits above the
+//! prefix in the first byte are taken from /a flags
+inline void hpackEncodeInteger( uint32_t value, uint8_t prefix, uint8_t flags, std::vector<uint8_t> &out )
+{
+	uint32_t mask = ( 1u << prefix ) - 1;
+	if( value < mask ) {
+		out.push_back( static_cast<uint8_t>( flags | value ) );
+		return;
+	}
+	out.push_back( static_cast<uint8_t>( flags | mask ) );
+	value -= mask;
+	while( value >= 0x80 ) {
+		out.push_back( static_cast<uint8_t>( ( value & 0x7f ) | 0x80 ) );
+		value >>= 7;
+	}
+	out.push_back( static_cast<uint8_t>( value ) );
+}
+
+//! Decodes an HPACK string literal, RFC 7541 section 5.2
+inline bool hpackDecodeString( const uint8_t *&pos, const uint8_t *end, std::string &out )
+{
+	if( pos == end )
+		return false;
+	bool huffman = ( *pos & 0x80 ) != 0;
+	uint32_t length;
+	if( ! hpackDecodeInteger( pos, end, 7, length ) || static_cast<size_t>( end - pos ) < length )
+		return false;
+	out.clear();
+	if( huffman ) {
+		if( ! huffmanDecode( pos, length, out ) )
+			return false;
+	}
+	else
+		out.assign( reinterpret_cast<const char*>( pos ), length );
+	pos += length;
+	return true;
+}
+
+//! Returns the number of bytes /a str takes once Huffman coded
+inline size_t huffmanEncodedSize( const std::string &str )
+{
+	auto codes = huffmanCodes();
+	size_t bits = 0;
+	for( auto c : str )
+		bits += codes[static_cast<uint8_t>( c )].length;
+	return ( bits + 7 ) / 8;
+}
+
+//! Huffman codes /a str, appending to /a out. The last byte is padded with the most
+//! significant bits of EOS.
+inline void huffmanEncode( const std::string &str, std::vector<uint8_t> &out )
+{
+	auto codes = huffmanCodes();
+	// Only the low /a pending bits of the accumulator are meaningful, anything above them
+	// has already been written out.
+	uint64_t bits = 0;
+	uint32_t pending = 0;
+	for( auto c : str ) {
+		auto &code = codes[static_cast<uint8_t>( c )];
+		bits = ( bits << code.length ) | code.code;
+		pending += code.length;
+		while( pending >= 8 ) {
+			pending -= 8;
+			out.push_back( static_cast<uint8_t>( bits >> pending ) );
+		}
+	}
+	if( pending )
+		out.push_back( static_cast<uint8_t>( ( bits << ( 8 - pending ) ) | ( 0xff >> pending ) ) );
+}
+
+//! Encodes /a str as an HPACK string literal, Huffman coded when that is shorter
+inline void hpackEncodeString( const std::string &str, std::vector<uint8_t> &out )
+{
+	auto huffmanSize = huffmanEncodedSize( str );
+	if( huffmanSize < str.size() ) {
+		hpackEncodeInteger( static_cast<uint32_t>( huffmanSize ), 7, 0x80, out );
+		huffmanEncode( str, out );
+		return;
+	}
+	hpackEncodeInteger( static_cast<uint32_t>( str.size() ), 7, 0, out );
+	out.insert( out.end(), str.begin(), str.end() );
+}
+
+//! Returns the size an entry takes up in a dynamic table, RFC 7541 section 4.1
+inline size_t hpackEntrySize( const std::string &name, const std::string &value )
+{
+	return name.size() + value.size() + 32;
+}
+	
+} // detail
+
+//! Byte counts of a coder, for judging how much the headers of a connection repeat
+struct HpackStats {
+	//! Returns the share of header bytes HPACK saved, 0 to 1
+	double getSavings() const { return plainBytes ? 1.0 - double( encodedBytes ) / double( plainBytes ) : 0.0; }
+	
+	//! Number of header fields coded
+	size_t	fields{0};
+	//! Number of fields that were a single index into the static or dynamic table
+	size_t	indexedFields{0};
+	//! Size of the fields written out as HTTP/1.1 "name: value\r\n" lines
+	size_t	plainBytes{0};
+	//! Size of the header blocks
+	size_t	encodedBytes{0};
+};
+
+//! Decodes HPACK header blocks, RFC 7541. A decoder keeps the dynamic table of one
+//! direction of a connection, so every header block has to go through it in order.
+class HpackDecoder {
+public:
+	//! Constructs a decoder whose dynamic table may grow to /a maxTableSize, the
+	//! SETTINGS_HEADER_TABLE_SIZE advertised to the peer
+	HpackDecoder( size_t maxTableSize = 4096 )
+	: mMaxTableSize( maxTableSize ), mTableSizeLimit( maxTableSize ) {}
+	
+	//! Decodes the complete header block at /a data, appending its fields to /a headers.
+	//! Returns false on a compression error, which is fatal to the connection, or as soon as
+	//! the fields add up to more than /a maxListSize, counted as SETTINGS_MAX_HEADER_LIST_SIZE is.
+	bool decode( const uint8_t *data, size_t size, HeaderSet::Headers &headers, size_t maxListSize = SIZE_MAX );
+	//! Decodes the complete header block at /a data into /a headerSet
+	bool decode( const uint8_t *data, size_t size, HeaderSet &headerSet ) { return decode( data, size, headerSet.getHeaders() ); }
+	
+	//! Returns whether decode() failed because the fields outgrew their limit
+	bool isOverLimit() const { return mOverLimit; }
+	
+	//! Returns the current size of the dynamic table as defined by RFC 7541
+	size_t getTableSize() const { return mTableSize; }
+	
+	//! Returns the byte counts of the blocks decoded so far
+	const HpackStats&	getStats() const { return mStats; }
+	void				resetStats() { mStats = HpackStats(); }
+	
+private:
+	bool lookup( uint32_t index, HeaderSet::Header &header ) const;
+	void insert( HeaderSet::Header header );
+	void evict( size_t maxSize );
+	
+	std::deque<HeaderSet::Header>	mTable;
+	size_t							mTableSize{0}, mMaxTableSize, mTableSizeLimit;
+	bool							mOverLimit{false};
+	HpackStats						mStats;
+};
+
+//! Encodes header blocks for HPACK, RFC 7541. Fields are looked up in hash indexes of the
+//! static and dynamic tables, repeated fields shrink to a single index and new ones are
+//! added to the dynamic table unless they change with every request or carry credentials.
+//! String literals are Huffman coded whenever that makes them shorter.
+class HpackEncoder {
+public:
+	//! Constructs an encoder whose dynamic table never grows beyond /a maxTableSize, even
+	//! if the peer allows more
+	HpackEncoder( size_t maxTableSize = 4096 )
+	: mMaxTableSize( maxTableSize ), mTableSizeLimit( maxTableSize ), mSmallestTableSize( maxTableSize ) {}
+	
+	//! Applies the peer's SETTINGS_HEADER_TABLE_SIZE, the change is signalled at the start
+	//! of the next header block
+	void setMaxTableSize( size_t maxTableSize );
+	
+	//! Encodes /a headers as a header block appended to /a out. Names are lowercased on the
+	//! way, as HTTP/2 requires.
+	void encode( const HeaderSet::Headers &headers, std::vector<uint8_t> &out );
+	//! Encodes the headers of /a headerSet as a header block appended to /a out
+	void encode( const HeaderSet &headerSet, std::vector<uint8_t> &out ) { encode( headerSet.getHeaders(), out ); }
+	
+	//! Returns the current size of the dynamic table as defined by RFC 7541
+	size_t getTableSize() const { return mTableSize; }
+	
+	//! Returns the byte counts of the blocks encoded so far
+	const HpackStats&	getStats() const { return mStats; }
+	void				resetStats() { mStats = HpackStats(); }
+	
+private:
+	//! Returns the dynamic table index of the entry inserted as number /a insertion, or 0
+	//! if it has been evicted
+	uint32_t dynamicIndex( uint64_t insertion ) const;
+	void insert( const std::string &name, const std::string &value, std::string key );
+	void evict( size_t maxSize );
+	
+	// Newest entries are at the front, each keeps its key into the hash indexes.
+	struct Entry {
+		std::string	name, key;
+		size_t		size;
+		uint64_t	insertion;
+	};
+	std::deque<Entry>							mTable;
+	std::unordered_map<std::string, uint64_t>	mNames, mFields;
+	uint64_t									mInsertions{0};
+	size_t										mTableSize{0}, mMaxTableSize, mTableSizeLimit,
+												mSmallestTableSize;
+	bool										mTableSizeChanged{false};
+	HpackStats									mStats;
+};
+
+inline bool HpackDecoder::decode( const uint8_t *data, size_t size, HeaderSet::Headers &headers, size_t maxListSize )
+{
+	auto pos = data, end = data + size;
+	mStats.encodedBytes += size;
+	mOverLimit = false;
+	bool fieldsStarted = false;
+	// A few bytes may reference a large entry of the dynamic table over and over, the
+	// fields are counted as they're decoded rather than once the block is done.
+	size_t listSize = 0;
+	auto overLimit = [&]( const HeaderSet::Header &field ) {
+		listSize += detail::hpackEntrySize( field.first, field.second );
+		mOverLimit = listSize > maxListSize;
+		return mOverLimit;
+	};
+	while( pos != end ) {
+		auto byte = *pos;
+		uint32_t index;
+		fieldsStarted = fieldsStarted || ( byte & 0xe0 ) != 0x20;
+		if( byte & 0x80 ) {
+			// Indexed header field.
+			headers.emplace_back();
+			auto &field = headers.back();
+			if( ! detail::hpackDecodeInteger( pos, end, 7, index ) || ! lookup( index, field ) )
+				return false;
+			if( overLimit( field ) )
+				return false;
+			++mStats.fields;
+			++mStats.indexedFields;
+			mStats.plainBytes += field.first.size() + field.second.size() + 4;
+			continue;
+		}
+		if( ( byte & 0xe0 ) == 0x20 ) {
+			// Dynamic table size update, only ever at the start of a block, RFC 7541 section 4.2.
+			if( fieldsStarted || ! detail::hpackDecodeInteger( pos, end, 5, index ) || index > mTableSizeLimit )
+				return false;
+			mMaxTableSize = index;
+			evict( mMaxTableSize );
+			continue;
+		}
+		// Literal with incremental indexing has a 6 bit index, the others have 4 bits.
+		bool indexing = ( byte & 0xc0 ) == 0x40;
+		if( ! detail::hpackDecodeInteger( pos, end, indexing ? 6 : 4, index ) )
+			return false;
+		headers.emplace_back();
+		auto &field = headers.back();
+		if( index ) {
+			if( ! lookup( index, field ) )
+				return false;
+		}
+		else if( ! detail::hpackDecodeString( pos, end, field.first ) )
+			return false;
+		if( ! detail::hpackDecodeString( pos, end, field.second ) || overLimit( field ) )
+			return false;
+		++mStats.fields;
+		mStats.plainBytes += field.first.size() + field.second.size() + 4;
+		if( indexing )
+			insert( field );
+	}
+	return true;
+}
+
+inline bool HpackDecoder::lookup( uint32_t index, HeaderSet::Header &header ) const
+{
+	if( index == 0 )
+		return false;
+	if( index <= detail::hpackStaticTableSize ) {
+		auto &entry = detail::hpackStaticTable()[index - 1];
+		header.first = entry.name;
+		header.second = entry.value;
+		return true;
+	}
+	index -= detail::hpackStaticTableSize + 1;
+	if( index >= mTable.size() )
+		return false;
+	header = mTable[index];
+	return true;
+}
+
+inline void HpackDecoder::insert( HeaderSet::Header header )
+{
+	// Each entry costs its name and value plus 32 bytes of overhead, RFC 7541 section 4.1.
+	auto size = detail::hpackEntrySize( header.first, header.second );
+	if( size > mMaxTableSize ) {
+		evict( 0 );
+		return;
+	}
+	evict( mMaxTableSize - size );
+	mTable.push_front( std::move( header ) );
+	mTableSize += size;
+}
+
+inline void HpackDecoder::evict( size_t maxSize )
+{
+	while( mTableSize > maxSize && ! mTable.empty() ) {
+		auto &oldest = mTable.back();
+		mTableSize -= detail::hpackEntrySize( oldest.first, oldest.second );
+		mTable.pop_back();
+	}
+}
+
+inline void HpackEncoder::setMaxTableSize( size_t maxTableSize )
+{
+	maxTableSize = std::min( maxTableSize, mTableSizeLimit );
+	if( maxTableSize == mMaxTableSize )
+		return;
+	mMaxTableSize = maxTableSize;
+	mSmallestTableSize = std::min( mSmallestTableSize, maxTableSize );
+	mTableSizeChanged = true;
+	evict( mMaxTableSize );
+}
+
+inline void HpackEncoder::encode( const HeaderSet::Headers &headers, std::vector<uint8_t> &out )
+{
+	auto start = out.size();
+	if( mTableSizeChanged ) {
+		// A shrink followed by a grow between blocks has to signal both, RFC 7541 section 4.2.
+		if( mSmallestTableSize < mMaxTableSize )
+			detail::hpackEncodeInteger( static_cast<uint32_t>( mSmallestTableSize ), 5, 0x20, out );
+		detail::hpackEncodeInteger( static_cast<uint32_t>( mMaxTableSize ), 5, 0x20, out );
+		mSmallestTableSize = mMaxTableSize;
+		mTableSizeChanged = false;
+	}
+	
+	auto &staticIndex = detail::hpackStaticIndex();
+	std::string name, key;
+	for( auto &header : headers ) {
+		name = header.first;
+		for( auto &c : name )
+			if( c >= 'A' && c <= 'Z' )
+				c += 'a' - 'A';
+		auto &value = header.second;
+		key = name;
+		key += '\0';
+		key += value;
+		++mStats.fields;
+		mStats.plainBytes += name.size() + value.size() + 4;
+		
+		// A full match in either table is sent as just its index.
+		uint32_t index = 0;
+		auto staticField = staticIndex.fields.find( key );
+		if( staticField != staticIndex.fields.end() )
+			index = staticField->second;
+		else {
+			auto dynamicField = mFields.find( key );
+			if( dynamicField != mFields.end() )
+				index = dynamicIndex( dynamicField->second );
+		}
+		if( index ) {
+			detail::hpackEncodeInteger( index, 7, 0x80, out );
+			++mStats.indexedFields;
+			continue;
+		}
+		
+		uint32_t nameIndex = 0;
+		auto staticName = staticIndex.names.find( name );
+		if( staticName != staticIndex.names.end() )
+			nameIndex = staticName->second;
+		else {
+			auto dynamicName = mNames.find( name );
+			if( dynamicName != mNames.end() )
+				nameIndex = dynamicIndex( dynamicName->second );
+		}
+		
+		// Credentials are never indexed, so no intermediary may compress them either, and
+		// short cookies are easy to guess by probing the table, RFC 7541 section 7.1.3.
+		bool sensitive = name == "authorization" || name == "proxy-authorization" ||
+			( name == "cookie" && value.size() < 20 );
+		// Values that differ with every message would only churn the table.
+		bool unique = name == ":path" || name == "content-length" || name == "date" || name == "etag" ||
+			name == "if-modified-since" || name == "if-none-match" || name == "last-modified" ||
+			name == "location" || name == "set-cookie";
+		bool indexing = ! sensitive && ! unique && detail::hpackEntrySize( name, value ) <= mMaxTableSize;
+		
+		if( indexing )
+			detail::hpackEncodeInteger( nameIndex, 6, 0x40, out );
+		else
+			detail::hpackEncodeInteger( nameIndex, 4, sensitive ? 0x10 : 0, out );
+		if( ! nameIndex )
+			detail::hpackEncodeString( name, out );
+		detail::hpackEncodeString( value, out );
+		if( indexing )
+			insert( name, value, std::move( key ) );
+	}
+	mStats.encodedBytes += out.size() - start;
+}
+
+inline uint32_t HpackEncoder::dynamicIndex( uint64_t insertion ) const
+{
+	auto position = mInsertions - 1 - insertion;
+	if( position >= mTable.size() )
+		return 0;
+	return static_cast<uint32_t>( detail::hpackStaticTableSize + 1 + position );
+}
+
+inline void HpackEncoder::insert( const std::string &name, const std::string &value, std::string key )
+{
+	auto size = detail::hpackEntrySize( name, value );
+	evict( mMaxTableSize - size );
+	auto insertion = mInsertions++;
+	mNames[name] = insertion;
+	mFields[key] = insertion;
+	mTable.push_front( { name, std::move( key ), size, insertion } );
+	mTableSize += size;
+}
+
+inline void HpackEncoder::evict( size_t maxSize )
+{
+	while( mTableSize > maxSize && ! mTable.empty() ) {
+		auto &oldest = mTable.back();
+		// A newer entry with the same name or field may have taken over the index.
+		auto name = mNames.find( oldest.name );
+		if( name != mNames.end() && name->second == oldest.insertion )
+			mNames.erase( name );
+		auto field = mFields.find( oldest.key );
+		if( field != mFields.end() && field->second == oldest.insertion )
+			mFields.erase( field );
+		mTableSize -= oldest.size;
+		mTable.pop_back();
+	}
+}
+	
+} // http
+} // cinder
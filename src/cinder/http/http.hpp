@@ -12,6 +12,8 @@
 #define ASIO_STANDALONE 1
 #endif
 #define USING_SSL
+// gzip and deflate content codings and permessage-deflate are opt in, a build linking zlib
+// defines USING_ZLIB.
 #include "asio/asio.hpp"
 #if defined( USING_SSL )
 #include "asio/ssl.hpp"
@@ -26,22 +28,184 @@
 #include "requester.hpp"
 #include "responder.hpp"
 #include "request_response.hpp"
+#include "cache.hpp"
+#include "coalescer.hpp"
 
 namespace cinder {
 namespace http {
 
-enum class protocol {
-	http,
-	https,
-	file
-};
-	
 using ResponseHandler = std::function<void( asio::error_code, ResponseRef )>;
 using ErrorHandler = std::function<void( asio::error_code, const UrlRef &, ResponseRef )>;
 	
+namespace detail {
+
+//! The cache, revalidation and coalescing both Session and SslSession go through, whatever
+//! their transport. SessionType derives from it, befriends it and starts a transfer only
+//! when answerWithoutConnecting() doesn't.
+template<typename SessionType>
+class CachingSession {
+public:
+	//! Answers from /a cache when it holds a fresh response to the request, without
+	//! connecting, and stores the response there when it may be cached. A stale response
+	//! is revalidated, in the background if its stale-while-revalidate lets it answer
+	//! meanwhile, and stands in for the origin's failure as far as its stale-if-error allows.
+	void						setCache( ResponseCacheRef cache ) { mCache = std::move( cache ); }
+	const ResponseCacheRef&		getCache() const { return mCache; }
+	
+	//! Shares transfers with the identical requests in flight through /a coalescer, waiting
+	//! on one if it's already underway instead of connecting
+	void						setCoalescer( RequestCoalescerRef coalescer ) { mCoalescer = std::move( coalescer ); }
+	const RequestCoalescerRef&	getCoalescer() const { return mCoalescer; }
+	
+protected:
+	//! Returns true if the request is answered from the cache, or waits on an identical one
+	bool answerWithoutConnecting() { return answerFromCache() || joinInFlight(); }
+	
+	void onResponse( asio::error_code ec )
+	{
+		auto &session = getSession();
+		if( mCache && session.request && ! session.request->getContentHandler() )
+			mCache->store( *session.request, session.response, mRequestTime );
+		endRevalidation();
+		completeInFlight( ec );
+		if( ! mBackground )
+			session.responseHandler( ec, session.response );
+	}
+	
+	void onError( asio::error_code ec )
+	{
+		auto &session = getSession();
+		endRevalidation();
+		if( auto stale = answerAfterError( ec ) ) {
+			session.response = stale;
+			completeInFlight( asio::error_code() );
+			session.responseHandler( asio::error_code(), session.response );
+			return;
+		}
+		completeInFlight( ec );
+		if( ! mBackground )
+			session.errorHandler( ec, session.mSessionUrl, session.response );
+	}
+	
+private:
+	SessionType& getSession() { return static_cast<SessionType&>( *this ); }
+	
+	bool answerFromCache()
+	{
+		auto &session = getSession();
+		auto &request = session.request;
+		mRequestTime = std::chrono::system_clock::now();
+		mBackground = false;
+		// Streamed content never makes it into the response to be cached.
+		if( ! mCache || ! request || request->getContentHandler() )
+			return false;
+		ResponseRef stale;
+		session.response = mCache->find( *request, mRequestTime, request->getPriorResponse() ? nullptr : &stale );
+		// Ask the origin whether the stale response still holds rather than for all of it again.
+		if( stale ) {
+			request->setPriorResponse( std::move( stale ) );
+			mRevalidating = true;
+		}
+		if( ! session.response )
+			return false;
+		auto self = session.shared_from_this();
+		auto answer = session.response;
+		session.io_service.post( [self, answer] { self->responseHandler( asio::error_code(), answer ); } );
+		// Answered with a stale response, the revalidation goes on without anyone waiting.
+		mBackground = mRevalidating;
+		return ! mBackground;
+	}
+	
+	//! Returns the stale response standing in for the origin's failure with /a ec, if the
+	//! cache holds one it may
+	ResponseRef answerAfterError( asio::error_code ec )
+	{
+		auto &request = getSession().request;
+		if( ! mCache || ! request || request->getContentHandler() || mBackground ||
+		    ec == asio::error::operation_aborted )
+			return nullptr;
+		// Client errors are the origin's answer, not its failure to give one.
+		if( ec.category() == http::error_category() && ec.value() < http::errc::internal_server_error )
+			return nullptr;
+		return mCache->findIfError( *request );
+	}
+	
+	//! Leaves the request as it was given, the next start() looks in the cache again
+	void endRevalidation()
+	{
+		if( mRevalidating ) {
+			getSession().request->setPriorResponse( nullptr );
+			mRevalidating = false;
+		}
+	}
+	
+	//! Waits on the transfer of an identical request if one is in flight, or becomes the
+	//! one whose transfer the next ones wait on
+	bool joinInFlight()
+	{
+		auto &session = getSession();
+		if( ! mCoalescer || ! session.request )
+			return false;
+		auto key = RequestCoalescer::getKey( *session.request );
+		if( key.empty() )
+			return false;
+		auto self = session.shared_from_this();
+		if( ! mCoalescer->join( key, [self]( asio::error_code ec, const ResponseRef &response ) {
+				self->io_service.post( [self, ec, response] { self->onLanded( ec, response ); } );
+			}) ) {
+			mFlightKey = std::move( key );
+			return false;
+		}
+		return true;
+	}
+	void completeInFlight( asio::error_code ec )
+	{
+		if( mFlightKey.empty() )
+			return;
+		auto key = std::move( mFlightKey );
+		mFlightKey.clear();
+		// An aborted transfer is this session's own business, the ones waiting on it start over.
+		if( ec == asio::error::operation_aborted )
+			mCoalescer->abandon( key );
+		else
+			mCoalescer->complete( key, ec, getSession().response );
+	}
+	//! Finishes with the outcome of the transfer this session waited on
+	void onLanded( asio::error_code ec, const ResponseRef &landed )
+	{
+		auto &session = getSession();
+		endRevalidation();
+		if( mBackground )
+			return;
+		// The transfer was abandoned, make it or wait on whoever makes it now.
+		if( ec == RequestCoalescer::abandoned() && ! session.cancelled ) {
+			session.start();
+			return;
+		}
+		session.response = landed;
+		if( session.cancelled )
+			ec = asio::error::operation_aborted;
+		if( ec )
+			session.errorHandler( ec, session.mSessionUrl, session.response );
+		else
+			session.responseHandler( ec, session.response );
+	}
+	
+	ResponseCacheRef	mCache;
+	std::chrono::system_clock::time_point	mRequestTime;
+	//! Whether the request's prior response came from the cache, and whether it was handed
+	//! over already while it's revalidated
+	bool				mRevalidating{false}, mBackground{false};
+	RequestCoalescerRef	mCoalescer;
+	//! The key identical requests wait on this session's transfer under, if they can
+	std::string			mFlightKey;
+};
+	
+} // detail
+	
 using SessionRef = std::shared_ptr<class Session>;
 
-class Session : public std::enable_shared_from_this<Session> {
+class Session : public std::enable_shared_from_this<Session>, public detail::CachingSession<Session> {
 public:
 	
 	Session( RequestRef request, ResponseHandler responseHandler, ErrorHandler errorHandler,
@@ -59,19 +223,39 @@ public:
 	
 	void start()
 	{
+		if( answerWithoutConnecting() )
+			return;
 		std::make_shared<detail::Connector<Session>>( 
 				shared_from_this(), socket )->start();
 	}
 	
 	void start( asio::ip::tcp::endpoint endpoint )
 	{
+		if( answerWithoutConnecting() )
+			return;
 		std::make_shared<detail::Connector<Session>>(
 			shared_from_this(), socket )->start( endpoint );
 	}
 	
+	//! Drops the connection, the error handler receives operation_aborted unless the
+	//! response is already complete
+	void cancel()
+	{
+		cancelled = true;
+		asio::error_code ignored;
+		socket.close( ignored );
+	}
+	
 private:
 	void onOpen( asio::error_code ec )
 	{
+		// The connection may have been made after a cancel() during the lookup.
+		if( cancelled ) {
+			asio::error_code ignored;
+			socket.close( ignored );
+			onError( asio::error::operation_aborted );
+			return;
+		}
 		std::make_shared<detail::Handshaker<Session>>(
 			shared_from_this() )->handshake();
 	}
@@ -80,22 +264,13 @@ private:
 		if( ! request )
 			request = std::make_shared<Request>( RequestMethod::GET, mSessionUrl );
 		std::make_shared<detail::Requester<Session>>(
-			shared_from_this(), std::move( request ) )->request();
+			shared_from_this(), request )->request();
 	}
 	void onRequest( asio::error_code ec )
 	{
 		std::make_shared<detail::Responder<Session>>(
 			shared_from_this() )->read();
 	}
-	void onResponse( asio::error_code ec )
-	{
-		responseHandler( ec, response );
-	}
-	
-	void onError( asio::error_code ec ) 
-	{
-		errorHandler( ec, mSessionUrl, response );
-	}
 	
 	asio::io_service	&io_service;
 	asio::ip::tcp::socket	socket;
@@ -104,10 +279,13 @@ private:
 	ErrorHandler		errorHandler;
 	RequestRef			request;
 	ResponseRef			response;
+	asio::streambuf		replyBuffer;
+	bool				cancelled{false};
 	
 	UrlRef					mSessionUrl;
 	asio::ip::tcp::endpoint	endpoint;
 	
+	friend class detail::CachingSession<Session>;
 	friend struct detail::Connector<Session>;
 	friend struct detail::Handshaker<Session>;
 	friend struct detail::Requester<Session>;
@@ -118,7 +296,7 @@ private:
 	
 using SslSessionRef = std::shared_ptr<class SslSession>;
 
-class SslSession : public std::enable_shared_from_this<SslSession> {
+class SslSession : public std::enable_shared_from_this<SslSession>, public detail::CachingSession<SslSession> {
 public:
 	
 	SslSession( RequestRef request, ResponseHandler responseHandler, ErrorHandler errorHandler,
@@ -142,19 +320,39 @@ public:
 	
 	void start()
 	{
+		if( answerWithoutConnecting() )
+			return;
 		std::make_shared<detail::Connector<SslSession>>(
 			shared_from_this(), socket.next_layer() )->start();
 	}
 	
 	void start( asio::ip::tcp::endpoint endpoint )
 	{
+		if( answerWithoutConnecting() )
+			return;
 		std::make_shared<detail::Connector<SslSession>>(
 			shared_from_this(), socket.next_layer() )->start( endpoint );
 	}
 	
+	//! Drops the connection, the error handler receives operation_aborted unless the
+	//! response is already complete
+	void cancel()
+	{
+		cancelled = true;
+		asio::error_code ignored;
+		socket.lowest_layer().close( ignored );
+	}
+	
 private:
 	void onOpen( asio::error_code ec )
 	{
+		// The connection may have been made after a cancel() during the lookup.
+		if( cancelled ) {
+			asio::error_code ignored;
+			socket.lowest_layer().close( ignored );
+			onError( asio::error::operation_aborted );
+			return;
+		}
 		std::make_shared<detail::Handshaker<SslSession>>(
 			shared_from_this() )->handshake();
 	}
@@ -163,22 +361,13 @@ private:
 		if( ! request )
 			request = std::make_shared<Request>( RequestMethod::GET, mSessionUrl );
 		std::make_shared<detail::Requester<SslSession>>(
-			shared_from_this(), std::move( request ) )->request();
+			shared_from_this(), request )->request();
 	}
 	void onRequest( asio::error_code ec )
 	{
 		std::make_shared<detail::Responder<SslSession>>(
 			shared_from_this() )->read();
 	}
-	void onResponse( asio::error_code ec )
-	{
-		responseHandler( ec, response );
-	}
-	
-	void onError( asio::error_code ec ) 
-	{
-		errorHandler( ec, mSessionUrl, response );
-	}
 	
 	asio::io_service	&io_service;
 	asio::ssl::context	context;
@@ -188,10 +377,13 @@ private:
 	ErrorHandler		errorHandler;
 	RequestRef			request;
 	ResponseRef			response;
+	asio::streambuf		replyBuffer;
+	bool				cancelled{false};
 	
 	UrlRef					mSessionUrl;
 	asio::ip::tcp::endpoint	endpoint;
 	
+	friend class detail::CachingSession<SslSession>;
 	friend struct detail::Connector<SslSession>;
 	friend struct detail::Handshaker<SslSession>;
 	friend struct detail::Requester<SslSession>;
@@ -0,0 +1,1390 @@
+//
+//  http2.hpp
+//  Cinder-HTTP
+//
+//
+
+#pragma once
+
+#include "http.hpp"
+#include "pipeline.hpp"
+#include "hpack.hpp"
+
+#include <map>
+#include <deque>
+#include <chrono>
+
+#if defined( USING_SSL )
+#include <openssl/ssl.h>
+#endif
+
+namespace cinder {
+namespace http {
+	
+//! Receives the round trip time of a PING, or the error that kept it from being answered
+using PingHandler = std::function<void( asio::error_code, std::chrono::steady_clock::duration )>;
+
+namespace detail {
+	
+//! Frame types, flags, settings and error codes of RFC 7540
+namespace http2 {
+	
+enum class FrameType : uint8_t {
+	DATA = 0x0,
+	HEADERS = 0x1,
+	PRIORITY = 0x2,
+	RST_STREAM = 0x3,
+	SETTINGS = 0x4,
+	PUSH_PROMISE = 0x5,
+	PING = 0x6,
+	GOAWAY = 0x7,
+	WINDOW_UPDATE = 0x8,
+	CONTINUATION = 0x9
+};
+
+namespace flags {
+	const uint8_t END_STREAM = 0x1;
+	const uint8_t ACK = 0x1;
+	const uint8_t END_HEADERS = 0x4;
+	const uint8_t PADDED = 0x8;
+	const uint8_t PRIORITY = 0x20;
+}
+
+enum class Setting : uint16_t {
+	HEADER_TABLE_SIZE = 0x1,
+	ENABLE_PUSH = 0x2,
+	MAX_CONCURRENT_STREAMS = 0x3,
+	INITIAL_WINDOW_SIZE = 0x4,
+	MAX_FRAME_SIZE = 0x5,
+	MAX_HEADER_LIST_SIZE = 0x6
+};
+
+//! Named without the _ERROR suffix of the RFC, NO_ERROR is a macro in winerror.h
+enum class ErrorCode : uint32_t {
+	NONE = 0x0,
+	PROTOCOL = 0x1,
+	INTERNAL = 0x2,
+	FLOW_CONTROL = 0x3,
+	SETTINGS_TIMEOUT = 0x4,
+	STREAM_CLOSED = 0x5,
+	FRAME_SIZE = 0x6,
+	REFUSED_STREAM = 0x7,
+	CANCEL = 0x8,
+	COMPRESSION = 0x9,
+	CONNECT = 0xa,
+	ENHANCE_YOUR_CALM = 0xb,
+	INADEQUATE_SECURITY = 0xc,
+	HTTP_1_1_REQUIRED = 0xd
+};
+
+const char preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+const uint32_t defaultWindowSize = 65535;
+const uint32_t maxWindowSize = 0x7fffffff;
+const uint32_t defaultFrameSize = 16384;
+
+inline uint32_t read32( const uint8_t *data )
+{
+	return ( uint32_t( data[0] ) << 24 ) | ( uint32_t( data[1] ) << 16 ) | ( uint32_t( data[2] ) << 8 ) | data[3];
+}
+
+inline void write32( uint32_t value, uint8_t *data )
+{
+	data[0] = uint8_t( value >> 24 );
+	data[1] = uint8_t( value >> 16 );
+	data[2] = uint8_t( value >> 8 );
+	data[3] = uint8_t( value );
+}
+
+//! Returns whether the lowercase header /a name only means something to an HTTP/1.1
+//! connection, these must not be sent over HTTP/2
+inline bool isConnectionSpecific( const std::string &name )
+{
+	return name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+		name == "transfer-encoding" || name == "upgrade" || name == "host" || name == "expect";
+}
+
+//! Turns a lowercase HTTP/2 header name into the capitalization HTTP/1.1 servers send, so
+//! the header keys in headers.hpp find it either way
+inline std::string canonicalHeaderName( std::string name )
+{
+	bool upper = true;
+	for( auto &c : name ) {
+		if( upper )
+			c = static_cast<char>( toupper( c ) );
+		upper = c == '-';
+	}
+	return name;
+}
+	
+} // http2
+
+//! A request waiting for or running on an HTTP/2 stream
+struct Http2Request {
+	RequestRef		request;
+	ResponseHandler	responseHandler;
+	uint16_t		weight;
+	uint8_t			refusals;
+};
+
+//! Runs requests as concurrent streams over one HTTP/2 connection, RFC 7540. The session
+//! gets the socket ready and keeps the handlers, the connection takes it from there. Once
+//! every stream is answered the connection says goodbye and closes.
+template<typename SessionType>
+struct Http2Connection : std::enable_shared_from_this<Http2Connection<SessionType>> {
+	Http2Connection( std::shared_ptr<SessionType> session )
+	: mSession( std::move( session ) ) {}
+	
+	//! Writes the connection preface and starts reading frames
+	void start();
+	//! Opens a stream for /a request, or queues it until the server allows another stream
+	void submit( Http2Request request );
+	//! Sends a PING, /a handler receives the round trip time
+	void ping( PingHandler handler );
+	
+	//! Window advertised for each stream
+	static const uint32_t streamWindowSize = 1 << 20;
+	//! Window advertised for the connection as a whole
+	static const uint32_t connectionWindowSize = 16 << 20;
+	//! SETTINGS_MAX_HEADER_LIST_SIZE advertised, header blocks may not be larger either
+	static const uint32_t maxHeaderListSize = 64 * 1024;
+	
+private:
+	struct Stream {
+		Http2Request			entry;
+		ResponseRef				response;
+		std::vector<uint8_t>	content, body;
+		const uint8_t			*bodyData{nullptr};
+		size_t					bodySize{0}, bodyOffset{0};
+		int64_t					sendWindow{0};
+		uint32_t				unacknowledged{0};
+#if defined( USING_ZLIB )
+		std::unique_ptr<Inflater>	inflater;
+#endif
+	};
+	using Streams = std::map<uint32_t, Stream>;
+	
+	struct Ping {
+		uint64_t								id;
+		std::chrono::steady_clock::time_point	sent;
+		PingHandler								handler;
+	};
+	
+	void read_frame_header();
+	void on_read_frame_header( asio::error_code ec, size_t bytes_transferred );
+	void on_read_frame_payload( asio::error_code ec, size_t bytes_transferred );
+	
+	void handle_data();
+	void handle_headers();
+	void handle_continuation();
+	void handle_rst_stream();
+	void handle_settings();
+	void handle_ping();
+	void handle_goaway();
+	void handle_window_update();
+	//! Decodes a complete header block, every block has to go through the decoder to keep
+	//! its table in sync, even those of streams that are already gone
+	void on_header_block();
+	//! Strips the padding off the current frame's payload, false on a malformed frame
+	bool strip_padding( const uint8_t *&data, size_t &size );
+	//! Acknowledges received DATA once half of a window is used up. Returns false if the
+	//! server sent more than a window allows, which fails the connection or the stream.
+	bool consume_window( uint32_t streamId, size_t size );
+	
+	void open_streams();
+	void open_stream( Http2Request entry );
+	void write_data( uint32_t streamId, Stream &stream );
+	void write_pending_data();
+	void write_frame( http2::FrameType type, uint8_t flags, uint32_t streamId,
+					  const uint8_t *payload, size_t size );
+	void write_window_update( uint32_t streamId, uint32_t increment );
+	void write_next();
+	void on_write( asio::error_code ec );
+	
+	//! Hands a finished stream's response to its handler
+	void complete( typename Streams::iterator it );
+	//! Same rule as the Responder, anything but a 2xx goes to the error handler
+	static bool is_success( const Response &response )
+	{
+		return response.statusCode >= http::errc::ok && response.statusCode < http::errc::multiple_choices;
+	}
+	//! Cancels a stream, reporting /a ec to the error handler
+	void reset_stream( typename Streams::iterator it, http2::ErrorCode code, asio::error_code ec );
+	//! Hands requests the server never processed back to the session to send again
+	void retry( std::vector<Http2Request> requests );
+	//! Says goodbye with /a code once the frames already queued are written
+	void go_away( http2::ErrorCode code );
+	//! Treats a violation by the server as fatal, every stream fails
+	void connection_error( http2::ErrorCode code );
+	//! Fails every stream and pending request with /a ec and drops the connection
+	void fail( asio::error_code ec );
+	void abort_streams( asio::error_code ec );
+	void finish_if_idle();
+	void close_socket();
+	
+	std::shared_ptr<SessionType>	mSession;
+	HpackEncoder					mEncoder;
+	HpackDecoder					mDecoder;
+	
+	Streams							mStreams;
+	std::deque<Http2Request>		mPending;
+	std::deque<Ping>				mPings;
+	uint32_t						mNextStreamId{1};
+	uint64_t						mNextPingId{1};
+	
+	// Settings of the server
+	uint32_t						mPeerMaxConcurrent{100},
+									mPeerInitialWindow{http2::defaultWindowSize},
+									mPeerMaxFrameSize{http2::defaultFrameSize};
+	int64_t							mSendWindow{http2::defaultWindowSize};
+	uint32_t						mUnacknowledged{0};
+	
+	std::array<uint8_t, 9>			mFrameHeader;
+	std::vector<uint8_t>			mFramePayload;
+	http2::FrameType				mFrameType;
+	uint8_t							mFrameFlags{0};
+	uint32_t						mFrameStream{0};
+	
+	std::vector<uint8_t>			mHeaderBlock;
+	uint32_t						mHeaderBlockStream{0};
+	bool							mHeaderBlockEndStream{false},
+									mContinuation{false};
+	
+	std::deque<std::vector<uint8_t>>	mWriteQueue;
+	std::vector<asio::const_buffer>		mWriteBuffers;
+	size_t							mWriting{0};
+	bool							mStarted{false},
+									mGoingAway{false},
+									mClosed{false};
+};
+
+template<typename SessionType>
+void Http2Connection<SessionType>::start()
+{
+	auto preface = reinterpret_cast<const uint8_t*>( http2::preface );
+	mWriteQueue.emplace_back( preface, preface + sizeof( http2::preface ) - 1 );
+	
+	// Server push is turned off, responses only ever arrive on streams we open.
+	uint8_t settings[18];
+	settings[0] = 0;
+	settings[1] = uint8_t( http2::Setting::ENABLE_PUSH );
+	http2::write32( 0, settings + 2 );
+	settings[6] = 0;
+	settings[7] = uint8_t( http2::Setting::INITIAL_WINDOW_SIZE );
+	http2::write32( streamWindowSize, settings + 8 );
+	settings[12] = 0;
+	settings[13] = uint8_t( http2::Setting::MAX_HEADER_LIST_SIZE );
+	http2::write32( maxHeaderListSize, settings + 14 );
+	write_frame( http2::FrameType::SETTINGS, 0, 0, settings, sizeof( settings ) );
+	write_window_update( 0, connectionWindowSize - http2::defaultWindowSize );
+	
+	mStarted = true;
+	read_frame_header();
+	open_streams();
+	finish_if_idle();
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::submit( Http2Request request )
+{
+	if( mGoingAway || mClosed ) {
+		retry( { std::move( request ) } );
+		return;
+	}
+	mPending.push_back( std::move( request ) );
+	open_streams();
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::ping( PingHandler handler )
+{
+	if( mClosed ) {
+		handler( asio::error::not_connected, std::chrono::steady_clock::duration() );
+		return;
+	}
+	auto id = mNextPingId++;
+	uint8_t payload[8];
+	http2::write32( uint32_t( id >> 32 ), payload );
+	http2::write32( uint32_t( id ), payload + 4 );
+	mPings.push_back( { id, std::chrono::steady_clock::now(), std::move( handler ) } );
+	write_frame( http2::FrameType::PING, 0, 0, payload, sizeof( payload ) );
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::read_frame_header()
+{
+	asio::async_read( mSession->socket, asio::buffer( mFrameHeader ),
+					  std::bind( &Http2Connection<SessionType>::on_read_frame_header,
+								 this->shared_from_this(),
+								 std::placeholders::_1,
+								 std::placeholders::_2 ) );
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::on_read_frame_header( asio::error_code ec, size_t bytes_transferred )
+{
+	if( ec ) {
+		fail( ec );
+		return;
+	}
+	auto length = ( uint32_t( mFrameHeader[0] ) << 16 ) | ( uint32_t( mFrameHeader[1] ) << 8 ) | mFrameHeader[2];
+	mFrameType = static_cast<http2::FrameType>( mFrameHeader[3] );
+	mFrameFlags = mFrameHeader[4];
+	mFrameStream = http2::read32( mFrameHeader.data() + 5 ) & 0x7fffffff;
+	// We never raise SETTINGS_MAX_FRAME_SIZE, anything larger than the default is an error.
+	if( length > http2::defaultFrameSize ) {
+		connection_error( http2::ErrorCode::FRAME_SIZE );
+		return;
+	}
+	mFramePayload.resize( length );
+	if( ! length ) {
+		on_read_frame_payload( ec, 0 );
+		return;
+	}
+	asio::async_read( mSession->socket, asio::buffer( mFramePayload ),
+					  std::bind( &Http2Connection<SessionType>::on_read_frame_payload,
+								 this->shared_from_this(),
+								 std::placeholders::_1,
+								 std::placeholders::_2 ) );
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::on_read_frame_payload( asio::error_code ec, size_t bytes_transferred )
+{
+	if( ec ) {
+		fail( ec );
+		return;
+	}
+	// Nothing may come between a HEADERS frame and the CONTINUATIONs that finish its block.
+	if( mContinuation && ( mFrameType != http2::FrameType::CONTINUATION || mFrameStream != mHeaderBlockStream ) ) {
+		connection_error( http2::ErrorCode::PROTOCOL );
+		return;
+	}
+	switch( mFrameType ) {
+		case http2::FrameType::DATA: handle_data(); break;
+		case http2::FrameType::HEADERS: handle_headers(); break;
+		case http2::FrameType::CONTINUATION: handle_continuation(); break;
+		case http2::FrameType::RST_STREAM: handle_rst_stream(); break;
+		case http2::FrameType::SETTINGS: handle_settings(); break;
+		case http2::FrameType::PING: handle_ping(); break;
+		case http2::FrameType::GOAWAY: handle_goaway(); break;
+		case http2::FrameType::WINDOW_UPDATE: handle_window_update(); break;
+		// Push was turned off in our SETTINGS, a promise breaks that.
+		case http2::FrameType::PUSH_PROMISE: connection_error( http2::ErrorCode::PROTOCOL ); break;
+		// Priorities only matter to the server, unknown frame types must be ignored.
+		default: break;
+	}
+	if( ! mClosed )
+		read_frame_header();
+}
+
+template<typename SessionType>
+bool Http2Connection<SessionType>::strip_padding( const uint8_t *&data, size_t &size )
+{
+	data = mFramePayload.data();
+	size = mFramePayload.size();
+	if( ! ( mFrameFlags & http2::flags::PADDED ) )
+		return true;
+	if( size < 1 || data[0] >= size ) {
+		connection_error( http2::ErrorCode::PROTOCOL );
+		return false;
+	}
+	size -= 1 + data[0];
+	data += 1;
+	return true;
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::handle_data()
+{
+	if( ! mFrameStream ) {
+		connection_error( http2::ErrorCode::PROTOCOL );
+		return;
+	}
+	// Padding counts against the window too, so the whole payload is acknowledged.
+	if( ! consume_window( mFrameStream, mFramePayload.size() ) )
+		return;
+	const uint8_t *data;
+	size_t size;
+	if( ! strip_padding( data, size ) )
+		return;
+	
+	// Frames already in flight for a stream we reset are simply dropped.
+	auto it = mStreams.find( mFrameStream );
+	if( it == mStreams.end() )
+		return;
+	auto &stream = it->second;
+	if( ! stream.response->statusCode ) {
+		reset_stream( it, http2::ErrorCode::PROTOCOL, http::errc::malformed_response_headers );
+		return;
+	}
+	bool decoded = true;
+#if defined( USING_ZLIB )
+	if( stream.inflater )
+		decoded = stream.inflater->decode( data, size, stream.content );
+	else
+#endif
+		stream.content.insert( stream.content.end(), data, data + size );
+	if( ! decoded ) {
+		reset_stream( it, http2::ErrorCode::CANCEL, http::errc::malformed_response_content );
+		return;
+	}
+	auto &contentHandler = stream.entry.request->getContentHandler();
+	if( contentHandler && is_success( *stream.response ) && ! stream.content.empty() ) {
+		contentHandler( stream.response, stream.content.data(), stream.content.size() );
+		stream.content.clear();
+	}
+	if( mFrameFlags & http2::flags::END_STREAM )
+		complete( it );
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::handle_headers()
+{
+	if( ! mFrameStream ) {
+		connection_error( http2::ErrorCode::PROTOCOL );
+		return;
+	}
+	const uint8_t *data;
+	size_t size;
+	if( ! strip_padding( data, size ) )
+		return;
+	if( mFrameFlags & http2::flags::PRIORITY ) {
+		// Skip the stream dependency and weight, they are the server's business.
+		if( size < 5 ) {
+			connection_error( http2::ErrorCode::PROTOCOL );
+			return;
+		}
+		data += 5;
+		size -= 5;
+	}
+	if( size > maxHeaderListSize ) {
+		connection_error( http2::ErrorCode::ENHANCE_YOUR_CALM );
+		return;
+	}
+	mHeaderBlock.assign( data, data + size );
+	mHeaderBlockStream = mFrameStream;
+	mHeaderBlockEndStream = ( mFrameFlags & http2::flags::END_STREAM ) != 0;
+	mContinuation = ! ( mFrameFlags & http2::flags::END_HEADERS );
+	if( ! mContinuation )
+		on_header_block();
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::handle_continuation()
+{
+	if( ! mContinuation ) {
+		connection_error( http2::ErrorCode::PROTOCOL );
+		return;
+	}
+	// Literals take about as many bytes as they decode to, a block past the limit on the
+	// list is only ever a flood of CONTINUATION frames.
+	if( mHeaderBlock.size() + mFramePayload.size() > maxHeaderListSize ) {
+		connection_error( http2::ErrorCode::ENHANCE_YOUR_CALM );
+		return;
+	}
+	mHeaderBlock.insert( mHeaderBlock.end(), mFramePayload.begin(), mFramePayload.end() );
+	mContinuation = ! ( mFrameFlags & http2::flags::END_HEADERS );
+	if( ! mContinuation )
+		on_header_block();
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::on_header_block()
+{
+	HeaderSet::Headers fields;
+	bool decoded = mDecoder.decode( mHeaderBlock.data(), mHeaderBlock.size(), fields, maxHeaderListSize );
+	mHeaderBlock.clear();
+	if( ! decoded ) {
+		// Either way the dynamic table is out of step with the server's now.
+		connection_error( mDecoder.isOverLimit() ? http2::ErrorCode::ENHANCE_YOUR_CALM : http2::ErrorCode::COMPRESSION );
+		return;
+	}
+	auto it = mStreams.find( mHeaderBlockStream );
+	if( it == mStreams.end() )
+		return;
+	
+	auto &stream = it->second;
+	auto &response = *stream.response;
+	uint32_t status = 0;
+	HeaderSet::Headers headers;
+	for( auto &field : fields ) {
+		if( field.first == ":status" )
+			status = static_cast<uint32_t>( atoi( field.second.c_str() ) );
+		else if( field.first.empty() || field.first[0] != ':' )
+			headers.emplace_back( http2::canonicalHeaderName( field.first ), std::move( field.second ) );
+	}
+	if( status ) {
+		// An interim response, the final one follows on the same stream.
+		if( status < http::errc::ok )
+			return;
+		response.statusCode = status;
+		response.setVersion( 2, 0 );
+	}
+	else if( ! response.statusCode ) {
+		reset_stream( it, http2::ErrorCode::PROTOCOL, http::errc::malformed_response_headers );
+		return;
+	}
+	// Without a status these are trailers, which join the headers of the response.
+	auto &headerSet = response.headerSet.getHeaders();
+	headerSet.insert( headerSet.end(), headers.begin(), headers.end() );
+	std::sort( begin( headerSet ), end( headerSet ),
+	[]( const HeaderSet::Header &a, const HeaderSet::Header &b ) {
+		return a.first < b.first;
+	});
+#if defined( USING_ZLIB )
+	if( status ) {
+		if( auto contentEncoding = response.headerSet.findHeader( ContentEncoding::key() ) )
+			stream.inflater = makeContentInflater( contentEncoding->second );
+	}
+#endif
+	auto &contentHandler = stream.entry.request->getContentHandler();
+	if( status && contentHandler && is_success( response ) )
+		contentHandler( stream.response, nullptr, 0 );
+	if( mHeaderBlockEndStream )
+		complete( it );
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::handle_rst_stream()
+{
+	if( ! mFrameStream || mFramePayload.size() != 4 ) {
+		connection_error( mFrameStream ? http2::ErrorCode::FRAME_SIZE : http2::ErrorCode::PROTOCOL );
+		return;
+	}
+	auto it = mStreams.find( mFrameStream );
+	if( it == mStreams.end() )
+		return;
+	auto code = static_cast<http2::ErrorCode>( http2::read32( mFramePayload.data() ) );
+	// A refused stream was never processed, it can go out again on this connection.
+	if( code == http2::ErrorCode::REFUSED_STREAM && it->second.entry.refusals < 3 ) {
+		auto entry = std::move( it->second.entry );
+		++entry.refusals;
+		mStreams.erase( it );
+		mPending.push_front( std::move( entry ) );
+		open_streams();
+		return;
+	}
+	CI_LOG_W( "Stream " << mFrameStream << " reset by server, error " << uint32_t( code ) );
+	auto stream = std::move( it->second );
+	mStreams.erase( it );
+	mSession->errorHandler( http::errc::http2_stream_reset, stream.entry.request->getUrl(), stream.response );
+	open_streams();
+	finish_if_idle();
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::handle_settings()
+{
+	if( mFrameStream ) {
+		connection_error( http2::ErrorCode::PROTOCOL );
+		return;
+	}
+	if( mFrameFlags & http2::flags::ACK )
+		return;
+	if( mFramePayload.size() % 6 ) {
+		connection_error( http2::ErrorCode::FRAME_SIZE );
+		return;
+	}
+	for( size_t offset = 0; offset < mFramePayload.size(); offset += 6 ) {
+		auto entry = mFramePayload.data() + offset;
+		auto id = static_cast<http2::Setting>( ( entry[0] << 8 ) | entry[1] );
+		auto value = http2::read32( entry + 2 );
+		switch( id ) {
+			case http2::Setting::MAX_CONCURRENT_STREAMS:
+				mPeerMaxConcurrent = value;
+			break;
+			case http2::Setting::INITIAL_WINDOW_SIZE: {
+				if( value > http2::maxWindowSize ) {
+					connection_error( http2::ErrorCode::FLOW_CONTROL );
+					return;
+				}
+				// The change applies to the windows of every open stream, RFC 7540 section 6.9.2.
+				auto delta = int64_t( value ) - int64_t( mPeerInitialWindow );
+				for( auto &stream : mStreams )
+					stream.second.sendWindow += delta;
+				mPeerInitialWindow = value;
+			}
+			break;
+			case http2::Setting::MAX_FRAME_SIZE:
+				if( value < http2::defaultFrameSize || value > 0xffffff ) {
+					connection_error( http2::ErrorCode::PROTOCOL );
+					return;
+				}
+				mPeerMaxFrameSize = value;
+			break;
+			case http2::Setting::HEADER_TABLE_SIZE:
+				mEncoder.setMaxTableSize( value );
+			break;
+			// The header list limit is advisory, unknown settings must be ignored.
+			default: break;
+		}
+	}
+	write_frame( http2::FrameType::SETTINGS, http2::flags::ACK, 0, nullptr, 0 );
+	write_pending_data();
+	open_streams();
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::handle_ping()
+{
+	if( mFrameStream || mFramePayload.size() != 8 ) {
+		connection_error( mFrameStream ? http2::ErrorCode::PROTOCOL : http2::ErrorCode::FRAME_SIZE );
+		return;
+	}
+	if( ! ( mFrameFlags & http2::flags::ACK ) ) {
+		write_frame( http2::FrameType::PING, http2::flags::ACK, 0, mFramePayload.data(), mFramePayload.size() );
+		return;
+	}
+	auto id = ( uint64_t( http2::read32( mFramePayload.data() ) ) << 32 ) | http2::read32( mFramePayload.data() + 4 );
+	auto it = std::find_if( mPings.begin(), mPings.end(), [id]( const Ping &ping ) { return ping.id == id; } );
+	if( it == mPings.end() )
+		return;
+	auto ping = std::move( *it );
+	mPings.erase( it );
+	ping.handler( asio::error_code(), std::chrono::steady_clock::now() - ping.sent );
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::handle_goaway()
+{
+	if( mFrameStream || mFramePayload.size() < 8 ) {
+		connection_error( http2::ErrorCode::PROTOCOL );
+		return;
+	}
+	auto lastStream = http2::read32( mFramePayload.data() ) & 0x7fffffff;
+	auto code = http2::read32( mFramePayload.data() + 4 );
+	if( code )
+		CI_LOG_W( "Server is going away, error " << code );
+	mGoingAway = true;
+	// Streams above the last one the server processed are safe to send again elsewhere.
+	std::vector<Http2Request> requests;
+	for( auto it = mStreams.upper_bound( lastStream ); it != mStreams.end(); )  {
+		requests.push_back( std::move( it->second.entry ) );
+		it = mStreams.erase( it );
+	}
+	for( auto &entry : mPending )
+		requests.push_back( std::move( entry ) );
+	mPending.clear();
+	retry( std::move( requests ) );
+	finish_if_idle();
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::handle_window_update()
+{
+	if( mFramePayload.size() != 4 ) {
+		connection_error( http2::ErrorCode::FRAME_SIZE );
+		return;
+	}
+	auto increment = http2::read32( mFramePayload.data() ) & 0x7fffffff;
+	if( ! mFrameStream ) {
+		mSendWindow += increment;
+		if( ! increment || mSendWindow > http2::maxWindowSize ) {
+			connection_error( increment ? http2::ErrorCode::FLOW_CONTROL : http2::ErrorCode::PROTOCOL );
+			return;
+		}
+		write_pending_data();
+		return;
+	}
+	auto it = mStreams.find( mFrameStream );
+	if( it == mStreams.end() )
+		return;
+	auto &stream = it->second;
+	stream.sendWindow += increment;
+	if( ! increment || stream.sendWindow > http2::maxWindowSize ) {
+		reset_stream( it, increment ? http2::ErrorCode::FLOW_CONTROL : http2::ErrorCode::PROTOCOL,
+					  http::errc::http2_protocol_error );
+		return;
+	}
+	write_data( it->first, stream );
+}
+
+template<typename SessionType>
+bool Http2Connection<SessionType>::consume_window( uint32_t streamId, size_t size )
+{
+	// What's left of a window is what was advertised less what hasn't been acknowledged yet,
+	// a server sending more is in breach of flow control, RFC 7540 section 6.9.1.
+	if( uint64_t( mUnacknowledged ) + size > connectionWindowSize ) {
+		connection_error( http2::ErrorCode::FLOW_CONTROL );
+		return false;
+	}
+	// Updates go out in batches of half a window, often enough to never stall the server.
+	mUnacknowledged += static_cast<uint32_t>( size );
+	if( mUnacknowledged >= connectionWindowSize / 2 ) {
+		write_window_update( 0, mUnacknowledged );
+		mUnacknowledged = 0;
+	}
+	auto it = mStreams.find( streamId );
+	if( it == mStreams.end() )
+		return true;
+	auto &stream = it->second;
+	if( uint64_t( stream.unacknowledged ) + size > streamWindowSize ) {
+		reset_stream( it, http2::ErrorCode::FLOW_CONTROL, http::errc::http2_protocol_error );
+		return false;
+	}
+	if( mFrameFlags & http2::flags::END_STREAM )
+		return true;
+	stream.unacknowledged += static_cast<uint32_t>( size );
+	if( stream.unacknowledged >= streamWindowSize / 2 ) {
+		write_window_update( streamId, stream.unacknowledged );
+		stream.unacknowledged = 0;
+	}
+	return true;
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::open_streams()
+{
+	// Nothing may be written ahead of the connection preface.
+	while( mStarted && ! mPending.empty() && ! mGoingAway && ! mClosed && mStreams.size() < mPeerMaxConcurrent ) {
+		// Stream ids can't be reused, a long lived connection eventually runs out of them.
+		if( mNextStreamId > 0x7fffffff ) {
+			std::vector<Http2Request> requests( std::make_move_iterator( mPending.begin() ),
+												std::make_move_iterator( mPending.end() ) );
+			mPending.clear();
+			mGoingAway = true;
+			retry( std::move( requests ) );
+			finish_if_idle();
+			return;
+		}
+		auto entry = std::move( mPending.front() );
+		mPending.pop_front();
+		open_stream( std::move( entry ) );
+	}
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::open_stream( Http2Request entry )
+{
+	auto streamId = mNextStreamId;
+	mNextStreamId += 2;
+	auto &stream = mStreams[streamId];
+	stream.entry = std::move( entry );
+	stream.response = std::make_shared<Response>();
+	stream.sendWindow = mPeerInitialWindow;
+	
+	auto &request = *stream.entry.request;
+	auto &url = *request.getUrl();
+	auto &content = request.getHeaders().getContent();
+	bool compressed = request.isContentCompressed();
+	if( content && content->getSize() ) {
+		stream.bodyData = static_cast<const uint8_t*>( content->getData() );
+		stream.bodySize = content->getSize();
+#if defined( USING_ZLIB )
+		// DATA frames delimit the body, so it can be compressed whole up front.
+		if( compressed ) {
+			Deflater deflater( request.getCompressionLevel() );
+			if( deflater.encode( stream.bodyData, stream.bodySize, true, stream.body ) ) {
+				stream.bodyData = stream.body.data();
+				stream.bodySize = stream.body.size();
+			}
+			else {
+				// Sent as it is then, without the content-encoding claiming otherwise.
+				stream.body.clear();
+				compressed = false;
+			}
+		}
+#endif
+	}
+	
+	HeaderSet::Headers headers;
+	headers.emplace_back( ":method", request.getRequestMethod( request.getRequestMethod() ) );
+	headers.emplace_back( ":scheme", url.protocol() );
+	headers.emplace_back( ":authority", url.to_string( Url::host_component | Url::port_component ) );
+	headers.emplace_back( ":path", url.to_string( Url::path_component | Url::query_component ) );
+	for( auto &header : request.getHeaders().getHeaders() ) {
+		auto name = header.first;
+		std::transform( name.begin(), name.end(), name.begin(), ::tolower );
+		if( http2::isConnectionSpecific( name ) || ( compressed && name == "content-length" ) )
+			continue;
+		headers.emplace_back( std::move( name ), header.second );
+	}
+	if( compressed )
+		headers.emplace_back( "content-encoding", "gzip" );
+	
+	// The priority fields lead the block, no dependency and the weight less one.
+	std::vector<uint8_t> block( 5, 0 );
+	block[4] = static_cast<uint8_t>( std::min<uint16_t>( std::max<uint16_t>( stream.entry.weight, 1 ), 256 ) - 1 );
+	mEncoder.encode( headers, block );
+	
+	// Blocks larger than a frame continue in CONTINUATION frames, nothing may come between.
+	uint8_t endStream = stream.bodySize ? 0 : http2::flags::END_STREAM;
+	size_t offset = 0;
+	do {
+		auto size = std::min<size_t>( block.size() - offset, mPeerMaxFrameSize );
+		uint8_t endHeaders = offset + size == block.size() ? http2::flags::END_HEADERS : 0;
+		if( ! offset )
+			write_frame( http2::FrameType::HEADERS, http2::flags::PRIORITY | endStream | endHeaders,
+						 streamId, block.data(), size );
+		else
+			write_frame( http2::FrameType::CONTINUATION, endHeaders, streamId, block.data() + offset, size );
+		offset += size;
+	} while( offset < block.size() );
+	
+	write_data( streamId, stream );
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::write_data( uint32_t streamId, Stream &stream )
+{
+	// Send as much of the body as both windows allow, WINDOW_UPDATE picks up the rest.
+	while( stream.bodyOffset < stream.bodySize ) {
+		auto window = std::min( stream.sendWindow, mSendWindow );
+		if( window <= 0 )
+			return;
+		auto size = std::min<size_t>( std::min<size_t>( stream.bodySize - stream.bodyOffset, size_t( window ) ),
+									  mPeerMaxFrameSize );
+		bool last = stream.bodyOffset + size == stream.bodySize;
+		write_frame( http2::FrameType::DATA, last ? http2::flags::END_STREAM : 0, streamId,
+					 stream.bodyData + stream.bodyOffset, size );
+		stream.bodyOffset += size;
+		stream.sendWindow -= size;
+		mSendWindow -= size;
+	}
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::write_pending_data()
+{
+	// Heavier streams get the shared connection window first.
+	std::vector<typename Streams::iterator> waiting;
+	for( auto it = mStreams.begin(); it != mStreams.end(); ++it )
+		if( it->second.bodyOffset < it->second.bodySize )
+			waiting.push_back( it );
+	std::stable_sort( waiting.begin(), waiting.end(),
+	[]( typename Streams::iterator a, typename Streams::iterator b ) {
+		return a->second.entry.weight > b->second.entry.weight;
+	});
+	for( auto it : waiting )
+		write_data( it->first, it->second );
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::write_frame( http2::FrameType type, uint8_t flags, uint32_t streamId,
+												const uint8_t *payload, size_t size )
+{
+	if( mClosed )
+		return;
+	std::vector<uint8_t> frame( 9 + size );
+	frame[0] = uint8_t( size >> 16 );
+	frame[1] = uint8_t( size >> 8 );
+	frame[2] = uint8_t( size );
+	frame[3] = uint8_t( type );
+	frame[4] = flags;
+	http2::write32( streamId & 0x7fffffff, frame.data() + 5 );
+	if( size )
+		memcpy( frame.data() + 9, payload, size );
+	mWriteQueue.push_back( std::move( frame ) );
+	if( ! mWriting )
+		write_next();
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::write_window_update( uint32_t streamId, uint32_t increment )
+{
+	uint8_t payload[4];
+	http2::write32( increment & 0x7fffffff, payload );
+	write_frame( http2::FrameType::WINDOW_UPDATE, 0, streamId, payload, sizeof( payload ) );
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::write_next()
+{
+	// Everything queued so far goes out in one gathered write.
+	mWriteBuffers.clear();
+	for( auto &frame : mWriteQueue )
+		mWriteBuffers.push_back( asio::buffer( frame ) );
+	mWriting = mWriteQueue.size();
+	asio::async_write( mSession->socket, mWriteBuffers,
+					   asio::transfer_all(),
+					   std::bind( &Http2Connection<SessionType>::on_write,
+								  this->shared_from_this(),
+								  std::placeholders::_1 ) );
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::on_write( asio::error_code ec )
+{
+	if( ec ) {
+		mWriting = 0;
+		fail( ec );
+		return;
+	}
+	mWriteQueue.erase( mWriteQueue.begin(), mWriteQueue.begin() + mWriting );
+	mWriting = 0;
+	if( ! mWriteQueue.empty() )
+		write_next();
+	else if( mClosed )
+		close_socket();
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::complete( typename Streams::iterator it )
+{
+#if defined( USING_ZLIB )
+	// A compressed body that ends before its stream does was cut short.
+	auto &inflater = it->second.inflater;
+	if( inflater && inflater->hasInput() && ! inflater->isFinished() ) {
+		reset_stream( it, http2::ErrorCode::CANCEL, http::errc::malformed_response_content );
+		return;
+	}
+#endif
+	auto stream = std::move( it->second );
+	mStreams.erase( it );
+	auto &response = stream.response;
+	auto &buf = response->getContent();
+	auto size = stream.content.size();
+	buf = ci::Buffer::create( size );
+	if( size )
+		memcpy( buf->getData(), stream.content.data(), size );
+	
+	if( is_success( *response ) )
+		stream.entry.responseHandler( asio::error_code(), response );
+	else
+		mSession->errorHandler( make_error_code( static_cast<http::errc::errc_t>( response->statusCode ) ),
+								stream.entry.request->getUrl(), response );
+	open_streams();
+	finish_if_idle();
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::reset_stream( typename Streams::iterator it, http2::ErrorCode code,
+												 asio::error_code ec )
+{
+	uint8_t payload[4];
+	http2::write32( uint32_t( code ), payload );
+	write_frame( http2::FrameType::RST_STREAM, 0, it->first, payload, sizeof( payload ) );
+	auto stream = std::move( it->second );
+	mStreams.erase( it );
+	mSession->errorHandler( ec, stream.entry.request->getUrl(), stream.response );
+	open_streams();
+	finish_if_idle();
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::retry( std::vector<Http2Request> requests )
+{
+	if( requests.empty() )
+		return;
+	mSession->get_io_service().post( std::bind( &SessionType::onRetry, mSession, std::move( requests ) ) );
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::go_away( http2::ErrorCode code )
+{
+	if( mClosed )
+		return;
+	uint8_t payload[8];
+	http2::write32( 0, payload );
+	http2::write32( uint32_t( code ), payload + 4 );
+	write_frame( http2::FrameType::GOAWAY, 0, 0, payload, sizeof( payload ) );
+	mGoingAway = mClosed = true;
+	mSession->get_io_service().post( std::bind( &SessionType::onClose, mSession ) );
+	if( ! mWriting )
+		close_socket();
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::connection_error( http2::ErrorCode code )
+{
+	CI_LOG_E( "HTTP/2 connection error " << uint32_t( code ) );
+	go_away( code );
+	abort_streams( http::errc::http2_protocol_error );
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::fail( asio::error_code ec )
+{
+	// Closing the socket fails the read that's still out, that one is expected.
+	if( mClosed )
+		return;
+	mGoingAway = mClosed = true;
+	close_socket();
+	mSession->get_io_service().post( std::bind( &SessionType::onClose, mSession ) );
+	abort_streams( ec );
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::abort_streams( asio::error_code ec )
+{
+	auto streams = std::move( mStreams );
+	auto pending = std::move( mPending );
+	auto pings = std::move( mPings );
+	mStreams.clear();
+	mPending.clear();
+	mPings.clear();
+	for( auto &stream : streams )
+		mSession->errorHandler( ec, stream.second.entry.request->getUrl(), stream.second.response );
+	for( auto &entry : pending )
+		mSession->errorHandler( ec, entry.request->getUrl(), nullptr );
+	for( auto &ping : pings )
+		ping.handler( ec, std::chrono::steady_clock::duration() );
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::finish_if_idle()
+{
+	if( mStreams.empty() && mPending.empty() )
+		go_away( http2::ErrorCode::NONE );
+}
+
+template<typename SessionType>
+void Http2Connection<SessionType>::close_socket()
+{
+	asio::error_code ignored;
+	mSession->socket.lowest_layer().close( ignored );
+}
+	
+} // detail
+
+using Http2SessionRef = std::shared_ptr<class Http2Session>;
+
+//! Runs requests to one host as concurrent HTTP/2 streams over a single plain TCP connection.
+//! There is no negotiation, the server has to be known to speak cleartext HTTP/2 ("h2c" with
+//! prior knowledge, RFC 7540 section 3.4). The connection closes once every request added
+//! so far has been answered.
+class Http2Session : public std::enable_shared_from_this<Http2Session> {
+public:
+	
+	Http2Session( UrlRef url, ErrorHandler errorHandler,
+				  asio::io_service &io_service = ci::app::App::get()->io_service() )
+	: io_service( io_service ), socket( io_service ), errorHandler( errorHandler ),
+	mSessionUrl( url ) {}
+	~Http2Session() = default;
+	
+	asio::io_service&	get_io_service() { return io_service; }
+	const UrlRef&		getUrl() const { return mSessionUrl; }
+	
+	const asio::ip::tcp::endpoint&	getEndpoint() const { return endpoint; }
+	
+	//! Queues /a request as a stream of /a weight, 1 to 256, relative to its siblings. Its
+	//! response goes to /a responseHandler. Requests added while the connection is up are
+	//! sent right away. Returns false if the request is for another host.
+	bool add( RequestRef request, ResponseHandler responseHandler, uint16_t weight = 16 )
+	{
+		if( ! request || ! request->getUrl() )
+			return false;
+		auto &url = *request->getUrl();
+		if( url.protocol() != mSessionUrl->protocol() || url.host() != mSessionUrl->host() ||
+		    url.port() != mSessionUrl->port() )
+			return false;
+		dispatch( { std::move( request ), std::move( responseHandler ), weight, 0 } );
+		return true;
+	}
+	
+	void start()
+	{
+		if( mState != State::IDLE )
+			return;
+		mState = State::CONNECTING;
+		std::make_shared<detail::Connector<Http2Session>>(
+			shared_from_this(), socket )->start();
+	}
+	
+	void start( asio::ip::tcp::endpoint endpoint )
+	{
+		if( mState != State::IDLE )
+			return;
+		mState = State::CONNECTING;
+		std::make_shared<detail::Connector<Http2Session>>(
+			shared_from_this(), socket )->start( endpoint );
+	}
+	
+	//! Sends a PING over the connection, /a handler receives the round trip time
+	void ping( PingHandler handler )
+	{
+		if( mConnection )
+			mConnection->ping( std::move( handler ) );
+		else
+			handler( asio::error::not_connected, std::chrono::steady_clock::duration() );
+	}
+	
+private:
+	enum class State {
+		IDLE,
+		CONNECTING,
+		OPEN,
+		CLOSED
+	};
+	
+	void dispatch( detail::Http2Request entry )
+	{
+		switch( mState ) {
+			case State::IDLE:
+			case State::CONNECTING:
+				pending.push_back( std::move( entry ) );
+			break;
+			case State::OPEN:
+				mConnection->submit( std::move( entry ) );
+			break;
+			case State::CLOSED:
+				onRetry( { std::move( entry ) } );
+			break;
+		}
+	}
+	
+	void onOpen( asio::error_code ec )
+	{
+		std::make_shared<detail::Handshaker<Http2Session>>(
+			shared_from_this() )->handshake();
+	}
+	void onHandshake( asio::error_code ec )
+	{
+		// With prior knowledge the preface goes out as soon as the socket is connected.
+		mState = State::OPEN;
+		mConnection = std::make_shared<detail::Http2Connection<Http2Session>>( shared_from_this() );
+		for( auto &entry : pending )
+			mConnection->submit( std::move( entry ) );
+		pending.clear();
+		mConnection->start();
+	}
+	
+	void onError( asio::error_code ec )
+	{
+		mState = State::CLOSED;
+		for( auto &entry : pending )
+			errorHandler( ec, entry.request->getUrl(), nullptr );
+		pending.clear();
+	}
+	
+	//! Sends requests the server never processed again on a new connection. There's no
+	//! HTTP/1.1 to fall back to without negotiation, so after a few tries they fail.
+	void onRetry( std::vector<detail::Http2Request> requests )
+	{
+		if( mAttempt >= 2 ) {
+			for( auto &entry : requests )
+				errorHandler( http::errc::http2_stream_reset, entry.request->getUrl(), nullptr );
+			return;
+		}
+		auto session = std::make_shared<Http2Session>( mSessionUrl, errorHandler, io_service );
+		session->mAttempt = mAttempt + 1;
+		for( auto &entry : requests )
+			session->dispatch( std::move( entry ) );
+		session->start( endpoint );
+	}
+	
+	void onClose()
+	{
+		mState = State::CLOSED;
+		mConnection.reset();
+	}
+	
+	asio::io_service		&io_service;
+	asio::ip::tcp::socket	socket;
+	
+	ErrorHandler		errorHandler;
+	std::vector<detail::Http2Request>	pending;
+	std::shared_ptr<detail::Http2Connection<Http2Session>>	mConnection;
+	State				mState{State::IDLE};
+	uint32_t			mAttempt{0};
+	
+	UrlRef					mSessionUrl;
+	asio::ip::tcp::endpoint	endpoint;
+	
+	friend struct detail::Connector<Http2Session>;
+	friend struct detail::Handshaker<Http2Session>;
+	friend struct detail::Http2Connection<Http2Session>;
+};
+
+#if defined( USING_SSL )
+
+using Http2SslSessionRef = std::shared_ptr<class Http2SslSession>;
+
+//! Runs requests to one host as concurrent HTTP/2 streams over a single TLS connection.
+//! "h2" is offered through ALPN during the handshake; if the server picks HTTP/1.1 instead,
+//! the requests are pipelined on that connection where possible and otherwise sent on
+//! their own SslSession.
+//! The connection closes once every request added so far has been answered.
+class Http2SslSession : public std::enable_shared_from_this<Http2SslSession> {
+public:
+	
+	Http2SslSession( UrlRef url, ErrorHandler errorHandler,
+					 asio::io_service &io_service = ci::app::App::get()->io_service() )
+	: io_service( io_service ), context(asio::ssl::context::tlsv12_client),
+	socket( io_service, context ), errorHandler( errorHandler ), mSessionUrl( url )
+	{
+		context.set_default_verify_paths();
+		auto host = mSessionUrl->host();
+		socket.set_verify_callback(asio::ssl::rfc2818_verification{host});
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+		// Offer h2 first, with HTTP/1.1 for servers that don't speak it.
+		static const unsigned char protocols[] = "\x02h2\x08http/1.1";
+		SSL_set_alpn_protos( socket.native_handle(), protocols, sizeof( protocols ) - 1 );
+#endif
+	}
+	~Http2SslSession() = default;
+	
+	asio::io_service&	get_io_service() { return io_service; }
+	const UrlRef&		getUrl() const { return mSessionUrl; }
+	
+	const asio::ip::tcp::endpoint&	getEndpoint() const { return endpoint; }
+	
+	//! Returns whether the server agreed to HTTP/2
+	bool isHttp2() const { return mState == State::HTTP2; }
+	
+	//! Queues /a request as a stream of /a weight, 1 to 256, relative to its siblings. Its
+	//! response goes to /a responseHandler. Requests added while the connection is up are
+	//! sent right away. Returns false if the request is for another host.
+	bool add( RequestRef request, ResponseHandler responseHandler, uint16_t weight = 16 )
+	{
+		if( ! request || ! request->getUrl() )
+			return false;
+		auto &url = *request->getUrl();
+		if( url.protocol() != mSessionUrl->protocol() || url.host() != mSessionUrl->host() ||
+		    url.port() != mSessionUrl->port() )
+			return false;
+		dispatch( { std::move( request ), std::move( responseHandler ), weight, 0 } );
+		return true;
+	}
+	
+	void start()
+	{
+		if( mState != State::IDLE )
+			return;
+		mState = State::CONNECTING;
+		std::make_shared<detail::Connector<Http2SslSession>>(
+			shared_from_this(), socket.next_layer() )->start();
+	}
+	
+	//! Sends a PING over the connection, /a handler receives the round trip time
+	void ping( PingHandler handler )
+	{
+		if( mConnection )
+			mConnection->ping( std::move( handler ) );
+		else
+			handler( asio::error::not_connected, std::chrono::steady_clock::duration() );
+	}
+	
+private:
+	enum class State {
+		IDLE,
+		CONNECTING,
+		HTTP2,
+		HTTP1,
+		CLOSED
+	};
+	
+	void dispatch( detail::Http2Request entry )
+	{
+		switch( mState ) {
+			case State::IDLE:
+			case State::CONNECTING:
+				pending.push_back( std::move( entry ) );
+			break;
+			case State::HTTP2:
+				mConnection->submit( std::move( entry ) );
+			break;
+			case State::HTTP1:
+				std::make_shared<SslSession>( entry.request, entry.responseHandler,
+											  errorHandler, io_service )->start();
+			break;
+			case State::CLOSED:
+				onRetry( { std::move( entry ) } );
+			break;
+		}
+	}
+	
+	void onOpen( asio::error_code ec )
+	{
+		std::make_shared<detail::Handshaker<Http2SslSession>>(
+			shared_from_this() )->handshake();
+	}
+	void onHandshake( asio::error_code ec )
+	{
+		const unsigned char *selected = nullptr;
+		unsigned int length = 0;
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+		SSL_get0_alpn_selected( socket.native_handle(), &selected, &length );
+#endif
+		if( length != 2 || memcmp( selected, "h2", 2 ) ) {
+			fallback();
+			return;
+		}
+		mState = State::HTTP2;
+		mConnection = std::make_shared<detail::Http2Connection<Http2SslSession>>( shared_from_this() );
+		for( auto &entry : pending )
+			mConnection->submit( std::move( entry ) );
+		pending.clear();
+		mConnection->start();
+	}
+	
+	void onError( asio::error_code ec )
+	{
+		mState = State::CLOSED;
+		for( auto &entry : pending )
+			errorHandler( ec, entry.request->getUrl(), nullptr );
+		pending.clear();
+	}
+	
+	//! Sends requests the server never processed again on a new connection. After a few
+	//! tries they go over HTTP/1.1 instead.
+	void onRetry( std::vector<detail::Http2Request> requests )
+	{
+		if( mAttempt >= 2 ) {
+			for( auto &entry : requests ) {
+				CI_LOG_I( "HTTP/2 retries exhausted, sending " << entry.request->getUrl()->to_string() << " on its own" );
+				std::make_shared<SslSession>( entry.request, entry.responseHandler,
+											  errorHandler, io_service )->start();
+			}
+			return;
+		}
+		auto session = std::make_shared<Http2SslSession>( mSessionUrl, errorHandler, io_service );
+		session->mAttempt = mAttempt + 1;
+		for( auto &entry : requests )
+			session->dispatch( std::move( entry ) );
+		session->start();
+	}
+	
+	void onClose()
+	{
+		mState = State::CLOSED;
+		mConnection.reset();
+	}
+	
+	//! The server chose HTTP/1.1, the connection goes on to a pipeline of what can be
+	//! pipelined and the rest is sent on sessions of its own
+	void fallback()
+	{
+		CI_LOG_I( "Server didn't negotiate h2, falling back to HTTP/1.1" );
+		mState = State::HTTP1;
+		// The stream lives in this session, which the pipeline keeps alive through it.
+		auto pipeline = std::make_shared<SslPipeline>( mSessionUrl, errorHandler,
+													   std::shared_ptr<SslPipeline::Stream>( shared_from_this(), &socket ), io_service );
+		bool pipelined = false;
+		for( auto &entry : pending ) {
+			if( pipeline->add( entry.request, entry.responseHandler ) )
+				pipelined = true;
+			else
+				std::make_shared<SslSession>( entry.request, entry.responseHandler,
+											  errorHandler, io_service )->start();
+		}
+		pending.clear();
+		if( pipelined )
+			pipeline->start();
+		else {
+			asio::error_code ignored;
+			socket.lowest_layer().close( ignored );
+		}
+	}
+	
+	asio::io_service	&io_service;
+	asio::ssl::context	context;
+	asio::ssl::stream<asio::ip::tcp::socket> socket;
+	
+	ErrorHandler		errorHandler;
+	std::vector<detail::Http2Request>	pending;
+	std::shared_ptr<detail::Http2Connection<Http2SslSession>>	mConnection;
+	State				mState{State::IDLE};
+	uint32_t			mAttempt{0};
+	
+	UrlRef					mSessionUrl;
+	asio::ip::tcp::endpoint	endpoint;
+	
+	friend struct detail::Connector<Http2SslSession>;
+	friend struct detail::Handshaker<Http2SslSession>;
+	friend struct detail::Http2Connection<Http2SslSession>;
+};
+
+#endif
+
+}} // http // cinder
@@ -184,6 +184,118 @@ bool parse_http_status_line(Iterator begin, Iterator end,
   return false;
 }
 
+template <typename Iterator>
+bool parse_http_request_line(Iterator begin, Iterator end,
+    std::string& method, std::string& target,
+    uint32_t& version_major, uint32_t& version_minor)
+{
+  enum
+  {
+    method_start,
+    method_name,
+    target_start,
+    target_char,
+    http_version_h,
+    http_version_t_1,
+    http_version_t_2,
+    http_version_p,
+    http_version_slash,
+    http_version_major_start,
+    http_version_major,
+    http_version_minor_start,
+    http_version_minor,
+    linefeed,
+    fail
+  } state = method_start;
+
+  Iterator iter = begin;
+  while (iter != end && state != fail)
+  {
+    char c = *iter++;
+    switch (state)
+    {
+    case method_start:
+    case method_name:
+      if (c == ' ' && state == method_name)
+        state = target_start;
+      else if (!is_char(c) || is_ctl(c) || is_tspecial(c))
+        state = fail;
+      else
+      {
+        method.push_back(c);
+        state = method_name;
+      }
+      break;
+    case target_start:
+    case target_char:
+      if (c == ' ' && state == target_char)
+        state = http_version_h;
+      else if (!is_char(c) || is_ctl(c) || c == ' ')
+        state = fail;
+      else
+      {
+        target.push_back(c);
+        state = target_char;
+      }
+      break;
+    case http_version_h:
+      state = (c == 'H') ? http_version_t_1 : fail;
+      break;
+    case http_version_t_1:
+      state = (c == 'T') ? http_version_t_2 : fail;
+      break;
+    case http_version_t_2:
+      state = (c == 'T') ? http_version_p : fail;
+      break;
+    case http_version_p:
+      state = (c == 'P') ? http_version_slash : fail;
+      break;
+    case http_version_slash:
+      state = (c == '/') ? http_version_major_start : fail;
+      break;
+    case http_version_major_start:
+      if (is_digit(c))
+      {
+        version_major = version_major * 10 + c - '0';
+        state = http_version_major;
+      }
+      else
+        state = fail;
+      break;
+    case http_version_major:
+      if (c == '.')
+        state = http_version_minor_start;
+      else if (is_digit(c))
+        version_major = version_major * 10 + c - '0';
+      else
+        state = fail;
+      break;
+    case http_version_minor_start:
+      if (is_digit(c))
+      {
+        version_minor = version_minor * 10 + c - '0';
+        state = http_version_minor;
+      }
+      else
+        state = fail;
+      break;
+    case http_version_minor:
+      if (c == '\r')
+        state = linefeed;
+      else if (is_digit(c))
+        version_minor = version_minor * 10 + c - '0';
+      else
+        state = fail;
+      break;
+    case linefeed:
+      return (c == '\n');
+    default:
+      return false;
+    }
+  }
+  return false;
+}
+
 template <typename Iterator>
 bool parse_http_headers(Iterator begin, Iterator end,
     std::string& content_type, std::size_t& content_length,
@@ -0,0 +1,334 @@
+//
+//  pipeline.hpp
+//  Cinder-HTTP
+//
+//
+
+#pragma once
+
+#include "http.hpp"
+
+namespace cinder {
+namespace http {
+	
+//! Returns whether /a method is idempotent, which makes it safe to pipeline and to retry
+inline bool isIdempotent( RequestMethod method )
+{
+	switch( method ) {
+		case RequestMethod::GET:
+		case RequestMethod::HEAD:
+		case RequestMethod::PUT:
+		case RequestMethod::DEL:
+		case RequestMethod::OPTIONS: return true;
+		default: return false;
+	}
+}
+
+namespace detail {
+	
+//! Returns whether /a request can share a pipelined connection to /a url
+inline bool isPipelinable( const Request &request, const Url &url )
+{
+	auto &requestUrl = request.getUrl();
+	return isIdempotent( request.getRequestMethod() ) && ! request.isExpectContinue() &&
+		requestUrl && requestUrl->protocol() == url.protocol() &&
+		requestUrl->host() == url.host() && requestUrl->port() == url.port();
+}
+
+//! Returns whether /a ec is a status the server answered with, rather than a failure of
+//! the connection or of parsing the response
+inline bool isStatusError( const asio::error_code &ec )
+{
+	return ec.category() == http::error_category() && ec.value() >= http::errc::continue_request;
+}
+	
+} // detail
+
+using PipelineRef = std::shared_ptr<class Pipeline>;
+
+//! Writes several idempotent requests to one host back to back on a single connection and
+//! hands each response to its own ResponseHandler, in order. If the pipeline breaks, the
+//! requests that didn't get an answer are retried one by one on their own Session.
+//! Responses must be delimited by Content-Length or chunked encoding.
+class Pipeline : public std::enable_shared_from_this<Pipeline> {
+public:
+	
+	Pipeline( UrlRef url, ErrorHandler errorHandler,
+			  asio::io_service &io_service = ci::app::App::get()->io_service() )
+	: io_service( io_service ), socket( io_service ), errorHandler( errorHandler ),
+	mSessionUrl( url ) {}
+	~Pipeline() = default;
+	
+	asio::io_service&	get_io_service() { return io_service; }
+	const UrlRef&		getUrl() const { return mSessionUrl; }
+	
+	const asio::ip::tcp::endpoint&	getEndpoint() const { return endpoint; }
+	
+	//! Queues /a request, its response goes to /a responseHandler. Returns false if the request
+	//! can't be pipelined, because its method isn't idempotent, it expects "100 Continue"
+	//! or it is for another host.
+	bool add( RequestRef request, ResponseHandler responseHandler )
+	{
+		if( ! request || ! detail::isPipelinable( *request, *mSessionUrl ) )
+			return false;
+		entries.push_back( { std::move( request ), std::move( responseHandler ) } );
+		return true;
+	}
+	
+	void start()
+	{
+		if( entries.empty() )
+			return;
+		std::make_shared<detail::Connector<Pipeline>>(
+			shared_from_this(), socket )->start();
+	}
+	
+private:
+	struct Entry {
+		RequestRef		request;
+		ResponseHandler	responseHandler;
+	};
+	
+	void onOpen( asio::error_code ec )
+	{
+		std::make_shared<detail::Handshaker<Pipeline>>(
+			shared_from_this() )->handshake();
+	}
+	void onHandshake( asio::error_code ec )
+	{
+		writeNext();
+	}
+	void onRequest( asio::error_code ec )
+	{
+		// Don't wait for the response, the next request goes out right away.
+		if( ++sent < entries.size() )
+			writeNext();
+		if( ! reading )
+			readNext();
+	}
+	void onResponse( asio::error_code ec )
+	{
+		reading = false;
+		entries[answered++].responseHandler( ec, response );
+		if( answered < sent )
+			readNext();
+		else if( answered == entries.size() )
+			socket.close( ec );
+	}
+	
+	void onError( asio::error_code ec )
+	{
+		// Closing the socket fails whatever else is in flight, only handle the first error.
+		if( failed )
+			return;
+		failed = true;
+		asio::error_code ignored;
+		socket.close( ignored );
+		
+		auto retryFrom = answered;
+		if( detail::isStatusError( ec ) && answered < entries.size() ) {
+			// The server did answer this one, it just wasn't a success.
+			errorHandler( ec, entries[answered].request->getUrl(), response );
+			++retryFrom;
+		}
+		for( auto i = retryFrom; i < entries.size(); ++i ) {
+			auto &entry = entries[i];
+			CI_LOG_I( "Pipeline failed, retrying " << entry.request->getUrl()->to_string() << " on its own" );
+			std::make_shared<Session>( entry.request, entry.responseHandler,
+									   errorHandler, io_service )->start();
+		}
+	}
+	
+	void writeNext()
+	{
+		// Keep the connection open until the last request, which lets the server close it.
+		// The requests themselves are left as the caller made them.
+		Connection connection( sent + 1 < entries.size() ? Connection::Type::KEEP_ALIVE : Connection::Type::CLOSE );
+		std::make_shared<detail::Requester<Pipeline>>(
+			shared_from_this(), entries[sent].request, &connection )->request();
+	}
+	void readNext()
+	{
+		reading = true;
+		request = entries[answered].request;
+		std::make_shared<detail::Responder<Pipeline>>(
+			shared_from_this() )->read();
+	}
+	
+	asio::io_service	&io_service;
+	asio::ip::tcp::socket	socket;
+	
+	ErrorHandler		errorHandler;
+	std::vector<Entry>	entries;
+	size_t				sent{0}, answered{0};
+	bool				reading{false}, failed{false};
+	RequestRef			request;
+	ResponseRef			response;
+	asio::streambuf		replyBuffer;
+	
+	UrlRef					mSessionUrl;
+	asio::ip::tcp::endpoint	endpoint;
+	
+	friend struct detail::Connector<Pipeline>;
+	friend struct detail::Handshaker<Pipeline>;
+	friend struct detail::Requester<Pipeline>;
+	friend struct detail::Responder<Pipeline>;
+};
+
+#if defined( USING_SSL )
+
+using SslPipelineRef = std::shared_ptr<class SslPipeline>;
+
+//! The TLS counterpart of Pipeline, failed requests are retried on their own SslSession.
+class SslPipeline : public std::enable_shared_from_this<SslPipeline> {
+public:
+	using Stream = asio::ssl::stream<asio::ip::tcp::socket>;
+	
+	SslPipeline( UrlRef url, ErrorHandler errorHandler,
+				 asio::io_service &io_service = ci::app::App::get()->io_service() )
+	: io_service( io_service ), context(asio::ssl::context::tlsv12_client),
+	mStream( std::make_shared<Stream>( io_service, context ) ), socket( *mStream ),
+	errorHandler( errorHandler ), mSessionUrl( url )
+	{
+		context.set_default_verify_paths();
+		auto host = mSessionUrl->host();
+		socket.set_verify_callback(asio::ssl::rfc2818_verification{host});
+	}
+	//! Pipelines over /a stream, a connection to the host of /a url whose handshake is done
+	//! already, instead of opening one of its own
+	SslPipeline( UrlRef url, ErrorHandler errorHandler, std::shared_ptr<Stream> stream,
+				 asio::io_service &io_service = ci::app::App::get()->io_service() )
+	: io_service( io_service ), context(asio::ssl::context::tlsv12_client),
+	mStream( std::move( stream ) ), socket( *mStream ), errorHandler( errorHandler ),
+	mSessionUrl( url ), mConnected( true )
+	{
+		asio::error_code ignored;
+		endpoint = socket.lowest_layer().remote_endpoint( ignored );
+	}
+	~SslPipeline() = default;
+	
+	asio::io_service&	get_io_service() { return io_service; }
+	const UrlRef&		getUrl() const { return mSessionUrl; }
+	
+	const asio::ip::tcp::endpoint&	getEndpoint() const { return endpoint; }
+	
+	//! Queues /a request, its response goes to /a responseHandler. Returns false if the request
+	//! can't be pipelined, because its method isn't idempotent, it expects "100 Continue"
+	//! or it is for another host.
+	bool add( RequestRef request, ResponseHandler responseHandler )
+	{
+		if( ! request || ! detail::isPipelinable( *request, *mSessionUrl ) )
+			return false;
+		entries.push_back( { std::move( request ), std::move( responseHandler ) } );
+		return true;
+	}
+	
+	void start()
+	{
+		if( entries.empty() )
+			return;
+		if( mConnected )
+			writeNext();
+		else
+			std::make_shared<detail::Connector<SslPipeline>>(
+				shared_from_this(), socket.next_layer() )->start();
+	}
+	
+private:
+	struct Entry {
+		RequestRef		request;
+		ResponseHandler	responseHandler;
+	};
+	
+	void onOpen( asio::error_code ec )
+	{
+		std::make_shared<detail::Handshaker<SslPipeline>>(
+			shared_from_this() )->handshake();
+	}
+	void onHandshake( asio::error_code ec )
+	{
+		writeNext();
+	}
+	void onRequest( asio::error_code ec )
+	{
+		// Don't wait for the response, the next request goes out right away.
+		if( ++sent < entries.size() )
+			writeNext();
+		if( ! reading )
+			readNext();
+	}
+	void onResponse( asio::error_code ec )
+	{
+		reading = false;
+		entries[answered++].responseHandler( ec, response );
+		if( answered < sent )
+			readNext();
+		else if( answered == entries.size() )
+			socket.lowest_layer().close( ec );
+	}
+	
+	void onError( asio::error_code ec )
+	{
+		// Closing the socket fails whatever else is in flight, only handle the first error.
+		if( failed )
+			return;
+		failed = true;
+		asio::error_code ignored;
+		socket.lowest_layer().close( ignored );
+		
+		auto retryFrom = answered;
+		if( detail::isStatusError( ec ) && answered < entries.size() ) {
+			// The server did answer this one, it just wasn't a success.
+			errorHandler( ec, entries[answered].request->getUrl(), response );
+			++retryFrom;
+		}
+		for( auto i = retryFrom; i < entries.size(); ++i ) {
+			auto &entry = entries[i];
+			CI_LOG_I( "Pipeline failed, retrying " << entry.request->getUrl()->to_string() << " on its own" );
+			std::make_shared<SslSession>( entry.request, entry.responseHandler,
+										  errorHandler, io_service )->start();
+		}
+	}
+	
+	void writeNext()
+	{
+		// Keep the connection open until the last request, which lets the server close it.
+		// The requests themselves are left as the caller made them.
+		Connection connection( sent + 1 < entries.size() ? Connection::Type::KEEP_ALIVE : Connection::Type::CLOSE );
+		std::make_shared<detail::Requester<SslPipeline>>(
+			shared_from_this(), entries[sent].request, &connection )->request();
+	}
+	void readNext()
+	{
+		reading = true;
+		request = entries[answered].request;
+		std::make_shared<detail::Responder<SslPipeline>>(
+			shared_from_this() )->read();
+	}
+	
+	asio::io_service	&io_service;
+	asio::ssl::context	context;
+	std::shared_ptr<Stream>	mStream;
+	Stream				&socket;
+	
+	ErrorHandler		errorHandler;
+	std::vector<Entry>	entries;
+	size_t				sent{0}, answered{0};
+	bool				reading{false}, failed{false};
+	RequestRef			request;
+	ResponseRef			response;
+	asio::streambuf		replyBuffer;
+	
+	UrlRef					mSessionUrl;
+	asio::ip::tcp::endpoint	endpoint;
+	bool					mConnected{false};
+	
+	friend struct detail::Connector<SslPipeline>;
+	friend struct detail::Handshaker<SslPipeline>;
+	friend struct detail::Requester<SslPipeline>;
+	friend struct detail::Responder<SslPipeline>;
+};
+
+#endif
+
+}} // http // cinder
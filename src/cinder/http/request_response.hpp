@@ -4,24 +4,43 @@
 #include <string>
 #include <algorithm>
 #include <memory>
+#include <chrono>
+#include <functional>
 
 #include "url.hpp"
 #include "headers.hpp"
+#include "error_codes.hpp"
+#include "parsers.hpp"
 #include "cinder/Base64.h"
+#if defined( USING_ZLIB )
+#include "compression.hpp"
+#endif
 
 namespace cinder {
 namespace http {
 	
 enum class RequestMethod {
 	GET,
-	POST
+	HEAD,
+	POST,
+	PUT,
+	PATCH,
+	//! Named DEL because DELETE is a macro in winnt.h
+	DEL,
+	OPTIONS
 };
 	
 using RequestRef = std::shared_ptr<struct Request>;
+using ResponseRef = std::shared_ptr<struct Response>;
+
+//! Receives a response's content as it comes off the socket, decoded. Called once without
+//! data as soon as the headers are in.
+using ContentHandler = std::function<void( const ResponseRef &response, const uint8_t *data, size_t size )>;
 
 struct Request {
 	//! Constructs the request with /a requestMethod and /a url. Also, sets two 
-	//! headers, "Accepts: */*" and "Connection: close"
+	//! headers, "Accepts: */*" and "Connection: close". With zlib available it also
+	//! asks for "Accept-Encoding: gzip, deflate", the Responder decodes the body.
 	Request( RequestMethod requestMethod, const UrlRef &requestUrl );
 	Request();
 
@@ -36,7 +55,7 @@ struct Request {
 	void setUrl( UrlRef request_url ) { requestUrl = request_url; }
 
 	//! Returns the RequestMethod of this request
-	RequestMethod getRequestMethod() { return requestMethod; }
+	RequestMethod getRequestMethod() const { return requestMethod; }
 	//! Sets the RequestMethod of this request
 	void setRequestMethod( RequestMethod method ) { requestMethod = method; }
 	//! Returns a const char* translation of the RequestMethod
@@ -44,7 +63,12 @@ struct Request {
 	{
 		switch( method ) {
 			case RequestMethod::GET: return "GET"; break;
+			case RequestMethod::HEAD: return "HEAD"; break;
 			case RequestMethod::POST: return "POST"; break;
+			case RequestMethod::PUT: return "PUT"; break;
+			case RequestMethod::PATCH: return "PATCH"; break;
+			case RequestMethod::DEL: return "DELETE"; break;
+			case RequestMethod::OPTIONS: return "OPTIONS"; break;
 			default: return "GET"; break;
 		}
 	}
@@ -54,20 +78,76 @@ struct Request {
 	
 	template<typename T>
 	void appendHeader( T header );
+	
+	//! Enables or disables "Expect: 100-continue" for this request. When enabled and the
+	//! request has content, the body is held back until the server answers with "100 Continue"
+	//! or /a timeout elapses. A final status received before that aborts the upload.
+	void setExpectContinue( bool enable, std::chrono::milliseconds timeout = std::chrono::milliseconds( 1000 ) );
+	//! Returns whether this request waits for "100 Continue" before writing its content
+	bool isExpectContinue() const { return expectContinue; }
+	//! Returns how long the request waits for "100 Continue" before writing its content anyway
+	std::chrono::milliseconds getExpectContinueTimeout() const { return expectContinueTimeout; }
 
-	//! Processes the request for output
-	void process( std::ostream &request_buffer ) const;
+	//! Enables or disables gzip compression of this request's content at /a level, 0 to 9.
+	//! Compressed content is sent with "Content-Encoding: gzip" using chunked transfer
+	//! encoding, as its length isn't known until it has been written.
+	void setContentCompression( bool enable, int level = 6 ) { compressContent = enable; compressionLevel = level; }
+	//! Returns whether this request's content will be gzip compressed on the way out
+	bool isContentCompressed() const;
+	//! Returns the zlib compression level used for this request's content
+	int getCompressionLevel() const { return compressionLevel; }
+	
+	//! Streams the response's content to /a handler as it arrives instead of collecting it,
+	//! for responses that never end or are too large to hold. The content of the response
+	//! handed to the ResponseHandler is then empty.
+	void setContentHandler( ContentHandler handler ) { contentHandler = std::move( handler ); }
+	//! Returns the handler the response's content is streamed to, if any
+	const ContentHandler& getContentHandler() const { return contentHandler; }
+	
+	//! Revalidates /a response, received earlier for the same request. Its ETag and
+	//! Last-Modified go out as If-None-Match and If-Modified-Since, unless the request has
+	//! its own, and a "304 Not Modified" hands /a response over again, with the headers the
+	//! 304 carried, instead of failing.
+	void setPriorResponse( ResponseRef response ) { priorResponse = std::move( response ); }
+	//! Returns the response this request revalidates, if any
+	const ResponseRef& getPriorResponse() const { return priorResponse; }
+	
+	//! Processes the request for output, with /a connection in place of its own Connection
+	//! header if not null
+	void process( std::ostream &request_buffer, const Connection *connection = nullptr ) const;
+	//! Processes only the request line and headers for output
+	void processHeaders( std::ostream &request_buffer, const Connection *connection = nullptr ) const;
+	//! Processes the request line and headers, those of gzip compressed content if /a compressed
+	void processHeaders( std::ostream &request_buffer, bool compressed, const Connection *connection = nullptr ) const;
 
 	RequestMethod	requestMethod;
 	UrlRef			requestUrl;
 	uint32_t		versionMajor,
 					versionMinor;
 	HeaderSet 		headerSet;
+	bool			expectContinue{false};
+	std::chrono::milliseconds expectContinueTimeout{1000};
+	bool			compressContent{false};
+	int				compressionLevel{6};
+	ContentHandler	contentHandler;
+	ResponseRef		priorResponse;
 };
 
-using ResponseRef = std::shared_ptr<struct Response>;
+using FileContentRef = std::shared_ptr<struct FileContent>;
+
+//! A region of an open file a Server sends as a response's content, from the kernel with
+//! sendfile(2) where there is one. /a handle keeps the descriptor open until it's sent.
+struct FileContent {
+	int						fd{-1};
+	uint64_t				offset{0},
+							size{0};
+	std::shared_ptr<void>	handle;
+};
 
 struct Response {
+	Response() = default;
+	//! Constructs an HTTP/1.1 response with /a statusCode, for a server to send
+	Response( uint32_t statusCode ) : statusCode( statusCode ), versionMajor( 1 ), versionMinor( 1 ) {}
 	
 	//! Returns a pair of uint32_t representing the major, minor version number of HTTP
 	std::pair<uint32_t, uint32_t> getVersion() const { return{ versionMajor, versionMinor }; }
@@ -75,23 +155,45 @@ struct Response {
 	void setVersion( uint32_t major, uint32_t minor ) { versionMajor = major; versionMinor = minor; }
 	
 	uint32_t getStatusCode() const { return statusCode; }
+	void setStatusCode( uint32_t code ) { statusCode = code; }
 	
 	HeaderSet& getHeaders() { return headerSet; }
 	const HeaderSet& getHeaders() const { return headerSet; }
 	
+	template<typename T>
+	void appendHeader( T header ) { headerSet.appendHeader( std::move( header ) ); }
+	
 	ci::BufferRef& getContent() { return headerSet.getContent(); }
 	const ci::BufferRef& getContent() const { return headerSet.getContent(); }
 	
-	uint32_t	statusCode{0},
-				versionMajor{0},
-				versionMinor{0};
-	HeaderSet	headerSet;
+	//! Sends /a file as the content instead of the buffer, only a Server writes it
+	void setFileContent( FileContentRef file ) { fileContent = std::move( file ); }
+	const FileContentRef& getFileContent() const { return fileContent; }
+	
+	//! Processes the response for output
+	void process( std::ostream &response_stream ) const;
+	//! Processes only the status line and headers for output
+	void processHeaders( std::ostream &response_stream ) const;
+	
+	uint32_t		statusCode{0},
+					versionMajor{0},
+					versionMinor{0};
+	HeaderSet		headerSet;
+	FileContentRef	fileContent;
 };
 
+inline Request::Request()
+: requestMethod( RequestMethod::GET ), versionMajor( 1 ), versionMinor( 1 )
+{
+}
+
 inline Request::Request( RequestMethod requestMethod, const UrlRef &requestUrl )
 : requestMethod( requestMethod ), requestUrl( requestUrl ),
 	versionMajor( 1 ), versionMinor( 1 )
 {
+#if defined( USING_ZLIB )
+	headerSet.appendHeader( AcceptEncoding() );
+#endif
 }
 	
 template<typename T>
@@ -100,7 +202,55 @@ inline void Request::appendHeader( T header )
 	headerSet.appendHeader( std::move( header ) );
 }
 
-inline void Request::process( std::ostream &request_stream ) const
+inline void Request::setExpectContinue( bool enable, std::chrono::milliseconds timeout )
+{
+	expectContinue = enable;
+	expectContinueTimeout = timeout;
+	if( enable )
+		headerSet.appendHeader( Expect() );
+	else
+		headerSet.removeHeader( Expect::key() );
+}
+
+inline bool Request::isContentCompressed() const
+{
+#if defined( USING_ZLIB )
+	auto &content = headerSet.getContent();
+	return compressContent && content && content->getSize() > 0;
+#else
+	return false;
+#endif
+}
+
+inline void Request::process( std::ostream &request_stream, const Connection *connection ) const
+{
+	auto content = headerSet.getContent();
+#if defined( USING_ZLIB )
+	if( isContentCompressed() ) {
+		// Written as a single chunk followed by the last-chunk marker.
+		std::vector<uint8_t> compressed;
+		detail::Deflater deflater( compressionLevel );
+		if( deflater.encode( static_cast<const uint8_t*>( content->getData() ), content->getSize(), true, compressed ) ) {
+			processHeaders( request_stream, true, connection );
+			request_stream << std::hex << compressed.size() << std::dec << "\r\n";
+			request_stream.write( reinterpret_cast<const char*>( compressed.data() ), compressed.size() );
+			request_stream << "\r\n0\r\n\r\n";
+			return;
+		}
+		// Sent as it is then, without the Content-Encoding claiming otherwise.
+	}
+#endif
+	processHeaders( request_stream, false, connection );
+	if( content )
+		request_stream.write( static_cast< const char* >( content->getData() ), content->getSize() );
+}
+
+inline void Request::processHeaders( std::ostream &request_stream, const Connection *connection ) const
+{
+	processHeaders( request_stream, isContentCompressed(), connection );
+}
+
+inline void Request::processHeaders( std::ostream &request_stream, bool compressed, const Connection *connection ) const
 {
 	request_stream << getRequestMethod( requestMethod ) << " ";
 	request_stream << requestUrl->to_string( Url::path_component | Url::query_component );
@@ -109,12 +259,37 @@ inline void Request::process( std::ostream &request_stream ) const
 	request_stream << requestUrl->to_string( Url::host_component | Url::port_component );
 	request_stream << "\r\n";
 	for( auto &header : headerSet.getHeaders() ) {
+		// The compressed length isn't known up front, chunked encoding replaces it.
+		if( compressed && header.first == Content::Length::key() )
+			continue;
+		if( connection && urdl::detail::headers_equal( header.first, Connection::key() ) )
+			continue;
 		request_stream << header.first << ": " << header.second << "\r\n";
 	}
+	if( connection )
+		request_stream << Connection::key() << ": " << connection->value() << "\r\n";
+	if( compressed ) {
+		request_stream << ContentEncoding::key() << ": " << ContentEncoding( TransferEncoding::Type::GZIP ).value() << "\r\n";
+		request_stream << TransferEncoding::key() << ": " << TransferEncoding( TransferEncoding::Type::CHUNKED ).value() << "\r\n";
+	}
+	if( priorResponse ) {
+		static const std::pair<const char*, const char*> conditions[] = {
+			{ "ETag", "If-None-Match" }, { "Last-Modified", "If-Modified-Since" }
+		};
+		auto hasHeader = []( const HeaderSet &headers, const char *name ) -> const HeaderSet::Header* {
+			for( auto &header : headers.getHeaders() ) {
+				if( urdl::detail::headers_equal( header.first, name ) )
+					return &header;
+			}
+			return nullptr;
+		};
+		for( auto &condition : conditions ) {
+			auto validator = hasHeader( priorResponse->getHeaders(), condition.first );
+			if( validator && ! hasHeader( headerSet, condition.second ) )
+				request_stream << condition.second << ": " << validator->second << "\r\n";
+		}
+	}
 	request_stream << "\r\n";
-	auto content = headerSet.getContent();
-	if( content )
-		request_stream.write( static_cast< const char* >( content->getData() ), content->getSize() );
 }
 	
 inline std::ostream& operator<<( std::ostream &stream, const Request &request )
@@ -123,5 +298,27 @@ inline std::ostream& operator<<( std::ostream &stream, const Request &request )
 	return stream;
 }
 
+inline void Response::process( std::ostream &response_stream ) const
+{
+	processHeaders( response_stream );
+	auto &content = headerSet.getContent();
+	if( content )
+		response_stream.write( static_cast< const char* >( content->getData() ), content->getSize() );
+}
+
+inline void Response::processHeaders( std::ostream &response_stream ) const
+{
+	response_stream << "HTTP/" << versionMajor << "." << versionMinor << " " << statusCode << " ";
+	response_stream << http::error_category().message( static_cast<int>( statusCode ) ) << "\r\n";
+	response_stream << headerSet;
+	response_stream << "\r\n";
+}
+
+inline std::ostream& operator<<( std::ostream &stream, const Response &response )
+{
+	response.process( stream );
+	return stream;
+}
+	
 } // http
 } // cinder
@@ -13,22 +13,52 @@
 #endif
 
 #include "url.hpp"
+#include "parsers.hpp"
+#include "error_codes.hpp"
 #include "request_response.hpp"
 #include "asio/asio.hpp"
 
+#include <array>
+#include <sstream>
+
 namespace cinder {
 namespace http { namespace detail {
 	
+//! Returns whether /a statusCode is that of an interim response, which a final one follows.
+//! A "101 Switching Protocols" is final, what follows it isn't HTTP anymore.
+inline bool isInterimStatus( uint32_t statusCode )
+{
+	return statusCode >= http::errc::continue_request && statusCode < http::errc::ok &&
+		   statusCode != http::errc::switching_protocols;
+}
+
 template<typename SessionType>
 struct Requester : std::enable_shared_from_this<Requester<SessionType>> {
 public:
-	Requester( std::shared_ptr<SessionType> session, RequestRef request )
-	: mSession( session ), mRequest( std::move( request ) ) {}
+	//! Writes /a request, with /a connection in place of its own Connection header if not null
+	Requester( std::shared_ptr<SessionType> session, RequestRef request, const Connection *connection = nullptr )
+	: mSession( session ), mRequest( std::move( request ) ),
+		mContinueTimer( session->socket.get_io_service() ),
+		mConnection( connection ? new Connection( *connection ) : nullptr ) {}
 	
 	void request()
 	{
 		std::ostream request_stream( &mRequestBuffer );
-		mRequest->process( request_stream );
+		auto &content = mRequest->getHeaders().getContent();
+		if( content && content->getSize() > 0 &&
+		    ( mRequest->isExpectContinue() || mRequest->isContentCompressed() ) ) {
+			// Only send the headers, the body either waits on the server's "100 Continue"
+			// or is compressed as it's written.
+			mRequest->processHeaders( request_stream, mConnection.get() );
+			asio::async_write(this->mSession->socket, mRequestBuffer,
+							  asio::transfer_all(),
+							  std::bind( &Requester<SessionType>::on_request_headers,
+										this->shared_from_this(),
+										std::placeholders::_1 ) );
+			return;
+		}
+		
+		mRequest->process( request_stream, mConnection.get() );
 		
 		asio::async_write(this->mSession->socket, mRequestBuffer,
 						  asio::transfer_all(),
@@ -38,6 +68,13 @@ public:
 	}
 	
 private:
+	enum class BodyState {
+		WAITING,
+		WRITING,
+		WRITTEN,
+		ABORTED
+	};
+	
 	void on_request( asio::error_code ec )
 	{
 		if( !ec ) {
@@ -49,9 +86,217 @@ private:
 				std::bind( &SessionType::onError, mSession, ec ) );
 	}
 	
+	void on_request_headers( asio::error_code ec )
+	{
+		if( ec ) {
+			fail( ec );
+			return;
+		}
+		if( ! mRequest->isExpectContinue() ) {
+			write_body();
+			return;
+		}
+		mReadingStatus = true;
+		mContinueTimer.expires_from_now( mRequest->getExpectContinueTimeout() );
+		mContinueTimer.async_wait( std::bind( &Requester<SessionType>::on_continue_timeout,
+											  this->shared_from_this(),
+											  std::placeholders::_1 ) );
+		asio::async_read_until( mSession->socket, mSession->replyBuffer, "\r\n",
+							    std::bind( &Requester<SessionType>::on_read_continue_status,
+										   this->shared_from_this(),
+										   std::placeholders::_1,
+										   std::placeholders::_2 ) );
+	}
+	
+	void on_continue_timeout( asio::error_code ec )
+	{
+		// The server didn't answer in time, which per RFC 7231 means we send the body anyway.
+		if( ec == asio::error::operation_aborted || mBodyState != BodyState::WAITING )
+			return;
+		write_body();
+	}
+	
+	void on_read_continue_status( asio::error_code ec, size_t bytes_transferred )
+	{
+		if( ec ) {
+			fail( ec );
+			return;
+		}
+		uint32_t versionMajor = 0, versionMinor = 0, statusCode = 0;
+		auto begIt = asio::buffers_begin( mSession->replyBuffer.data() );
+		if( ! urdl::detail::parse_http_status_line( begIt, begIt + bytes_transferred,
+												   versionMajor, versionMinor, statusCode ) ) {
+			fail( http::errc::malformed_status_line );
+			return;
+		}
+		
+		if( isInterimStatus( statusCode ) ) {
+			// Discard the interim response, it only carries headers we don't need. Any other
+			// than "100 Continue", like "103 Early Hints", leaves us waiting.
+			mSession->replyBuffer.consume( bytes_transferred );
+			asio::async_read_until( mSession->socket, mSession->replyBuffer, "\r\n",
+								    std::bind( &Requester<SessionType>::on_read_continue_header,
+											   this->shared_from_this(),
+											   std::placeholders::_1,
+											   std::placeholders::_2,
+											   statusCode == http::errc::continue_request ) );
+			return;
+		}
+		
+		// A final status before the body means the server has already decided, leave the
+		// status line in the reply buffer for the Responder and don't upload anything.
+		mContinueTimer.cancel();
+		mReadingStatus = false;
+		if( mBodyState == BodyState::WAITING ) {
+			CI_LOG_I( "Server answered " << statusCode << " before upload, aborting body" );
+			mBodyState = BodyState::ABORTED;
+		}
+		finish();
+	}
+	
+	void on_read_continue_header( asio::error_code ec, size_t bytes_transferred, bool continued )
+	{
+		if( ec ) {
+			fail( ec );
+			return;
+		}
+		mSession->replyBuffer.consume( bytes_transferred );
+		// Keep reading until the empty line that ends the interim response.
+		if( bytes_transferred != 2 ) {
+			asio::async_read_until( mSession->socket, mSession->replyBuffer, "\r\n",
+								    std::bind( &Requester<SessionType>::on_read_continue_header,
+											   this->shared_from_this(),
+											   std::placeholders::_1,
+											   std::placeholders::_2,
+											   continued ) );
+			return;
+		}
+		if( ! continued ) {
+			asio::async_read_until( mSession->socket, mSession->replyBuffer, "\r\n",
+								    std::bind( &Requester<SessionType>::on_read_continue_status,
+											   this->shared_from_this(),
+											   std::placeholders::_1,
+											   std::placeholders::_2 ) );
+			return;
+		}
+		mContinueTimer.cancel();
+		mReadingStatus = false;
+		if( mBodyState == BodyState::WAITING )
+			write_body();
+		else
+			finish();
+	}
+	
+	void write_body()
+	{
+		mBodyState = BodyState::WRITING;
+#if defined( USING_ZLIB )
+		if( mRequest->isContentCompressed() ) {
+			mDeflater.reset( new Deflater( mRequest->getCompressionLevel() ) );
+			write_compressed_chunk();
+			return;
+		}
+#endif
+		auto &content = mRequest->getHeaders().getContent();
+		asio::async_write( mSession->socket,
+						   asio::buffer( content->getData(), content->getSize() ),
+						   asio::transfer_all(),
+						   std::bind( &Requester<SessionType>::on_write_body,
+									  this->shared_from_this(),
+									  std::placeholders::_1 ) );
+	}
+	
+#if defined( USING_ZLIB )
+	//! Deflates the next slices of the body and writes the output as one chunk, the last
+	//! one also carrying the chunked encoding's terminator.
+	void write_compressed_chunk()
+	{
+		const size_t sliceSize = 64 * 1024;
+		auto &content = mRequest->getHeaders().getContent();
+		auto data = static_cast<const uint8_t*>( content->getData() );
+		auto size = content->getSize();
+		
+		mCompressed.clear();
+		// Small slices of compressible data often produce no output yet, keep feeding.
+		while( mCompressed.empty() && mBodyOffset < size ) {
+			auto slice = std::min( sliceSize, size - mBodyOffset );
+			bool finish = mBodyOffset + slice == size;
+			if( ! mDeflater->encode( data + mBodyOffset, slice, finish, mCompressed ) ) {
+				fail( asio::error::invalid_argument );
+				return;
+			}
+			mBodyOffset += slice;
+		}
+		
+		std::ostringstream chunkHeader;
+		chunkHeader << std::hex << mCompressed.size() << "\r\n";
+		mChunkHeader = chunkHeader.str();
+		const char *chunkEnd = mBodyOffset == size ? "\r\n0\r\n\r\n" : "\r\n";
+		std::array<asio::const_buffer, 3> buffers = {{
+			asio::buffer( mChunkHeader ),
+			asio::buffer( mCompressed ),
+			asio::buffer( chunkEnd, strlen( chunkEnd ) )
+		}};
+		asio::async_write( mSession->socket, buffers,
+						   asio::transfer_all(),
+						   std::bind( &Requester<SessionType>::on_write_compressed_chunk,
+									  this->shared_from_this(),
+									  std::placeholders::_1 ) );
+	}
+	
+	void on_write_compressed_chunk( asio::error_code ec )
+	{
+		if( ! ec && mBodyOffset < mRequest->getHeaders().getContent()->getSize() )
+			write_compressed_chunk();
+		else
+			on_write_body( ec );
+	}
+#endif
+	
+	void on_write_body( asio::error_code ec )
+	{
+		if( ec ) {
+			fail( ec );
+			return;
+		}
+		mBodyState = BodyState::WRITTEN;
+		finish();
+	}
+	
+	//! Hands the connection to the Responder once the body is settled and nothing is
+	//! reading from the socket anymore.
+	void finish()
+	{
+		if( mFailed || mReadingStatus || mBodyState == BodyState::WRITING )
+			return;
+		mSession->socket.get_io_service().post(
+			std::bind( &SessionType::onRequest, mSession, asio::error_code() ) );
+	}
+	
+	void fail( asio::error_code ec )
+	{
+		if( mFailed )
+			return;
+		mFailed = true;
+		mContinueTimer.cancel();
+		mSession->socket.get_io_service().post(
+			std::bind( &SessionType::onError, mSession, ec ) );
+	}
+	
 	std::shared_ptr<SessionType>	mSession;
 	asio::streambuf					mRequestBuffer;
 	RequestRef						mRequest;
+	asio::steady_timer				mContinueTimer;
+	std::unique_ptr<Connection>		mConnection;
+	BodyState						mBodyState{BodyState::WAITING};
+	bool							mReadingStatus{false},
+									mFailed{false};
+#if defined( USING_ZLIB )
+	std::unique_ptr<Deflater>		mDeflater;
+	std::vector<uint8_t>			mCompressed;
+	std::string						mChunkHeader;
+	size_t							mBodyOffset{0};
+#endif
 };
 	
 } // detail
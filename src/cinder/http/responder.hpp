@@ -17,12 +17,84 @@
 #include "parsers.hpp"
 #include "error_codes.hpp"
 #include "request_response.hpp"
+#include "requester.hpp"
+#if defined( USING_ZLIB )
+#include "compression.hpp"
+#include "cache.hpp"
+#endif
+
+#include <algorithm>
 
 namespace cinder {
 namespace http {
 	
 namespace detail {
 	
+using ReplyIterator = asio::buffers_iterator<asio::streambuf::const_buffers_type>;
+
+//! Matches the empty line ending a header block, which is the very first line when a
+//! response has no headers at all
+inline std::pair<ReplyIterator, bool> match_end_of_headers( ReplyIterator begin, ReplyIterator end )
+{
+	static const char terminator[] = "\r\n\r\n";
+	if( end - begin >= 2 && begin[0] == '\r' && begin[1] == '\n' )
+		return { begin + 2, true };
+	auto found = std::search( begin, end, terminator, terminator + 4 );
+	if( found != end )
+		return { found + 4, true };
+	// Search again from the start next time, a resumed search could mistake the middle of
+	// the block for its start. Header blocks are small.
+	return { begin, false };
+}
+
+#if defined( USING_ZLIB )
+//! Returns an inflater undoing /a contentEncoding, the value of a Content-Encoding header,
+//! or nullptr if it's only "identity" or codings that can't be undone
+inline std::unique_ptr<Inflater> makeContentInflater( const std::string &contentEncoding )
+{
+	// Codings are listed in the order they were applied, only a single one is undone.
+	std::vector<std::string> codings;
+	for( auto &coding : cache::splitList( contentEncoding ) ) {
+		if( ! urdl::detail::headers_equal( coding, "identity" ) )
+			codings.push_back( coding );
+	}
+	if( codings.size() == 1 && ( urdl::detail::headers_equal( codings[0], "gzip" ) ||
+								 urdl::detail::headers_equal( codings[0], "x-gzip" ) ||
+								 urdl::detail::headers_equal( codings[0], "deflate" ) ) )
+		return std::unique_ptr<Inflater>( new Inflater );
+	if( ! codings.empty() )
+		CI_LOG_W( "Unsupported Content-Encoding: " << contentEncoding << ", content is left encoded" );
+	return nullptr;
+}
+#endif
+
+//! Returns /a prior, as revalidated by /a notModified. The "304 Not Modified" replaces the
+//! stored headers it carries, except those describing its own, empty, message.
+inline ResponseRef revalidated( const Response &prior, const Response &notModified )
+{
+	static const char *framing[] = {
+		"Content-Length", "Transfer-Encoding", "Content-Encoding", "Connection", "Keep-Alive"
+	};
+	auto response = std::make_shared<Response>( prior );
+	auto &headers = response->getHeaders().getHeaders();
+	for( auto &header : notModified.getHeaders().getHeaders() ) {
+		if( std::any_of( std::begin( framing ), std::end( framing ), [&]( const char *name ) {
+				return urdl::detail::headers_equal( header.first, name ); } ) )
+			continue;
+		auto existing = std::find_if( headers.begin(), headers.end(), [&]( const HeaderSet::Header &stored ) {
+			return urdl::detail::headers_equal( stored.first, header.first );
+		});
+		if( existing != headers.end() )
+			existing->second = header.second;
+		else
+			headers.push_back( header );
+	}
+	std::sort( headers.begin(), headers.end(), []( const HeaderSet::Header &a, const HeaderSet::Header &b ) {
+		return a.first < b.first;
+	});
+	return response;
+}
+	
 template<typename SessionType>
 struct Responder : std::enable_shared_from_this<Responder<SessionType>> {
 	Responder( std::shared_ptr<SessionType> session );
@@ -30,23 +102,42 @@ struct Responder : std::enable_shared_from_this<Responder<SessionType>> {
 	void read();
 private:
 	void on_read_status( asio::error_code ec, size_t lengthRead );
+	void on_read_interim_header( asio::error_code ec, size_t lengthRead );
 	void on_read_headers( asio::error_code ec, size_t lengthRead );
 	void on_read_content( asio::error_code ec, size_t lengthRead );
+	void on_read_content_length( asio::error_code ec, size_t lengthRead );
+	void on_read_encoded_content_length( asio::error_code ec, size_t lengthRead );
 	// chunk reading
 	void on_read_chunk_header( asio::error_code ec, size_t lengthRead );
 	void on_read_chunk( asio::error_code ec, size_t lengthRead );
 	void on_finalize_chunks( asio::error_code ec, size_t lengthRead );
 	
+	//! Returns false for responses that never carry a body, regardless of their headers
+	bool expects_content() const;
+	//! Returns whether the content has to go through consume_content as it arrives, because
+	//! it's decoded or streamed, rather than being read straight into the response
+	bool is_incremental() const;
+	//! Moves the accumulated content into the response and signals the session
+	void on_complete( asio::error_code ec );
+	//! Moves /a size bytes from the front of the reply buffer into the content, decoding
+	//! them on the way if needed. Signals the session and returns false on failure.
+	bool consume_content( size_t size );
+	
 	std::shared_ptr<SessionType>	mSession;
-	asio::streambuf			mReplyBuffer;
+	asio::streambuf			&mReplyBuffer;
 	ResponseRef			mResponse;
 	std::vector<uint8_t>		contentBuffer;
+	ContentHandler			mContentHandler;
 	size_t				writeHead{0}, content_length{0}, current_chunk_length{0};
+#if defined( USING_ZLIB )
+	std::unique_ptr<Inflater>	mInflater;
+#endif
 };
 
 template<typename SessionType>
 Responder<SessionType>::Responder( std::shared_ptr<SessionType> session )
-: mSession( std::move( session ) ), mResponse( std::make_shared<Response>() )
+: mSession( std::move( session ) ), mReplyBuffer( mSession->replyBuffer ),
+	mResponse( std::make_shared<Response>() )
 {
 	mSession->response = mResponse;
 }
@@ -80,13 +171,20 @@ void Responder<SessionType>::on_read_status( asio::error_code ec, size_t bytes_t
 		}
 		// Consume read bytes
 		mReplyBuffer.consume( bytes_transferred );
-		// TODO: figure out what he was doing here
-		// A "continue" header means we need to keep waiting.
-		if ( mResponse->statusCode != http::errc::continue_request ) {
+		// Interim responses like "100 Continue" are skipped, headers and all, up to the final status.
+		if ( isInterimStatus( mResponse->statusCode ) ) {
+			mResponse->versionMajor = mResponse->versionMinor = mResponse->statusCode = 0;
+			asio::async_read_until( mSession->socket, mReplyBuffer, "\r\n",
+								    std::bind( &Responder<SessionType>::on_read_interim_header,
+											   this->shared_from_this(),
+											   std::placeholders::_1,
+											   std::placeholders::_2 ) );
+		}
+		else {
 			// Read list of headers and save them. If there's anything left in the
 			// reply buffer afterwards, it's the start of the content returned by the
 			// HTTP server.
-			asio::async_read_until( mSession->socket, mReplyBuffer, "\r\n\r\n",
+			asio::async_read_until( mSession->socket, mReplyBuffer, match_end_of_headers,
 								    std::bind( &Responder<SessionType>::on_read_headers,
 											   this->shared_from_this(),
 											   std::placeholders::_1,
@@ -97,6 +195,26 @@ void Responder<SessionType>::on_read_status( asio::error_code ec, size_t bytes_t
 		mSession->socket.get_io_service().post(
 			std::bind( &SessionType::onError, mSession, ec ) );
 }
+
+template<typename SessionType>
+void Responder<SessionType>::on_read_interim_header( asio::error_code ec, size_t bytes_transferred )
+{
+	if( ! ec ) {
+		mReplyBuffer.consume( bytes_transferred );
+		// An empty line ends the interim response, anything else is one of its headers.
+		if( bytes_transferred == 2 )
+			read();
+		else
+			asio::async_read_until( mSession->socket, mReplyBuffer, "\r\n",
+								    std::bind( &Responder<SessionType>::on_read_interim_header,
+											   this->shared_from_this(),
+											   std::placeholders::_1,
+											   std::placeholders::_2 ) );
+	}
+	else
+		mSession->socket.get_io_service().post(
+			std::bind( &SessionType::onError, mSession, ec ) );
+}
 	
 template<typename SessionType>
 void Responder<SessionType>::on_read_headers( asio::error_code ec, size_t bytes_transferred )
@@ -115,8 +233,27 @@ void Responder<SessionType>::on_read_headers( asio::error_code ec, size_t bytes_
 			return;
 		}
 		
-		// Check the response code to see if we got the page correctly.
-		if (mResponse->statusCode != http::errc::ok)
+		auto &request = mSession->request;
+		if( mResponse->statusCode == http::errc::not_modified && request && request->getPriorResponse() ) {
+			// Still valid, the response revalidated comes back as if it had been sent again.
+			auto response = detail::revalidated( *request->getPriorResponse(), *mResponse );
+			mSession->response = response;
+			if( auto &contentHandler = request->getContentHandler() ) {
+				auto &content = response->getContent();
+				contentHandler( response, nullptr, 0 );
+				if( content && content->getSize() )
+					contentHandler( response, static_cast<const uint8_t*>( content->getData() ), content->getSize() );
+			}
+			mSession->socket.get_io_service().post(
+				std::bind( &SessionType::onResponse, mSession, ec ) );
+			return;
+		}
+		
+		// Check the response code to see if we got the page correctly. A "switching protocols"
+		// completes the exchange, the session takes the connection over from here.
+		if ( ( mResponse->statusCode < http::errc::ok &&
+			   mResponse->statusCode != http::errc::switching_protocols ) ||
+			 mResponse->statusCode >= http::errc::multiple_choices )
 			ec = make_error_code(static_cast<http::errc::errc_t>(mResponse->statusCode));
 		
 		if( ! ec ) {
@@ -126,16 +263,42 @@ void Responder<SessionType>::on_read_headers( asio::error_code ec, size_t bytes_
 				return a.first < b.first;
 			});
 			CI_LOG_D( mResponse->getHeaders() );
-			if( auto contentLengthHeader = mResponse->headerSet.findHeader( Content::Length::key() ) ) {
+			if( mSession->request && mSession->request->getContentHandler() ) {
+				mContentHandler = mSession->request->getContentHandler();
+				mContentHandler( mResponse, nullptr, 0 );
+			}
+#if defined( USING_ZLIB )
+			if( auto contentEncoding = mResponse->headerSet.findHeader( ContentEncoding::key() ) )
+				mInflater = makeContentInflater( contentEncoding->second );
+#endif
+			if( ! expects_content() ) {
+				// Nothing follows the headers, finish without touching the socket again.
+				on_complete( ec );
+			}
+			else if( auto contentLengthHeader = mResponse->headerSet.findHeader( Content::Length::key() ) ) {
 				content_length = atoi(contentLengthHeader->second.c_str());
-				if( content_length > 0 )
-					contentBuffer.reserve( content_length );
-				asio::async_read( mSession->socket, mReplyBuffer,
-								asio::transfer_all(),
-								std::bind( &Responder<SessionType>::on_read_content,
-										  this->shared_from_this(),
-										  std::placeholders::_1,
-										  std::placeholders::_2 ));
+				// Encoded or streamed content is handled as it arrives instead of being read in full first.
+				if( is_incremental() ) {
+					on_read_encoded_content_length( ec, 0 );
+					return;
+				}
+				// The length is known up front, so read straight into the response's buffer.
+				auto &buf = mResponse->getContent();
+				buf = ci::Buffer::create( content_length );
+				writeHead = std::min( content_length, mReplyBuffer.size() );
+				asio::buffer_copy( asio::buffer( buf->getData(), writeHead ), mReplyBuffer.data() );
+				mReplyBuffer.consume( writeHead );
+				if( writeHead < content_length )
+					asio::async_read( mSession->socket,
+									asio::buffer( static_cast<uint8_t*>( buf->getData() ) + writeHead,
+												  content_length - writeHead ),
+									std::bind( &Responder<SessionType>::on_read_content_length,
+											  this->shared_from_this(),
+											  std::placeholders::_1,
+											  std::placeholders::_2 ));
+				else
+					mSession->socket.get_io_service().post(
+						std::bind( &SessionType::onResponse, mSession, ec ) );
 			}
 			else if( auto transferEncoding = mResponse->headerSet.findHeader( TransferEncoding::key() ) ) {
 				asio::async_read_until( mSession->socket, mReplyBuffer, "\r\n",
@@ -165,11 +328,8 @@ void Responder<SessionType>::on_read_content( asio::error_code ec, size_t bytes_
 {
 	if ( ! ec ) {
 		// Write all of the data that has been read so far.
-		auto begIt = asio::buffers_begin( mReplyBuffer.data() );
-		// Copy out all data
-		contentBuffer.insert( contentBuffer.end(), begIt, begIt + bytes_transferred );
-		// Consume the response buffer
-		mReplyBuffer.consume(bytes_transferred);
+		if( ! consume_content( bytes_transferred ) )
+			return;
 		writeHead += bytes_transferred;
 		// Continue reading remaining data until EOF.
 		asio::async_read( mSession->socket, mReplyBuffer,
@@ -180,29 +340,17 @@ void Responder<SessionType>::on_read_content( asio::error_code ec, size_t bytes_
 									 std::placeholders::_2 ));
 	}
 	else if ( ec == asio::error::eof ) {
-		auto begIt = asio::buffers_begin( mReplyBuffer.data() );
-		auto endIt = asio::buffers_end( mReplyBuffer.data() );
 		// Copy out all data
-		contentBuffer.insert( contentBuffer.end(), begIt, endIt );
-		// Consume the response buffer
-		mReplyBuffer.consume(endIt - begIt);
-		auto &buf = mResponse->getContent();
-		auto size = contentBuffer.size();
-		buf = ci::Buffer::create( size );
-		memcpy( buf->getData(), contentBuffer.data(), size );
-		mSession->socket.get_io_service().post(
-			std::bind( &SessionType::onResponse, mSession, ec ) );
+		if( consume_content( mReplyBuffer.size() ) )
+			on_complete( ec );
 	}
 #if defined( USING_SSL )
 	// TODO: this is super hacky because there isn't a definition for short read and most are
 	// supposed to be ignored, new asio fixes this.
 	else if( ec.value() == 335544539 && bytes_transferred > 0 ) {
 		// Write all of the data that has been read so far.
-		auto begIt = asio::buffers_begin( mReplyBuffer.data() );
-		// Copy out all data
-		contentBuffer.insert( contentBuffer.end(), begIt, begIt + bytes_transferred );
-		// Consume the response buffer
-		mReplyBuffer.consume(bytes_transferred);
+		if( ! consume_content( bytes_transferred ) )
+			return;
 		writeHead += bytes_transferred;
 		// Continue reading remaining data until EOF.
 		asio::async_read( mSession->socket, mReplyBuffer,
@@ -214,20 +362,50 @@ void Responder<SessionType>::on_read_content( asio::error_code ec, size_t bytes_
 	}
 	else if( ec.value() == 335544539 ) {
 		// Write all of the data that has been read so far.
-		auto begIt = asio::buffers_begin( mReplyBuffer.data() );
-		auto endIt = asio::buffers_end( mReplyBuffer.data() );
 		// Copy out all data
-		contentBuffer.insert( contentBuffer.end(), begIt, endIt );
-		// Consume the response buffer
-		mReplyBuffer.consume(endIt - begIt);
-		auto &buf = mResponse->getContent();
-		auto size = contentBuffer.size();
-		buf = ci::Buffer::create( size );
-		memcpy( buf->getData(), contentBuffer.data(), size );
+		if( consume_content( mReplyBuffer.size() ) )
+			on_complete( ec );
+	}
+#endif
+	else {
+		mSession->socket.get_io_service().post(
+			std::bind( &SessionType::onError, mSession, ec ) );
+	}
+}
+
+template<typename SessionType>
+void Responder<SessionType>::on_read_content_length( asio::error_code ec, size_t bytes_transferred )
+{
+	if ( ! ec ) {
+		writeHead += bytes_transferred;
 		mSession->socket.get_io_service().post(
 			std::bind( &SessionType::onResponse, mSession, ec ) );
 	}
-#endif
+	else {
+		mSession->socket.get_io_service().post(
+			std::bind( &SessionType::onError, mSession, ec ) );
+	}
+}
+
+template<typename SessionType>
+void Responder<SessionType>::on_read_encoded_content_length( asio::error_code ec, size_t bytes_transferred )
+{
+	if ( ! ec ) {
+		// Only take what belongs to this response, anything after it stays in the buffer.
+		auto available = std::min( content_length - writeHead, mReplyBuffer.size() );
+		if( ! consume_content( available ) )
+			return;
+		writeHead += available;
+		if( writeHead < content_length )
+			asio::async_read( mSession->socket, mReplyBuffer,
+							  asio::transfer_at_least(1),
+							  std::bind( &Responder<SessionType>::on_read_encoded_content_length,
+										 this->shared_from_this(),
+										 std::placeholders::_1,
+										 std::placeholders::_2 ));
+		else
+			on_complete( ec );
+	}
 	else {
 		mSession->socket.get_io_service().post(
 			std::bind( &SessionType::onError, mSession, ec ) );
@@ -247,12 +425,17 @@ void Responder<SessionType>::on_read_chunk_header( asio::error_code ec, size_t b
 		ss >> current_chunk_length;
 		mReplyBuffer.consume( bytes_transferred );
 		if( current_chunk_length != 0 ) {
-			// Continue reading remaining data until EOF.
-			asio::async_read_until( mSession->socket, mReplyBuffer, "\r\n",
-							 std::bind( &Responder<SessionType>::on_read_chunk,
-									   this->shared_from_this(),
-									   std::placeholders::_1,
-									   std::placeholders::_2 ));
+			// The chunk is binary, read it by length along with its trailing CRLF.
+			auto needed = current_chunk_length + 2;
+			if( mReplyBuffer.size() >= needed )
+				on_read_chunk( ec, 0 );
+			else
+				asio::async_read( mSession->socket, mReplyBuffer,
+								 asio::transfer_exactly( needed - mReplyBuffer.size() ),
+								 std::bind( &Responder<SessionType>::on_read_chunk,
+										   this->shared_from_this(),
+										   std::placeholders::_1,
+										   std::placeholders::_2 ));
 		}
 		else {
 			// chunk is done.
@@ -274,13 +457,10 @@ void Responder<SessionType>::on_read_chunk( asio::error_code ec, size_t bytes_tr
 {
 	if ( ! ec ) {
 		// Write all of the data that has been read so far.
-		auto begIt = asio::buffers_begin( mReplyBuffer.data() );
-		if( current_chunk_length != bytes_transferred - 2 )
-			CI_LOG_W( "current_chunk_length: " << current_chunk_length << ", doesn't match bytes_transferred: " << bytes_transferred );
-		// Copy out all data
-		contentBuffer.insert( contentBuffer.end(), begIt, begIt + current_chunk_length );
-		// Consume the response buffer
-		mReplyBuffer.consume(bytes_transferred);
+		if( ! consume_content( current_chunk_length ) )
+			return;
+		// Drop the CRLF that ends the chunk.
+		mReplyBuffer.consume( 2 );
 		// Continue reading remaining data until EOF.
 		asio::async_read_until( mSession->socket, mReplyBuffer, "\r\n",
 							   std::bind( &Responder<SessionType>::on_read_chunk_header,
@@ -302,12 +482,7 @@ void Responder<SessionType>::on_finalize_chunks( asio::error_code ec, size_t byt
 		if( bytes_transferred != 2 )
 			CI_LOG_W( "In finalize and it's not 2 bytes. Instead, " << bytes_transferred );
 		mReplyBuffer.consume(bytes_transferred);
-		auto &buf = mResponse->getContent();
-		auto size = contentBuffer.size();
-		buf = ci::Buffer::create( size );
-		memcpy( buf->getData(), contentBuffer.data(), size );
-		mSession->socket.get_io_service().post(
-			std::bind( &SessionType::onResponse, mSession, ec ) );
+		on_complete( ec );
 		
 	}
 #if defined( USING_SSL )
@@ -318,12 +493,7 @@ void Responder<SessionType>::on_finalize_chunks( asio::error_code ec, size_t byt
 		contentBuffer.insert( contentBuffer.end(), begIt, endIt );
 		// Consume the response buffer
 		mReplyBuffer.consume(endIt - begIt);
-		auto &buf = mResponse->getContent();
-		auto size = contentBuffer.size();
-		buf = ci::Buffer::create( size );
-		memcpy( buf->getData(), contentBuffer.data(), size );
-		mSession->socket.get_io_service().post(
-			std::bind( &SessionType::onResponse, mSession, ec ) );
+		on_complete( ec );
 	}
 #endif
 	else {
@@ -332,6 +502,72 @@ void Responder<SessionType>::on_finalize_chunks( asio::error_code ec, size_t byt
 	}
 }
 	
+template<typename SessionType>
+bool Responder<SessionType>::expects_content() const
+{
+	auto &request = mSession->request;
+	if( request && request->getRequestMethod() == RequestMethod::HEAD )
+		return false;
+	auto status = mResponse->statusCode;
+	return ! ( status < http::errc::ok || status == http::errc::no_content ||
+			   status == http::errc::not_modified );
+}
+
+template<typename SessionType>
+bool Responder<SessionType>::is_incremental() const
+{
+#if defined( USING_ZLIB )
+	if( mInflater )
+		return true;
+#endif
+	return mContentHandler != nullptr;
+}
+
+template<typename SessionType>
+void Responder<SessionType>::on_complete( asio::error_code ec )
+{
+#if defined( USING_ZLIB )
+	// A compressed body that ends before its stream does was cut short.
+	if( mInflater && mInflater->hasInput() && ! mInflater->isFinished() ) {
+		ec = http::errc::malformed_response_content;
+		mSession->socket.get_io_service().post(
+			std::bind( &SessionType::onError, mSession, ec ) );
+		return;
+	}
+#endif
+	auto &buf = mResponse->getContent();
+	auto size = contentBuffer.size();
+	buf = ci::Buffer::create( size );
+	if( size )
+		memcpy( buf->getData(), contentBuffer.data(), size );
+	mSession->socket.get_io_service().post(
+		std::bind( &SessionType::onResponse, mSession, ec ) );
+}
+	
+template<typename SessionType>
+bool Responder<SessionType>::consume_content( size_t size )
+{
+	auto data = asio::buffer_cast<const uint8_t*>( mReplyBuffer.data() );
+	bool decoded = true;
+#if defined( USING_ZLIB )
+	if( mInflater )
+		decoded = mInflater->decode( data, size, contentBuffer );
+	else
+#endif
+		contentBuffer.insert( contentBuffer.end(), data, data + size );
+	mReplyBuffer.consume( size );
+	if( ! decoded ) {
+		asio::error_code ec = http::errc::malformed_response_content;
+		mSession->socket.get_io_service().post(
+			std::bind( &SessionType::onError, mSession, ec ) );
+	}
+	else if( mContentHandler && ! contentBuffer.empty() ) {
+		mContentHandler( mResponse, contentBuffer.data(), contentBuffer.size() );
+		contentBuffer.clear();
+	}
+	return decoded;
+}
+	
 } // detail
 } // http
 } // cinder
@@ -0,0 +1,219 @@
+//
+//  router.hpp
+//  Cinder-HTTP
+//
+//
+
+#pragma once
+
+#include "request_response.hpp"
+
+#include <array>
+
+namespace cinder {
+namespace http {
+	
+//! The values captured by a route's ":name" and "*name" segments, in the order they appear
+using RouteParams = std::vector<std::pair<std::string, std::string>>;
+
+//! Fills in /a response to /a request. The response starts out as an empty "200 OK".
+using RequestHandler = std::function<void( const RequestRef &request, const ResponseRef &response,
+										   const RouteParams &params )>;
+
+namespace detail {
+	
+//! A node of the router's radix tree. Its prefix is the run of path characters every route
+//! below it shares, so a lookup compares whole runs instead of walking a character at a time.
+struct RouteNode {
+	struct Route {
+		RequestHandler				handler;
+		std::vector<std::string>	names;
+	};
+	
+	std::string								prefix;
+	std::vector<std::unique_ptr<RouteNode>>	children;
+	//! The child matching any one segment, for a ":name" in the pattern
+	std::unique_ptr<RouteNode>				param;
+	//! The routes matching the rest of the path, for a "*name" ending the pattern
+	std::unique_ptr<RouteNode>				wildcard;
+	std::array<std::unique_ptr<Route>, 7>	routes;
+	
+	//! Returns the route for /a method, or any route if /a method is null
+	const Route* findRoute( const RequestMethod *method ) const
+	{
+		if( ! method ) {
+			auto found = std::find_if( routes.begin(), routes.end(), []( const std::unique_ptr<Route> &route ) {
+				return route != nullptr;
+			});
+			return found != routes.end() ? found->get() : nullptr;
+		}
+		auto &route = routes[static_cast<size_t>( *method )];
+		if( ! route && *method == RequestMethod::HEAD )
+			return routes[static_cast<size_t>( RequestMethod::GET )].get();
+		return route.get();
+	}
+};
+	
+} // detail
+
+//! Maps request paths to RequestHandlers with a radix tree. Patterns are literal paths in
+//! which a segment starting with ':' captures one segment of the path, and a final segment
+//! starting with '*' captures the rest of it. "/users/:id" matches "/users/42" with "id"
+//! as "42". A literal segment wins over a ":name" one, which wins over a "*name" one.
+class Router {
+public:
+	Router() : mRoot( new detail::RouteNode ) {}
+	
+	//! Routes /a method requests for paths matching /a pattern to /a handler, replacing the
+	//! handler of the same method and pattern if there is one. HEAD requests fall back to
+	//! the GET handler.
+	void add( RequestMethod method, const std::string &pattern, RequestHandler handler );
+	
+	//! Returns the handler for /a method and /a path, capturing into /a params, or nullptr.
+	//! /a path is matched in its escaped form, captured values are unescaped.
+	const RequestHandler* find( RequestMethod method, const std::string &path, RouteParams &params ) const;
+	//! Returns the methods there are routes for at /a path, empty if it matches no pattern
+	std::vector<RequestMethod> getMethods( const std::string &path ) const;
+	
+private:
+	detail::RouteNode* insert( detail::RouteNode *node, const char *begin, const char *end );
+	//! Returns the node routing /a method, or any method if it's null, at /a path from /a offset
+	const detail::RouteNode* match( const detail::RouteNode *node, const RequestMethod *method, const std::string &path,
+									size_t offset, std::vector<std::string> &values ) const;
+	
+	std::unique_ptr<detail::RouteNode> mRoot;
+};
+
+inline void Router::add( RequestMethod method, const std::string &pattern, RequestHandler handler )
+{
+	auto route = std::unique_ptr<detail::RouteNode::Route>( new detail::RouteNode::Route );
+	route->handler = std::move( handler );
+	
+	auto node = mRoot.get();
+	auto it = pattern.c_str(), end = it + pattern.size();
+	while( it < end ) {
+		if( *it == ':' || *it == '*' ) {
+			auto nameEnd = std::find( it, end, '/' );
+			route->names.emplace_back( it + 1, nameEnd );
+			auto &child = *it == ':' ? node->param : node->wildcard;
+			if( ! child )
+				child.reset( new detail::RouteNode );
+			node = child.get();
+			// Nothing can follow the rest of the path.
+			if( *it == '*' )
+				break;
+			it = nameEnd;
+			continue;
+		}
+		// The literal run up to the next capture.
+		auto literalEnd = it;
+		while( literalEnd < end && ! ( ( *literalEnd == ':' || *literalEnd == '*' ) && literalEnd[-1] == '/' ) )
+			++literalEnd;
+		node = insert( node, it, literalEnd );
+		it = literalEnd;
+	}
+	node->routes[static_cast<size_t>( method )] = std::move( route );
+}
+
+inline detail::RouteNode* Router::insert( detail::RouteNode *node, const char *begin, const char *end )
+{
+	while( begin < end ) {
+		auto childIt = std::find_if( node->children.begin(), node->children.end(),
+		[begin]( const std::unique_ptr<detail::RouteNode> &child ) {
+			return child->prefix[0] == *begin;
+		});
+		if( childIt == node->children.end() ) {
+			std::unique_ptr<detail::RouteNode> child( new detail::RouteNode );
+			child->prefix.assign( begin, end );
+			node->children.push_back( std::move( child ) );
+			return node->children.back().get();
+		}
+		
+		auto child = childIt->get();
+		auto &prefix = child->prefix;
+		size_t common = 0;
+		while( common < prefix.size() && begin + common < end && prefix[common] == begin[common] )
+			++common;
+		if( common < prefix.size() ) {
+			// Split the edge, the shared part becomes a node of its own.
+			std::unique_ptr<detail::RouteNode> split( new detail::RouteNode );
+			split->prefix = prefix.substr( 0, common );
+			prefix.erase( 0, common );
+			split->children.push_back( std::move( *childIt ) );
+			*childIt = std::move( split );
+			child = childIt->get();
+		}
+		node = child;
+		begin += common;
+	}
+	return node;
+}
+
+inline const detail::RouteNode* Router::match( const detail::RouteNode *node, const RequestMethod *method, const std::string &path,
+											   size_t offset, std::vector<std::string> &values ) const
+{
+	if( offset == path.size() && node->findRoute( method ) )
+		return node;
+	
+	if( offset < path.size() ) {
+		for( auto &child : node->children ) {
+			auto &prefix = child->prefix;
+			if( prefix[0] == path[offset] && ! path.compare( offset, prefix.size(), prefix ) ) {
+				if( auto found = match( child.get(), method, path, offset + prefix.size(), values ) )
+					return found;
+				break;
+			}
+		}
+		if( node->param ) {
+			auto segmentEnd = std::min( path.find( '/', offset ), path.size() );
+			if( segmentEnd > offset ) {
+				values.emplace_back( path, offset, segmentEnd - offset );
+				if( auto found = match( node->param.get(), method, path, segmentEnd, values ) )
+					return found;
+				values.pop_back();
+			}
+		}
+	}
+	if( node->wildcard && node->wildcard->findRoute( method ) ) {
+		values.emplace_back( path, offset, std::string::npos );
+		return node->wildcard.get();
+	}
+	return nullptr;
+}
+
+inline const RequestHandler* Router::find( RequestMethod method, const std::string &path, RouteParams &params ) const
+{
+	std::vector<std::string> values;
+	auto node = match( mRoot.get(), &method, path, 0, values );
+	if( ! node )
+		return nullptr;
+	auto found = node->findRoute( &method );
+	
+	params.clear();
+	for( size_t i = 0; i < values.size() && i < found->names.size(); ++i ) {
+		std::string value;
+		if( ! Url::unescape_path( values[i], value ) )
+			value = std::move( values[i] );
+		params.emplace_back( found->names[i], std::move( value ) );
+	}
+	return &found->handler;
+}
+
+inline std::vector<RequestMethod> Router::getMethods( const std::string &path ) const
+{
+	// Each method may be routed by a different pattern, only the error path gets here.
+	std::vector<RequestMethod> methods;
+	std::vector<std::string> values;
+	for( size_t i = 0; i < mRoot->routes.size(); ++i ) {
+		auto method = static_cast<RequestMethod>( i );
+		values.clear();
+		if( ! match( mRoot.get(), &method, path, 0, values ) )
+			continue;
+		// HEAD falls back to GET, it's only worth listing on its own.
+		if( method != RequestMethod::HEAD || methods.empty() || methods.front() != RequestMethod::GET )
+			methods.push_back( method );
+	}
+	return methods;
+}
+	
+}} // http // cinder
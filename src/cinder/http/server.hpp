@@ -0,0 +1,776 @@
+//
+//  server.hpp
+//  Cinder-HTTP
+//
+//
+
+#pragma once
+
+#include "http.hpp"
+#include "router.hpp"
+
+#include <atomic>
+#include <thread>
+#if defined( __linux__ )
+#include <sys/sendfile.h>
+#elif defined( __APPLE__ )
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#elif defined( _WIN32 )
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace cinder {
+namespace http {
+	
+namespace detail {
+	
+//! What every connection of a Server shares. The router and limits are read concurrently by
+//! all reactors, set them up before listening.
+struct ServerState {
+	Router						router;
+	std::chrono::milliseconds	keepAliveTimeout{5000};
+	size_t						maxHeaderSize{16 * 1024},
+								maxContentSize{8 * 1024 * 1024};
+	std::atomic<bool>			stopped{false};
+};
+
+#if defined( __linux__ ) && defined( SO_REUSEPORT )
+//! Lets each reactor listen on the port with a socket of its own, Linux balances incoming
+//! connections across them. Elsewhere the option doesn't balance, one socket accepts for all.
+using reuse_port = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+const bool kReusePort = true;
+#else
+const bool kReusePort = false;
+#endif
+
+//! Returns the first of /a headers named /a name, in any case, or nullptr
+inline const HeaderSet::Header* findRequestHeader( const HeaderSet::Headers &headers, const std::string &name )
+{
+	auto found = std::find_if( headers.begin(), headers.end(), [&name]( const HeaderSet::Header &header ) {
+		return urdl::detail::headers_equal( header.first, name );
+	});
+	return found != headers.end() ? &(*found) : nullptr;
+}
+
+//! Returns whether the comma separated /a value lists /a token, in any case
+inline bool hasHeaderToken( const HeaderSet::Header *header, const std::string &token )
+{
+	if( ! header )
+		return false;
+	auto &value = header->second;
+	size_t begin = 0;
+	while( begin < value.size() ) {
+		auto end = std::min( value.find( ',', begin ), value.size() );
+		auto first = value.find_first_not_of( " \t", begin );
+		auto last = value.find_last_not_of( " \t", end - 1 );
+		if( first < end && last != std::string::npos && last >= first &&
+		    urdl::detail::headers_equal( value.substr( first, last - first + 1 ), token ) )
+			return true;
+		begin = end + 1;
+	}
+	return false;
+}
+
+inline bool toRequestMethod( const std::string &name, RequestMethod &method )
+{
+	static const std::pair<const char*, RequestMethod> methods[] = {
+		{ "GET", RequestMethod::GET }, { "HEAD", RequestMethod::HEAD },
+		{ "POST", RequestMethod::POST }, { "PUT", RequestMethod::PUT },
+		{ "PATCH", RequestMethod::PATCH }, { "DELETE", RequestMethod::DEL },
+		{ "OPTIONS", RequestMethod::OPTIONS }
+	};
+	for( auto &entry : methods ) {
+		if( name == entry.first ) {
+			method = entry.second;
+			return true;
+		}
+	}
+	return false;
+}
+
+#if ! defined( __linux__ ) && ! defined( __APPLE__ )
+//! Reads up to /a size bytes at /a offset of the file open as /a fd, without moving its
+//! position, which other connections share. Returns the bytes read, or -1.
+inline int64_t readFileAt( int fd, uint64_t offset, uint8_t *data, size_t size )
+{
+#if defined( _WIN32 )
+	OVERLAPPED overlapped = {};
+	overlapped.Offset = static_cast<DWORD>( offset );
+	overlapped.OffsetHigh = static_cast<DWORD>( offset >> 32 );
+	DWORD read = 0;
+	if( ! ReadFile( reinterpret_cast<HANDLE>( _get_osfhandle( fd ) ), data, static_cast<DWORD>( size ), &read, &overlapped ) )
+		return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+	return read;
+#else
+	return ::pread( fd, data, size, static_cast<off_t>( offset ) );
+#endif
+}
+#endif
+
+//! One client connection of a Server. Reads requests one after the other, pipelined or not,
+//! routes each to its handler and writes the response, until either side closes or the
+//! connection idles past the keep-alive timeout.
+struct ServerConnection : std::enable_shared_from_this<ServerConnection> {
+	ServerConnection( asio::io_service &io_service, std::shared_ptr<ServerState> state )
+	: mSocket( io_service ), mTimer( io_service ), mState( std::move( state ) ),
+		mBuffer( mState->maxHeaderSize ) {}
+	
+	asio::ip::tcp::socket& socket() { return mSocket; }
+	
+	void start()
+	{
+		asio::error_code ignored;
+		mSocket.set_option( asio::ip::tcp::no_delay( true ), ignored );
+		read_request();
+	}
+	
+private:
+	void read_request();
+	void on_read_headers( asio::error_code ec, size_t bytes_transferred );
+	void read_content();
+	void on_read_content( asio::error_code ec, size_t bytes_transferred );
+	void read_chunk_header();
+	void on_read_chunk_header( asio::error_code ec, size_t bytes_transferred );
+	void on_read_chunk( asio::error_code ec, size_t bytes_transferred );
+	void on_read_trailer( asio::error_code ec, size_t bytes_transferred );
+	void on_write_continue( asio::error_code ec );
+	void dispatch();
+	void write_response( ResponseRef response );
+	void on_write_headers( asio::error_code ec );
+	//! Writes the response's FileContent, as much as the socket takes at a time
+	void send_file();
+	void on_send_file( asio::error_code ec );
+	void on_write( asio::error_code ec );
+	//! Answers with /a status and closes, for requests that can't be read any further
+	void reply_error( uint32_t status );
+	void arm_timer();
+	void on_timeout( asio::error_code ec );
+	void close();
+	
+	asio::ip::tcp::socket			mSocket;
+	asio::steady_timer				mTimer;
+	std::shared_ptr<ServerState>	mState;
+	asio::streambuf					mBuffer, mHeaderBuffer;
+	RequestRef						mRequest;
+	ResponseRef						mResponse;
+	std::string						mPath;
+	std::vector<uint8_t>			mChunkedContent;
+	size_t							mContentLength{0}, mChunkLength{0};
+	uint64_t						mFileOffset{0}, mFileRemaining{0};
+#if ! defined( __linux__ ) && ! defined( __APPLE__ )
+	std::vector<uint8_t>			mFileBuffer;
+#endif
+	bool							mKeepAlive{false}, mChunked{false};
+};
+
+inline void ServerConnection::read_request()
+{
+	arm_timer();
+	asio::async_read_until( mSocket, mBuffer, match_end_of_headers,
+						    std::bind( &ServerConnection::on_read_headers,
+									   shared_from_this(),
+									   std::placeholders::_1,
+									   std::placeholders::_2 ) );
+}
+
+inline void ServerConnection::on_read_headers( asio::error_code ec, size_t bytes_transferred )
+{
+	mTimer.expires_at( std::chrono::steady_clock::time_point::max() );
+	if( ec ) {
+		// The buffer is capped at the largest header block accepted.
+		if( ec == asio::error::not_found )
+			reply_error( http::errc::request_header_fields_too_large );
+		else
+			close();
+		return;
+	}
+	std::string head;
+	head.resize( bytes_transferred );
+	mBuffer.sgetn( &head[0], bytes_transferred );
+	// Clients may send an empty line after a request's content, skip it.
+	if( bytes_transferred == 2 ) {
+		read_request();
+		return;
+	}
+	
+	auto lineEnd = head.begin() + head.find( "\r\n" ) + 2;
+	std::string method, target;
+	uint32_t versionMajor = 0, versionMinor = 0;
+	mRequest = std::make_shared<Request>();
+	auto &headers = mRequest->getHeaders().getHeaders();
+	if( ! urdl::detail::parse_http_request_line( head.begin(), lineEnd, method, target, versionMajor, versionMinor ) ||
+	    ! urdl::detail::parse_http_headers( lineEnd, head.end(), headers ) ) {
+		reply_error( http::errc::bad_request );
+		return;
+	}
+	if( versionMajor != 1 ) {
+		reply_error( http::errc::version_not_supported );
+		return;
+	}
+	if( ! toRequestMethod( method, mRequest->requestMethod ) ) {
+		reply_error( http::errc::not_implemented );
+		return;
+	}
+	mRequest->setVersion( versionMajor, versionMinor );
+	std::sort( begin( headers ), end( headers ),
+	[]( const HeaderSet::Header &a, const HeaderSet::Header &b ) {
+		return a.first < b.first;
+	});
+	
+	// Origin form is the norm, absolute form comes from proxies.
+	std::string url;
+	size_t pathBegin = 0;
+	if( ! target.empty() && target[0] == '/' ) {
+		auto host = findRequestHeader( headers, "Host" );
+		asio::error_code ignored;
+		url = "http://" + ( host ? host->second : mSocket.local_endpoint( ignored ).address().to_string() ) + target;
+	}
+	else {
+		url = target;
+		pathBegin = target.find( '/', std::min( target.find( "://" ), target.size() - 1 ) + 3 );
+	}
+	asio::error_code urlError;
+	auto requestUrl = std::make_shared<Url>( Url::from_string( url, urlError ) );
+	if( urlError || pathBegin >= target.size() ) {
+		reply_error( http::errc::bad_request );
+		return;
+	}
+	mRequest->setUrl( requestUrl );
+	mPath = target.substr( pathBegin, target.find_first_of( "?#", pathBegin ) - pathBegin );
+	
+	auto connection = findRequestHeader( headers, Connection::key() );
+	mKeepAlive = versionMinor >= 1 ? ! hasHeaderToken( connection, "close" ) : hasHeaderToken( connection, "keep-alive" );
+	
+	mContentLength = 0;
+	mChunked = false;
+	if( auto transferEncoding = findRequestHeader( headers, TransferEncoding::key() ) ) {
+		if( ! hasHeaderToken( transferEncoding, "chunked" ) ) {
+			reply_error( http::errc::not_implemented );
+			return;
+		}
+		mChunked = true;
+	}
+	else if( auto contentLength = findRequestHeader( headers, Content::Length::key() ) ) {
+		auto &value = contentLength->second;
+		if( value.empty() || value.size() > 18 || ! std::all_of( value.begin(), value.end(), urdl::detail::is_digit ) ) {
+			reply_error( http::errc::bad_request );
+			return;
+		}
+		mContentLength = std::strtoull( value.c_str(), nullptr, 10 );
+		if( mContentLength > mState->maxContentSize ) {
+			reply_error( http::errc::request_entity_too_large );
+			return;
+		}
+	}
+	
+	if( ! mChunked && ! mContentLength ) {
+		dispatch();
+		return;
+	}
+	// The client holds the content back until it's told to go ahead.
+	if( hasHeaderToken( findRequestHeader( headers, Expect::key() ), "100-continue" ) ) {
+		static const char continueResponse[] = "HTTP/1.1 100 Continue\r\n\r\n";
+		asio::async_write( mSocket, asio::buffer( continueResponse, sizeof( continueResponse ) - 1 ),
+						   std::bind( &ServerConnection::on_write_continue,
+									  shared_from_this(),
+									  std::placeholders::_1 ) );
+		return;
+	}
+	on_write_continue( asio::error_code() );
+}
+
+inline void ServerConnection::on_write_continue( asio::error_code ec )
+{
+	if( ec )
+		close();
+	else if( mChunked ) {
+		mChunkedContent.clear();
+		read_chunk_header();
+	}
+	else
+		read_content();
+}
+
+inline void ServerConnection::read_content()
+{
+	// The length is known, read straight into the request's buffer.
+	auto &content = mRequest->getHeaders().getContent();
+	content = ci::Buffer::create( mContentLength );
+	auto data = static_cast<uint8_t*>( content->getData() );
+	auto available = std::min( mContentLength, mBuffer.size() );
+	asio::buffer_copy( asio::buffer( data, available ), mBuffer.data() );
+	mBuffer.consume( available );
+	if( available == mContentLength ) {
+		dispatch();
+		return;
+	}
+	arm_timer();
+	asio::async_read( mSocket, asio::buffer( data + available, mContentLength - available ),
+					  std::bind( &ServerConnection::on_read_content,
+								 shared_from_this(),
+								 std::placeholders::_1,
+								 std::placeholders::_2 ) );
+}
+
+inline void ServerConnection::on_read_content( asio::error_code ec, size_t bytes_transferred )
+{
+	mTimer.expires_at( std::chrono::steady_clock::time_point::max() );
+	if( ec )
+		close();
+	else
+		dispatch();
+}
+
+inline void ServerConnection::read_chunk_header()
+{
+	arm_timer();
+	asio::async_read_until( mSocket, mBuffer, "\r\n",
+						    std::bind( &ServerConnection::on_read_chunk_header,
+									   shared_from_this(),
+									   std::placeholders::_1,
+									   std::placeholders::_2 ) );
+}
+
+inline void ServerConnection::on_read_chunk_header( asio::error_code ec, size_t bytes_transferred )
+{
+	mTimer.expires_at( std::chrono::steady_clock::time_point::max() );
+	if( ec ) {
+		close();
+		return;
+	}
+	auto begIt = asio::buffers_begin( mBuffer.data() );
+	std::string line( begIt, begIt + bytes_transferred - 2 );
+	mBuffer.consume( bytes_transferred );
+	// The empty line ending the previous chunk's data.
+	if( line.empty() ) {
+		read_chunk_header();
+		return;
+	}
+	char *sizeEnd = nullptr;
+	mChunkLength = std::strtoull( line.c_str(), &sizeEnd, 16 );
+	if( sizeEnd == line.c_str() ) {
+		reply_error( http::errc::bad_request );
+		return;
+	}
+	if( mChunkLength > mState->maxContentSize - mChunkedContent.size() ) {
+		reply_error( http::errc::request_entity_too_large );
+		return;
+	}
+	if( ! mChunkLength ) {
+		// The last chunk, trailers may follow up to an empty line.
+		on_read_trailer( asio::error_code(), 0 );
+		return;
+	}
+	auto offset = mChunkedContent.size();
+	mChunkedContent.resize( offset + mChunkLength );
+	auto available = std::min( mChunkLength, mBuffer.size() );
+	asio::buffer_copy( asio::buffer( mChunkedContent.data() + offset, available ), mBuffer.data() );
+	mBuffer.consume( available );
+	if( available == mChunkLength ) {
+		read_chunk_header();
+		return;
+	}
+	arm_timer();
+	asio::async_read( mSocket, asio::buffer( mChunkedContent.data() + offset + available, mChunkLength - available ),
+					  std::bind( &ServerConnection::on_read_chunk,
+								 shared_from_this(),
+								 std::placeholders::_1,
+								 std::placeholders::_2 ) );
+}
+
+inline void ServerConnection::on_read_chunk( asio::error_code ec, size_t bytes_transferred )
+{
+	mTimer.expires_at( std::chrono::steady_clock::time_point::max() );
+	if( ec )
+		close();
+	else
+		read_chunk_header();
+}
+
+inline void ServerConnection::on_read_trailer( asio::error_code ec, size_t bytes_transferred )
+{
+	mTimer.expires_at( std::chrono::steady_clock::time_point::max() );
+	if( ec ) {
+		close();
+		return;
+	}
+	mBuffer.consume( bytes_transferred );
+	if( bytes_transferred == 2 ) {
+		auto &content = mRequest->getHeaders().getContent();
+		content = ci::Buffer::create( mChunkedContent.size() );
+		if( ! mChunkedContent.empty() )
+			memcpy( content->getData(), mChunkedContent.data(), mChunkedContent.size() );
+		mChunkedContent.clear();
+		dispatch();
+		return;
+	}
+	arm_timer();
+	asio::async_read_until( mSocket, mBuffer, "\r\n",
+						    std::bind( &ServerConnection::on_read_trailer,
+									   shared_from_this(),
+									   std::placeholders::_1,
+									   std::placeholders::_2 ) );
+}
+
+inline void ServerConnection::dispatch()
+{
+	auto response = std::make_shared<Response>( http::errc::ok );
+	RouteParams params;
+	auto &router = mState->router;
+	if( auto handler = router.find( mRequest->getRequestMethod(), mPath, params ) ) {
+		try {
+			(*handler)( mRequest, response, params );
+		}
+		catch( const std::exception &exc ) {
+			CI_LOG_E( "Handler for " << mPath << " threw: " << exc.what() );
+			response = std::make_shared<Response>( http::errc::internal_server_error );
+		}
+	}
+	else {
+		auto methods = router.getMethods( mPath );
+		if( methods.empty() )
+			response->setStatusCode( http::errc::not_found );
+		else {
+			// The path is known, just not for this method.
+			response->setStatusCode( http::errc::method_not_allowed );
+			std::string allow;
+			for( auto method : methods ) {
+				allow += ( allow.empty() ? "" : ", " ) + std::string( mRequest->getRequestMethod( method ) );
+				if( method == RequestMethod::GET )
+					allow += ", HEAD";
+			}
+			response->getHeaders().appendHeader( "Allow", allow );
+		}
+	}
+	write_response( std::move( response ) );
+}
+
+inline void ServerConnection::write_response( ResponseRef response )
+{
+	mResponse = std::move( response );
+	auto status = mResponse->getStatusCode();
+	auto &content = mResponse->getContent();
+	auto &file = mResponse->getFileContent();
+	uint64_t size = file ? file->size : content ? content->getSize() : 0;
+	bool hasContent = status >= http::errc::ok && status != http::errc::no_content &&
+					  status != http::errc::not_modified;
+	if( hasContent ) {
+		// Handlers usually set it along with the content, the length written is the one that counts.
+		mResponse->getHeaders().removeHeader( Content::Length::key() );
+		mResponse->getHeaders().appendHeader( Content::Length::key(), std::to_string( size ) );
+	}
+	
+	if( mState->stopped || hasHeaderToken( mResponse->getHeaders().findHeader( Connection::key() ), "close" ) )
+		mKeepAlive = false;
+	if( ! mKeepAlive )
+		mResponse->appendHeader( Connection( Connection::Type::CLOSE ) );
+	else if( mRequest && mRequest->getVersion().second == 0 )
+		mResponse->appendHeader( Connection( Connection::Type::KEEP_ALIVE ) );
+	
+	std::ostream response_stream( &mHeaderBuffer );
+	mResponse->processHeaders( response_stream );
+	bool writeContent = hasContent && size && ! ( mRequest && mRequest->getRequestMethod() == RequestMethod::HEAD );
+	if( writeContent && file ) {
+		mFileOffset = file->offset;
+		mFileRemaining = file->size;
+		asio::async_write( mSocket, asio::buffer( mHeaderBuffer.data() ),
+						   std::bind( &ServerConnection::on_write_headers,
+									  shared_from_this(),
+									  std::placeholders::_1 ) );
+		return;
+	}
+	// Headers and content go out in one write, without copying the content.
+	std::array<asio::const_buffer, 2> buffers = {{
+		asio::buffer( mHeaderBuffer.data() ),
+		writeContent ? asio::buffer( content->getData(), static_cast<size_t>( size ) ) : asio::const_buffer()
+	}};
+	asio::async_write( mSocket, buffers,
+					   std::bind( &ServerConnection::on_write,
+								  shared_from_this(),
+								  std::placeholders::_1 ) );
+}
+
+inline void ServerConnection::on_write_headers( asio::error_code ec )
+{
+	if( ec )
+		on_write( ec );
+	else
+		send_file();
+}
+
+inline void ServerConnection::send_file()
+{
+	auto &file = *mResponse->getFileContent();
+	asio::error_code ec;
+#if defined( __linux__ ) || defined( __APPLE__ )
+	// The kernel copies straight from the file, asio only says when the socket takes more.
+	if( ! mSocket.native_non_blocking() )
+		mSocket.native_non_blocking( true, ec );
+	while( ! ec && mFileRemaining ) {
+		auto chunk = std::min<uint64_t>( mFileRemaining, 1 << 20 );
+		int64_t sent = -1;
+#if defined( __linux__ )
+		off_t offset = static_cast<off_t>( mFileOffset );
+		sent = ::sendfile( mSocket.native_handle(), file.fd, &offset, static_cast<size_t>( chunk ) );
+#else
+		// Reports what it sent even when it stops short with EAGAIN.
+		off_t length = static_cast<off_t>( chunk );
+		if( ::sendfile( file.fd, mSocket.native_handle(), static_cast<off_t>( mFileOffset ), &length, nullptr, 0 ) == 0 || length > 0 )
+			sent = length;
+#endif
+		if( sent > 0 ) {
+			mFileOffset += sent;
+			mFileRemaining -= sent;
+		}
+		else if( sent == 0 )
+			// The file got shorter than the length already promised.
+			ec = asio::error::eof;
+		else if( errno == EAGAIN || errno == EWOULDBLOCK ) {
+			arm_timer();
+			mSocket.async_write_some( asio::null_buffers(),
+									  std::bind( &ServerConnection::on_send_file,
+												 shared_from_this(),
+												 std::placeholders::_1 ) );
+			return;
+		}
+		else if( errno != EINTR )
+			ec = asio::error_code( errno, asio::error::get_system_category() );
+	}
+	on_write( ec );
+#else
+	if( ! mFileRemaining ) {
+		on_write( ec );
+		return;
+	}
+	mFileBuffer.resize( static_cast<size_t>( std::min<uint64_t>( mFileRemaining, 64 * 1024 ) ) );
+	auto read = readFileAt( file.fd, mFileOffset, mFileBuffer.data(), mFileBuffer.size() );
+	if( read <= 0 ) {
+		on_write( read == 0 ? asio::error::eof : asio::error::fault );
+		return;
+	}
+	mFileOffset += read;
+	mFileRemaining -= read;
+	arm_timer();
+	asio::async_write( mSocket, asio::buffer( mFileBuffer.data(), static_cast<size_t>( read ) ),
+					   std::bind( &ServerConnection::on_send_file,
+								  shared_from_this(),
+								  std::placeholders::_1 ) );
+#endif
+}
+
+inline void ServerConnection::on_send_file( asio::error_code ec )
+{
+	mTimer.expires_at( std::chrono::steady_clock::time_point::max() );
+	if( ec )
+		on_write( ec );
+	else
+		send_file();
+}
+
+inline void ServerConnection::on_write( asio::error_code ec )
+{
+	mHeaderBuffer.consume( mHeaderBuffer.size() );
+	mResponse.reset();
+	mRequest.reset();
+	if( ! ec && mKeepAlive )
+		read_request();
+	else
+		close();
+}
+
+inline void ServerConnection::reply_error( uint32_t status )
+{
+	mKeepAlive = false;
+	write_response( std::make_shared<Response>( status ) );
+}
+
+inline void ServerConnection::arm_timer()
+{
+	mTimer.expires_from_now( mState->keepAliveTimeout );
+	mTimer.async_wait( std::bind( &ServerConnection::on_timeout,
+								  shared_from_this(),
+								  std::placeholders::_1 ) );
+}
+
+inline void ServerConnection::on_timeout( asio::error_code ec )
+{
+	// Rearming or disarming the timer moves its expiry, a stale wait leaves it alone.
+	if( ec == asio::error::operation_aborted || mTimer.expires_at() > std::chrono::steady_clock::now() )
+		return;
+	close();
+}
+
+inline void ServerConnection::close()
+{
+	asio::error_code ignored;
+	mTimer.cancel( ignored );
+	mSocket.shutdown( asio::ip::tcp::socket::shutdown_both, ignored );
+	mSocket.close( ignored );
+}
+	
+} // detail
+
+using ServerRef = std::shared_ptr<class Server>;
+
+//! An embedded HTTP/1.1 server, for control and status endpoints. Requests are routed by
+//! path and method to RequestHandlers, which fill in the response before returning.
+//! Connections are kept alive and may pipeline requests. The server runs on one or more
+//! reactors, each an io_service serving its own connections. On Linux each reactor also
+//! accepts on its own socket bound with SO_REUSEPORT, elsewhere one socket hands
+//! connections out to the reactors in turn.
+class Server {
+public:
+	
+	//! Serves from /a io_service, which the application runs. Handlers are called on its thread.
+	Server( asio::io_service &io_service = ci::app::App::get()->io_service() )
+	: mState( std::make_shared<detail::ServerState>() )
+	{
+		mReactors.emplace_back( new Reactor( io_service ) );
+	}
+	//! Serves from /a threadCount io_services of its own, one per core by default, each run
+	//! by a thread of its own. Handlers are called on those threads, concurrently.
+	explicit Server( size_t threadCount )
+	: mState( std::make_shared<detail::ServerState>() )
+	{
+		threadCount = std::max<size_t>( threadCount, 1 );
+		for( size_t i = 0; i < threadCount; ++i ) {
+			mReactors.emplace_back( new Reactor );
+			auto &io_service = mReactors.back()->io_service;
+			mReactors.back()->thread = std::thread( [&io_service] { io_service.run(); } );
+		}
+	}
+	~Server() { stop(); }
+	
+	//! Returns the router requests are dispatched with, set up routes before listening
+	Router&			getRouter() { return mState->router; }
+	const Router&	getRouter() const { return mState->router; }
+	
+	//! Sets how long a connection may wait on the next request or part of one, 5 seconds by default
+	void						setKeepAliveTimeout( std::chrono::milliseconds timeout ) { mState->keepAliveTimeout = timeout; }
+	std::chrono::milliseconds	getKeepAliveTimeout() const { return mState->keepAliveTimeout; }
+	//! Sets the largest request line and headers accepted, 16 KiB by default. Larger ones are
+	//! answered with "431 Request Header Fields Too Large".
+	void	setMaxHeaderSize( size_t size ) { mState->maxHeaderSize = size; }
+	size_t	getMaxHeaderSize() const { return mState->maxHeaderSize; }
+	//! Sets the largest request content accepted, 8 MiB by default. Larger content is answered
+	//! with "413 Request Entity Too Large".
+	void	setMaxContentSize( size_t size ) { mState->maxContentSize = size; }
+	size_t	getMaxContentSize() const { return mState->maxContentSize; }
+	
+	//! Starts accepting connections on /a endpoint, returns the error if it can't be bound
+	asio::error_code listen( const asio::ip::tcp::endpoint &endpoint );
+	//! Starts accepting connections on /a port of every IPv4 interface
+	asio::error_code listen( uint16_t port ) { return listen( asio::ip::tcp::endpoint( asio::ip::tcp::v4(), port ) ); }
+	
+	//! Returns the endpoint listened on, with the port picked when listening on port 0
+	const asio::ip::tcp::endpoint&	getEndpoint() const { return mEndpoint; }
+	size_t							getThreadCount() const { return mReactors.size(); }
+	
+	//! Stops accepting connections. The server's own threads are stopped and joined, dropping
+	//! their connections. On the application's io_service, connections close once their
+	//! current response is written. Call it from the thread running that io_service.
+	void stop();
+	
+private:
+	struct Reactor {
+		Reactor()
+		: ownService( new asio::io_service( 1 ) ), io_service( *ownService ),
+			work( new asio::io_service::work( io_service ) ), acceptor( io_service ) {}
+		Reactor( asio::io_service &io_service )
+		: io_service( io_service ), acceptor( io_service ) {}
+		
+		std::unique_ptr<asio::io_service>		ownService;
+		asio::io_service						&io_service;
+		std::unique_ptr<asio::io_service::work>	work;
+		asio::ip::tcp::acceptor					acceptor;
+		std::thread								thread;
+	};
+	
+	void accept( size_t listener );
+	
+	std::shared_ptr<detail::ServerState>	mState;
+	std::vector<std::unique_ptr<Reactor>>	mReactors;
+	asio::ip::tcp::endpoint					mEndpoint;
+	size_t									mNextReactor{0};
+};
+
+inline asio::error_code Server::listen( const asio::ip::tcp::endpoint &endpoint )
+{
+	asio::error_code ec;
+	mEndpoint = endpoint;
+	size_t listeners = detail::kReusePort ? mReactors.size() : 1;
+	for( size_t i = 0; i < listeners && ! ec; ++i ) {
+		auto &acceptor = mReactors[i]->acceptor;
+		acceptor.open( mEndpoint.protocol(), ec );
+		if( ! ec )
+			acceptor.set_option( asio::ip::tcp::acceptor::reuse_address( true ), ec );
+#if defined( __linux__ ) && defined( SO_REUSEPORT )
+		if( ! ec && listeners > 1 )
+			acceptor.set_option( detail::reuse_port( true ), ec );
+#endif
+		if( ! ec )
+			acceptor.bind( mEndpoint, ec );
+		if( ! ec )
+			acceptor.listen( asio::socket_base::max_connections, ec );
+		// On port 0 the first listener picks the port, the others share it.
+		if( ! ec && i == 0 )
+			mEndpoint = acceptor.local_endpoint( ec );
+	}
+	if( ec ) {
+		asio::error_code ignored;
+		for( auto &reactor : mReactors )
+			reactor->acceptor.close( ignored );
+		return ec;
+	}
+	auto state = mState;
+	for( size_t i = 0; i < listeners; ++i ) {
+		mReactors[i]->io_service.post( [this, state, i] {
+			if( ! state->stopped )
+				accept( i );
+		});
+	}
+	return ec;
+}
+
+inline void Server::accept( size_t listener )
+{
+	auto &reactor = *mReactors[listener];
+	auto &target = detail::kReusePort ? reactor : *mReactors[mNextReactor++ % mReactors.size()];
+	auto connection = std::make_shared<detail::ServerConnection>( target.io_service, mState );
+	auto state = mState;
+	reactor.acceptor.async_accept( connection->socket(),
+	[this, state, listener, connection]( asio::error_code ec ) {
+		// The server may be gone once it's stopped, don't touch it.
+		if( ec == asio::error::operation_aborted || state->stopped )
+			return;
+		if( ! ec )
+			connection->socket().get_io_service().post( std::bind( &detail::ServerConnection::start, connection ) );
+		else
+			CI_LOG_W( "Accepting a connection failed: " << ec.message() );
+		accept( listener );
+	});
+}
+
+inline void Server::stop()
+{
+	if( mState->stopped.exchange( true ) )
+		return;
+	for( auto &reactor : mReactors ) {
+		if( reactor->ownService ) {
+			reactor->work.reset();
+			reactor->io_service.stop();
+		}
+	}
+	for( auto &reactor : mReactors ) {
+		if( reactor->thread.joinable() )
+			reactor->thread.join();
+		asio::error_code ignored;
+		reactor->acceptor.close( ignored );
+	}
+}
+	
+}} // http // cinder
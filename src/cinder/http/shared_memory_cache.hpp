@@ -0,0 +1,615 @@
+//
+//  shared_memory_cache.hpp
+//  Cinder-HTTP
+//
+//
+
+#pragma once
+
+#include "disk_cache.hpp"
+
+#if ! defined( _WIN32 )
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <thread>
+
+namespace cinder {
+namespace http {
+	
+namespace detail {
+namespace shm {
+	
+const uint32_t kMagic = 0x4d484843; // "CHHM"
+const uint32_t kVersion = 1;
+//! The index is split into this many shards, each behind a lock of its own
+const uint32_t kShardCount = 64;
+//! Bodies take whole slabs, runs of them for the larger ones
+const uint32_t kSlabSize = 16 * 1024;
+
+#if ! defined( _WIN32 )
+
+//! A mutex shared by the processes mapping the segment. On Linux, the next one to lock it
+//! after its owner died gets it, rather than blocking for good.
+struct SharedMutex {
+	void init()
+	{
+		pthread_mutexattr_t attributes;
+		pthread_mutexattr_init( &attributes );
+		pthread_mutexattr_setpshared( &attributes, PTHREAD_PROCESS_SHARED );
+#if defined( __linux__ )
+		pthread_mutexattr_setrobust( &attributes, PTHREAD_MUTEX_ROBUST );
+#endif
+		pthread_mutex_init( &mutex, &attributes );
+		pthread_mutexattr_destroy( &attributes );
+	}
+	void lock()
+	{
+		auto result = pthread_mutex_lock( &mutex );
+#if defined( __linux__ )
+		// What the owner left half done is at worst a slot or a slab too many in use.
+		if( result == EOWNERDEAD )
+			pthread_mutex_consistent( &mutex );
+#endif
+		(void)result;
+	}
+	void unlock() { pthread_mutex_unlock( &mutex ); }
+	
+	pthread_mutex_t mutex;
+};
+
+#endif
+
+//! The start of the segment
+struct SegmentHeader {
+	enum State : uint32_t { INITIALIZING, READY };
+	
+	//! Set last by the process creating the segment, the others wait for it
+	std::atomic<uint32_t>	state;
+	uint32_t				magic,
+							version,
+							slotsPerShard,
+							slabCount,
+							reserved;
+	uint64_t				size;
+	//! Where the slot arrays, the slab bitmap and the slabs begin
+	uint64_t				slotsOffset,
+							bitmapOffset,
+							slabsOffset;
+	//! Advances on every load, a slot's last use is its value at the time
+	std::atomic<uint64_t>	tick;
+	//! The next shard to evict from when the slabs run out
+	std::atomic<uint32_t>	evictShard;
+	//! Where the next search for free slabs starts, guarded by the allocation lock
+	uint32_t				allocHint;
+#if ! defined( _WIN32 )
+	SharedMutex				allocLock;
+	SharedMutex				shardLocks[kShardCount];
+#endif
+};
+
+//! A slot of a shard's open addressed hash table, locating a record's run of slabs
+struct Slot {
+	enum State : uint32_t { EMPTY, LIVE };
+	
+	uint64_t	hash;
+	uint64_t	lastUsed;
+	uint32_t	slab;
+	uint32_t	state;
+};
+
+//! The start of a run of slabs holding a record
+struct RunHeader {
+	//! The index holds a reference to a live record, and each response viewing it another.
+	//! The run is freed with the last one.
+	std::atomic<uint32_t>	references;
+	uint32_t				slabCount;
+	uint64_t				size;
+};
+
+static_assert( sizeof( RunHeader ) == 16, "Records are expected 16 bytes into their run" );
+	
+} // shm
+} // detail
+
+using SharedMemoryCacheRef = std::shared_ptr<class SharedMemoryCache>;
+
+//! A CacheStore in a named shared memory segment, for processes on one machine to share
+//! what any of them fetched. Records, in the DiskCache's format, are kept in runs of slabs
+//! located by an index sharded across locks, and content is handed out as a view of the
+//! segment, never copied. Runs are reference counted, so a response handed out outlives
+//! its eviction. When the slabs or a shard's slots run out, the least recently used
+//! responses of a shard are evicted. A process that dies holding responses leaks their
+//! slabs until the segment is unlinked. POSIX only, a SharedMemoryCache never opens
+//! on Windows. Thread safe.
+class SharedMemoryCache : public CacheStore, public std::enable_shared_from_this<SharedMemoryCache> {
+public:
+	//! Opens the segment /a name, creating it /a size bytes large for up to /a maxEntries
+	//! responses unless another process did already, in which case its size holds
+	static SharedMemoryCacheRef create( const std::string &name, uint64_t size = 256 * 1024 * 1024,
+										uint32_t maxEntries = 16 * 1024 );
+	~SharedMemoryCache();
+	
+	CachedResponseRef	load( const std::string &key, const Request &request ) override;
+	void				save( const CachedResponse &entry ) override;
+	void				remove( const std::string &key ) override;
+	
+	//! Returns whether the segment could be opened, a SharedMemoryCache that couldn't
+	//! stores nothing
+	bool				isOpen() const { return mData != nullptr; }
+	const std::string&	getName() const { return mName; }
+	//! Returns the number of responses stored, by every process
+	uint32_t			getCount() const;
+	//! Returns the bytes of slabs in use, by every process
+	uint64_t			getSize() const;
+	
+	//! Removes the segment /a name, which lives on until every process unmaps it
+	static bool			unlink( const std::string &name );
+	
+private:
+	SharedMemoryCache( const std::string &name, uint64_t size, uint32_t maxEntries );
+	
+	detail::shm::SegmentHeader&	header() const { return *reinterpret_cast<detail::shm::SegmentHeader*>( mData ); }
+	detail::shm::Slot*			slots( uint32_t shard ) const;
+	detail::shm::RunHeader&		run( uint32_t slab ) const;
+	uint64_t*					bitmap() const { return reinterpret_cast<uint64_t*>( mData + header().bitmapOffset ); }
+	
+	//! Returns the first of /a count free slabs in a row, marked used, or UINT32_MAX
+	uint32_t			allocate( uint32_t count );
+	//! Drops a reference to the run starting at /a slab, freeing it with the last one
+	void				release( uint32_t slab );
+	//! Returns whether /a slot locates a run inside the segment with a record that fits it,
+	//! which a process dying halfway through a write may leave it not to. Must be called
+	//! with its shard locked.
+	bool				isIntact( const detail::shm::Slot &slot ) const;
+	//! Returns whether /a slot's record is /a key's, matching /a vary if given. Must be
+	//! called with its shard locked.
+	bool				matches( const detail::shm::Slot &slot, const std::string &key,
+								 const std::vector<std::pair<std::string, std::string>> *vary ) const;
+	//! Empties the slot at /a index of /a shard, shifting the ones probed past it back.
+	//! Must be called with the shard locked.
+	void				removeSlot( uint32_t shard, uint32_t index );
+	//! Evicts the least recently used response of /a shard. Must be called with the shard
+	//! locked.
+	bool				evict( uint32_t shard );
+	
+	std::string		mName;
+	uint8_t			*mData{nullptr};
+	uint64_t		mSize{0};
+};
+
+inline SharedMemoryCacheRef SharedMemoryCache::create( const std::string &name, uint64_t size, uint32_t maxEntries )
+{
+	return SharedMemoryCacheRef( new SharedMemoryCache( name, size, maxEntries ) );
+}
+
+inline SharedMemoryCache::SharedMemoryCache( const std::string &name, uint64_t size, uint32_t maxEntries )
+: mName( name.empty() || name[0] != '/' ? "/" + name : name )
+{
+	using namespace detail::shm;
+#if defined( _WIN32 )
+	CI_LOG_E( "Shared memory caches aren't supported on Windows, " << mName << " stores nothing" );
+#else
+	uint32_t slotsPerShard = std::max<uint32_t>( maxEntries / kShardCount / 3 * 4, 4 );
+	uint64_t slotsOffset = ( sizeof( SegmentHeader ) + 63 ) / 64 * 64;
+	uint64_t bitmapOffset = slotsOffset + uint64_t( kShardCount ) * slotsPerShard * sizeof( Slot );
+	uint64_t slabCount = size > bitmapOffset ? ( size - bitmapOffset ) / ( kSlabSize + 1 ) : 0;
+	uint64_t slabsOffset = ( bitmapOffset + ( slabCount + 63 ) / 64 * 8 + kSlabSize - 1 ) / kSlabSize * kSlabSize;
+	// No more than the bitmap was sized for.
+	slabCount = std::min<uint64_t>( std::min<uint64_t>( slabCount, size > slabsOffset ? ( size - slabsOffset ) / kSlabSize : 0 ),
+									UINT32_MAX - 1 );
+	
+	// Whoever creates the segment lays it out, everyone else waits for it to be ready.
+	bool created = true;
+	int fd = ::shm_open( mName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600 );
+	if( fd < 0 && errno == EEXIST ) {
+		created = false;
+		fd = ::shm_open( mName.c_str(), O_RDWR, 0600 );
+	}
+	if( fd < 0 ) {
+		CI_LOG_E( "Can't open the shared memory cache " << mName << ": " << strerror( errno ) );
+		return;
+	}
+	if( created ) {
+		if( ! slabCount || ::ftruncate( fd, slabsOffset + slabCount * kSlabSize ) ) {
+			CI_LOG_E( "Can't size the shared memory cache " << mName );
+			::close( fd );
+			::shm_unlink( mName.c_str() );
+			return;
+		}
+		mSize = slabsOffset + slabCount * kSlabSize;
+	}
+	else {
+		struct stat st{};
+		for( int attempt = 0; attempt < 1000 && ! ::fstat( fd, &st ) && st.st_size < static_cast<off_t>( sizeof( SegmentHeader ) ); ++attempt )
+			std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+		mSize = st.st_size;
+	}
+	void *data = mSize >= sizeof( SegmentHeader ) ? ::mmap( nullptr, mSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 )
+												  : MAP_FAILED;
+	::close( fd );
+	if( data == MAP_FAILED ) {
+		CI_LOG_E( "Can't map the shared memory cache " << mName );
+		return;
+	}
+	mData = static_cast<uint8_t*>( data );
+	
+	auto &segment = header();
+	if( created ) {
+		// ftruncate zeroed it all, the slots are empty and the slabs free.
+		segment.magic = kMagic;
+		segment.version = kVersion;
+		segment.slotsPerShard = slotsPerShard;
+		segment.slabCount = static_cast<uint32_t>( slabCount );
+		segment.size = mSize;
+		segment.slotsOffset = slotsOffset;
+		segment.bitmapOffset = bitmapOffset;
+		segment.slabsOffset = slabsOffset;
+		segment.allocLock.init();
+		for( auto &lock : segment.shardLocks )
+			lock.init();
+		segment.state.store( SegmentHeader::READY, std::memory_order_release );
+		return;
+	}
+	for( int attempt = 0; attempt < 1000 && segment.state.load( std::memory_order_acquire ) != SegmentHeader::READY; ++attempt )
+		std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+	if( segment.state.load( std::memory_order_acquire ) != SegmentHeader::READY || segment.magic != kMagic ||
+	    segment.version != kVersion || segment.size != mSize ) {
+		CI_LOG_E( "Not a shared memory cache this version laid out: " << mName );
+		::munmap( mData, mSize );
+		mData = nullptr;
+	}
+#endif
+}
+
+inline SharedMemoryCache::~SharedMemoryCache()
+{
+#if ! defined( _WIN32 )
+	// Responses handed out hold the cache, nothing views the segment anymore.
+	if( mData )
+		::munmap( mData, mSize );
+#endif
+}
+
+inline bool SharedMemoryCache::unlink( const std::string &name )
+{
+#if defined( _WIN32 )
+	return false;
+#else
+	return ! ::shm_unlink( ( name.empty() || name[0] != '/' ? "/" + name : name ).c_str() );
+#endif
+}
+
+inline detail::shm::Slot* SharedMemoryCache::slots( uint32_t shard ) const
+{
+	return reinterpret_cast<detail::shm::Slot*>( mData + header().slotsOffset ) + uint64_t( shard ) * header().slotsPerShard;
+}
+
+inline detail::shm::RunHeader& SharedMemoryCache::run( uint32_t slab ) const
+{
+	return *reinterpret_cast<detail::shm::RunHeader*>( mData + header().slabsOffset + uint64_t( slab ) * detail::shm::kSlabSize );
+}
+
+#if ! defined( _WIN32 )
+
+inline CachedResponseRef SharedMemoryCache::load( const std::string &key, const Request &request )
+{
+	using namespace detail::shm;
+	if( ! mData )
+		return nullptr;
+	auto hash = detail::disk::hashKey( key );
+	auto shard = static_cast<uint32_t>( hash >> 32 ) % kShardCount;
+	auto count = header().slotsPerShard;
+	auto shardSlots = slots( shard );
+	
+	auto entry = std::make_shared<CachedResponse>();
+	uint32_t slab = UINT32_MAX;
+	{
+		std::lock_guard<SharedMutex> lock( header().shardLocks[shard] );
+		uint32_t probe = 0;
+		while( probe < count ) {
+			auto index = static_cast<uint32_t>( ( hash + probe ) % count );
+			auto &slot = shardSlots[index];
+			if( slot.state == Slot::EMPTY )
+				break;
+			if( slot.hash != hash ) {
+				++probe;
+				continue;
+			}
+			// A torn record is dropped instead of read, the next slot shifts into this one.
+			if( ! isIntact( slot ) ) {
+				removeSlot( shard, index );
+				continue;
+			}
+			++probe;
+			if( ! matches( slot, key, nullptr ) )
+				continue;
+			auto &record = run( slot.slab );
+			detail::disk::RecordReader reader( reinterpret_cast<const uint8_t*>( &record + 1 ), record.size );
+			CachedResponse stored;
+			if( ! detail::disk::readRecord( reader, record.size, stored ) || ! detail::cache::matchesVary( stored.vary, request ) )
+				continue;
+			// The index's reference keeps the run alive until this one is taken.
+			record.references.fetch_add( 1, std::memory_order_relaxed );
+			slot.lastUsed = header().tick.fetch_add( 1, std::memory_order_relaxed );
+			slab = slot.slab;
+			*entry = std::move( stored );
+			break;
+		}
+	}
+	if( slab == UINT32_MAX )
+		return nullptr;
+	
+	// The record can't change while it's referenced, it's read unlocked.
+	auto &record = run( slab );
+	detail::disk::RecordReader reader( reinterpret_cast<const uint8_t*>( &record + 1 ), record.size );
+	CachedResponse skipped;
+	detail::disk::readRecord( reader, record.size, skipped );
+	auto self = shared_from_this();
+	std::shared_ptr<void> reference( nullptr, [self, slab]( void* ) {
+		self->release( slab );
+	});
+	auto response = detail::disk::readResponse( reader, reference );
+	if( ! response )
+		return nullptr;
+	auto contentSize = static_cast<uint64_t>( reader.end - reader.it );
+	entry->response = std::move( response );
+	entry->size = sizeof( CachedResponse ) + sizeof( Response ) + static_cast<size_t>( record.size - contentSize );
+	return entry;
+}
+
+inline void SharedMemoryCache::save( const CachedResponse &entry )
+{
+	using namespace detail::shm;
+	if( ! mData )
+		return;
+	auto &content = entry.response->getContent();
+	uint64_t contentSize = content ? content->getSize() : 0;
+	bool validators;
+	auto record = detail::disk::writeRecord( entry, validators );
+	uint64_t size = record.size() + contentSize;
+	auto slabCount = ( sizeof( RunHeader ) + size + kSlabSize - 1 ) / kSlabSize;
+	if( slabCount > header().slabCount / 2 )
+		return;
+	
+	// Evicting takes shard locks, which come before the allocation lock.
+	auto slab = allocate( static_cast<uint32_t>( slabCount ) );
+	for( uint32_t attempt = 0; slab == UINT32_MAX && attempt < kShardCount * header().slotsPerShard; ++attempt ) {
+		auto shard = header().evictShard.fetch_add( 1, std::memory_order_relaxed ) % kShardCount;
+		{
+			std::lock_guard<SharedMutex> lock( header().shardLocks[shard] );
+			evict( shard );
+		}
+		slab = allocate( static_cast<uint32_t>( slabCount ) );
+	}
+	if( slab == UINT32_MAX ) {
+		CI_LOG_W( "The shared memory cache " << mName << " is full of responses in use" );
+		return;
+	}
+	
+	auto &target = run( slab );
+	target.slabCount = static_cast<uint32_t>( slabCount );
+	target.size = size;
+	auto data = reinterpret_cast<uint8_t*>( &target + 1 );
+	memcpy( data, record.data(), record.size() );
+	if( contentSize )
+		memcpy( data + record.size(), content->getData(), static_cast<size_t>( contentSize ) );
+	target.references.store( 1, std::memory_order_release );
+	
+	auto hash = detail::disk::hashKey( entry.key );
+	auto shard = static_cast<uint32_t>( hash >> 32 ) % kShardCount;
+	auto count = header().slotsPerShard;
+	auto shardSlots = slots( shard );
+	std::lock_guard<SharedMutex> lock( header().shardLocks[shard] );
+	// The variant it replaces, if there is one, is dead from now on.
+	for( uint32_t probe = 0; probe < count; ++probe ) {
+		auto index = static_cast<uint32_t>( ( hash + probe ) % count );
+		auto &slot = shardSlots[index];
+		if( slot.state == Slot::EMPTY )
+			break;
+		if( slot.hash == hash && matches( slot, entry.key, &entry.vary ) ) {
+			removeSlot( shard, index );
+			break;
+		}
+	}
+	uint32_t live = 0;
+	for( uint32_t i = 0; i < count; ++i )
+		live += shardSlots[i].state == Slot::LIVE;
+	if( live + 1 > count / 4 * 3 )
+		evict( shard );
+	for( uint32_t probe = 0; probe < count; ++probe ) {
+		auto &slot = shardSlots[( hash + probe ) % count];
+		if( slot.state == Slot::EMPTY ) {
+			slot.hash = hash;
+			slot.lastUsed = header().tick.fetch_add( 1, std::memory_order_relaxed );
+			slot.slab = slab;
+			slot.state = Slot::LIVE;
+			return;
+		}
+	}
+	release( slab );
+}
+
+inline void SharedMemoryCache::remove( const std::string &key )
+{
+	using namespace detail::shm;
+	if( ! mData )
+		return;
+	auto hash = detail::disk::hashKey( key );
+	auto shard = static_cast<uint32_t>( hash >> 32 ) % kShardCount;
+	auto count = header().slotsPerShard;
+	auto shardSlots = slots( shard );
+	std::lock_guard<SharedMutex> lock( header().shardLocks[shard] );
+	uint32_t probe = 0;
+	while( probe < count ) {
+		auto index = static_cast<uint32_t>( ( hash + probe ) % count );
+		auto &slot = shardSlots[index];
+		if( slot.state == Slot::EMPTY )
+			break;
+		// Removing shifts the next slot into this one, it's looked at again.
+		if( slot.hash == hash && matches( slot, key, nullptr ) )
+			removeSlot( shard, index );
+		else
+			++probe;
+	}
+}
+
+inline uint32_t SharedMemoryCache::getCount() const
+{
+	using namespace detail::shm;
+	if( ! mData )
+		return 0;
+	uint32_t live = 0;
+	for( uint32_t shard = 0; shard < kShardCount; ++shard ) {
+		std::lock_guard<SharedMutex> lock( header().shardLocks[shard] );
+		auto shardSlots = slots( shard );
+		for( uint32_t i = 0; i < header().slotsPerShard; ++i )
+			live += shardSlots[i].state == Slot::LIVE;
+	}
+	return live;
+}
+
+inline uint64_t SharedMemoryCache::getSize() const
+{
+	if( ! mData )
+		return 0;
+	std::lock_guard<detail::shm::SharedMutex> lock( header().allocLock );
+	uint64_t used = 0;
+	auto words = ( header().slabCount + 63 ) / 64;
+	for( uint32_t i = 0; i < words; ++i )
+		used += __builtin_popcountll( bitmap()[i] );
+	return used * detail::shm::kSlabSize;
+}
+
+inline uint32_t SharedMemoryCache::allocate( uint32_t count )
+{
+	auto &segment = header();
+	auto total = segment.slabCount;
+	auto bits = bitmap();
+	auto isUsed = [bits]( uint32_t slab ) { return ( bits[slab / 64] >> ( slab % 64 ) ) & 1; };
+	std::lock_guard<detail::shm::SharedMutex> lock( segment.allocLock );
+	// First fit from where the last run ended, wrapping around once.
+	uint32_t start = segment.allocHint < total ? segment.allocHint : 0;
+	for( uint32_t pass = 0; pass < 2; ++pass ) {
+		uint32_t begin = pass ? 0 : start, end = pass ? start : total;
+		uint32_t runStart = begin, runLength = 0;
+		for( uint32_t slab = begin; slab < end; ++slab ) {
+			// Whole words in use are skipped at once.
+			if( slab % 64 == 0 && bits[slab / 64] == ~0ULL && slab + 64 <= end ) {
+				slab += 63;
+				runLength = 0;
+				continue;
+			}
+			if( isUsed( slab ) ) {
+				runLength = 0;
+				continue;
+			}
+			if( ! runLength++ )
+				runStart = slab;
+			if( runLength == count ) {
+				for( uint32_t i = runStart; i < runStart + count; ++i )
+					bits[i / 64] |= 1ULL << ( i % 64 );
+				segment.allocHint = runStart + count;
+				return runStart;
+			}
+		}
+	}
+	return UINT32_MAX;
+}
+
+inline void SharedMemoryCache::release( uint32_t slab )
+{
+	auto &record = run( slab );
+	if( record.references.fetch_sub( 1, std::memory_order_acq_rel ) != 1 )
+		return;
+	auto bits = bitmap();
+	std::lock_guard<detail::shm::SharedMutex> lock( header().allocLock );
+	for( uint32_t i = slab; i < slab + record.slabCount; ++i )
+		bits[i / 64] &= ~( 1ULL << ( i % 64 ) );
+}
+
+inline bool SharedMemoryCache::isIntact( const detail::shm::Slot &slot ) const
+{
+	using namespace detail::shm;
+	auto slabCount = header().slabCount;
+	if( slot.slab >= slabCount )
+		return false;
+	auto &record = run( slot.slab );
+	return record.slabCount && uint64_t( slot.slab ) + record.slabCount <= slabCount &&
+		   record.size <= uint64_t( record.slabCount ) * kSlabSize - sizeof( RunHeader );
+}
+
+inline bool SharedMemoryCache::matches( const detail::shm::Slot &slot, const std::string &key,
+										const std::vector<std::pair<std::string, std::string>> *vary ) const
+{
+	// A record that can't be read matches anything, so it's replaced or removed.
+	if( ! isIntact( slot ) )
+		return true;
+	auto &record = run( slot.slab );
+	detail::disk::RecordReader reader( reinterpret_cast<const uint8_t*>( &record + 1 ), record.size );
+	CachedResponse stored;
+	if( ! detail::disk::readRecord( reader, record.size, stored ) )
+		return true;
+	return stored.key == key && ( ! vary || stored.vary == *vary );
+}
+
+inline void SharedMemoryCache::removeSlot( uint32_t shard, uint32_t index )
+{
+	using namespace detail::shm;
+	auto count = header().slotsPerShard;
+	auto shardSlots = slots( shard );
+	// A torn run's sizes can't be trusted to free it by, its slabs are leaked instead.
+	if( isIntact( shardSlots[index] ) )
+		release( shardSlots[index].slab );
+	// Backward shift deletion, the slots probed past this one move up so no probe stops
+	// short of them.
+	auto hole = index;
+	for( uint32_t next = ( hole + 1 ) % count; shardSlots[next].state == Slot::LIVE; next = ( next + 1 ) % count ) {
+		auto home = static_cast<uint32_t>( shardSlots[next].hash % count );
+		bool reachable = hole <= next ? ( home <= hole || home > next ) : ( home <= hole && home > next );
+		if( reachable ) {
+			shardSlots[hole] = shardSlots[next];
+			hole = next;
+		}
+	}
+	shardSlots[hole] = Slot();
+}
+
+inline bool SharedMemoryCache::evict( uint32_t shard )
+{
+	using namespace detail::shm;
+	auto shardSlots = slots( shard );
+	uint32_t oldest = UINT32_MAX;
+	for( uint32_t i = 0; i < header().slotsPerShard; ++i ) {
+		if( shardSlots[i].state == Slot::LIVE && ( oldest == UINT32_MAX || shardSlots[i].lastUsed < shardSlots[oldest].lastUsed ) )
+			oldest = i;
+	}
+	if( oldest == UINT32_MAX )
+		return false;
+	removeSlot( shard, oldest );
+	return true;
+}
+
+#else
+
+inline CachedResponseRef SharedMemoryCache::load( const std::string &key, const Request &request ) { return nullptr; }
+inline void SharedMemoryCache::save( const CachedResponse &entry ) {}
+inline void SharedMemoryCache::remove( const std::string &key ) {}
+inline uint32_t SharedMemoryCache::getCount() const { return 0; }
+inline uint64_t SharedMemoryCache::getSize() const { return 0; }
+inline uint32_t SharedMemoryCache::allocate( uint32_t count ) { return UINT32_MAX; }
+inline void SharedMemoryCache::release( uint32_t slab ) {}
+inline bool SharedMemoryCache::isIntact( const detail::shm::Slot &slot ) const { return false; }
+inline bool SharedMemoryCache::matches( const detail::shm::Slot &slot, const std::string &key,
+										const std::vector<std::pair<std::string, std::string>> *vary ) const { return false; }
+inline void SharedMemoryCache::removeSlot( uint32_t shard, uint32_t index ) {}
+inline bool SharedMemoryCache::evict( uint32_t shard ) { return false; }
+
+#endif
+
+}} // http // cinder
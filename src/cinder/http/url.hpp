@@ -12,12 +12,117 @@
 #define URDL_URL_HPP
 
 #include <string>
+#include <cstring>
 #include <memory>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
 #include "asio/error_code.hpp"
 
 namespace cinder {
 namespace http {
 
+/// A read-only view of characters owned elsewhere.
+/**
+ * The part of C++17's @c std::string_view the url accessors need. It converts
+ * implicitly to @c std::string, which copies the characters.
+ */
+class string_view
+{
+public:
+  typedef std::size_t size_type;
+  typedef const char* const_iterator;
+  static const size_type npos = static_cast<size_type>(-1);
+
+  string_view() : data_(nullptr), size_(0) {}
+  string_view(const char* s) : data_(s), size_(std::strlen(s)) {}
+  string_view(const char* s, size_type n) : data_(s), size_(n) {}
+  string_view(const std::string& s) : data_(s.data()), size_(s.size()) {}
+
+  const char* data() const { return data_; }
+  size_type size() const { return size_; }
+  size_type length() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const_iterator begin() const { return data_; }
+  const_iterator end() const { return data_ + size_; }
+  char operator[](size_type i) const { return data_[i]; }
+  char front() const { return data_[0]; }
+  char back() const { return data_[size_ - 1]; }
+
+  /// Returns the view of at most @c n characters from @c pos.
+  string_view substr(size_type pos, size_type n = npos) const
+  {
+    if (pos > size_)
+      pos = size_;
+    return string_view(data_ + pos, n < size_ - pos ? n : size_ - pos);
+  }
+
+  /// Returns the position of the first @c c from @c pos, or @c npos.
+  size_type find(char c, size_type pos = 0) const
+  {
+    for (; pos < size_; ++pos)
+      if (data_[pos] == c)
+        return pos;
+    return npos;
+  }
+
+  /// Returns the position of the last @c c, or @c npos.
+  size_type rfind(char c) const
+  {
+    for (size_type pos = size_; pos-- > 0;)
+      if (data_[pos] == c)
+        return pos;
+    return npos;
+  }
+
+  int compare(string_view other) const
+  {
+    size_type n = size_ < other.size_ ? size_ : other.size_;
+    int result = n ? std::memcmp(data_, other.data_, n) : 0;
+    if (result != 0)
+      return result;
+    return size_ < other.size_ ? -1 : size_ > other.size_ ? 1 : 0;
+  }
+
+  std::string to_string() const { return std::string(data_, size_); }
+  operator std::string() const { return to_string(); }
+
+private:
+  const char* data_;
+  size_type size_;
+};
+
+inline bool operator==(string_view a, string_view b)
+{
+  return a.size() == b.size() && a.compare(b) == 0;
+}
+
+inline bool operator!=(string_view a, string_view b)
+{
+  return !(a == b);
+}
+
+inline bool operator<(string_view a, string_view b)
+{
+  return a.compare(b) < 0;
+}
+
+inline std::ostream& operator<<(std::ostream& os, string_view s)
+{
+  return os.write(s.data(), static_cast<std::streamsize>(s.size()));
+}
+
+/// The protocols a url's scheme names, as far as anything here acts on them.
+enum class protocol {
+	http,
+	https,
+	file,
+	ftp,
+	ws,
+	wss,
+	unknown
+};
+
 /// The class @c url enables parsing and accessing the components of URLs.
 /**
  * @par Example
@@ -43,6 +148,11 @@ namespace http {
  * Fragment: anchor
  * @endcode
  *
+ * @par Storage
+ * The components are kept in a single buffer, laid out as @c to_string()
+ * would print them, and the accessors return views of it. They stay valid
+ * until the url is changed or destroyed.
+ *
  * @par Requirements
  * @e Header: @c <urdl/url.hpp> @n
  * @e Namespace: @c urdl
@@ -58,8 +168,9 @@ public:
    * 0.
    */
   Url()
-    : ipv6_host_(false)
+    : scheme_(http::protocol::unknown), port_(0), hash_(0), ipv6_host_(false)
   {
+    std::memset(spans_, 0, sizeof(spans_));
   }
 
   /// Constructs an object of class @c url.
@@ -69,7 +180,7 @@ public:
    * @throws std::system_error Thrown when the URL string is invalid.
    */
   Url(const char* s)
-    : ipv6_host_(false)
+    : Url()
   {
     *this = from_string(s);
   }
@@ -81,7 +192,7 @@ public:
    * @throws std::system_error Thrown when the URL string is invalid.
    */
   Url(const std::string& s)
-    : ipv6_host_(false)
+    : Url()
   {
     *this = from_string(s);
   }
@@ -91,9 +202,9 @@ public:
    * @returns A string specifying the protocol of the URL. Examples include
    * @c http, @c https or @c file.
    */
-  std::string protocol() const
+  string_view protocol() const
   {
-    return protocol_;
+    return component(protocol_span);
   }
 	
   inline void set_protocol( std::string protocol );
@@ -104,19 +215,28 @@ public:
 	return *this;
   }
 
+  /// Gets the protocol the URL's scheme names.
+  /**
+   * @returns The protocol, parsed once, or @c protocol::unknown.
+   */
+  http::protocol scheme() const
+  {
+    return scheme_;
+  }
+
   /// Gets the user info component of the URL.
   /**
    * @returns A string containing the user info of the URL. Typically in the
    * format <tt>user:password</tt>, but depends on the protocol.
    */
-  std::string user_info() const
+  string_view user_info() const
   {
-    return user_info_;
+    return component(user_info_span);
   }
 	
   void set_user_info( std::string user_info )
   {
-	user_info_ = std::move( user_info );
+	set_component( user_info_span, user_info );
   }
 	
   Url& user_info( std::string user_info )
@@ -129,14 +249,14 @@ public:
   /**
    * @returns A string containing the host name of the URL.
    */
-  std::string host() const
+  string_view host() const
   {
-    return host_;
+    return component(host_span);
   }
 	
   void set_host( std::string host )
   {
-	host_ = std::move( host );
+	set_component( host_span, host );
   }
 	
   Url& host( std::string host )
@@ -151,18 +271,22 @@ public:
    *
    * @par Remarks
    * If the URL string did not specify a port, and the protocol is one of @c
-   * http, @c https or @c ftp, an appropriate default port number is returned.
+   * http, @c https, @c ftp, @c ws or @c wss, an appropriate default port number
+   * is returned.
    */
-  inline uint16_t port() const;
+  uint16_t port() const
+  {
+    return port_;
+  }
 	
   void set_port( std::string port )
   {
-	port_ = std::move( port );
+	set_component( port_span, port );
   }
 	
   void set_port( uint16_t port )
   {
-	port_ = std::to_string( port );
+	set_component( port_span, std::to_string( port ) );
   }
 	
   Url& port( std::string port )
@@ -183,13 +307,17 @@ public:
    *
    * @par Remarks
    * The path string is unescaped. To obtain the path in escaped form, use
-   * @c to_string(url::path_component).
+   * @c to_string(url::path_component). It's decoded once, when it's set, and
+   * only kept apart from the buffer when it has escapes.
    */
-  inline std::string path() const;
+  string_view path() const
+  {
+    return decoded_path_.empty() ? component(path_span) : string_view(decoded_path_);
+  }
 	
   void set_path( std::string path )
   {
-	path_ = std::move( path );
+	set_component( path_span, path );
   }
 	
   Url& path( std::string path )
@@ -208,26 +336,28 @@ public:
    * The query string is not unescaped, but is returned in whatever form it
    * takes in the original URL string.
    */
-  std::string query() const
+  string_view query() const
   {
-    return query_;
+    return component(query_span);
   }
 	
+  /// Appends @c query, already escaped, to the query string.
   inline Url& add_query( std::string query );
-  inline Url& add_query( std::string key, std::string value );
+  /// Appends @c key=value to the query string, escaping both.
+  inline Url& add_query( string_view key, string_view value );
 
   /// Gets the fragment component of the URL.
   /**
    * @returns A string containing the fragment of the URL.
    */
-  std::string fragment() const
+  string_view fragment() const
   {
-    return fragment_;
+    return component(fragment_span);
   }
 	
   void set_fragment( std::string fragment )
   {
-	fragment_ = std::move( fragment );
+	set_component( fragment_span, fragment );
   }
 	
   Url& fragment( std::string fragment )
@@ -314,6 +444,55 @@ public:
   inline static Url from_string(const std::string& s,
       asio::error_code& ec);
 
+  /// Resolves a reference against a base URL, as RFC 3986 5.2 has it.
+  /**
+   * @param base The absolute URL @c reference is relative to.
+   *
+   * @param reference An absolute URL, or a network-path, absolute-path or
+   * relative-path reference, like a @c Location header or a link holds.
+   *
+   * @param ec Error code set to indicate the reason for failure, if any.
+   *
+   * @returns The target URL, its path without dot segments.
+   *
+   * @par Remarks
+   * The reference is parsed in place, only the merged path and the URL are
+   * allocated. As the RFC allows, a reference with the base's scheme is
+   * resolved as if it had none, so @c http:g against an http URL is relative.
+   * Other references with a scheme must be absolute URLs with an authority.
+   */
+  inline static Url resolve(const Url& base, const char* reference,
+      asio::error_code& ec);
+
+  /// Resolves a reference against a base URL, @see resolve(const Url&, const char*, asio::error_code&)
+  inline static Url resolve(const Url& base, const std::string& reference,
+      asio::error_code& ec);
+
+  /// Resolves a reference against a base URL, @see resolve(const Url&, const char*, asio::error_code&)
+  /**
+   * @throws std::system_error Thrown when the reference is invalid.
+   */
+  inline static Url resolve(const Url& base, const std::string& reference);
+
+  /// Returns the URL normalized as RFC 3986 6.2.2 has it.
+  /**
+   * @returns A copy with the host in lower case, the protocol's default port
+   * dropped, escapes of unreserved characters decoded and the others in upper
+   * case, and the dot segments of the path removed. Equivalent URLs, like
+   * @c HTTP://Host:80/a/./b and @c http://host/a/b, normalize equal.
+   */
+  inline Url normalized() const;
+
+  /// Gets a hash of the URL's components.
+  /**
+   * @returns A 64-bit hash, computed when the URL is parsed or changed. Equal
+   * URLs hash equal.
+   */
+  uint64_t hash() const
+  {
+    return hash_;
+  }
+
   /// Compares two @c url objects for equality.
   friend inline bool operator==(const Url& a, const Url& b);
 
@@ -323,24 +502,171 @@ public:
   /// Compares two @c url objects for ordering.
   friend inline bool operator<(const Url& a, const Url& b);
 
+  /// The characters a component leaves unescaped.
+  enum escape_set
+  {
+    /// Those of a path, RFC 3986's pchar and "/".
+    escape_path,
+
+    /// Those of a key or value of a query, the ones a query may hold but
+    /// "&", "=", "+" and "#".
+    escape_query,
+
+    /// Those of application/x-www-form-urlencoded, where a space is "+".
+    escape_form
+  };
+
+  /// Percent-escapes the characters of @c in that @c set doesn't leave as is.
+  /**
+   * @param in The string to escape.
+   *
+   * @param set The characters left unescaped.
+   *
+   * @param out Receives the escaped string, appended.
+   *
+   * @par Remarks
+   * Runs of unreserved characters are found 16 or 32 at a time where SSE2 or
+   * AVX2 is there, and copied in bulk.
+   */
+  inline static void escape(string_view in, escape_set set, std::string& out);
+
+  /// Returns @c in percent-escaped, @see escape(string_view, escape_set, std::string&)
+  inline static std::string escape(string_view in, escape_set set);
+
+  /// Decodes the percent-escapes of a component.
+  /**
+   * @param in The escaped string.
+   *
+   * @param set The characters @c in was escaped with. A form's "+" decodes to
+   * a space.
+   *
+   * @param out Receives the unescaped string, appended.
+   *
+   * @returns @c false if @c in contains an invalid escape, or, for a path, a
+   * character a path can't hold.
+   */
+  inline static bool unescape(string_view in, escape_set set, std::string& out);
+
+  /// Decodes the percent-escapes of a path.
+  /**
+   * @param in The escaped path.
+   *
+   * @param out Receives the unescaped path.
+   *
+   * @returns @c false if @c in contains an invalid escape or character.
+   */
+  inline static bool unescape_path(string_view in, std::string& out);
+
+  /// Returns whether @c c may appear unescaped in a path.
+  inline static bool is_path_char(char c);
+
+  /// Removes the "." and ".." segments of @c path in place, as RFC 3986 5.2.4
+  /// has it.
+  inline static void remove_dot_segments(std::string& path);
+
 private:
-  inline static bool unescape_path(const std::string& in, std::string& out);
-
-  std::string protocol_;
-  std::string user_info_;
-  std::string host_;
-  std::string port_;
-  std::string path_;
-  std::string query_;
-  std::string fragment_;
+  /// The components, in the order they're laid out in the buffer.
+  enum span_index
+  {
+    protocol_span,
+    user_info_span,
+    host_span,
+    port_span,
+    path_span,
+    query_span,
+    fragment_span,
+    span_count
+  };
+
+  /// Where a component lies in the buffer, without its delimiters.
+  struct span
+  {
+    uint32_t offset;
+    uint32_t length;
+  };
+
+  string_view component(span_index index) const
+  {
+    return string_view(buffer_.data() + spans_[index].offset, spans_[index].length);
+  }
+
+  /// Lays @c components out in a new buffer, in one allocation, and parses what
+  /// the accessors need. Returns @c false if the path is malformed.
+  inline bool assign(const string_view (&components)[span_count]);
+
+  /// Replaces the component at @c index with @c value.
+  inline void set_component(span_index index, string_view value);
+
+  /// Parses the user info, host and port at @c s, after "//".
+  /**
+   * @returns Where the authority ends, or @c nullptr if it's malformed.
+   */
+  inline static const char* parse_authority(const char* s,
+      string_view (&components)[span_count], bool& ipv6_host);
+
+  /// Parses the path, query and fragment at @c s, the path may be empty.
+  /**
+   * @returns Whether there's a query, if only an empty one.
+   */
+  inline static bool parse_path(const char* s,
+      string_view (&components)[span_count]);
+
+  std::string buffer_;
+  span spans_[span_count];
+  /// Parsed from the buffer whenever it's laid out.
+  http::protocol scheme_;
+  uint16_t port_;
+  /// The unescaped path, if it differs from the escaped one.
+  std::string decoded_path_;
+  uint64_t hash_;
   bool ipv6_host_;
 };
 
 using UrlRef = std::shared_ptr<Url>;
 
+/// Maps equivalent URLs to one shared instance.
+/**
+ * URLs are interned normalized, so connection pools, caches and coalescing can
+ * tell equivalent URLs apart by pointer, or by hash first. The table only
+ * holds weak references, an instance goes once nothing else holds it. Interned
+ * URLs are shared, they must not be changed. Thread safe.
+ */
+class UrlInternTable
+{
+public:
+  /// Returns the instance of @c url, normalized, adding it if there's none.
+  inline UrlRef intern(const Url& url);
+
+  /// Returns the number of URLs held, some may have gone since.
+  std::size_t size() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return urls_.size();
+  }
+
+private:
+  mutable std::mutex mutex_;
+  std::unordered_multimap<uint64_t, std::weak_ptr<Url>> urls_;
+  /// The size at which the references to URLs gone are dropped.
+  std::size_t purge_size_ = 64;
+};
+
 } // namespace http
 } // namespace cinder
 
+namespace std {
+
+template<>
+struct hash<cinder::http::Url>
+{
+  std::size_t operator()(const cinder::http::Url& url) const
+  {
+    return static_cast<std::size_t>(url.hash());
+  }
+};
+
+} // namespace std
+
 # include "url.ipp"
 
 #endif // URDL_URL_HPP
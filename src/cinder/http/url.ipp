@@ -16,157 +16,354 @@
 #include <cstdlib>
 #include <system_error>
 
+#if defined(__AVX2__)
+# include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# include <emmintrin.h>
+# define URDL_URL_SSE2 1
+#endif
+#if defined(_MSC_VER)
+# include <intrin.h>
+#endif
+
 namespace cinder {
 namespace http {
+namespace detail {
+
+/// Which characters each of Url's escape sets leaves as is, when escaping and
+/// when unescaping.
+struct escape_tables
+{
+  bool escaped[3][256];
+  bool unescaped[3][256];
+
+  escape_tables()
+  {
+    std::memset(escaped, 0, sizeof(escaped));
+    const char* const marks[3] = { "-._~!$&'()*+,;=:@/", "-._~!$'()*,;:@/?", "-._*" };
+    for (int set = 0; set < 3; ++set)
+    {
+      for (int c = '0'; c <= '9'; ++c)
+        escaped[set][c] = true;
+      for (int c = 'a'; c <= 'z'; ++c)
+        escaped[set][c] = escaped[set][c - 'a' + 'A'] = true;
+      for (const char* mark = marks[set]; *mark; ++mark)
+        escaped[set][static_cast<unsigned char>(*mark)] = true;
+    }
+    // A path must hold nothing else, a query or form anything but escapes.
+    std::memcpy(unescaped[Url::escape_path], escaped[Url::escape_path], 256);
+    for (int set = Url::escape_query; set <= Url::escape_form; ++set)
+    {
+      std::memset(unescaped[set], 1, 256);
+      unescaped[set]['%'] = false;
+    }
+    unescaped[Url::escape_form]['+'] = false;
+  }
+
+  static const escape_tables& get()
+  {
+    static const escape_tables tables;
+    return tables;
+  }
+};
 
-unsigned short Url::port() const
-{
-  if (!port_.empty())
-    return std::atoi(port_.c_str());
-  if (protocol_ == "http")
-    return 80;
-  if (protocol_ == "https")
-    return 443;
-  if (protocol_ == "ftp")
-    return 21;
-  return 0;
+inline unsigned int count_trailing_zeros(uint32_t bits)
+{
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, bits);
+  return index;
+#else
+  return __builtin_ctz(bits);
+#endif
 }
 
-std::string Url::path() const
+/// Returns the length of the run of characters at the start of @c in that
+/// @c table holds as is.
+/**
+ * Every table holds letters, digits, "-", "." and "_", which make up most of
+ * any component, so those are looked for a block at a time and the table is
+ * only looked up for the others.
+ */
+inline std::size_t plain_run(string_view in, const bool* table)
 {
-  std::string tmp_path;
-  unescape_path(path_, tmp_path);
-  return tmp_path;
+  const char* s = in.data();
+  std::size_t size = in.size();
+  std::size_t i = 0;
+  for (;;)
+  {
+#if defined(__AVX2__)
+    for (; i + 32 <= size; i += 32)
+    {
+      __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+      __m256i lower = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+      __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+          _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+      __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8('0' - 1)),
+          _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), x));
+      __m256i mark = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('-')),
+          _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('.')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_'))));
+      uint32_t plain = static_cast<uint32_t>(_mm256_movemask_epi8(
+          _mm256_or_si256(_mm256_or_si256(alpha, digit), mark)));
+      if (plain != 0xffffffffu)
+      {
+        i += count_trailing_zeros(~plain);
+        break;
+      }
+    }
+#elif defined(URDL_URL_SSE2)
+    for (; i + 16 <= size; i += 16)
+    {
+      __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+      __m128i lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+      __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+          _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+      __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('0' - 1)),
+          _mm_cmplt_epi8(x, _mm_set1_epi8('9' + 1)));
+      __m128i mark = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('-')),
+          _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('.')), _mm_cmpeq_epi8(x, _mm_set1_epi8('_'))));
+      uint32_t plain = static_cast<uint32_t>(_mm_movemask_epi8(
+          _mm_or_si128(_mm_or_si128(alpha, digit), mark)));
+      if (plain != 0xffffu)
+      {
+        i += count_trailing_zeros(~plain);
+        break;
+      }
+    }
+#endif
+    // The character that stopped the block, or the tail.
+    if (i == size || !table[static_cast<unsigned char>(s[i])])
+      return i;
+    ++i;
+#if !defined(__AVX2__) && !defined(URDL_URL_SSE2)
+    while (i < size && table[static_cast<unsigned char>(s[i])])
+      ++i;
+    return i;
+#endif
+  }
 }
-	
+
+/// Returns the value of hex digit @c c, or -1.
+inline int hex_value(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+} // namespace detail
+
 void Url::set_protocol( std::string protocol )
 {
-  protocol_.resize( protocol.length() );
   for (std::size_t i = 0; i < protocol.length(); ++i)
-	protocol_[i] = std::tolower(protocol[i]);
+	protocol[i] = std::tolower(protocol[i]);
+  set_component( protocol_span, protocol );
 }
 	
 Url& Url::append_path( std::string path )
 {
-	if(path_.empty() || path_ == "/") {
+	std::string current = component( path_span );
+	if(current.empty() || current == "/") {
 		if(path.front() != '/')
 			set_path("/" + path);
 		else
 			set_path(path);
 	}
-	else if(path_.back() == '/' && path.front() == '/') {
-		path_.pop_back();
-		set_path(path_ + path);
+	else if(current.back() == '/' && path.front() == '/') {
+		current.pop_back();
+		set_path(current + path);
 	}
-	else if(path_.back() != '/' && path.front() != '/')
-		set_path(path_ + "/" + path);
+	else if(current.back() != '/' && path.front() != '/')
+		set_path(current + "/" + path);
 	else {
 		// Only one slash.
-		set_path(path_ + path);
+		set_path(current + path);
 	}
 	return *this;
 }
 	
 Url& Url::add_query( std::string query )
 {
-	if( ! query_.empty() )
-		query_.append( "&" );
-	query_.append( query );
+	std::string current = component( query_span );
+	if( ! current.empty() )
+		current.append( "&" );
+	current.append( query );
+	set_component( query_span, current );
 	return *this;
 }
 	
-Url& Url::add_query( std::string key, std::string value )
+Url& Url::add_query( string_view key, string_view value )
 {
-	if( ! query_.empty() )
-		query_.append( "&" );
-	query_.append( key + "=" + value );
-	return *this;
+	std::string query;
+	query.reserve( key.size() + value.size() + 1 );
+	escape( key, escape_query, query );
+	query += '=';
+	escape( value, escape_query, query );
+	return add_query( std::move( query ) );
 }
 
 std::string Url::to_string(int components) const
 {
-  std::string s;
+  // The buffer is laid out as the whole url prints.
+  if (components == all_components && spans_[path_span].length)
+    return buffer_;
 
-  if ((components & protocol_component) != 0 && !protocol_.empty())
+  std::string s;
+  s.reserve(buffer_.size() + 1);
+  string_view protocol = component(protocol_span);
+  string_view user_info = component(user_info_span);
+  string_view port = component(port_span);
+  string_view path = component(path_span);
+  string_view query = component(query_span);
+  string_view fragment = component(fragment_span);
+
+  if ((components & protocol_component) != 0 && !protocol.empty())
   {
-    s = protocol_;
+    s.append(protocol.data(), protocol.size());
     s += "://";
   }
 
-  if ((components & user_info_component) != 0 && !user_info_.empty())
+  if ((components & user_info_component) != 0 && !user_info.empty())
   {
-    s += user_info_;
+    s.append(user_info.data(), user_info.size());
     s += "@";
   }
 
   if ((components & host_component) != 0)
   {
+    string_view host = component(host_span);
     if (ipv6_host_)
       s += "[";
-    s += host_;
+    s.append(host.data(), host.size());
     if (ipv6_host_)
       s += "]";
   }
 
-  if ((components & port_component) != 0 && !port_.empty())
+  if ((components & port_component) != 0 && !port.empty())
   {
     s += ":";
-    s += port_;
+    s.append(port.data(), port.size());
   }
 
   if ((components & path_component) != 0 )
   {
-	s += !path_.empty() ? path_ : "/";
+	if (!path.empty())
+	  s.append(path.data(), path.size());
+	else
+	  s += "/";
   }
 
-  if ((components & query_component) != 0 && !query_.empty())
+  if ((components & query_component) != 0 && !query.empty())
   {
     s += "?";
-    s += query_;
+    s.append(query.data(), query.size());
   }
 
-  if ((components & fragment_component) != 0 && !fragment_.empty())
+  if ((components & fragment_component) != 0 && !fragment.empty())
   {
     s += "#";
-    s += fragment_;
+    s.append(fragment.data(), fragment.size());
   }
 
   return s;
 }
 
-Url Url::from_string(const char* s, asio::error_code& ec)
+bool Url::assign(const string_view (&components)[span_count])
 {
-  Url new_url;
-
-  // Protocol.
-  std::size_t length = std::strcspn(s, ":");
-  new_url.protocol_.assign(s, s + length);
-  for (std::size_t i = 0; i < new_url.protocol_.length(); ++i)
-    new_url.protocol_[i] = std::tolower(new_url.protocol_[i]);
-  s += length;
-
-  // "://".
-  if (*s++ != ':')
+  static const char* const prefixes[span_count] = { "", "", "", ":", "", "?", "#" };
+  static const char* const suffixes[span_count] = { "://", "@", "", "", "", "", "" };
+
+  std::size_t size = 0;
+  for (int i = 0; i < span_count; ++i)
+    if (!components[i].empty())
+      size += components[i].size() + std::strlen(prefixes[i]) + std::strlen(suffixes[i]);
+  if (ipv6_host_)
+    size += 2;
+
+  std::string buffer;
+  buffer.reserve(size);
+  for (int i = 0; i < span_count; ++i)
   {
-    ec = make_error_code(std::errc::invalid_argument);
-    return Url();
+    // The host is always there, if only to bracket an empty IPv6 address.
+    bool present = !components[i].empty();
+    if (present)
+      buffer += prefixes[i];
+    if (i == host_span && ipv6_host_)
+      buffer += "[";
+    spans_[i].offset = static_cast<uint32_t>(buffer.size());
+    spans_[i].length = static_cast<uint32_t>(components[i].size());
+    buffer.append(components[i].data(), components[i].size());
+    if (i == host_span && ipv6_host_)
+      buffer += "]";
+    if (present)
+      buffer += suffixes[i];
   }
-  if (*s++ != '/')
+  buffer_.swap(buffer);
+
+  // What the accessors would otherwise work out on every call.
+  string_view protocol = component(protocol_span);
+  struct known { const char* name; http::protocol scheme; uint16_t port; };
+  static const known schemes[] = {
+    { "http", http::protocol::http, 80 }, { "https", http::protocol::https, 443 },
+    { "file", http::protocol::file, 0 }, { "ftp", http::protocol::ftp, 21 },
+    { "ws", http::protocol::ws, 80 }, { "wss", http::protocol::wss, 443 }
+  };
+  scheme_ = http::protocol::unknown;
+  port_ = 0;
+  for (const known& k : schemes)
   {
-    ec = make_error_code(std::errc::invalid_argument);
-    return Url();
+    if (protocol == k.name)
+    {
+      scheme_ = k.scheme;
+      port_ = k.port;
+      break;
+    }
   }
-  if (*s++ != '/')
+  string_view port = component(port_span);
+  if (!port.empty())
+    port_ = static_cast<uint16_t>(std::atoi(port.data()));
+
+  // FNV-1a, a separator after each component keeps "ab" + "" from hashing as "a" + "b".
+  hash_ = 0xcbf29ce484222325ULL;
+  for (int i = 0; i < span_count; ++i)
   {
-    ec = make_error_code(std::errc::invalid_argument);
-    return Url();
+    for (char c : component(static_cast<span_index>(i)))
+      hash_ = (hash_ ^ static_cast<unsigned char>(c)) * 0x100000001b3ULL;
+    hash_ = (hash_ ^ 0xff) * 0x100000001b3ULL;
   }
 
+  // Only a path with escapes is decoded apart from the buffer.
+  string_view path = component(path_span);
+  decoded_path_.clear();
+  if (path.find('%') != string_view::npos)
+    return unescape_path(path, decoded_path_);
+  return detail::plain_run(path, detail::escape_tables::get().escaped[escape_path]) == path.size();
+}
+
+void Url::set_component(span_index index, string_view value)
+{
+  string_view components[span_count];
+  for (int i = 0; i < span_count; ++i)
+    components[i] = component(static_cast<span_index>(i));
+  components[index] = value;
+  // The views point into the old buffer, which lives until the new one is laid out.
+  assign(components);
+}
+
+const char* Url::parse_authority(const char* s,
+    string_view (&components)[span_count], bool& ipv6_host)
+{
+  ipv6_host = false;
+
   // UserInfo.
-  length = std::strcspn(s, "@:[/?#");
+  std::size_t length = std::strcspn(s, "@:[/?#");
   if (s[length] == '@')
   {
-    new_url.user_info_.assign(s, s + length);
+    components[user_info_span] = string_view(s, length);
     s += length + 1;
   }
   else if (s[length] == ':')
@@ -174,7 +371,7 @@ Url Url::from_string(const char* s, asio::error_code& ec)
     std::size_t length2 = std::strcspn(s + length, "@/?#");
     if (s[length + length2] == '@')
     {
-      new_url.user_info_.assign(s, s + length + length2);
+      components[user_info_span] = string_view(s, length + length2);
       s += length + length2 + 1;
     }
   }
@@ -184,23 +381,17 @@ Url Url::from_string(const char* s, asio::error_code& ec)
   {
     length = std::strcspn(++s, "]");
     if (s[length] != ']')
-    {
-      ec = make_error_code(std::errc::invalid_argument);
-      return Url();
-    }
-    new_url.host_.assign(s, s + length);
-    new_url.ipv6_host_ = true;
+      return nullptr;
+    components[host_span] = string_view(s, length);
+    ipv6_host = true;
     s += length + 1;
     if (std::strcspn(s, ":/?#") != 0)
-    {
-      ec = make_error_code(std::errc::invalid_argument);
-      return Url();
-    }
+      return nullptr;
   }
   else
   {
     length = std::strcspn(s, ":/?#");
-    new_url.host_.assign(s, s + length);
+    components[host_span] = string_view(s, length);
     s += length;
   }
 
@@ -209,50 +400,88 @@ Url Url::from_string(const char* s, asio::error_code& ec)
   {
     length = std::strcspn(++s, "/?#");
     if (length == 0)
+      return nullptr;
+    components[port_span] = string_view(s, length);
+    for (std::size_t i = 0; i < length; ++i)
     {
-      ec = make_error_code(std::errc::invalid_argument);
-      return Url();
-    }
-    new_url.port_.assign(s, s + length);
-    for (std::size_t i = 0; i < new_url.port_.length(); ++i)
-    {
-      if (!std::isdigit(new_url.port_[i]))
-      {
-        ec = make_error_code(std::errc::invalid_argument);
-        return Url();
-      }
+      if (!std::isdigit(static_cast<unsigned char>(s[i])))
+        return nullptr;
     }
     s += length;
   }
 
+  return s;
+}
+
+bool Url::parse_path(const char* s, string_view (&components)[span_count])
+{
   // Path.
-  if (*s == '/')
-  {
-    length = std::strcspn(s, "?#");
-    new_url.path_.assign(s, s + length);
-    std::string tmp_path;
-    if (!unescape_path(new_url.path_, tmp_path))
-    {
-      ec = make_error_code(std::errc::invalid_argument);
-      return Url();
-    }
-    s += length;
-  }
-  else
-    new_url.path_ = "/";
+  std::size_t length = std::strcspn(s, "?#");
+  components[path_span] = string_view(s, length);
+  s += length;
 
   // Query.
-  if (*s == '?')
+  bool has_query = *s == '?';
+  if (has_query)
   {
     length = std::strcspn(++s, "#");
-    new_url.query_.assign(s, s + length);
+    components[query_span] = string_view(s, length);
     s += length;
   }
 
   // Fragment.
   if (*s == '#')
-    new_url.fragment_.assign(++s);
+    components[fragment_span] = string_view(s + 1);
+  return has_query;
+}
+
+Url Url::from_string(const char* s, asio::error_code& ec)
+{
+  Url new_url;
+  string_view components[span_count];
+
+  // Protocol.
+  std::size_t length = std::strcspn(s, ":");
+  components[protocol_span] = string_view(s, length);
+  s += length;
 
+  // "://".
+  if (*s++ != ':')
+  {
+    ec = make_error_code(std::errc::invalid_argument);
+    return Url();
+  }
+  if (*s++ != '/')
+  {
+    ec = make_error_code(std::errc::invalid_argument);
+    return Url();
+  }
+  if (*s++ != '/')
+  {
+    ec = make_error_code(std::errc::invalid_argument);
+    return Url();
+  }
+
+  s = parse_authority(s, components, new_url.ipv6_host_);
+  if (!s)
+  {
+    ec = make_error_code(std::errc::invalid_argument);
+    return Url();
+  }
+  parse_path(s, components);
+  if (components[path_span].empty())
+    components[path_span] = "/";
+
+  // The protocol is case insensitive, it's kept in lower case.
+  std::string protocol = components[protocol_span];
+  for (std::size_t i = 0; i < protocol.length(); ++i)
+    protocol[i] = std::tolower(protocol[i]);
+  components[protocol_span] = protocol;
+  if (!new_url.assign(components))
+  {
+    ec = make_error_code(std::errc::invalid_argument);
+    return Url();
+  }
   ec = asio::error_code();
   return new_url;
 }
@@ -279,108 +508,354 @@ Url Url::from_string(const std::string& s)
   return from_string(s.c_str());
 }
 
-bool Url::unescape_path(const std::string& in, std::string& out)
+Url Url::resolve(const Url& base, const char* reference, asio::error_code& ec)
 {
-  out.clear();
-  out.reserve(in.size());
-  for (std::size_t i = 0; i < in.size(); ++i)
+  string_view components[span_count];
+  bool ipv6_host = base.ipv6_host_;
+  const char* s = reference;
+
+  // A scheme makes the reference absolute, unless it's the base's.
+  string_view protocol = base.component(protocol_span);
+  std::string own_protocol;
+  std::size_t length = std::strcspn(s, ":/?#");
+  if (s[length] == ':' && length > 0)
   {
-    switch (in[i])
+    bool same = length == protocol.size();
+    for (std::size_t i = 0; same && i < length; ++i)
+      same = std::tolower(s[i]) == protocol[i];
+    if (!same)
     {
-    case '%':
-      if (i + 3 <= in.size())
+      own_protocol.assign(s, length);
+      for (std::size_t i = 0; i < length; ++i)
+        own_protocol[i] = std::tolower(own_protocol[i]);
+      protocol = own_protocol;
+      if (s[length + 1] != '/' || s[length + 2] != '/')
       {
-        unsigned int value = 0;
-        for (std::size_t j = i + 1; j < i + 3; ++j)
-        {
-          switch (in[j])
-          {
-          case '0': case '1': case '2': case '3': case '4':
-          case '5': case '6': case '7': case '8': case '9':
-            value += in[j] - '0';
-            break;
-          case 'a': case 'b': case 'c': case 'd': case 'e': case 'f':
-            value += in[j] - 'a' + 10;
-            break;
-          case 'A': case 'B': case 'C': case 'D': case 'E': case 'F':
-            value += in[j] - 'A' + 10;
-            break;
-          default:
-            return false;
-          }
-          if (j == i + 1)
-            value <<= 4;
-        }
-        out += static_cast<char>(value);
-        i += 2;
+        ec = make_error_code(std::errc::invalid_argument);
+        return Url();
       }
+    }
+    s += length + 1;
+  }
+  components[protocol_span] = protocol;
+
+  // The merged path is the one string built, dot segments are removed from it in place.
+  std::string path;
+  if (s[0] == '/' && s[1] == '/')
+  {
+    s = parse_authority(s + 2, components, ipv6_host);
+    if (!s)
+    {
+      ec = make_error_code(std::errc::invalid_argument);
+      return Url();
+    }
+    parse_path(s, components);
+    path = components[path_span];
+  }
+  else
+  {
+    components[user_info_span] = base.component(user_info_span);
+    components[host_span] = base.component(host_span);
+    components[port_span] = base.component(port_span);
+    bool has_query = parse_path(s, components);
+    string_view reference_path = components[path_span];
+    string_view base_path = base.component(path_span);
+    if (reference_path.empty())
+    {
+      path = base_path;
+      if (!has_query)
+        components[query_span] = base.component(query_span);
+    }
+    else if (reference_path[0] == '/')
+      path = reference_path;
+    else
+    {
+      // Merged with the base's path, up to its last segment.
+      std::size_t slash = base_path.rfind('/');
+      std::size_t directory = slash == string_view::npos ? 0 : slash + 1;
+      path.reserve(directory + reference_path.size() + 1);
+      if (directory == 0)
+        path = "/";
       else
-        return false;
-      break;
-    case '-': case '_': case '.': case '!': case '~': case '*':
-    case '\'': case '(': case ')': case ':': case '@': case '&':
-    case '=': case '+': case '$': case ',': case '/': case ';':
-      out += in[i];
-      break;
-    default:
-      if (!std::isalnum(in[i]))
-        return false;
+        path.assign(base_path.data(), directory);
+      path.append(reference_path.data(), reference_path.size());
+    }
+  }
+  remove_dot_segments(path);
+  if (path.empty())
+    path = "/";
+  components[path_span] = path;
+
+  Url url;
+  url.ipv6_host_ = ipv6_host;
+  if (!url.assign(components))
+  {
+    ec = make_error_code(std::errc::invalid_argument);
+    return Url();
+  }
+  ec = asio::error_code();
+  return url;
+}
+
+Url Url::resolve(const Url& base, const std::string& reference, asio::error_code& ec)
+{
+  return resolve(base, reference.c_str(), ec);
+}
+
+Url Url::resolve(const Url& base, const std::string& reference)
+{
+  asio::error_code ec;
+  Url url(resolve(base, reference.c_str(), ec));
+  if (ec)
+  {
+    std::system_error ex(ec);
+    throw ex;
+  }
+  return url;
+}
+
+namespace detail {
+
+/// Copies @c in to @c out, decoding the escapes of unreserved characters and
+/// upper casing the hex digits of the others, as RFC 3986 6.2.2 has it.
+inline void normalize_escapes(string_view in, std::string& out)
+{
+  static const char hex[] = "0123456789ABCDEF";
+  out.reserve(out.size() + in.size());
+  for (std::size_t i = 0; i < in.size(); ++i)
+  {
+    if (in[i] == '%' && i + 2 < in.size()
+        && std::isxdigit(static_cast<unsigned char>(in[i + 1]))
+        && std::isxdigit(static_cast<unsigned char>(in[i + 2])))
+    {
+      char digits[3] = { in[i + 1], in[i + 2], 0 };
+      unsigned int value = static_cast<unsigned int>(std::strtoul(digits, 0, 16));
+      if (std::isalnum(value) || value == '-' || value == '.' || value == '_' || value == '~')
+        out += static_cast<char>(value);
+      else
+      {
+        out += '%';
+        out += hex[value >> 4];
+        out += hex[value & 15];
+      }
+      i += 2;
+    }
+    else
       out += in[i];
-      break;
+  }
+}
+
+} // namespace detail
+
+Url Url::normalized() const
+{
+  string_view components[span_count];
+  for (int i = 0; i < span_count; ++i)
+    components[i] = component(static_cast<span_index>(i));
+
+  // The host is lower cased first, the hex digits of its escapes end up upper case.
+  std::string lower_host = components[host_span];
+  for (std::size_t i = 0; i < lower_host.length(); ++i)
+    lower_host[i] = std::tolower(lower_host[i]);
+
+  std::string user_info, host, path, query, fragment;
+  detail::normalize_escapes(components[user_info_span], user_info);
+  detail::normalize_escapes(lower_host, host);
+  detail::normalize_escapes(components[path_span], path);
+  remove_dot_segments(path);
+  if (path.empty())
+    path = "/";
+  detail::normalize_escapes(components[query_span], query);
+  detail::normalize_escapes(components[fragment_span], fragment);
+  components[user_info_span] = user_info;
+  components[host_span] = host;
+  components[path_span] = path;
+  components[query_span] = query;
+  components[fragment_span] = fragment;
+
+  // The protocol's default port goes, any other is written without leading zeros.
+  components[port_span] = string_view();
+  Url url;
+  url.ipv6_host_ = ipv6_host_;
+  url.assign(components);
+  if (url.port_ != port_)
+  {
+    std::string port = std::to_string(port_);
+    components[port_span] = port;
+    url.assign(components);
+  }
+  return url;
+}
+
+void Url::remove_dot_segments(std::string& path)
+{
+  // The output never outgrows what's been read of the input, so it's written over it.
+  char* p = &path[0];
+  std::size_t in = 0, out = 0, size = path.size();
+  while (in < size)
+  {
+    string_view rest(p + in, size - in);
+    // A. Leading "../" and "./" go.
+    if (rest.substr(0, 3) == "../")
+      in += 3;
+    else if (rest.substr(0, 2) == "./")
+      in += 2;
+    // B. "/./" and a final "/." become "/".
+    else if (rest.substr(0, 3) == "/./")
+      in += 2;
+    else if (rest == "/.")
+    {
+      p[out++] = '/';
+      in += 2;
+    }
+    // C. "/../" and a final "/.." become "/", dropping the last output segment.
+    else if (rest.substr(0, 4) == "/../" || rest == "/..")
+    {
+      while (out > 0 && p[--out] != '/')
+        ;
+      if (rest == "/..")
+        p[out++] = '/';
+      in += 3;
+    }
+    // D. A lone "." or ".." goes.
+    else if (rest == "." || rest == "..")
+      in = size;
+    // E. The first segment moves to the output.
+    else
+    {
+      std::size_t end = in + 1;
+      while (end < size && p[end] != '/')
+        ++end;
+      std::memmove(p + out, p + in, end - in);
+      out += end - in;
+      in = end;
     }
   }
-  return true;
+  path.resize(out);
 }
 
-bool operator==(const Url& a, const Url& b)
+UrlRef UrlInternTable::intern(const Url& url)
 {
-  return a.protocol_ == b.protocol_
-    && a.user_info_ == b.user_info_
-    && a.host_ == b.host_
-    && a.port_ == b.port_
-    && a.path_ == b.path_
-    && a.query_ == b.query_
-    && a.fragment_ == b.fragment_;
+  Url normalized = url.normalized();
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto range = urls_.equal_range(normalized.hash());
+  for (auto it = range.first; it != range.second; ++it)
+  {
+    if (UrlRef interned = it->second.lock())
+      if (*interned == normalized)
+        return interned;
+  }
+  if (urls_.size() >= purge_size_)
+  {
+    for (auto it = urls_.begin(); it != urls_.end();)
+      it = it->second.expired() ? urls_.erase(it) : std::next(it);
+    purge_size_ = std::max<std::size_t>(64, urls_.size() * 2);
+  }
+  UrlRef interned = std::make_shared<Url>(std::move(normalized));
+  urls_.emplace(interned->hash(), interned);
+  return interned;
 }
 
-bool operator!=(const Url& a, const Url& b)
+bool Url::is_path_char(char c)
 {
-  return !(a == b);
+  return detail::escape_tables::get().escaped[escape_path][static_cast<unsigned char>(c)];
 }
 
-bool operator<(const Url& a, const Url& b)
+void Url::escape(string_view in, escape_set set, std::string& out)
 {
-  if (a.protocol_ < b.protocol_)
-    return true;
-  if (b.protocol_ < a.protocol_)
-    return false;
+  static const char hex[] = "0123456789ABCDEF";
+  const bool* table = detail::escape_tables::get().escaped[set];
+  out.reserve(out.size() + in.size());
+  std::size_t i = 0;
+  while (i < in.size())
+  {
+    std::size_t run = detail::plain_run(in.substr(i), table);
+    out.append(in.data() + i, run);
+    i += run;
+    if (i == in.size())
+      break;
+    unsigned char c = static_cast<unsigned char>(in[i++]);
+    if (c == ' ' && set == escape_form)
+      out += '+';
+    else
+    {
+      out += '%';
+      out += hex[c >> 4];
+      out += hex[c & 15];
+    }
+  }
+}
 
-  if (a.user_info_ < b.user_info_)
-    return true;
-  if (b.user_info_ < a.user_info_)
-    return false;
+std::string Url::escape(string_view in, escape_set set)
+{
+  std::string out;
+  escape(in, set, out);
+  return out;
+}
 
-  if (a.host_ < b.host_)
-    return true;
-  if (b.host_ < a.host_)
-    return false;
+bool Url::unescape(string_view in, escape_set set, std::string& out)
+{
+  const bool* table = detail::escape_tables::get().unescaped[set];
+  out.reserve(out.size() + in.size());
+  std::size_t i = 0;
+  while (i < in.size())
+  {
+    std::size_t run = detail::plain_run(in.substr(i), table);
+    out.append(in.data() + i, run);
+    i += run;
+    if (i == in.size())
+      break;
+    if (in[i] == '%')
+    {
+      int high = i + 2 < in.size() ? detail::hex_value(in[i + 1]) : -1;
+      int low = high >= 0 ? detail::hex_value(in[i + 2]) : -1;
+      if (low < 0)
+        return false;
+      out += static_cast<char>(high << 4 | low);
+      i += 3;
+    }
+    else if (in[i] == '+' && set == escape_form)
+    {
+      out += ' ';
+      ++i;
+    }
+    else
+      return false;
+  }
+  return true;
+}
 
-  if (a.port_ < b.port_)
-    return true;
-  if (b.port_ < a.port_)
-    return false;
+bool Url::unescape_path(string_view in, std::string& out)
+{
+  out.clear();
+  return unescape(in, escape_path, out);
+}
 
-  if (a.path_ < b.path_)
-    return true;
-  if (b.path_ < a.path_)
+bool operator==(const Url& a, const Url& b)
+{
+  if (a.hash_ != b.hash_)
     return false;
+  for (int i = 0; i < Url::span_count; ++i)
+    if (a.component(static_cast<Url::span_index>(i)) != b.component(static_cast<Url::span_index>(i)))
+      return false;
+  return true;
+}
 
-  if (a.query_ < b.query_)
-    return true;
-  if (b.query_ < a.query_)
-    return false;
+bool operator!=(const Url& a, const Url& b)
+{
+  return !(a == b);
+}
 
-  return a.fragment_ < b.fragment_;
+bool operator<(const Url& a, const Url& b)
+{
+  for (int i = 0; i < Url::span_count; ++i)
+  {
+    int result = a.component(static_cast<Url::span_index>(i)).compare(
+        b.component(static_cast<Url::span_index>(i)));
+    if (result != 0)
+      return result < 0;
+  }
+  return false;
 }
 
 } // namespace http
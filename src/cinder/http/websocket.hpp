@@ -0,0 +1,1161 @@
+//
+//  websocket.hpp
+//  Cinder-HTTP
+//
+//
+
+#pragma once
+
+#include "http.hpp"
+
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+
+#include <deque>
+#include <random>
+
+namespace cinder {
+namespace http {
+	
+//! Receives the outcome of the opening handshake along with the server's response
+using WebSocketOpenHandler = std::function<void( asio::error_code, ResponseRef )>;
+//! Receives a complete message, /a binary is false for text messages
+using WebSocketMessageHandler = std::function<void( const std::vector<uint8_t> &message, bool binary )>;
+//! Receives the close code and reason once the connection is gone, /a ec is set if it
+//! didn't end with a clean closing handshake
+using WebSocketCloseHandler = std::function<void( asio::error_code, uint16_t code, const std::string &reason )>;
+//! Receives the payload of a pong
+using WebSocketPongHandler = std::function<void( const std::vector<uint8_t> &payload )>;
+
+//! Options of the permessage-deflate extension, RFC 7692, offered during the handshake.
+//! With context takeover each message can refer back to the ones before it, which shrinks
+//! small repetitive messages the most, at the cost of a window kept for the whole connection.
+struct WebSocketCompression {
+	//! Whether our compressor keeps its window from one message to the next
+	bool	clientContextTakeover{true};
+	//! Whether the server's compressor may keep its window from one message to the next
+	bool	serverContextTakeover{true};
+	//! Window of our compressor, 9 to 15, zlib can't compress with a 256 byte window
+	int		clientMaxWindowBits{15};
+	//! Largest window the server may compress with, 8 to 15
+	int		serverMaxWindowBits{15};
+	//! zlib compression level of our messages, 0 to 9
+	int		level{6};
+};
+
+namespace detail {
+	
+//! Opcodes, close codes and helpers of RFC 6455
+namespace websocket {
+	
+enum class Opcode : uint8_t {
+	CONTINUATION = 0x0,
+	TEXT = 0x1,
+	BINARY = 0x2,
+	CLOSE = 0x8,
+	PING = 0x9,
+	PONG = 0xA
+};
+
+namespace close_code {
+	const uint16_t NORMAL = 1000;
+	const uint16_t GOING_AWAY = 1001;
+	const uint16_t PROTOCOL_ERROR = 1002;
+	const uint16_t UNSUPPORTED_DATA = 1003;
+	//! Reported, never sent, when a close frame carries no code
+	const uint16_t NO_STATUS = 1005;
+	//! Reported, never sent, when the connection drops without a close frame
+	const uint16_t ABNORMAL = 1006;
+	const uint16_t INVALID_DATA = 1007;
+	const uint16_t POLICY_VIOLATION = 1008;
+	const uint16_t MESSAGE_TOO_BIG = 1009;
+}
+
+//! Appended to the client's key before hashing it into Sec-WebSocket-Accept
+const char acceptGuid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+//! Returns the Sec-WebSocket-Accept a server has to answer /a key with
+inline std::string acceptKey( const std::string &key )
+{
+	auto input = key + acceptGuid;
+	std::string digest( SHA_DIGEST_LENGTH, '\0' );
+	SHA1( reinterpret_cast<const unsigned char*>( input.data() ), input.size(),
+		  reinterpret_cast<unsigned char*>( &digest[0] ) );
+	return ci::toBase64( digest );
+}
+
+//! XORs /a size bytes at /a data with the repeating 4 byte /a key, a word at a time
+inline void applyMask( uint8_t *data, size_t size, const uint8_t key[4] )
+{
+	uint8_t pattern[8];
+	for( int i = 0; i < 8; ++i )
+		pattern[i] = key[i % 4];
+	uint64_t mask;
+	memcpy( &mask, pattern, sizeof( mask ) );
+	
+	size_t i = 0;
+	for( ; i + 8 <= size; i += 8 ) {
+		uint64_t word;
+		memcpy( &word, data + i, sizeof( word ) );
+		word ^= mask;
+		memcpy( data + i, &word, sizeof( word ) );
+	}
+	// Whole words leave the tail aligned on the key.
+	for( ; i < size; ++i )
+		data[i] ^= key[i % 4];
+}
+
+//! Returns whether /a size bytes at /a data are well formed UTF-8, text messages and close
+//! reasons have to be
+inline bool isValidUtf8( const uint8_t *data, size_t size )
+{
+	size_t i = 0;
+	while( i < size ) {
+		// Skip ASCII eight bytes at a time.
+		if( i + 8 <= size ) {
+			uint64_t word;
+			memcpy( &word, data + i, sizeof( word ) );
+			if( ! ( word & 0x8080808080808080ULL ) ) {
+				i += 8;
+				continue;
+			}
+		}
+		uint8_t c = data[i];
+		if( c < 0x80 ) {
+			++i;
+			continue;
+		}
+		size_t continuation;
+		uint32_t codePoint;
+		if( ( c & 0xE0 ) == 0xC0 ) {
+			continuation = 1;
+			codePoint = c & 0x1F;
+		}
+		else if( ( c & 0xF0 ) == 0xE0 ) {
+			continuation = 2;
+			codePoint = c & 0x0F;
+		}
+		else if( ( c & 0xF8 ) == 0xF0 ) {
+			continuation = 3;
+			codePoint = c & 0x07;
+		}
+		else
+			return false;
+		if( i + continuation >= size )
+			return false;
+		for( size_t k = 1; k <= continuation; ++k ) {
+			if( ( data[i + k] & 0xC0 ) != 0x80 )
+				return false;
+			codePoint = ( codePoint << 6 ) | ( data[i + k] & 0x3F );
+		}
+		// Overlong forms, surrogates and anything past the last code point are invalid.
+		static const uint32_t minimum[] = { 0, 0x80, 0x800, 0x10000 };
+		if( codePoint < minimum[continuation] || codePoint > 0x10FFFF ||
+		    ( codePoint >= 0xD800 && codePoint <= 0xDFFF ) )
+			return false;
+		i += continuation + 1;
+	}
+	return true;
+}
+
+//! Returns whether /a code may appear in a close frame
+inline bool isValidCloseCode( uint16_t code )
+{
+	if( code >= 3000 && code <= 4999 )
+		return true;
+	return code >= 1000 && code <= 1014 && code != 1004 &&
+		code != close_code::NO_STATUS && code != close_code::ABNORMAL;
+}
+
+//! Finds /a name in /a headers ignoring case, the handshake's headers are often sent in
+//! capitalizations the sorted lookup of HeaderSet doesn't know
+inline const std::string* findHeader( const HeaderSet &headers, const char *name )
+{
+	for( auto &header : headers.getHeaders() )
+		if( urdl::detail::headers_equal( header.first, name ) )
+			return &header.second;
+	return nullptr;
+}
+
+//! Returns whether the comma separated /a list contains /a token, ignoring case
+inline bool hasToken( const std::string &list, const std::string &token )
+{
+	size_t begin = 0;
+	while( begin <= list.size() ) {
+		auto end = std::min( list.find( ',', begin ), list.size() );
+		auto first = list.find_first_not_of( " \t", begin );
+		auto last = list.find_last_not_of( " \t", end - 1 );
+		if( first < end && last != std::string::npos && last >= first &&
+		    urdl::detail::headers_equal( list.substr( first, last - first + 1 ), token ) )
+			return true;
+		begin = end + 1;
+	}
+	return false;
+}
+
+//! Fills /a data with /a size bytes from OpenSSL's CSPRNG, as RFC 6455 5.3 asks of masking
+//! keys. Falls back to std::random_device only if OpenSSL can't seed itself.
+inline void randomBytes( void *data, size_t size )
+{
+	auto bytes = static_cast<unsigned char*>( data );
+	if( RAND_bytes( bytes, static_cast<int>( size ) ) == 1 )
+		return;
+	std::random_device random;
+	for( size_t i = 0; i < size; i += 4 ) {
+		auto value = random();
+		for( size_t k = 0; k < 4 && i + k < size; ++k )
+			bytes[i + k] = static_cast<unsigned char>( value >> ( k * 8 ) );
+	}
+}
+
+//! Returns a fresh Sec-WebSocket-Key, 16 random bytes in base64
+inline std::string generateKey()
+{
+	std::string key( 16, '\0' );
+	randomBytes( &key[0], key.size() );
+	return ci::toBase64( key );
+}
+
+//! The permessage-deflate parameters the server agreed to
+struct DeflateParams {
+	bool	enabled{false},
+			clientNoContextTakeover{false},
+			serverNoContextTakeover{false};
+	int		clientWindowBits{15},
+			serverWindowBits{15},
+			level{6};
+};
+
+//! Returns the Sec-WebSocket-Extensions offer for /a options
+inline std::string offerDeflate( const WebSocketCompression &options )
+{
+	// Offering client_max_window_bits lets the server ask for a smaller window.
+	std::string offer = "permessage-deflate; client_max_window_bits";
+	if( options.clientMaxWindowBits < 15 )
+		offer += "=" + std::to_string( options.clientMaxWindowBits );
+	if( options.serverMaxWindowBits < 15 )
+		offer += "; server_max_window_bits=" + std::to_string( options.serverMaxWindowBits );
+	if( ! options.clientContextTakeover )
+		offer += "; client_no_context_takeover";
+	if( ! options.serverContextTakeover )
+		offer += "; server_no_context_takeover";
+	return offer;
+}
+
+//! Returns /a value without the whitespace and quotes around it
+inline std::string trim( const std::string &value )
+{
+	auto first = value.find_first_not_of( " \t\"" );
+	if( first == std::string::npos )
+		return std::string();
+	auto last = value.find_last_not_of( " \t\"" );
+	return value.substr( first, last - first + 1 );
+}
+
+//! Reads the server's answer to the permessage-deflate offer made with /a offered into
+//! /a params. Returns false if the answer isn't one the offer allows.
+inline bool acceptDeflate( const std::string &extensions, const WebSocketCompression &offered,
+						   DeflateParams &params )
+{
+	// Nothing else was offered, so there's exactly one extension to accept.
+	if( extensions.find( ',' ) != std::string::npos )
+		return false;
+	std::vector<std::string> parts;
+	size_t begin = 0;
+	while( begin <= extensions.size() ) {
+		auto end = std::min( extensions.find( ';', begin ), extensions.size() );
+		parts.push_back( trim( extensions.substr( begin, end - begin ) ) );
+		begin = end + 1;
+	}
+	if( ! urdl::detail::headers_equal( parts[0], "permessage-deflate" ) )
+		return false;
+	
+	bool serverBits = false, clientBits = false;
+	for( size_t i = 1; i < parts.size(); ++i ) {
+		auto equals = parts[i].find( '=' );
+		auto name = trim( parts[i].substr( 0, equals ) );
+		auto value = equals == std::string::npos ? std::string() : trim( parts[i].substr( equals + 1 ) );
+		int bits = value.size() == 1 || value.size() == 2 ? atoi( value.c_str() ) : 0;
+		if( name == "server_no_context_takeover" && value.empty() && ! params.serverNoContextTakeover )
+			params.serverNoContextTakeover = true;
+		else if( name == "client_no_context_takeover" && value.empty() && ! params.clientNoContextTakeover )
+			params.clientNoContextTakeover = true;
+		else if( name == "server_max_window_bits" && ! serverBits &&
+				 bits >= 8 && bits <= offered.serverMaxWindowBits ) {
+			params.serverWindowBits = bits;
+			serverBits = true;
+		}
+		else if( name == "client_max_window_bits" && ! clientBits && bits >= 8 && bits <= 15 ) {
+			params.clientWindowBits = bits;
+			clientBits = true;
+		}
+		else
+			return false;
+	}
+	// Restrictions asked of the server have to be confirmed, ours apply either way.
+	if( ( offered.serverMaxWindowBits < 15 && ! serverBits ) ||
+	    ( ! offered.serverContextTakeover && ! params.serverNoContextTakeover ) )
+		return false;
+	params.clientNoContextTakeover |= ! offered.clientContextTakeover;
+	params.clientWindowBits = std::min( params.clientWindowBits, offered.clientMaxWindowBits );
+	if( params.clientWindowBits < 9 )
+		return false;
+	params.level = offered.level;
+	params.enabled = true;
+	return true;
+}
+
+//! Adds the headers of an opening handshake offering /a key to /a request, and the
+//! permessage-deflate extension unless /a compression is null or zlib isn't available
+inline void prepareUpgrade( Request &request, const std::string &key, const WebSocketCompression *compression )
+{
+	auto &headers = request.getHeaders();
+	// Content codings don't apply to the frames that follow.
+	headers.removeHeader( AcceptEncoding::key() );
+	headers.appendHeader( Connection( Connection::Type::UPGRADE ) );
+	headers.appendHeader( Upgrade( "websocket" ) );
+	headers.appendHeader( "Sec-WebSocket-Key", key );
+	headers.appendHeader( "Sec-WebSocket-Version", "13" );
+#if defined( USING_ZLIB )
+	if( compression )
+		headers.appendHeader( "Sec-WebSocket-Extensions", offerDeflate( *compression ) );
+#endif
+}
+
+//! Checks the server's answer to the opening handshake of /a request, offering /a key and
+//! /a compression, the agreed permessage-deflate parameters go to /a deflate
+inline asio::error_code validateUpgrade( const Request &request, const Response &response,
+										 const std::string &key, const WebSocketCompression *compression,
+										 DeflateParams &deflate )
+{
+	asio::error_code failed = http::errc::websocket_handshake_failed;
+	if( response.statusCode != http::errc::switching_protocols )
+		return failed;
+	auto &headers = response.getHeaders();
+	auto upgrade = findHeader( headers, Upgrade::key() );
+	auto connection = findHeader( headers, Connection::key() );
+	auto accept = findHeader( headers, "Sec-WebSocket-Accept" );
+	if( ! upgrade || ! urdl::detail::headers_equal( *upgrade, "websocket" ) ||
+	    ! connection || ! hasToken( *connection, "upgrade" ) ||
+	    ! accept || *accept != acceptKey( key ) )
+		return failed;
+	// The server may only pick a subprotocol or an extension that was offered.
+	if( auto protocol = findHeader( headers, "Sec-WebSocket-Protocol" ) ) {
+		auto offered = findHeader( request.getHeaders(), "Sec-WebSocket-Protocol" );
+		if( ! offered || ! hasToken( *offered, *protocol ) )
+			return failed;
+	}
+	if( auto extensions = findHeader( headers, "Sec-WebSocket-Extensions" ) ) {
+		auto offered = findHeader( request.getHeaders(), "Sec-WebSocket-Extensions" );
+		if( ! offered || ! compression || ! acceptDeflate( *extensions, *compression, deflate ) )
+			return failed;
+	}
+	return asio::error_code();
+}
+	
+} // websocket
+
+//! Reads and writes the frames of an upgraded connection, RFC 6455. The session keeps the
+//! socket and the handlers, bytes the server sent right behind its 101 are still in the
+//! session's reply buffer and are read first. Client frames are masked as they're queued,
+//! incoming fragments are put back together before the message handler sees them. With
+//! permessage-deflate agreed, whole messages are compressed before they're fragmented and
+//! inflated once all of their fragments are in.
+template<typename SessionType>
+struct WebSocketConnection : std::enable_shared_from_this<WebSocketConnection<SessionType>> {
+	WebSocketConnection( std::shared_ptr<SessionType> session );
+	
+	//! Starts reading frames
+	void start();
+	//! Sends a TEXT or BINARY message, split into fragments of at most the session's
+	//! fragment size. Returns false once the connection is closing.
+	bool send( websocket::Opcode opcode, const uint8_t *data, size_t size );
+	//! Sends a PING carrying up to 125 bytes of /a data
+	bool ping( const uint8_t *data, size_t size );
+	//! Starts the closing handshake with /a code and /a reason, the connection closes once
+	//! the server answers or /a timeout elapses
+	void close( uint16_t code, const std::string &reason, std::chrono::milliseconds timeout );
+	//! Returns whether messages can still be sent
+	bool isOpen() const { return ! mCloseSent && ! mFinished; }
+	
+private:
+	void read_more();
+	void on_read( asio::error_code ec, size_t bytes_transferred );
+	//! Handles every complete frame in the reply buffer
+	void process();
+	//! Returns false if the frame ended the connection
+	bool handle_frame( websocket::Opcode opcode, bool fin, bool compressed,
+					   const uint8_t *payload, size_t size );
+	bool handle_close( const uint8_t *payload, size_t size );
+	bool deliver();
+	
+	void write_frame( websocket::Opcode opcode, bool fin, const uint8_t *payload, size_t size,
+					  bool compressed = false );
+	void write_close( uint16_t code, const std::string &reason );
+	void write_next();
+	void on_write( asio::error_code ec );
+	void on_close_timeout( asio::error_code ec );
+	
+	//! Closes with /a code because the server broke the protocol
+	void protocol_error( uint16_t code );
+	//! Reports the end of the connection once, the socket closes when the queue is written
+	void finish( asio::error_code ec, uint16_t code, const std::string &reason );
+	void close_socket();
+	
+	std::shared_ptr<SessionType>	mSession;
+	asio::steady_timer				mCloseTimer;
+	
+	std::vector<uint8_t>			mMessage;
+	websocket::Opcode				mMessageOpcode{websocket::Opcode::TEXT};
+	bool							mFragmented{false},
+									mMessageCompressed{false};
+	
+	websocket::DeflateParams		mDeflate;
+#if defined( USING_ZLIB )
+	std::unique_ptr<Deflater>		mDeflater;
+	std::unique_ptr<Inflater>		mInflater;
+	std::vector<uint8_t>			mCompressed;
+#endif
+	
+	std::deque<std::vector<uint8_t>>	mWriteQueue;
+	std::vector<asio::const_buffer>		mWriteBuffers;
+	size_t							mWriting{0};
+	bool							mCloseSent{false},
+									mCloseReceived{false},
+									mFinished{false},
+									mClosed{false};
+};
+
+template<typename SessionType>
+WebSocketConnection<SessionType>::WebSocketConnection( std::shared_ptr<SessionType> session )
+: mSession( std::move( session ) ), mCloseTimer( mSession->get_io_service() ),
+	mDeflate( mSession->deflate )
+{
+#if defined( USING_ZLIB )
+	if( mDeflate.enabled ) {
+		mDeflater.reset( new Deflater( mDeflate.level, mDeflate.clientWindowBits ) );
+		// The server never refers back further than the window it agreed to.
+		mInflater.reset( new Inflater( mDeflate.serverWindowBits ) );
+	}
+#endif
+}
+
+template<typename SessionType>
+void WebSocketConnection<SessionType>::start()
+{
+	process();
+}
+
+template<typename SessionType>
+bool WebSocketConnection<SessionType>::send( websocket::Opcode opcode, const uint8_t *data, size_t size )
+{
+	if( ! isOpen() )
+		return false;
+	bool compressed = false;
+#if defined( USING_ZLIB )
+	if( mDeflater ) {
+		mCompressed.clear();
+		if( ! mDeflater->flush( data, size, mCompressed ) )
+			return false;
+		// The empty block ending the flush is implied, RFC 7692 section 7.2.1.
+		static const uint8_t tail[] = { 0x00, 0x00, 0xFF, 0xFF };
+		if( mCompressed.size() >= 4 && std::equal( tail, tail + 4, mCompressed.end() - 4 ) )
+			mCompressed.resize( mCompressed.size() - 4 );
+		if( mDeflate.clientNoContextTakeover )
+			mDeflater->reset();
+		data = mCompressed.data();
+		size = mCompressed.size();
+		compressed = true;
+	}
+#endif
+	auto fragmentSize = mSession->mMaxFragmentSize ? mSession->mMaxFragmentSize : size;
+	size_t offset = 0;
+	do {
+		auto fragment = std::min( fragmentSize, size - offset );
+		// Only the first fragment says the message is compressed.
+		write_frame( opcode, offset + fragment == size, data + offset, fragment, compressed && ! offset );
+		opcode = websocket::Opcode::CONTINUATION;
+		offset += fragment;
+	} while( offset < size );
+	return true;
+}
+
+template<typename SessionType>
+bool WebSocketConnection<SessionType>::ping( const uint8_t *data, size_t size )
+{
+	if( ! isOpen() || size > 125 )
+		return false;
+	write_frame( websocket::Opcode::PING, true, data, size );
+	return true;
+}
+
+template<typename SessionType>
+void WebSocketConnection<SessionType>::close( uint16_t code, const std::string &reason,
+											  std::chrono::milliseconds timeout )
+{
+	if( ! isOpen() )
+		return;
+	write_close( code, reason );
+	mCloseTimer.expires_from_now( timeout );
+	mCloseTimer.async_wait( std::bind( &WebSocketConnection<SessionType>::on_close_timeout,
+									   this->shared_from_this(),
+									   std::placeholders::_1 ) );
+}
+
+template<typename SessionType>
+void WebSocketConnection<SessionType>::read_more()
+{
+	asio::async_read( mSession->socket, mSession->replyBuffer,
+					  asio::transfer_at_least( 1 ),
+					  std::bind( &WebSocketConnection<SessionType>::on_read,
+								 this->shared_from_this(),
+								 std::placeholders::_1,
+								 std::placeholders::_2 ) );
+}
+
+template<typename SessionType>
+void WebSocketConnection<SessionType>::on_read( asio::error_code ec, size_t bytes_transferred )
+{
+	if( ec ) {
+		// Closing the socket fails the read that's still out, that one is expected.
+		finish( ec, websocket::close_code::ABNORMAL, "" );
+		return;
+	}
+	process();
+}
+
+template<typename SessionType>
+void WebSocketConnection<SessionType>::process()
+{
+	auto &buffer = mSession->replyBuffer;
+	while( ! mCloseReceived ) {
+		auto size = buffer.size();
+		if( size < 2 )
+			break;
+		auto data = asio::buffer_cast<const uint8_t*>( buffer.data() );
+		bool fin = data[0] & 0x80;
+		auto opcode = websocket::Opcode( data[0] & 0x0F );
+		// RSV1 marks the first frame of a compressed message, the other reserved bits stay
+		// clear. Only the client masks its frames.
+		uint8_t reserved = data[0] & 0x70;
+		bool compressed = reserved == 0x40 && mDeflate.enabled &&
+			( opcode == websocket::Opcode::TEXT || opcode == websocket::Opcode::BINARY );
+		if( ( reserved && ! compressed ) || ( data[1] & 0x80 ) ) {
+			protocol_error( websocket::close_code::PROTOCOL_ERROR );
+			return;
+		}
+		uint64_t length = data[1] & 0x7F;
+		size_t header = 2;
+		if( length == 126 ) {
+			if( size < 4 )
+				break;
+			length = ( uint64_t( data[2] ) << 8 ) | data[3];
+			header = 4;
+		}
+		else if( length == 127 ) {
+			if( size < 10 )
+				break;
+			length = 0;
+			for( int i = 2; i < 10; ++i )
+				length = ( length << 8 ) | data[i];
+			header = 10;
+		}
+		bool control = uint8_t( opcode ) & 0x8;
+		if( control && ( ! fin || length > 125 ) ) {
+			protocol_error( websocket::close_code::PROTOCOL_ERROR );
+			return;
+		}
+		if( ! control && length > mSession->mMaxMessageSize - mMessage.size() ) {
+			protocol_error( websocket::close_code::MESSAGE_TOO_BIG );
+			return;
+		}
+		if( size < header + length )
+			break;
+		if( ! handle_frame( opcode, fin, compressed, data + header, size_t( length ) ) )
+			return;
+		buffer.consume( header + size_t( length ) );
+	}
+	if( ! mCloseReceived )
+		read_more();
+}
+
+template<typename SessionType>
+bool WebSocketConnection<SessionType>::handle_frame( websocket::Opcode opcode, bool fin, bool compressed,
+													 const uint8_t *payload, size_t size )
+{
+	switch( opcode ) {
+		case websocket::Opcode::CONTINUATION:
+			if( ! mFragmented ) {
+				protocol_error( websocket::close_code::PROTOCOL_ERROR );
+				return false;
+			}
+			mMessage.insert( mMessage.end(), payload, payload + size );
+			return ! fin || deliver();
+		case websocket::Opcode::TEXT:
+		case websocket::Opcode::BINARY:
+			if( mFragmented ) {
+				protocol_error( websocket::close_code::PROTOCOL_ERROR );
+				return false;
+			}
+			mMessageOpcode = opcode;
+			mMessageCompressed = compressed;
+			mMessage.assign( payload, payload + size );
+			mFragmented = true;
+			return ! fin || deliver();
+		case websocket::Opcode::CLOSE:
+			return handle_close( payload, size );
+		case websocket::Opcode::PING:
+			// Pings may arrive between the fragments of a message, answer right away.
+			if( isOpen() )
+				write_frame( websocket::Opcode::PONG, true, payload, size );
+			return true;
+		case websocket::Opcode::PONG:
+			if( mSession->pongHandler )
+				mSession->pongHandler( std::vector<uint8_t>( payload, payload + size ) );
+			return true;
+		default:
+			protocol_error( websocket::close_code::PROTOCOL_ERROR );
+			return false;
+	}
+}
+
+template<typename SessionType>
+bool WebSocketConnection<SessionType>::handle_close( const uint8_t *payload, size_t size )
+{
+	uint16_t code = websocket::close_code::NO_STATUS;
+	std::string reason;
+	if( size == 1 ) {
+		protocol_error( websocket::close_code::PROTOCOL_ERROR );
+		return false;
+	}
+	if( size >= 2 ) {
+		code = uint16_t( ( payload[0] << 8 ) | payload[1] );
+		if( ! websocket::isValidCloseCode( code ) ) {
+			protocol_error( websocket::close_code::PROTOCOL_ERROR );
+			return false;
+		}
+		if( ! websocket::isValidUtf8( payload + 2, size - 2 ) ) {
+			protocol_error( websocket::close_code::INVALID_DATA );
+			return false;
+		}
+		reason.assign( payload + 2, payload + size );
+	}
+	mCloseReceived = true;
+	// Echo the code if the server started the closing handshake.
+	if( ! mCloseSent )
+		write_close( code == websocket::close_code::NO_STATUS ? 0 : code, "" );
+	finish( asio::error_code(), code, reason );
+	return true;
+}
+
+template<typename SessionType>
+bool WebSocketConnection<SessionType>::deliver()
+{
+	mFragmented = false;
+#if defined( USING_ZLIB )
+	if( mMessageCompressed ) {
+		// Put back the empty block the server left off and inflate the message as a whole.
+		static const uint8_t tail[] = { 0x00, 0x00, 0xFF, 0xFF };
+		mMessage.insert( mMessage.end(), tail, tail + 4 );
+		mCompressed.clear();
+		// The limit applies as it inflates, not once the whole message has.
+		if( ! mInflater->decode( mMessage.data(), mMessage.size(), mCompressed, mSession->mMaxMessageSize ) ) {
+			protocol_error( mInflater->isOverLimit() ? websocket::close_code::MESSAGE_TOO_BIG : websocket::close_code::INVALID_DATA );
+			return false;
+		}
+		mMessage.swap( mCompressed );
+		// A message ending in a final block ends the stream too, the next one starts anew.
+		if( mDeflate.serverNoContextTakeover || mInflater->isFinished() )
+			mInflater->reset();
+	}
+#endif
+	bool binary = mMessageOpcode == websocket::Opcode::BINARY;
+	if( ! binary && ! websocket::isValidUtf8( mMessage.data(), mMessage.size() ) ) {
+		protocol_error( websocket::close_code::INVALID_DATA );
+		return false;
+	}
+	if( mSession->messageHandler )
+		mSession->messageHandler( mMessage, binary );
+	mMessage.clear();
+	return ! mFinished;
+}
+
+template<typename SessionType>
+void WebSocketConnection<SessionType>::write_frame( websocket::Opcode opcode, bool fin,
+													const uint8_t *payload, size_t size, bool compressed )
+{
+	if( mClosed )
+		return;
+	uint8_t header[14];
+	size_t headerSize = 2;
+	header[0] = uint8_t( ( fin ? 0x80 : 0 ) | ( compressed ? 0x40 : 0 ) | uint8_t( opcode ) );
+	if( size < 126 )
+		header[1] = uint8_t( 0x80 | size );
+	else if( size <= 0xFFFF ) {
+		header[1] = 0x80 | 126;
+		header[2] = uint8_t( size >> 8 );
+		header[3] = uint8_t( size );
+		headerSize = 4;
+	}
+	else {
+		header[1] = 0x80 | 127;
+		for( int i = 0; i < 8; ++i )
+			header[2 + i] = uint8_t( uint64_t( size ) >> ( 56 - i * 8 ) );
+		headerSize = 10;
+	}
+	auto key = header + headerSize;
+	// Each frame's key is unpredictable from the ones before it.
+	websocket::randomBytes( key, 4 );
+	headerSize += 4;
+	
+	std::vector<uint8_t> frame( headerSize + size );
+	memcpy( frame.data(), header, headerSize );
+	if( size ) {
+		// The copy in the queue is masked in place, the caller's data is left alone.
+		memcpy( frame.data() + headerSize, payload, size );
+		websocket::applyMask( frame.data() + headerSize, size, key );
+	}
+	mWriteQueue.push_back( std::move( frame ) );
+	if( ! mWriting )
+		write_next();
+}
+
+template<typename SessionType>
+void WebSocketConnection<SessionType>::write_close( uint16_t code, const std::string &reason )
+{
+	std::vector<uint8_t> payload;
+	if( code ) {
+		payload.push_back( uint8_t( code >> 8 ) );
+		payload.push_back( uint8_t( code ) );
+		// Control frames are limited to 125 bytes.
+		payload.insert( payload.end(), reason.begin(), reason.begin() + std::min<size_t>( reason.size(), 123 ) );
+	}
+	write_frame( websocket::Opcode::CLOSE, true, payload.data(), payload.size() );
+	mCloseSent = true;
+}
+
+template<typename SessionType>
+void WebSocketConnection<SessionType>::write_next()
+{
+	// Everything queued so far goes out in one gathered write.
+	mWriteBuffers.clear();
+	for( auto &frame : mWriteQueue )
+		mWriteBuffers.push_back( asio::buffer( frame ) );
+	mWriting = mWriteQueue.size();
+	asio::async_write( mSession->socket, mWriteBuffers,
+					   asio::transfer_all(),
+					   std::bind( &WebSocketConnection<SessionType>::on_write,
+								  this->shared_from_this(),
+								  std::placeholders::_1 ) );
+}
+
+template<typename SessionType>
+void WebSocketConnection<SessionType>::on_write( asio::error_code ec )
+{
+	if( ec ) {
+		mWriting = 0;
+		mWriteQueue.clear();
+		finish( ec, websocket::close_code::ABNORMAL, "" );
+		return;
+	}
+	mWriteQueue.erase( mWriteQueue.begin(), mWriteQueue.begin() + mWriting );
+	mWriting = 0;
+	if( ! mWriteQueue.empty() )
+		write_next();
+	else if( mFinished )
+		close_socket();
+}
+
+template<typename SessionType>
+void WebSocketConnection<SessionType>::on_close_timeout( asio::error_code ec )
+{
+	if( ec == asio::error::operation_aborted || mFinished )
+		return;
+	CI_LOG_W( "WebSocket server didn't answer the close, dropping the connection" );
+	finish( asio::error::timed_out, websocket::close_code::ABNORMAL, "" );
+}
+
+template<typename SessionType>
+void WebSocketConnection<SessionType>::protocol_error( uint16_t code )
+{
+	CI_LOG_E( "WebSocket protocol error, closing with " << code );
+	if( ! mCloseSent )
+		write_close( code, "" );
+	mCloseReceived = true;
+	finish( http::errc::websocket_protocol_error, code, "" );
+}
+
+template<typename SessionType>
+void WebSocketConnection<SessionType>::finish( asio::error_code ec, uint16_t code, const std::string &reason )
+{
+	if( mFinished )
+		return;
+	mFinished = true;
+	mCloseTimer.cancel();
+	if( ! mWriting )
+		close_socket();
+	if( mSession->closeHandler )
+		mSession->closeHandler( ec, code, reason );
+	mSession->get_io_service().post( std::bind( &SessionType::onClose, mSession ) );
+}
+
+template<typename SessionType>
+void WebSocketConnection<SessionType>::close_socket()
+{
+	if( mClosed )
+		return;
+	mClosed = true;
+	asio::error_code ignored;
+	mSession->socket.lowest_layer().close( ignored );
+}
+	
+} // detail
+
+using WebSocketRef = std::shared_ptr<class WebSocket>;
+
+//! A WebSocket client over plain TCP for "ws" urls. The connection is opened with an
+//! HTTP/1.1 upgrade, /a openHandler hears whether the server switched protocols, after
+//! which messages go both ways until either side closes.
+class WebSocket : public std::enable_shared_from_this<WebSocket> {
+public:
+	
+	WebSocket( UrlRef url, WebSocketOpenHandler openHandler, WebSocketMessageHandler messageHandler,
+			   WebSocketCloseHandler closeHandler,
+			   asio::io_service &io_service = ci::app::App::get()->io_service() )
+	: io_service( io_service ), socket( io_service ), openHandler( openHandler ),
+	messageHandler( messageHandler ), closeHandler( closeHandler ), mSessionUrl( url ),
+	request( std::make_shared<Request>( RequestMethod::GET, url ) ) {}
+	~WebSocket() = default;
+	
+	asio::io_service&	get_io_service() { return io_service; }
+	const UrlRef&		getUrl() const { return mSessionUrl; }
+	
+	const asio::ip::tcp::endpoint&	getEndpoint() const { return endpoint; }
+	
+	//! Returns the upgrade request, headers such as "Sec-WebSocket-Protocol" can be added
+	//! to it before start()
+	const RequestRef&	getRequest() const { return request; }
+	//! Returns the subprotocol the server picked, empty if none
+	std::string			getProtocol() const;
+	
+	//! Sets the handler receiving the payload of pongs
+	void setPongHandler( WebSocketPongHandler handler ) { pongHandler = std::move( handler ); }
+	//! Splits outgoing messages into fragments of at most /a size bytes, 0 sends every
+	//! message as a single frame, the default
+	void setMaxFragmentSize( size_t size ) { mMaxFragmentSize = size; }
+	//! Closes the connection with "message too big" if an incoming message exceeds /a size
+	//! bytes, 16 MiB by default
+	void setMaxMessageSize( size_t size ) { mMaxMessageSize = size; }
+	//! Enables or disables offering permessage-deflate with /a options, on by default when
+	//! zlib is available. Takes effect on the next start().
+	void setCompression( bool enable, WebSocketCompression options = WebSocketCompression() )
+	{
+		mCompressionEnabled = enable;
+		mCompression = options;
+		mCompression.clientMaxWindowBits = std::max( 9, std::min( 15, options.clientMaxWindowBits ) );
+		mCompression.serverMaxWindowBits = std::max( 8, std::min( 15, options.serverMaxWindowBits ) );
+	}
+	//! Returns whether the server agreed to compress messages
+	bool isCompressed() const { return deflate.enabled; }
+	
+	void start()
+	{
+		std::make_shared<detail::Connector<WebSocket>>(
+			shared_from_this(), socket )->start();
+	}
+	
+	void start( asio::ip::tcp::endpoint endpoint )
+	{
+		std::make_shared<detail::Connector<WebSocket>>(
+			shared_from_this(), socket )->start( endpoint );
+	}
+	
+	//! Returns whether the connection is open and messages can be sent
+	bool isOpen() const { return mConnection && mConnection->isOpen(); }
+	
+	//! Sends /a text as a text message, returns false if the connection isn't open
+	bool send( const std::string &text )
+	{
+		return mConnection && mConnection->send( detail::websocket::Opcode::TEXT,
+			reinterpret_cast<const uint8_t*>( text.data() ), text.size() );
+	}
+	//! Sends /a data as a binary message, returns false if the connection isn't open
+	bool send( const ci::BufferRef &data )
+	{
+		return mConnection && data && mConnection->send( detail::websocket::Opcode::BINARY,
+			static_cast<const uint8_t*>( data->getData() ), data->getSize() );
+	}
+	//! Sends a ping carrying up to 125 bytes of /a payload, the answer goes to the pong handler
+	bool ping( const std::string &payload = "" )
+	{
+		return mConnection && mConnection->ping(
+			reinterpret_cast<const uint8_t*>( payload.data() ), payload.size() );
+	}
+	//! Starts the closing handshake with /a code and /a reason, the close handler is called
+	//! once the server answers, or after /a timeout without an answer
+	void close( uint16_t code = detail::websocket::close_code::NORMAL, const std::string &reason = "",
+			    std::chrono::milliseconds timeout = std::chrono::milliseconds( 5000 ) )
+	{
+		if( mConnection )
+			mConnection->close( code, reason, timeout );
+	}
+	
+private:
+	using Connection = detail::WebSocketConnection<WebSocket>;
+	
+	void onOpen( asio::error_code ec )
+	{
+		std::make_shared<detail::Handshaker<WebSocket>>(
+			shared_from_this() )->handshake();
+	}
+	void onHandshake( asio::error_code ec )
+	{
+		mKey = detail::websocket::generateKey();
+		deflate = detail::websocket::DeflateParams();
+		detail::websocket::prepareUpgrade( *request, mKey, mCompressionEnabled ? &mCompression : nullptr );
+		std::make_shared<detail::Requester<WebSocket>>(
+			shared_from_this(), request )->request();
+	}
+	void onRequest( asio::error_code ec )
+	{
+		std::make_shared<detail::Responder<WebSocket>>(
+			shared_from_this() )->read();
+	}
+	void onResponse( asio::error_code ec )
+	{
+		ec = detail::websocket::validateUpgrade( *request, *response, mKey,
+			mCompressionEnabled ? &mCompression : nullptr, deflate );
+		if( ec ) {
+			onError( ec );
+			return;
+		}
+		mConnection = std::make_shared<Connection>( shared_from_this() );
+		openHandler( ec, response );
+		mConnection->start();
+	}
+	
+	void onError( asio::error_code ec )
+	{
+		asio::error_code ignored;
+		socket.close( ignored );
+		openHandler( ec, response );
+	}
+	void onClose()
+	{
+		mConnection.reset();
+	}
+	
+	asio::io_service	&io_service;
+	asio::ip::tcp::socket	socket;
+	
+	WebSocketOpenHandler	openHandler;
+	WebSocketMessageHandler	messageHandler;
+	WebSocketCloseHandler	closeHandler;
+	WebSocketPongHandler	pongHandler;
+	size_t				mMaxFragmentSize{0},
+						mMaxMessageSize{16 << 20};
+	std::string			mKey;
+	WebSocketCompression	mCompression;
+	bool				mCompressionEnabled{true};
+	detail::websocket::DeflateParams	deflate;
+	std::shared_ptr<Connection>	mConnection;
+	
+	UrlRef				mSessionUrl;
+	RequestRef			request;
+	ResponseRef			response;
+	asio::streambuf		replyBuffer;
+	
+	asio::ip::tcp::endpoint	endpoint;
+	
+	friend struct detail::Connector<WebSocket>;
+	friend struct detail::Handshaker<WebSocket>;
+	friend struct detail::Requester<WebSocket>;
+	friend struct detail::Responder<WebSocket>;
+	friend struct detail::WebSocketConnection<WebSocket>;
+};
+
+inline std::string WebSocket::getProtocol() const
+{
+	auto protocol = response ? detail::websocket::findHeader( response->getHeaders(), "Sec-WebSocket-Protocol" ) : nullptr;
+	return protocol ? *protocol : std::string();
+}
+
+#if defined( USING_SSL )
+
+using SslWebSocketRef = std::shared_ptr<class SslWebSocket>;
+
+//! The TLS counterpart of WebSocket, for "wss" urls.
+class SslWebSocket : public std::enable_shared_from_this<SslWebSocket> {
+public:
+	
+	SslWebSocket( UrlRef url, WebSocketOpenHandler openHandler, WebSocketMessageHandler messageHandler,
+				  WebSocketCloseHandler closeHandler,
+				  asio::io_service &io_service = ci::app::App::get()->io_service() )
+	: io_service( io_service ), context(asio::ssl::context::tlsv12_client),
+	socket( io_service, context ), openHandler( openHandler ), messageHandler( messageHandler ),
+	closeHandler( closeHandler ), mSessionUrl( url ),
+	request( std::make_shared<Request>( RequestMethod::GET, url ) )
+	{
+		context.set_default_verify_paths();
+		auto host = mSessionUrl->host();
+		socket.set_verify_callback(asio::ssl::rfc2818_verification{host});
+	}
+	~SslWebSocket() = default;
+	
+	asio::io_service&	get_io_service() { return io_service; }
+	const UrlRef&		getUrl() const { return mSessionUrl; }
+	
+	const asio::ip::tcp::endpoint&	getEndpoint() const { return endpoint; }
+	
+	//! Returns the upgrade request, headers such as "Sec-WebSocket-Protocol" can be added
+	//! to it before start()
+	const RequestRef&	getRequest() const { return request; }
+	//! Returns the subprotocol the server picked, empty if none
+	std::string			getProtocol() const;
+	
+	//! Sets the handler receiving the payload of pongs
+	void setPongHandler( WebSocketPongHandler handler ) { pongHandler = std::move( handler ); }
+	//! Splits outgoing messages into fragments of at most /a size bytes, 0 sends every
+	//! message as a single frame, the default
+	void setMaxFragmentSize( size_t size ) { mMaxFragmentSize = size; }
+	//! Closes the connection with "message too big" if an incoming message exceeds /a size
+	//! bytes, 16 MiB by default
+	void setMaxMessageSize( size_t size ) { mMaxMessageSize = size; }
+	//! Enables or disables offering permessage-deflate with /a options, on by default when
+	//! zlib is available. Takes effect on the next start().
+	void setCompression( bool enable, WebSocketCompression options = WebSocketCompression() )
+	{
+		mCompressionEnabled = enable;
+		mCompression = options;
+		mCompression.clientMaxWindowBits = std::max( 9, std::min( 15, options.clientMaxWindowBits ) );
+		mCompression.serverMaxWindowBits = std::max( 8, std::min( 15, options.serverMaxWindowBits ) );
+	}
+	//! Returns whether the server agreed to compress messages
+	bool isCompressed() const { return deflate.enabled; }
+	
+	void start()
+	{
+		std::make_shared<detail::Connector<SslWebSocket>>(
+			shared_from_this(), socket.next_layer() )->start();
+	}
+	
+	void start( asio::ip::tcp::endpoint endpoint )
+	{
+		std::make_shared<detail::Connector<SslWebSocket>>(
+			shared_from_this(), socket.next_layer() )->start( endpoint );
+	}
+	
+	//! Returns whether the connection is open and messages can be sent
+	bool isOpen() const { return mConnection && mConnection->isOpen(); }
+	
+	//! Sends /a text as a text message, returns false if the connection isn't open
+	bool send( const std::string &text )
+	{
+		return mConnection && mConnection->send( detail::websocket::Opcode::TEXT,
+			reinterpret_cast<const uint8_t*>( text.data() ), text.size() );
+	}
+	//! Sends /a data as a binary message, returns false if the connection isn't open
+	bool send( const ci::BufferRef &data )
+	{
+		return mConnection && data && mConnection->send( detail::websocket::Opcode::BINARY,
+			static_cast<const uint8_t*>( data->getData() ), data->getSize() );
+	}
+	//! Sends a ping carrying up to 125 bytes of /a payload, the answer goes to the pong handler
+	bool ping( const std::string &payload = "" )
+	{
+		return mConnection && mConnection->ping(
+			reinterpret_cast<const uint8_t*>( payload.data() ), payload.size() );
+	}
+	//! Starts the closing handshake with /a code and /a reason, the close handler is called
+	//! once the server answers, or after /a timeout without an answer
+	void close( uint16_t code = detail::websocket::close_code::NORMAL, const std::string &reason = "",
+			    std::chrono::milliseconds timeout = std::chrono::milliseconds( 5000 ) )
+	{
+		if( mConnection )
+			mConnection->close( code, reason, timeout );
+	}
+	
+private:
+	using Connection = detail::WebSocketConnection<SslWebSocket>;
+	
+	void onOpen( asio::error_code ec )
+	{
+		std::make_shared<detail::Handshaker<SslWebSocket>>(
+			shared_from_this() )->handshake();
+	}
+	void onHandshake( asio::error_code ec )
+	{
+		mKey = detail::websocket::generateKey();
+		deflate = detail::websocket::DeflateParams();
+		detail::websocket::prepareUpgrade( *request, mKey, mCompressionEnabled ? &mCompression : nullptr );
+		std::make_shared<detail::Requester<SslWebSocket>>(
+			shared_from_this(), request )->request();
+	}
+	void onRequest( asio::error_code ec )
+	{
+		std::make_shared<detail::Responder<SslWebSocket>>(
+			shared_from_this() )->read();
+	}
+	void onResponse( asio::error_code ec )
+	{
+		ec = detail::websocket::validateUpgrade( *request, *response, mKey,
+			mCompressionEnabled ? &mCompression : nullptr, deflate );
+		if( ec ) {
+			onError( ec );
+			return;
+		}
+		mConnection = std::make_shared<Connection>( shared_from_this() );
+		openHandler( ec, response );
+		mConnection->start();
+	}
+	
+	void onError( asio::error_code ec )
+	{
+		asio::error_code ignored;
+		socket.lowest_layer().close( ignored );
+		openHandler( ec, response );
+	}
+	void onClose()
+	{
+		mConnection.reset();
+	}
+	
+	asio::io_service	&io_service;
+	asio::ssl::context	context;
+	asio::ssl::stream<asio::ip::tcp::socket> socket;
+	
+	WebSocketOpenHandler	openHandler;
+	WebSocketMessageHandler	messageHandler;
+	WebSocketCloseHandler	closeHandler;
+	WebSocketPongHandler	pongHandler;
+	size_t				mMaxFragmentSize{0},
+						mMaxMessageSize{16 << 20};
+	std::string			mKey;
+	WebSocketCompression	mCompression;
+	bool				mCompressionEnabled{true};
+	detail::websocket::DeflateParams	deflate;
+	std::shared_ptr<Connection>	mConnection;
+	
+	UrlRef				mSessionUrl;
+	RequestRef			request;
+	ResponseRef			response;
+	asio::streambuf		replyBuffer;
+	
+	asio::ip::tcp::endpoint	endpoint;
+	
+	friend struct detail::Connector<SslWebSocket>;
+	friend struct detail::Handshaker<SslWebSocket>;
+	friend struct detail::Requester<SslWebSocket>;
+	friend struct detail::Responder<SslWebSocket>;
+	friend struct detail::WebSocketConnection<SslWebSocket>;
+};
+
+inline std::string SslWebSocket::getProtocol() const
+{
+	auto protocol = response ? detail::websocket::findHeader( response->getHeaders(), "Sec-WebSocket-Protocol" ) : nullptr;
+	return protocol ? *protocol : std::string();
+}
+
+#endif
+
+}} // http // cinder